@@ -0,0 +1,301 @@
+/*
+ * Extensions provided by the lua55 compat layer on top of the 5.1 API.
+ *
+ * Include after the 5.1 lua.h.  Everything declared here is implemented
+ * in compat/lua55_compat.cpp and is not available when linking against
+ * a stock Lua 5.1.
+ */
+
+#ifndef compat55_h
+#define compat55_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ── API call profiler ─────────────────────────────────────────── */
+/* Populated only when the library is built with -DCOMPAT55_PROFILE;
+   otherwise compat55_prof_count() returns 0. */
+
+typedef struct compat55_ProfEntry {
+    const char *name;           /* exported function, e.g. "lua_gettop" */
+    unsigned long long calls;   /* number of calls */
+    unsigned long long sampled; /* calls that were timed */
+    unsigned long long ticks;   /* total ticks over the timed calls */
+} compat55_ProfEntry;
+
+/* Number of profiled entry points */
+int compat55_prof_count(void);
+
+/* Fills *e for entry i (0 <= i < count); returns 0 if i is out of range */
+int compat55_prof_get(int i, compat55_ProfEntry *e);
+
+/* Unit of compat55_ProfEntry.ticks: "cycles", "ticks" or "ns" */
+const char *compat55_prof_unit(void);
+
+/* Zeroes all counters */
+void compat55_prof_reset(void);
+
+/* Writes the called entries as JSON, busiest first; returns 0 on error */
+int compat55_prof_dump(const char *path);
+
+/* ── Bulk array transfer ─────────────────────────────────────── */
+/* Copy n values between a C array and t[first .. first+n-1] of the
+   table at idx, without metamethods or stack traffic.  The set
+   functions size the table's array part to cover the range, unless
+   the range lies so far beyond it that the array would be mostly
+   empty; those values go to the hash part.  The get functions stop at
+   the first value that is not a number (for integers: not a number
+   with an exact integer value) and return how many they copied.
+   Integers are 64-bit (long long) on every target, whatever the 5.1
+   lua_Integer is. */
+
+void compat55_rawsetnumbers(lua_State *L, int idx, int first,
+                            const lua_Number *v, int n);
+void compat55_rawsetintegers(lua_State *L, int idx, int first,
+                             const long long *v, int n);
+int compat55_rawgetnumbers(lua_State *L, int idx, int first,
+                           lua_Number *v, int n);
+int compat55_rawgetintegers(lua_State *L, int idx, int first,
+                            long long *v, int n);
+
+/* ── Sampling CPU profiler ─────────────────────────────────────── */
+/* Samples the Lua call stack of L (and its coroutines) hz times per
+   second of process CPU time and aggregates it as folded stacks
+   ("outer;inner;leaf count" lines) for flame-graph tools.  One state
+   per process can be profiled at a time; POSIX only.  Lua code can do
+   the same through require "profiler". */
+
+/* Returns 0 if unavailable or already running; discards old results */
+int compat55_cpuprof_start(lua_State *L, int hz);
+
+/* Stops sampling; results stay available until the next start */
+void compat55_cpuprof_stop(lua_State *L);
+
+/* Writes the folded stacks sampled so far; returns the first non-zero
+   writer result, or 0.  May run on another thread while L runs. */
+int compat55_cpuprof_dump(lua_State *L, lua_Writer writer, void *data);
+
+/* ── Heap profiler ─────────────────────────────────────────────── */
+/* Samples the allocations of L (and its coroutines) about every
+   interval bytes and charges each sample to the Lua stack that made
+   it.  Reports are folded stacks of estimated bytes: all bytes
+   allocated since the start, or (live != 0) only those not freed yet.
+   Costs one test per allocation when off.  Lua code can do the same
+   through require "profiler" (heapstart, heapdump, heapstop). */
+
+/* Returns 0 if already running or interval is 0 or over 2^30 */
+int compat55_heapprof_start(lua_State *L, size_t interval);
+
+/* Stops sampling and discards the results */
+void compat55_heapprof_stop(lua_State *L);
+
+/* Returns the first non-zero writer result, or 0 */
+int compat55_heapprof_dump(lua_State *L, lua_Writer writer, void *data,
+                           int live);
+
+/* ── Execution statistics ────────────────────────────────────── */
+/* With lua55 built with -DLUA_OPSTATS (CMake: COMPAT55_OPSTATS), pushes
+   a table of counters and returns 1:
+     ops        opcode name -> executions
+     jumps      opcode name -> {taken = n, nottaken = n}
+     functions  {source=, line=, calls=, instructions=}..., busiest first
+   and zeroes them if reset is non-zero.  Otherwise pushes nothing and
+   returns 0.  Lua code gets the same table from debug.opstats([reset]). */
+int compat55_opstats(lua_State *L, int reset);
+
+/* ── Time-budgeted GC step ─────────────────────────────────────── */
+/* lua_gc(L, LUA_GCBUDGET, us) runs the incremental collector for about
+   us microseconds, even if it is stopped, and returns 1 if that
+   finished a cycle.  The atomic phase cannot be split and may overrun
+   the budget.  In generational mode it runs one minor collection.  Lua
+   code can call collectgarbage("budget", us). */
+#ifndef LUA_GCBUDGET
+#define LUA_GCBUDGET 10
+#endif
+
+/* lua_gc(L, LUA_GCDEFERFREE, on) switches deferred freeing for L, which
+   is off by default.  When it is on, a helper thread hands the memory
+   of swept objects back to the allocator.  That shortens GC pauses on
+   multi-core machines.  The allocator must be thread-safe, as the one
+   luaL_newstate installs is, and compat55_slab_alloc is not.  Returns
+   the previous setting, or -1 if threads are not available (POSIX only)
+   or L allocates from a slab.  Queued blocks are freed before
+   lua_setallocf and lua_close return; switching to a slab turns
+   deferred freeing off. */
+#ifndef LUA_GCDEFERFREE
+#define LUA_GCDEFERFREE 11
+#endif
+
+/* lua_gc(L, LUA_GCPARMARK, n) makes n threads share the marking of the
+   atomic phase, which does all the marking of a full collection; 0 or 1
+   turns it off (the default).  Heaps under 1 MB, minor collections and
+   emergency collections are still marked by one thread.  Any allocator
+   works.  Returns the previous number of threads (0 when off), or -1 if
+   threads are not available (POSIX only). */
+#ifndef LUA_GCPARMARK
+#define LUA_GCPARMARK 12
+#endif
+
+/* ── GC statistics ─────────────────────────────────────────────── */
+/* Counters kept by the collector and allocator of every state; they
+   cost a few additions per allocation and two clock readings per GC
+   step.  Lua code gets the same data as a table from
+   collectgarbage("stats"). */
+
+#define COMPAT55_GCSTATBUCKETS 20
+
+/* kinds of pauses (first index of 'pauses') */
+#define COMPAT55_GCS_STEP   0   /* a GC step, or a minor collection */
+#define COMPAT55_GCS_ATOMIC 1   /* an atomic phase */
+#define COMPAT55_GCS_FULL   2   /* a full collection */
+
+typedef struct compat55_GCStats {
+    size_t allocated;    /* bytes allocated since the state was created */
+    size_t freed;        /* bytes freed since the state was created */
+    size_t incremental;  /* cycles finished in incremental mode */
+    size_t minor;        /* minor collections (generational mode) */
+    size_t major;        /* major collections (generational mode) */
+    size_t full;         /* full collections */
+    size_t promoted;     /* objects turned old by minor collections */
+    size_t strsize;      /* slots in the string table */
+    size_t strused;      /* strings in the string table */
+    size_t objects[11];  /* objects not freed yet, by LUA_T* type;
+                            upvalues at 9 and prototypes at 10 */
+    /* bucket 0 counts pauses under 1 us, bucket i pauses from 2^(i-1)
+       to 2^i - 1 us; the last bucket counts everything longer */
+    size_t pauses[3][COMPAT55_GCSTATBUCKETS];
+    size_t pausetime[3]; /* total microseconds per kind */
+} compat55_GCStats;
+
+void compat55_getstats(lua_State *L, compat55_GCStats *s);
+
+/* ── Heap census ───────────────────────────────────────────────── */
+/* Counts the objects not freed yet by type and by the __name of their
+   metatables and writes the result as text:
+     census <tab> 1 <tab> objects <tab> bytes
+     type <tab> name <tab> count <tab> bytes [<tab> path]
+   one line per group, heaviest first.  The name is "-" without a
+   metatable and the metatable's address when it has no __name.  With
+   COMPAT55_CENSUSPATHS each group also gets a path from the roots to
+   one of its objects, e.g. "registry[2].players[1]".  The walk uses
+   raw memory from the allocator and creates no Lua objects; run a full
+   collection first to count only live objects.  Returns the first
+   non-zero writer result, LUA_ERRMEM, or 0.  Lua code can take and
+   diff snapshots through require "census". */
+
+#define COMPAT55_CENSUSPATHS 1
+
+int compat55_census(lua_State *L, lua_Writer writer, void *data, int flags);
+
+/* ── Slab allocator ────────────────────────────────────────────── */
+/* A lua_Alloc for one state: blocks of up to 512 bytes come from 64 KB
+   pages split into 20 size classes (16-byte steps up to 256, then
+   64-byte steps), larger ones from realloc.  Use it with
+   lua_newstate(compat55_slab_alloc, S), or hand it to a state created
+   by luaL_newstate with lua_setallocf.  Not thread-safe: one slab per
+   state, and no LUA_GCDEFERFREE with it. */
+
+typedef struct compat55_Slab compat55_Slab;
+
+typedef struct compat55_SlabClass {
+    size_t size;    /* block size; 0 for blocks above 512 bytes */
+    size_t live;    /* blocks in use */
+    size_t bytes;   /* bytes in use */
+    size_t allocs;  /* blocks handed out since creation */
+    size_t pages;   /* pages owned */
+} compat55_SlabClass;
+
+/* With hugepages set, pages are 2 MB and use transparent huge pages
+   where available (Linux); worth it only for large heaps. */
+compat55_Slab *compat55_slab_new(int hugepages);
+
+/* Releases all pages; call it after lua_close */
+void compat55_slab_free(compat55_Slab *S);
+
+void *compat55_slab_alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
+/* Statistics of class i, from 0; the last class counts the blocks
+   above 512 bytes.  Returns 0 past the last class. */
+int compat55_slab_class(compat55_Slab *S, int i, compat55_SlabClass *c);
+
+/* Releases the empty pages kept for reuse; returns the bytes released */
+size_t compat55_slab_trim(compat55_Slab *S);
+
+/* ── State pool ──────────────────────────────────────────────── */
+/* Runs jobs on worker threads, each owning its own preloaded states.
+   A job calls a global function of a worker state with arguments
+   copied from the submitting state and hands back copies of its
+   results.  Values are copied with the serialize library of lua55
+   (lua55L_serialize in lua55/lualib.h): nil, booleans, numbers,
+   strings, light userdata and tables of those, at most 200 levels
+   deep; a table reached twice is copied once, so sharing and cycles
+   are kept.
+   Jobs are queued on the workers in turn; idle workers steal queued
+   jobs from busy ones.  All functions below may be called from any
+   thread, but a given lua_State must only be used by one thread at a
+   time.  Link with the platform's thread library; without threads
+   (e.g. Emscripten), compat55_pool_new returns NULL. */
+
+typedef struct compat55_Pool compat55_Pool;
+typedef struct compat55_Job compat55_Job;
+
+/* Called in protected mode for every worker state after
+   luaL_openlibs, before the workers start; typically loads the job
+   scripts.  Returns non-zero to fail pool creation. */
+typedef int (*compat55_PoolInit)(lua_State *L, void *ud);
+
+typedef struct compat55_PoolStats {
+    int threads;                /* worker threads */
+    int states;                 /* worker states in all */
+    int pending;                /* jobs submitted and not finished */
+    unsigned long long jobs;    /* jobs finished */
+    unsigned long long steals;  /* jobs run by a worker they were not queued on */
+} compat55_PoolStats;
+
+/* Starts nthreads workers (<= 0: one per CPU) with nstates states each,
+   used in turn.  Returns NULL if a state cannot be created or init
+   fails. */
+compat55_Pool *compat55_pool_new(int nthreads, int nstates,
+                                 compat55_PoolInit init, void *ud);
+
+/* Runs all queued jobs, stops the workers and frees the pool together
+   with its finished jobs; jobs taken by compat55_pool_next and not yet
+   passed to compat55_pool_result leak. */
+void compat55_pool_free(compat55_Pool *P);
+
+/* Queues a call of global 'func' with the top nargs values of L, which
+   are popped.  Returns NULL if a value cannot be copied, leaving an
+   error message on L instead. */
+compat55_Job *compat55_pool_submit(compat55_Pool *P, lua_State *L,
+                                   const char *func, int nargs);
+
+/* Blocks until the job has finished */
+void compat55_pool_wait(compat55_Job *job);
+
+/* Returns a finished job not yet returned, oldest first.  If there is
+   none: NULL, or with wait set, blocks until one finishes (NULL once
+   no job is pending). */
+compat55_Job *compat55_pool_next(compat55_Pool *P, int wait);
+
+/* Waits for the job, pushes copies of its results onto L and returns
+   their number; if the job raised an error, pushes the message and
+   returns -1.  Frees the job. */
+int compat55_pool_result(compat55_Job *job, lua_State *L);
+
+void compat55_pool_stats(compat55_Pool *P, compat55_PoolStats *s);
+
+/* ── Bytecode cache ────────────────────────────────────────────── */
+/* Directory for luaL_loadfile's bytecode cache, off by default.  NULL
+   or "" disables the cache.  The directory must exist and be private
+   to the application: cached chunks are loaded as lua55 bytecode
+   without verification, so anyone who can write there can run code
+   in (or crash) the process.  Not thread-safe: set it once at
+   startup. */
+void compat55_setcachedir(const char *dir);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,821 @@
+/*
+** $Id: lua.h,v 1.218.1.7 2012/01/13 20:36:20 roberto Exp $
+** Lua - An Extensible Extension Language
+** Lua.org, PUC-Rio, Brazil (http://www.lua.org)
+** See Copyright Notice at the end of this file
+**
+** lua55-on-51: stock 5.1 header plus the lua55 inline fast path below.
+*/
+
+
+#ifndef lua_h
+#define lua_h
+
+#include <stdarg.h>
+#include <stddef.h>
+
+
+#include "luaconf.h"
+
+
+#define LUA_VERSION	"Lua 5.1"
+#define LUA_RELEASE	"Lua 5.1.5"
+#define LUA_VERSION_NUM	501
+#define LUA_COPYRIGHT	"Copyright (C) 1994-2012 Lua.org, PUC-Rio"
+#define LUA_AUTHORS 	"R. Ierusalimschy, L. H. de Figueiredo & W. Celes"
+
+
+/* mark for precompiled code (`<esc>Lua') */
+#define	LUA_SIGNATURE	"\033Lua"
+
+/* option for multiple returns in `lua_pcall' and `lua_call' */
+#define LUA_MULTRET	(-1)
+
+
+/*
+** pseudo-indices
+*/
+#define LUA_REGISTRYINDEX	(-10000)
+#define LUA_ENVIRONINDEX	(-10001)
+#define LUA_GLOBALSINDEX	(-10002)
+#define lua_upvalueindex(i)	(LUA_GLOBALSINDEX-(i))
+
+
+/* thread status; 0 is OK */
+#define LUA_YIELD	1
+#define LUA_ERRRUN	2
+#define LUA_ERRSYNTAX	3
+#define LUA_ERRMEM	4
+#define LUA_ERRERR	5
+
+
+typedef struct lua_State lua_State;
+
+typedef int (*lua_CFunction) (lua_State *L);
+
+
+/*
+** functions that read/write blocks when loading/dumping Lua chunks
+*/
+typedef const char * (*lua_Reader) (lua_State *L, void *ud, size_t *sz);
+
+typedef int (*lua_Writer) (lua_State *L, const void* p, size_t sz, void* ud);
+
+
+/*
+** prototype for memory-allocation functions
+*/
+typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
+
+
+/*
+** basic types
+*/
+#define LUA_TNONE		(-1)
+
+#define LUA_TNIL		0
+#define LUA_TBOOLEAN		1
+#define LUA_TLIGHTUSERDATA	2
+#define LUA_TNUMBER		3
+#define LUA_TSTRING		4
+#define LUA_TTABLE		5
+#define LUA_TFUNCTION		6
+#define LUA_TUSERDATA		7
+#define LUA_TTHREAD		8
+
+
+
+/* minimum Lua stack available to a C function */
+#define LUA_MINSTACK	20
+
+
+/*
+** generic extra include file
+*/
+#if defined(LUA_USER_H)
+#include LUA_USER_H
+#endif
+
+
+/* type of numbers in Lua */
+typedef LUA_NUMBER lua_Number;
+
+
+/* type for integer functions */
+typedef LUA_INTEGER lua_Integer;
+
+
+
+/*
+** state manipulation
+*/
+LUA_API lua_State *(lua_newstate) (lua_Alloc f, void *ud);
+LUA_API void       (lua_close) (lua_State *L);
+LUA_API lua_State *(lua_newthread) (lua_State *L);
+
+LUA_API lua_CFunction (lua_atpanic) (lua_State *L, lua_CFunction panicf);
+
+
+/*
+** basic stack manipulation
+*/
+LUA_API int   (lua_gettop) (lua_State *L);
+LUA_API void  (lua_settop) (lua_State *L, int idx);
+LUA_API void  (lua_pushvalue) (lua_State *L, int idx);
+LUA_API void  (lua_remove) (lua_State *L, int idx);
+LUA_API void  (lua_insert) (lua_State *L, int idx);
+LUA_API void  (lua_replace) (lua_State *L, int idx);
+LUA_API int   (lua_checkstack) (lua_State *L, int sz);
+
+LUA_API void  (lua_xmove) (lua_State *from, lua_State *to, int n);
+
+
+/*
+** access functions (stack -> C)
+*/
+
+LUA_API int             (lua_isnumber) (lua_State *L, int idx);
+LUA_API int             (lua_isstring) (lua_State *L, int idx);
+LUA_API int             (lua_iscfunction) (lua_State *L, int idx);
+LUA_API int             (lua_isuserdata) (lua_State *L, int idx);
+LUA_API int             (lua_type) (lua_State *L, int idx);
+LUA_API const char     *(lua_typename) (lua_State *L, int tp);
+
+LUA_API int            (lua_equal) (lua_State *L, int idx1, int idx2);
+LUA_API int            (lua_rawequal) (lua_State *L, int idx1, int idx2);
+LUA_API int            (lua_lessthan) (lua_State *L, int idx1, int idx2);
+
+LUA_API lua_Number      (lua_tonumber) (lua_State *L, int idx);
+LUA_API lua_Integer     (lua_tointeger) (lua_State *L, int idx);
+LUA_API int             (lua_toboolean) (lua_State *L, int idx);
+LUA_API const char     *(lua_tolstring) (lua_State *L, int idx, size_t *len);
+LUA_API size_t          (lua_objlen) (lua_State *L, int idx);
+LUA_API lua_CFunction   (lua_tocfunction) (lua_State *L, int idx);
+LUA_API void	       *(lua_touserdata) (lua_State *L, int idx);
+LUA_API lua_State      *(lua_tothread) (lua_State *L, int idx);
+LUA_API const void     *(lua_topointer) (lua_State *L, int idx);
+
+
+/*
+** push functions (C -> stack)
+*/
+LUA_API void  (lua_pushnil) (lua_State *L);
+LUA_API void  (lua_pushnumber) (lua_State *L, lua_Number n);
+LUA_API void  (lua_pushinteger) (lua_State *L, lua_Integer n);
+LUA_API void  (lua_pushlstring) (lua_State *L, const char *s, size_t l);
+LUA_API void  (lua_pushstring) (lua_State *L, const char *s);
+LUA_API const char *(lua_pushvfstring) (lua_State *L, const char *fmt,
+                                                      va_list argp);
+LUA_API const char *(lua_pushfstring) (lua_State *L, const char *fmt, ...);
+LUA_API void  (lua_pushcclosure) (lua_State *L, lua_CFunction fn, int n);
+LUA_API void  (lua_pushboolean) (lua_State *L, int b);
+LUA_API void  (lua_pushlightuserdata) (lua_State *L, void *p);
+LUA_API int   (lua_pushthread) (lua_State *L);
+
+
+/*
+** get functions (Lua -> stack)
+*/
+LUA_API void  (lua_gettable) (lua_State *L, int idx);
+LUA_API void  (lua_getfield) (lua_State *L, int idx, const char *k);
+LUA_API void  (lua_rawget) (lua_State *L, int idx);
+LUA_API void  (lua_rawgeti) (lua_State *L, int idx, int n);
+LUA_API void  (lua_createtable) (lua_State *L, int narr, int nrec);
+LUA_API void *(lua_newuserdata) (lua_State *L, size_t sz);
+LUA_API int   (lua_getmetatable) (lua_State *L, int objindex);
+LUA_API void  (lua_getfenv) (lua_State *L, int idx);
+
+
+/*
+** set functions (stack -> Lua)
+*/
+LUA_API void  (lua_settable) (lua_State *L, int idx);
+LUA_API void  (lua_setfield) (lua_State *L, int idx, const char *k);
+LUA_API void  (lua_rawset) (lua_State *L, int idx);
+LUA_API void  (lua_rawseti) (lua_State *L, int idx, int n);
+LUA_API int   (lua_setmetatable) (lua_State *L, int objindex);
+LUA_API int   (lua_setfenv) (lua_State *L, int idx);
+
+
+/*
+** `load' and `call' functions (load and run Lua code)
+*/
+LUA_API void  (lua_call) (lua_State *L, int nargs, int nresults);
+LUA_API int   (lua_pcall) (lua_State *L, int nargs, int nresults, int errfunc);
+LUA_API int   (lua_cpcall) (lua_State *L, lua_CFunction func, void *ud);
+LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
+                                        const char *chunkname);
+
+LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data);
+
+
+/*
+** coroutine functions
+*/
+LUA_API int  (lua_yield) (lua_State *L, int nresults);
+LUA_API int  (lua_resume) (lua_State *L, int narg);
+LUA_API int  (lua_status) (lua_State *L);
+
+/*
+** garbage-collection function and options
+*/
+
+#define LUA_GCSTOP		0
+#define LUA_GCRESTART		1
+#define LUA_GCCOLLECT		2
+#define LUA_GCCOUNT		3
+#define LUA_GCCOUNTB		4
+#define LUA_GCSTEP		5
+#define LUA_GCSETPAUSE		6
+#define LUA_GCSETSTEPMUL	7
+
+LUA_API int (lua_gc) (lua_State *L, int what, int data);
+
+
+/*
+** miscellaneous functions
+*/
+
+LUA_API int   (lua_error) (lua_State *L);
+
+LUA_API int   (lua_next) (lua_State *L, int idx);
+
+LUA_API void  (lua_concat) (lua_State *L, int n);
+
+LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
+LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud);
+
+
+
+/* 
+** ===============================================================
+** some useful macros
+** ===============================================================
+*/
+
+#define lua_pop(L,n)		lua_settop(L, -(n)-1)
+
+#define lua_newtable(L)		lua_createtable(L, 0, 0)
+
+#define lua_register(L,n,f) (lua_pushcfunction(L, (f)), lua_setglobal(L, (n)))
+
+#define lua_pushcfunction(L,f)	lua_pushcclosure(L, (f), 0)
+
+#define lua_strlen(L,i)		lua_objlen(L, (i))
+
+#define lua_isfunction(L,n)	(lua_type(L, (n)) == LUA_TFUNCTION)
+#define lua_istable(L,n)	(lua_type(L, (n)) == LUA_TTABLE)
+#define lua_islightuserdata(L,n)	(lua_type(L, (n)) == LUA_TLIGHTUSERDATA)
+#define lua_isnil(L,n)		(lua_type(L, (n)) == LUA_TNIL)
+#define lua_isboolean(L,n)	(lua_type(L, (n)) == LUA_TBOOLEAN)
+#define lua_isthread(L,n)	(lua_type(L, (n)) == LUA_TTHREAD)
+#define lua_isnone(L,n)		(lua_type(L, (n)) == LUA_TNONE)
+#define lua_isnoneornil(L, n)	(lua_type(L, (n)) <= 0)
+
+#define lua_pushliteral(L, s)	\
+	lua_pushlstring(L, "" s, (sizeof(s)/sizeof(char))-1)
+
+#define lua_setglobal(L,s)	lua_setfield(L, LUA_GLOBALSINDEX, (s))
+#define lua_getglobal(L,s)	lua_getfield(L, LUA_GLOBALSINDEX, (s))
+
+#define lua_tostring(L,i)	lua_tolstring(L, (i), NULL)
+
+
+
+/*
+** compatibility macros and functions
+*/
+
+#define lua_open()	luaL_newstate()
+
+#define lua_getregistry(L)	lua_pushvalue(L, LUA_REGISTRYINDEX)
+
+#define lua_getgccount(L)	lua_gc(L, LUA_GCCOUNT, 0)
+
+#define lua_Chunkreader		lua_Reader
+#define lua_Chunkwriter		lua_Writer
+
+
+/* hack */
+LUA_API void lua_setlevel	(lua_State *from, lua_State *to);
+
+
+/*
+** {======================================================================
+** Debug API
+** =======================================================================
+*/
+
+
+/*
+** Event codes
+*/
+#define LUA_HOOKCALL	0
+#define LUA_HOOKRET	1
+#define LUA_HOOKLINE	2
+#define LUA_HOOKCOUNT	3
+#define LUA_HOOKTAILRET 4
+
+
+/*
+** Event masks
+*/
+#define LUA_MASKCALL	(1 << LUA_HOOKCALL)
+#define LUA_MASKRET	(1 << LUA_HOOKRET)
+#define LUA_MASKLINE	(1 << LUA_HOOKLINE)
+#define LUA_MASKCOUNT	(1 << LUA_HOOKCOUNT)
+
+typedef struct lua_Debug lua_Debug;  /* activation record */
+
+
+/* Functions to be called by the debuger in specific events */
+typedef void (*lua_Hook) (lua_State *L, lua_Debug *ar);
+
+
+LUA_API int lua_getstack (lua_State *L, int level, lua_Debug *ar);
+LUA_API int lua_getinfo (lua_State *L, const char *what, lua_Debug *ar);
+LUA_API const char *lua_getlocal (lua_State *L, const lua_Debug *ar, int n);
+LUA_API const char *lua_setlocal (lua_State *L, const lua_Debug *ar, int n);
+LUA_API const char *lua_getupvalue (lua_State *L, int funcindex, int n);
+LUA_API const char *lua_setupvalue (lua_State *L, int funcindex, int n);
+
+LUA_API int lua_sethook (lua_State *L, lua_Hook func, int mask, int count);
+LUA_API lua_Hook lua_gethook (lua_State *L);
+LUA_API int lua_gethookmask (lua_State *L);
+LUA_API int lua_gethookcount (lua_State *L);
+
+
+struct lua_Debug {
+  int event;
+  const char *name;	/* (n) */
+  const char *namewhat;	/* (n) `global', `local', `field', `method' */
+  const char *what;	/* (S) `Lua', `C', `main', `tail' */
+  const char *source;	/* (S) */
+  int currentline;	/* (l) */
+  int nups;		/* (u) number of upvalues */
+  int linedefined;	/* (S) */
+  int lastlinedefined;	/* (S) */
+  char short_src[LUA_IDSIZE]; /* (S) */
+  /* private part */
+  int i_ci;  /* active function */
+};
+
+/* }====================================================================== */
+
+
+/*
+** {======================================================================
+** lua55 inline fast path
+**
+** This copy of lua.h is meant for code built against the lua55 compat
+** layer (compat/lua55_compat.cpp).  The hot entry points below call the
+** lua55 API directly, so the 5.1 pseudo-index translation folds away at
+** compile time whenever the index is a constant.  Each wrapper mirrors
+** the out-of-line shim exactly; the out-of-line functions stay exported
+** so `&lua_gettop' and friends keep working.
+**
+** Define LUA55_NO_INLINE to get the plain 5.1 declarations only.
+** =======================================================================
+*/
+
+#if !defined(LUA55_NO_INLINE)
+
+#include <limits.h>
+
+#if defined(_MSC_VER) && !defined(__cplusplus)
+#define LUA55_INLINE	static __inline
+#else
+#define LUA55_INLINE	static inline
+#endif
+
+/* must match the setting the compat55 library was built with */
+#if !defined(COMPAT55_REFSTORE)
+#define COMPAT55_REFSTORE	0
+#endif
+
+/* lua55 values of the pseudo-indices (must match lua55/lua.h) */
+#define LUA55_REGISTRYINDEX	(-(INT_MAX/2 + 1000))
+#define LUA55_RIDX_GLOBALS	2
+#define LUA55_OPEQ		0
+#define LUA55_OPLT		1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+LUA_API int   (lua55_gettop) (lua_State *L);
+LUA_API void  (lua55_settop) (lua_State *L, int idx);
+LUA_API void  (lua55_pushvalue) (lua_State *L, int idx);
+LUA_API void  (lua55_rotate) (lua_State *L, int idx, int n);
+LUA_API void  (lua55_copy) (lua_State *L, int fromidx, int toidx);
+LUA_API int   (lua55_checkstack) (lua_State *L, int n);
+
+LUA_API int         (lua55_isnumber) (lua_State *L, int idx);
+LUA_API int         (lua55_isstring) (lua_State *L, int idx);
+LUA_API int         (lua55_iscfunction) (lua_State *L, int idx);
+LUA_API int         (lua55_isuserdata) (lua_State *L, int idx);
+LUA_API int         (lua55_type) (lua_State *L, int idx);
+LUA_API lua_Number  (lua55_tonumberx) (lua_State *L, int idx, int *isnum);
+LUA_API int         (lua55_toboolean) (lua_State *L, int idx);
+LUA_API const char *(lua55_tolstring) (lua_State *L, int idx, size_t *len);
+LUA_API unsigned long long (lua55_rawlen) (lua_State *L, int idx);
+LUA_API lua_CFunction (lua55_tocfunction) (lua_State *L, int idx);
+LUA_API void       *(lua55_touserdata) (lua_State *L, int idx);
+LUA_API lua_State  *(lua55_tothread) (lua_State *L, int idx);
+LUA_API const void *(lua55_topointer) (lua_State *L, int idx);
+LUA_API int         (lua55_rawequal) (lua_State *L, int idx1, int idx2);
+LUA_API int         (lua55_compare) (lua_State *L, int idx1, int idx2, int op);
+
+LUA_API void        (lua55_pushnil) (lua_State *L);
+LUA_API void        (lua55_pushnumber) (lua_State *L, lua_Number n);
+LUA_API void        (lua55_pushinteger) (lua_State *L, long long n);
+LUA_API const char *(lua55_pushlstring) (lua_State *L, const char *s, size_t len);
+LUA_API const char *(lua55_pushstring) (lua_State *L, const char *s);
+LUA_API void        (lua55_pushcclosure) (lua_State *L, lua_CFunction fn, int n);
+LUA_API void        (lua55_pushboolean) (lua_State *L, int b);
+LUA_API void        (lua55_pushlightuserdata) (lua_State *L, void *p);
+
+LUA_API int   (lua55_getglobal) (lua_State *L, const char *name);
+LUA_API int   (lua55_gettable) (lua_State *L, int idx);
+LUA_API int   (lua55_getfield) (lua_State *L, int idx, const char *k);
+LUA_API int   (lua55_rawget) (lua_State *L, int idx);
+LUA_API int   (lua55_rawgeti) (lua_State *L, int idx, long long n);
+LUA_API void  (lua55_createtable) (lua_State *L, int narr, int nrec);
+LUA_API int   (lua55_getref) (lua_State *L, int ref);
+LUA_API int   (lua55_setref) (lua_State *L, int ref);
+LUA_API int   (lua55_getmetatable) (lua_State *L, int objindex);
+
+LUA_API void  (lua55_setglobal) (lua_State *L, const char *name);
+LUA_API void  (lua55_settable) (lua_State *L, int idx);
+LUA_API void  (lua55_setfield) (lua_State *L, int idx, const char *k);
+LUA_API void  (lua55_rawset) (lua_State *L, int idx);
+LUA_API void  (lua55_rawseti) (lua_State *L, int idx, long long n);
+LUA_API int   (lua55_setmetatable) (lua_State *L, int objindex);
+
+LUA_API void  (lua55_callk) (lua_State *L, int nargs, int nresults,
+                             ptrdiff_t ctx, lua_CFunction k);
+LUA_API int   (lua55_pcallk) (lua_State *L, int nargs, int nresults,
+                              int errfunc, ptrdiff_t ctx, lua_CFunction k);
+
+LUA_API int   (lua55_error) (lua_State *L);
+LUA_API int   (lua55_next) (lua_State *L, int idx);
+LUA_API void  (lua55_concat) (lua_State *L, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+/*
+** Translate a 5.1 index to its lua55 equivalent.  LUA_GLOBALSINDEX has
+** no lua55 counterpart and maps to 0; callers that accept it handle it
+** before translating.  LUA_ENVIRONINDEX is stubbed as the registry.
+*/
+LUA55_INLINE int lua55i_index (int idx) {
+  if (idx > LUA_REGISTRYINDEX) return idx;
+  if (idx == LUA_GLOBALSINDEX) return 0;
+  if (idx >= LUA_ENVIRONINDEX) return LUA55_REGISTRYINDEX;
+  return LUA55_REGISTRYINDEX - (LUA_GLOBALSINDEX - idx);
+}
+
+#define lua55i_x(i)	lua55i_index(i)
+
+
+/* basic stack manipulation */
+LUA55_INLINE int lua55i_gettop (lua_State *L) {
+  return lua55_gettop(L);
+}
+
+LUA55_INLINE void lua55i_settop (lua_State *L, int idx) {
+  lua55_settop(L, idx);
+}
+
+LUA55_INLINE void lua55i_pushvalue (lua_State *L, int idx) {
+  if (idx == LUA_GLOBALSINDEX)
+    (void)lua55_rawgeti(L, LUA55_REGISTRYINDEX, LUA55_RIDX_GLOBALS);
+  else
+    lua55_pushvalue(L, lua55i_x(idx));
+}
+
+LUA55_INLINE void lua55i_remove (lua_State *L, int idx) {
+  lua55_rotate(L, idx, -1);
+  lua55_settop(L, -2);
+}
+
+LUA55_INLINE void lua55i_insert (lua_State *L, int idx) {
+  lua55_rotate(L, idx, 1);
+}
+
+LUA55_INLINE void lua55i_replace (lua_State *L, int idx) {
+  if (idx == LUA_GLOBALSINDEX)
+    lua55_rawseti(L, LUA55_REGISTRYINDEX, LUA55_RIDX_GLOBALS);
+  else {
+    lua55_copy(L, -1, lua55i_x(idx));
+    lua55_settop(L, -2);
+  }
+}
+
+LUA55_INLINE int lua55i_checkstack (lua_State *L, int sz) {
+  return lua55_checkstack(L, sz);
+}
+
+
+/* access functions (stack -> C) */
+LUA55_INLINE int lua55i_isnumber (lua_State *L, int idx) {
+  return lua55_isnumber(L, lua55i_x(idx));
+}
+
+LUA55_INLINE int lua55i_isstring (lua_State *L, int idx) {
+  return lua55_isstring(L, lua55i_x(idx));
+}
+
+LUA55_INLINE int lua55i_iscfunction (lua_State *L, int idx) {
+  return lua55_iscfunction(L, lua55i_x(idx));
+}
+
+LUA55_INLINE int lua55i_isuserdata (lua_State *L, int idx) {
+  return lua55_isuserdata(L, lua55i_x(idx));
+}
+
+LUA55_INLINE int lua55i_type (lua_State *L, int idx) {
+  if (idx <= LUA_REGISTRYINDEX && idx >= LUA_GLOBALSINDEX)
+    return LUA_TTABLE;
+  return lua55_type(L, lua55i_x(idx));
+}
+
+LUA55_INLINE int lua55i_equal (lua_State *L, int idx1, int idx2) {
+  return lua55_compare(L, lua55i_x(idx1), lua55i_x(idx2), LUA55_OPEQ);
+}
+
+LUA55_INLINE int lua55i_rawequal (lua_State *L, int idx1, int idx2) {
+  return lua55_rawequal(L, lua55i_x(idx1), lua55i_x(idx2));
+}
+
+LUA55_INLINE int lua55i_lessthan (lua_State *L, int idx1, int idx2) {
+  return lua55_compare(L, lua55i_x(idx1), lua55i_x(idx2), LUA55_OPLT);
+}
+
+LUA55_INLINE lua_Number lua55i_tonumber (lua_State *L, int idx) {
+  return lua55_tonumberx(L, lua55i_x(idx), NULL);
+}
+
+LUA55_INLINE lua_Integer lua55i_tointeger (lua_State *L, int idx) {
+  /* 5.1 truncates any number; see lua_tointeger in the shim */
+  int isnum;
+  lua_Number n = lua55_tonumberx(L, lua55i_x(idx), &isnum);
+  return isnum ? (lua_Integer)n : 0;
+}
+
+LUA55_INLINE int lua55i_toboolean (lua_State *L, int idx) {
+  return lua55_toboolean(L, lua55i_x(idx));
+}
+
+LUA55_INLINE const char *lua55i_tolstring (lua_State *L, int idx,
+                                           size_t *len) {
+  return lua55_tolstring(L, lua55i_x(idx), len);
+}
+
+LUA55_INLINE size_t lua55i_objlen (lua_State *L, int idx) {
+  return (size_t)lua55_rawlen(L, lua55i_x(idx));
+}
+
+LUA55_INLINE lua_CFunction lua55i_tocfunction (lua_State *L, int idx) {
+  return lua55_tocfunction(L, lua55i_x(idx));
+}
+
+LUA55_INLINE void *lua55i_touserdata (lua_State *L, int idx) {
+  return lua55_touserdata(L, lua55i_x(idx));
+}
+
+LUA55_INLINE lua_State *lua55i_tothread (lua_State *L, int idx) {
+  return lua55_tothread(L, lua55i_x(idx));
+}
+
+LUA55_INLINE const void *lua55i_topointer (lua_State *L, int idx) {
+  return lua55_topointer(L, lua55i_x(idx));
+}
+
+
+/* push functions (C -> stack) */
+LUA55_INLINE void lua55i_pushnil (lua_State *L) {
+  lua55_pushnil(L);
+}
+
+LUA55_INLINE void lua55i_pushnumber (lua_State *L, lua_Number n) {
+  lua55_pushnumber(L, n);
+}
+
+LUA55_INLINE void lua55i_pushinteger (lua_State *L, lua_Integer n) {
+  lua55_pushinteger(L, (long long)n);
+}
+
+LUA55_INLINE void lua55i_pushlstring (lua_State *L, const char *s, size_t l) {
+  (void)lua55_pushlstring(L, s, l);
+}
+
+LUA55_INLINE void lua55i_pushstring (lua_State *L, const char *s) {
+  (void)lua55_pushstring(L, s);
+}
+
+LUA55_INLINE void lua55i_pushcclosure (lua_State *L, lua_CFunction fn, int n) {
+  lua55_pushcclosure(L, fn, n);
+}
+
+LUA55_INLINE void lua55i_pushboolean (lua_State *L, int b) {
+  lua55_pushboolean(L, b);
+}
+
+LUA55_INLINE void lua55i_pushlightuserdata (lua_State *L, void *p) {
+  lua55_pushlightuserdata(L, p);
+}
+
+
+/* get functions (Lua -> stack) */
+LUA55_INLINE void lua55i_gettable (lua_State *L, int idx) {
+  if (idx == LUA_GLOBALSINDEX) {
+    (void)lua55_rawgeti(L, LUA55_REGISTRYINDEX, LUA55_RIDX_GLOBALS);
+    lua55_rotate(L, -2, 1);
+    (void)lua55_gettable(L, -2);
+    lua55_rotate(L, -2, -1);
+    lua55_settop(L, -2);
+  }
+  else
+    (void)lua55_gettable(L, lua55i_x(idx));
+}
+
+LUA55_INLINE void lua55i_getfield (lua_State *L, int idx, const char *k) {
+  if (idx == LUA_GLOBALSINDEX)
+    (void)lua55_getglobal(L, k);
+  else
+    (void)lua55_getfield(L, lua55i_x(idx), k);
+}
+
+LUA55_INLINE void lua55i_rawget (lua_State *L, int idx) {
+  (void)lua55_rawget(L, lua55i_x(idx));
+}
+
+LUA55_INLINE void lua55i_rawgeti (lua_State *L, int idx, int n) {
+#if COMPAT55_REFSTORE
+  if (idx == LUA_REGISTRYINDEX && lua55_getref(L, n) != LUA_TNONE)
+    return;
+#endif
+  (void)lua55_rawgeti(L, lua55i_x(idx), (long long)n);
+}
+
+LUA55_INLINE void lua55i_createtable (lua_State *L, int narr, int nrec) {
+  lua55_createtable(L, narr, nrec);
+}
+
+LUA55_INLINE int lua55i_getmetatable (lua_State *L, int objindex) {
+  return lua55_getmetatable(L, lua55i_x(objindex));
+}
+
+
+/* set functions (stack -> Lua) */
+LUA55_INLINE void lua55i_settable (lua_State *L, int idx) {
+  if (idx == LUA_GLOBALSINDEX) {
+    (void)lua55_rawgeti(L, LUA55_REGISTRYINDEX, LUA55_RIDX_GLOBALS);
+    lua55_rotate(L, -3, 1);
+    lua55_settable(L, -3);
+    lua55_settop(L, -2);
+  }
+  else
+    lua55_settable(L, lua55i_x(idx));
+}
+
+LUA55_INLINE void lua55i_setfield (lua_State *L, int idx, const char *k) {
+  if (idx == LUA_GLOBALSINDEX)
+    lua55_setglobal(L, k);
+  else
+    lua55_setfield(L, lua55i_x(idx), k);
+}
+
+LUA55_INLINE void lua55i_rawset (lua_State *L, int idx) {
+  lua55_rawset(L, lua55i_x(idx));
+}
+
+LUA55_INLINE void lua55i_rawseti (lua_State *L, int idx, int n) {
+#if COMPAT55_REFSTORE
+  if (idx == LUA_REGISTRYINDEX) {
+    lua55_pushvalue(L, -1);
+    if (lua55_setref(L, n)) {
+      lua55_settop(L, -2);
+      return;
+    }
+  }
+#endif
+  lua55_rawseti(L, lua55i_x(idx), (long long)n);
+}
+
+LUA55_INLINE int lua55i_setmetatable (lua_State *L, int objindex) {
+  return lua55_setmetatable(L, lua55i_x(objindex));
+}
+
+
+/* `call' functions and miscellaneous */
+LUA55_INLINE void lua55i_call (lua_State *L, int nargs, int nresults) {
+  lua55_callk(L, nargs, nresults, 0, NULL);
+}
+
+LUA55_INLINE int lua55i_pcall (lua_State *L, int nargs, int nresults,
+                               int errfunc) {
+  return lua55_pcallk(L, nargs, nresults, errfunc, 0, NULL);
+}
+
+LUA55_INLINE int lua55i_error (lua_State *L) {
+  return lua55_error(L);
+}
+
+LUA55_INLINE int lua55i_next (lua_State *L, int idx) {
+  return lua55_next(L, lua55i_x(idx));
+}
+
+LUA55_INLINE void lua55i_concat (lua_State *L, int n) {
+  lua55_concat(L, n);
+}
+
+
+#define lua_gettop(L)			lua55i_gettop(L)
+#define lua_settop(L,idx)		lua55i_settop(L,idx)
+#define lua_pushvalue(L,idx)		lua55i_pushvalue(L,idx)
+#define lua_remove(L,idx)		lua55i_remove(L,idx)
+#define lua_insert(L,idx)		lua55i_insert(L,idx)
+#define lua_replace(L,idx)		lua55i_replace(L,idx)
+#define lua_checkstack(L,sz)		lua55i_checkstack(L,sz)
+
+#define lua_isnumber(L,idx)		lua55i_isnumber(L,idx)
+#define lua_isstring(L,idx)		lua55i_isstring(L,idx)
+#define lua_iscfunction(L,idx)		lua55i_iscfunction(L,idx)
+#define lua_isuserdata(L,idx)		lua55i_isuserdata(L,idx)
+#define lua_type(L,idx)			lua55i_type(L,idx)
+#define lua_equal(L,i1,i2)		lua55i_equal(L,i1,i2)
+#define lua_rawequal(L,i1,i2)		lua55i_rawequal(L,i1,i2)
+#define lua_lessthan(L,i1,i2)		lua55i_lessthan(L,i1,i2)
+#define lua_tonumber(L,idx)		lua55i_tonumber(L,idx)
+#define lua_tointeger(L,idx)		lua55i_tointeger(L,idx)
+#define lua_toboolean(L,idx)		lua55i_toboolean(L,idx)
+#define lua_tolstring(L,idx,len)	lua55i_tolstring(L,idx,len)
+#define lua_objlen(L,idx)		lua55i_objlen(L,idx)
+#define lua_tocfunction(L,idx)		lua55i_tocfunction(L,idx)
+#define lua_touserdata(L,idx)		lua55i_touserdata(L,idx)
+#define lua_tothread(L,idx)		lua55i_tothread(L,idx)
+#define lua_topointer(L,idx)		lua55i_topointer(L,idx)
+
+#define lua_pushnil(L)			lua55i_pushnil(L)
+#define lua_pushnumber(L,n)		lua55i_pushnumber(L,n)
+#define lua_pushinteger(L,n)		lua55i_pushinteger(L,n)
+#define lua_pushlstring(L,s,l)		lua55i_pushlstring(L,s,l)
+#define lua_pushstring(L,s)		lua55i_pushstring(L,s)
+#define lua_pushcclosure(L,fn,n)	lua55i_pushcclosure(L,fn,n)
+#define lua_pushboolean(L,b)		lua55i_pushboolean(L,b)
+#define lua_pushlightuserdata(L,p)	lua55i_pushlightuserdata(L,p)
+
+#define lua_gettable(L,idx)		lua55i_gettable(L,idx)
+#define lua_getfield(L,idx,k)		lua55i_getfield(L,idx,k)
+#define lua_rawget(L,idx)		lua55i_rawget(L,idx)
+#define lua_rawgeti(L,idx,n)		lua55i_rawgeti(L,idx,n)
+#define lua_createtable(L,na,nr)	lua55i_createtable(L,na,nr)
+#define lua_getmetatable(L,idx)		lua55i_getmetatable(L,idx)
+
+#define lua_settable(L,idx)		lua55i_settable(L,idx)
+#define lua_setfield(L,idx,k)		lua55i_setfield(L,idx,k)
+#define lua_rawset(L,idx)		lua55i_rawset(L,idx)
+#define lua_rawseti(L,idx,n)		lua55i_rawseti(L,idx,n)
+#define lua_setmetatable(L,idx)		lua55i_setmetatable(L,idx)
+
+#define lua_call(L,na,nr)		lua55i_call(L,na,nr)
+#define lua_pcall(L,na,nr,ef)		lua55i_pcall(L,na,nr,ef)
+#define lua_error(L)			lua55i_error(L)
+#define lua_next(L,idx)			lua55i_next(L,idx)
+#define lua_concat(L,n)			lua55i_concat(L,n)
+
+#endif  /* LUA55_NO_INLINE */
+
+/* }====================================================================== */
+
+
+/******************************************************************************
+* Copyright (C) 1994-2012 Lua.org, PUC-Rio.  All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+
+#endif
@@ -9,6 +9,7 @@
 #include <stddef.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 
@@ -17,6 +18,14 @@
 #include "lua55/lauxlib.h"
 #include "lua55/lualib.h"
 
+#ifdef _WIN32
+#include <process.h>
+#define compat55_getpid  _getpid
+#else
+#include <unistd.h>
+#define compat55_getpid  getpid
+#endif
+
 /* Undefine lua55 compat macros that conflict with our function names */
 #undef lua_equal
 #undef lua_lessthan
@@ -36,6 +45,8 @@
 typedef lua55_State       lua_State;
 /* lua_Number, lua_Integer, etc. already typedef'd at bottom of lua55/lua.h */
 
+#include "compat/compat55.h"
+
 /* ── Translate lua51 pseudo-indices to lua55 equivalents ──────── */
 /* Returns the translated index.  For LUA51_GLOBALSINDEX the caller
    must handle the case specially (push the global table). */
@@ -50,11 +61,54 @@ static int xidx(int idx) {
     return lua55_upvalueindex(LUA51_GLOBALSINDEX - idx);
 }
 
+/* compat/inline/lua.h translates indices at compile time and hard-codes
+   these lua55 values; fail the build if they ever drift. */
+typedef char compat55_registryindex_check[
+    (LUA_REGISTRYINDEX == -(INT_MAX/2 + 1000)) ? 1 : -1];
+typedef char compat55_ridx_globals_check[(LUA_RIDX_GLOBALS == 2) ? 1 : -1];
+typedef char compat55_opcodes_check[(LUA_OPEQ == 0 && LUA_OPLT == 1) ? 1 : -1];
+
 /* Push the global table onto the stack (lua55 equivalent of LUA_GLOBALSINDEX) */
 static void push_globaltable(lua_State *L) {
     lua55_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
 }
 
+/* ── Userdata environments ───────────────────────────────────── */
+/* Number of user values reserved by lua_newuserdata.  With 0, plain
+   userdata carry no hidden slot and lua_setfenv attaches the
+   environment lazily through a weak-keyed registry table. */
+#ifndef COMPAT55_UDATA_NUVALUE
+#define COMPAT55_UDATA_NUVALUE  1
+#endif
+
+static const char fenv_key = 0;
+
+/* Push the userdata -> env side table; nil if absent and !create */
+static void push_fenvtable(lua_State *L, int create) {
+    if (lua55_rawgetp(L, LUA_REGISTRYINDEX, &fenv_key) != LUA_TNIL || !create)
+        return;
+    lua55_settop(L, -2);
+    lua55_createtable(L, 0, 4);
+    lua55_createtable(L, 0, 1);
+    lua55_pushstring(L, "k");
+    lua55_setfield(L, -2, "__mode");
+    lua55_setmetatable(L, -2);
+    lua55_pushvalue(L, -1);
+    lua55_rawsetp(L, LUA_REGISTRYINDEX, &fenv_key);
+}
+
+/* ── Reference store ─────────────────────────────────────────── */
+/* With COMPAT55_REFSTORE=1, luaL_ref/luaL_unref on the registry use
+   the lua55 reference store (lua55_ref) instead of the registry table,
+   and lua_rawgeti/lua_rawseti on LUA_REGISTRYINDEX look live refs up
+   there first.  Refs are then no longer keys of the registry table:
+   debug.getregistry()[ref], or lua_rawgeti through a copy of the
+   registry pushed on the stack, does not find them.  Off by default;
+   compat/inline/lua.h must be built with the same setting. */
+#ifndef COMPAT55_REFSTORE
+#define COMPAT55_REFSTORE  0
+#endif
+
 /* ── lua51_Debug layout ──────────────────────────────────────── */
 /* The application allocates this (smaller) struct; our functions
    must not write beyond it. */
@@ -87,15 +141,169 @@ struct lua51_Buffer {
     char  buffer[LUA51_BUFFERSIZE];
 };
 
-/* ── Keep one lua55_Debug for getstack↔getinfo pairing ───────── */
-static lua55_Debug g_debug55;
+/* ── API call profiler ───────────────────────────────────────── */
+/* Build with -DCOMPAT55_PROFILE to count calls to every exported lua_*
+   and luaL_* function; every COMPAT55_PROFILE_SAMPLE-th call of each
+   function is also timed.  Results come out through compat55_prof_*
+   (compat/compat55.h).  Without COMPAT55_PROFILE, PROF_ENTER expands
+   to nothing and the query functions report no entries. */
+#ifndef COMPAT55_PROFILE
+#define COMPAT55_PROFILE  0
+#endif
+
+#ifndef COMPAT55_PROFILE_SAMPLE
+#define COMPAT55_PROFILE_SAMPLE  64
+#endif
+
+#define COMPAT55_API_LIST(X) \
+    X(lua_newstate) X(lua_close) X(lua_newthread) X(lua_atpanic) \
+    X(lua_getallocf) X(lua_setallocf) X(lua_gettop) X(lua_settop) \
+    X(lua_pushvalue) X(lua_remove) X(lua_insert) X(lua_replace) \
+    X(lua_checkstack) X(lua_xmove) X(lua_type) X(lua_typename) \
+    X(lua_tonumber) X(lua_tonumberx) X(lua_tointeger) X(lua_tointegerx) \
+    X(lua_isnumber) X(lua_isstring) X(lua_iscfunction) X(lua_isuserdata) \
+    X(lua_rawequal) X(lua_equal) X(lua_lessthan) X(lua_toboolean) \
+    X(lua_tolstring) X(lua_rawlen) X(lua_objlen) X(lua_tocfunction) \
+    X(lua_touserdata) X(lua_tothread) X(lua_topointer) X(lua_pushnil) \
+    X(lua_pushnumber) X(lua_pushinteger) X(lua_pushlstring) \
+    X(lua_pushstring) X(lua_pushvfstring) X(lua_pushfstring) \
+    X(lua_pushcclosure) X(lua_pushboolean) X(lua_pushlightuserdata) \
+    X(lua_pushthread) X(lua_gettable) X(lua_getfield) X(lua_rawget) \
+    X(lua_rawgeti) X(lua_createtable) X(lua_newuserdata) \
+    X(lua_getmetatable) X(lua_getfenv) X(lua_settable) X(lua_setfield) \
+    X(lua_rawset) X(lua_rawseti) X(lua_setmetatable) X(lua_setfenv) \
+    X(lua_call) X(lua_pcall) X(lua_cpcall) X(lua_load) X(lua_dump) \
+    X(lua_yield) X(lua_resume) X(lua_status) X(lua_isyieldable) \
+    X(lua_gc) X(lua_error) X(lua_next) X(lua_concat) X(lua_len) \
+    X(lua_setlevel) X(lua_getstack) X(lua_getinfo) X(lua_getlocal) \
+    X(lua_setlocal) X(lua_getupvalue) X(lua_setupvalue) X(lua_sethook) \
+    X(lua_gethook) X(lua_gethookmask) X(lua_gethookcount) \
+    X(luaL_newstate) X(luaL_register) X(luaL_openlib) \
+    X(luaL_getmetafield) X(luaL_callmeta) X(luaL_error) X(luaL_typerror) \
+    X(luaL_argerror) X(luaL_checkinteger) X(luaL_optinteger) \
+    X(luaL_checknumber) X(luaL_optnumber) X(luaL_checklstring) \
+    X(luaL_optlstring) X(luaL_checkstack) X(luaL_checktype) \
+    X(luaL_checkany) X(luaL_newmetatable) X(luaL_setmetatable) \
+    X(luaL_testudata) X(luaL_checkudata) X(luaL_checkoption) \
+    X(luaL_where) X(luaL_ref) X(luaL_unref) X(luaL_loadfile) \
+    X(luaL_loadbuffer) X(luaL_loadstring) X(luaL_gsub) X(luaL_setfuncs) \
+    X(luaL_getsubtable) X(luaL_traceback) X(luaL_requiref) \
+    X(luaL_findtable) X(luaL_buffinit) X(luaL_prepbuffer) \
+    X(luaL_addlstring) X(luaL_addstring) X(luaL_addvalue) \
+    X(luaL_pushresult) X(luaL_openlibs)
+
+#if COMPAT55_PROFILE
+
+#define PROF_ENUM(fn)  PROF_##fn,
+#define PROF_NAME(fn)  #fn,
+
+enum { COMPAT55_API_LIST(PROF_ENUM) PROF_N };
+
+static const char *const prof_names[PROF_N] = { COMPAT55_API_LIST(PROF_NAME) };
+
+static struct {
+    unsigned long long calls, sampled, ticks;
+} prof_data[PROF_N];
+
+#if defined(__GNUC__)
+#define prof_add(p, n)  __atomic_fetch_add((p), (n), __ATOMIC_RELAXED)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define prof_add(p, n)  \
+    (unsigned long long)_InterlockedExchangeAdd64((volatile long long *)(p), (long long)(n))
+#else
+static unsigned long long prof_add(unsigned long long *p, unsigned long long n) {
+    unsigned long long old = *p;
+    *p += n;
+    return old;
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define PROF_UNIT  "cycles"
+static unsigned long long prof_ticks(void) { return __rdtsc(); }
+#elif defined(__aarch64__) && defined(__GNUC__)
+#define PROF_UNIT  "ticks"
+static unsigned long long prof_ticks(void) {
+    unsigned long long t;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+}
+#else
+#include <time.h>
+#define PROF_UNIT  "ns"
+static unsigned long long prof_ticks(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+}
+#endif
+
+typedef struct ProfScope {
+    int id;                 /* -1 when this call is not timed */
+    unsigned long long t0;
+} ProfScope;
+
+static ProfScope prof_enter(int id) {
+    ProfScope ps;
+    ps.id = -1;
+    ps.t0 = 0;
+    if (prof_add(&prof_data[id].calls, 1) % COMPAT55_PROFILE_SAMPLE == 0) {
+        ps.id = id;
+        ps.t0 = prof_ticks();
+    }
+    return ps;
+}
+
+#if defined(__GNUC__)
+static void prof_leave(ProfScope *ps) {
+    if (ps->id >= 0) {
+        prof_add(&prof_data[ps->id].ticks, prof_ticks() - ps->t0);
+        prof_add(&prof_data[ps->id].sampled, 1);
+    }
+}
+#define PROF_ENTER(fn)  \
+    ProfScope prof_scope_ __attribute__((cleanup(prof_leave))) = prof_enter(PROF_##fn)
+#else
+/* no scope-exit hook: count calls only */
+#define PROF_ENTER(fn)  (void)prof_add(&prof_data[PROF_##fn].calls, 1)
+#endif
+
+#else
+#define PROF_ENTER(fn)  ((void)0)
+#endif
+
+/* ── Per-state debug storage ─────────────────────────────────── */
+/* lua51_Debug has no room for a lua55 CallInfo pointer, so getstack
+   records the level in ar->i_ci and the other debug calls resolve it
+   again with lua55_getstack.  Nothing is shared between states, so
+   independent states can run on different threads. */
+static int resolve_ar(lua_State *L, const struct lua51_Debug *ar51,
+                      lua55_Debug *ar) {
+    return lua55_getstack(L, ar51->i_ci, ar);
+}
 
 /* ── Hook wrapper ────────────────────────────────────────────── */
+/* The user hook lives in the thread's extra space (one pointer per
+   lua55 thread), which is where lua55 keeps its own hook as well. */
 typedef void (*lua51_Hook)(lua_State *L, struct lua51_Debug *ar);
-static lua51_Hook g_user_hook;
+
+typedef char compat55_extraspace_check[
+    (sizeof(lua51_Hook) <= LUA_EXTRASPACE) ? 1 : -1];
+
+#define user_hook(L)  (*(lua51_Hook *)lua55_getextraspace(L))
+
+/* slabs have no locks, so deferred freeing must stay off with them */
+#define is_slaballoc(f)  ((f) == compat55_slab_alloc || (f) == lua55L_slaballoc)
 
 static void hook_bridge(lua_State *L, lua55_Debug *ar) {
-    if (!g_user_hook) return;
+    lua51_Hook hook = user_hook(L);
+    if (!hook) return;
     struct lua51_Debug ar51;
     ar51.event        = ar->event;
     ar51.name         = ar->name;
@@ -107,8 +315,8 @@ static void hook_bridge(lua_State *L, lua55_Debug *ar) {
     ar51.linedefined  = ar->linedefined;
     ar51.lastlinedefined = ar->lastlinedefined;
     memcpy(ar51.short_src, ar->short_src, sizeof(ar51.short_src));
-    ar51.i_ci         = 0;
-    g_user_hook(L, &ar51);
+    ar51.i_ci         = 0;   /* level 0 is the hooked function */
+    hook(L, &ar51);
 }
 
 /* ================================================================
@@ -116,26 +324,40 @@ static void hook_bridge(lua_State *L, lua55_Debug *ar) {
  * ================================================================ */
 
 lua_State *lua_newstate(lua_Alloc f, void *ud) {
-    return lua55_newstate(f, ud, 0);
+    PROF_ENTER(lua_newstate);
+    lua_State *L = lua55_newstate(f, ud, 0);
+    if (L) user_hook(L) = NULL;   /* lua55 leaves the extra space as is */
+    return L;
 }
 
 void lua_close(lua_State *L) {
+    PROF_ENTER(lua_close);
     lua55_close(L);
 }
 
 lua_State *lua_newthread(lua_State *L) {
-    return lua55_newthread(L);
+    PROF_ENTER(lua_newthread);
+    lua_State *L1 = lua55_newthread(L);
+    /* lua55 copies the hook from L but the extra space from the main
+       thread; keep the user hook with the lua55 hook */
+    user_hook(L1) = user_hook(L);
+    return L1;
 }
 
 lua_CFunction lua_atpanic(lua_State *L, lua_CFunction panicf) {
+    PROF_ENTER(lua_atpanic);
     return lua55_atpanic(L, panicf);
 }
 
 lua_Alloc lua_getallocf(lua_State *L, void **ud) {
+    PROF_ENTER(lua_getallocf);
     return lua55_getallocf(L, ud);
 }
 
 void lua_setallocf(lua_State *L, lua_Alloc f, void *ud) {
+    PROF_ENTER(lua_setallocf);
+    if (is_slaballoc(f))
+        lua55_gc(L, LUA_GCDEFERFREE, 0);
     lua55_setallocf(L, f, ud);
 }
 
@@ -144,29 +366,35 @@ void lua_setallocf(lua_State *L, lua_Alloc f, void *ud) {
  * ================================================================ */
 
 int lua_gettop(lua_State *L) {
+    PROF_ENTER(lua_gettop);
     return lua55_gettop(L);
 }
 
 void lua_settop(lua_State *L, int idx) {
+    PROF_ENTER(lua_settop);
     lua55_settop(L, idx);
 }
 
 void lua_pushvalue(lua_State *L, int idx) {
+    PROF_ENTER(lua_pushvalue);
     if (idx == LUA51_GLOBALSINDEX)  { push_globaltable(L); return; }
     if (idx == LUA51_REGISTRYINDEX) { lua55_pushvalue(L, LUA_REGISTRYINDEX); return; }
     lua55_pushvalue(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
 }
 
 void lua_remove(lua_State *L, int idx) {
+    PROF_ENTER(lua_remove);
     lua55_rotate(L, idx, -1);
     lua55_settop(L, -2);
 }
 
 void lua_insert(lua_State *L, int idx) {
+    PROF_ENTER(lua_insert);
     lua55_rotate(L, idx, 1);
 }
 
 void lua_replace(lua_State *L, int idx) {
+    PROF_ENTER(lua_replace);
     if (idx == LUA51_GLOBALSINDEX) {
         /* set global table from top of stack */
         lua55_rawseti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
@@ -178,10 +406,12 @@ void lua_replace(lua_State *L, int idx) {
 }
 
 int lua_checkstack(lua_State *L, int sz) {
+    PROF_ENTER(lua_checkstack);
     return lua55_checkstack(L, sz);
 }
 
 void lua_xmove(lua_State *from, lua_State *to, int n) {
+    PROF_ENTER(lua_xmove);
     lua55_xmove(from, to, n);
 }
 
@@ -190,6 +420,7 @@ void lua_xmove(lua_State *from, lua_State *to, int n) {
  * ================================================================ */
 
 int lua_type(lua_State *L, int idx) {
+    PROF_ENTER(lua_type);
     if (idx == LUA51_GLOBALSINDEX)  return LUA_TTABLE;
     if (idx == LUA51_ENVIRONINDEX)  return LUA_TTABLE;
     if (idx == LUA51_REGISTRYINDEX) return LUA_TTABLE;
@@ -197,18 +428,22 @@ int lua_type(lua_State *L, int idx) {
 }
 
 const char *lua_typename(lua_State *L, int t) {
+    PROF_ENTER(lua_typename);
     return lua55_typename(L, t);
 }
 
 lua_Number lua_tonumber(lua_State *L, int idx) {
+    PROF_ENTER(lua_tonumber);
     return lua55_tonumberx(L, IS_PSEUDO51(idx) ? xidx(idx) : idx, NULL);
 }
 
 lua_Number lua_tonumberx(lua_State *L, int idx, int *isnum) {
+    PROF_ENTER(lua_tonumberx);
     return lua55_tonumberx(L, IS_PSEUDO51(idx) ? xidx(idx) : idx, isnum);
 }
 
 lua_Integer lua_tointeger(lua_State *L, int idx) {
+    PROF_ENTER(lua_tointeger);
     /* lua51 truncates any number to integer; lua55 returns 0 for non-integers */
     int i55 = IS_PSEUDO51(idx) ? xidx(idx) : idx;
     int isnum;
@@ -218,32 +453,39 @@ lua_Integer lua_tointeger(lua_State *L, int idx) {
 }
 
 lua_Integer lua_tointegerx(lua_State *L, int idx, int *isnum) {
+    PROF_ENTER(lua_tointegerx);
     return lua55_tointegerx(L, IS_PSEUDO51(idx) ? xidx(idx) : idx, isnum);
 }
 
 int lua_isnumber(lua_State *L, int idx) {
+    PROF_ENTER(lua_isnumber);
     return lua55_isnumber(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
 }
 
 int lua_isstring(lua_State *L, int idx) {
+    PROF_ENTER(lua_isstring);
     return lua55_isstring(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
 }
 
 int lua_iscfunction(lua_State *L, int idx) {
+    PROF_ENTER(lua_iscfunction);
     return lua55_iscfunction(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
 }
 
 int lua_isuserdata(lua_State *L, int idx) {
+    PROF_ENTER(lua_isuserdata);
     return lua55_isuserdata(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
 }
 
 int lua_rawequal(lua_State *L, int idx1, int idx2) {
+    PROF_ENTER(lua_rawequal);
     return lua55_rawequal(L,
         IS_PSEUDO51(idx1) ? xidx(idx1) : idx1,
         IS_PSEUDO51(idx2) ? xidx(idx2) : idx2);
 }
 
 int lua_equal(lua_State *L, int idx1, int idx2) {
+    PROF_ENTER(lua_equal);
     return lua55_compare(L,
         IS_PSEUDO51(idx1) ? xidx(idx1) : idx1,
         IS_PSEUDO51(idx2) ? xidx(idx2) : idx2,
@@ -251,6 +493,7 @@ int lua_equal(lua_State *L, int idx1, int idx2) {
 }
 
 int lua_lessthan(lua_State *L, int idx1, int idx2) {
+    PROF_ENTER(lua_lessthan);
     return lua55_compare(L,
         IS_PSEUDO51(idx1) ? xidx(idx1) : idx1,
         IS_PSEUDO51(idx2) ? xidx(idx2) : idx2,
@@ -258,34 +501,42 @@ int lua_lessthan(lua_State *L, int idx1, int idx2) {
 }
 
 int lua_toboolean(lua_State *L, int idx) {
+    PROF_ENTER(lua_toboolean);
     return lua55_toboolean(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
 }
 
 const char *lua_tolstring(lua_State *L, int idx, size_t *len) {
+    PROF_ENTER(lua_tolstring);
     return lua55_tolstring(L, IS_PSEUDO51(idx) ? xidx(idx) : idx, len);
 }
 
 size_t lua_rawlen(lua_State *L, int idx) {
+    PROF_ENTER(lua_rawlen);
     return (size_t)lua55_rawlen(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
 }
 
 size_t lua_objlen(lua_State *L, int idx) {
+    PROF_ENTER(lua_objlen);
     return (size_t)lua55_rawlen(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
 }
 
 lua_CFunction lua_tocfunction(lua_State *L, int idx) {
+    PROF_ENTER(lua_tocfunction);
     return lua55_tocfunction(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
 }
 
 void *lua_touserdata(lua_State *L, int idx) {
+    PROF_ENTER(lua_touserdata);
     return lua55_touserdata(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
 }
 
 lua_State *lua_tothread(lua_State *L, int idx) {
+    PROF_ENTER(lua_tothread);
     return lua55_tothread(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
 }
 
 const void *lua_topointer(lua_State *L, int idx) {
+    PROF_ENTER(lua_topointer);
     return lua55_topointer(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
 }
 
@@ -294,30 +545,37 @@ const void *lua_topointer(lua_State *L, int idx) {
  * ================================================================ */
 
 void lua_pushnil(lua_State *L) {
+    PROF_ENTER(lua_pushnil);
     lua55_pushnil(L);
 }
 
 void lua_pushnumber(lua_State *L, lua_Number n) {
+    PROF_ENTER(lua_pushnumber);
     lua55_pushnumber(L, n);
 }
 
 void lua_pushinteger(lua_State *L, lua_Integer n) {
+    PROF_ENTER(lua_pushinteger);
     lua55_pushinteger(L, n);
 }
 
 void lua_pushlstring(lua_State *L, const char *s, size_t len) {
+    PROF_ENTER(lua_pushlstring);
     lua55_pushlstring(L, s, len);
 }
 
 void lua_pushstring(lua_State *L, const char *s) {
+    PROF_ENTER(lua_pushstring);
     lua55_pushstring(L, s);
 }
 
 const char *lua_pushvfstring(lua_State *L, const char *fmt, va_list argp) {
+    PROF_ENTER(lua_pushvfstring);
     return lua55_pushvfstring(L, fmt, argp);
 }
 
 const char *lua_pushfstring(lua_State *L, const char *fmt, ...) {
+    PROF_ENTER(lua_pushfstring);
     va_list argp;
     va_start(argp, fmt);
     const char *s = lua55_pushvfstring(L, fmt, argp);
@@ -326,18 +584,22 @@ const char *lua_pushfstring(lua_State *L, const char *fmt, ...) {
 }
 
 void lua_pushcclosure(lua_State *L, lua_CFunction fn, int n) {
+    PROF_ENTER(lua_pushcclosure);
     lua55_pushcclosure(L, fn, n);
 }
 
 void lua_pushboolean(lua_State *L, int b) {
+    PROF_ENTER(lua_pushboolean);
     lua55_pushboolean(L, b);
 }
 
 void lua_pushlightuserdata(lua_State *L, void *p) {
+    PROF_ENTER(lua_pushlightuserdata);
     lua55_pushlightuserdata(L, p);
 }
 
 int lua_pushthread(lua_State *L) {
+    PROF_ENTER(lua_pushthread);
     return lua55_pushthread(L);
 }
 
@@ -346,6 +608,7 @@ int lua_pushthread(lua_State *L) {
  * ================================================================ */
 
 void lua_gettable(lua_State *L, int idx) {
+    PROF_ENTER(lua_gettable);
     if (idx == LUA51_GLOBALSINDEX) {
         push_globaltable(L);
         lua55_insert(L, -2);   /* key is now on top, table below */
@@ -357,6 +620,7 @@ void lua_gettable(lua_State *L, int idx) {
 }
 
 void lua_getfield(lua_State *L, int idx, const char *k) {
+    PROF_ENTER(lua_getfield);
     if (idx == LUA51_GLOBALSINDEX) {
         lua55_getglobal(L, k);
         return;
@@ -365,28 +629,48 @@ void lua_getfield(lua_State *L, int idx, const char *k) {
 }
 
 void lua_rawget(lua_State *L, int idx) {
+    PROF_ENTER(lua_rawget);
     lua55_rawget(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
 }
 
 void lua_rawgeti(lua_State *L, int idx, int n) {
+    PROF_ENTER(lua_rawgeti);
+#if COMPAT55_REFSTORE
+    if (idx == LUA51_REGISTRYINDEX && lua55_getref(L, n) != LUA_TNONE)
+        return;
+#endif
     lua55_rawgeti(L, IS_PSEUDO51(idx) ? xidx(idx) : idx, (lua55_Integer)n);
 }
 
 void lua_createtable(lua_State *L, int narr, int nrec) {
+    PROF_ENTER(lua_createtable);
     lua55_createtable(L, narr, nrec);
 }
 
 void *lua_newuserdata(lua_State *L, size_t sz) {
-    return lua55_newuserdatauv(L, sz, 1);
+    PROF_ENTER(lua_newuserdata);
+    return lua55_newuserdatauv(L, sz, COMPAT55_UDATA_NUVALUE);
 }
 
 int lua_getmetatable(lua_State *L, int objindex) {
+    PROF_ENTER(lua_getmetatable);
     return lua55_getmetatable(L, IS_PSEUDO51(objindex) ? xidx(objindex) : objindex);
 }
 
 void lua_getfenv(lua_State *L, int idx) {
-    (void)idx;
-    lua55_pushnil(L);
+    PROF_ENTER(lua_getfenv);
+    int i55 = lua55_absindex(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
+    if (lua55_type(L, i55) != LUA_TUSERDATA) {
+        lua55_pushnil(L);
+        return;
+    }
+    if (lua55_getiuservalue(L, i55, 1) != LUA_TNONE) return;
+    lua55_settop(L, -2);
+    push_fenvtable(L, 0);
+    if (lua55_type(L, -1) == LUA_TNIL) return;
+    lua55_pushvalue(L, i55);
+    lua55_rawget(L, -2);
+    lua55_remove(L, -2);
 }
 
 /* ================================================================
@@ -394,6 +678,7 @@ void lua_getfenv(lua_State *L, int idx) {
  * ================================================================ */
 
 void lua_settable(lua_State *L, int idx) {
+    PROF_ENTER(lua_settable);
     if (idx == LUA51_GLOBALSINDEX) {
         push_globaltable(L);
         lua55_insert(L, -3);   /* table below key and value */
@@ -405,6 +690,7 @@ void lua_settable(lua_State *L, int idx) {
 }
 
 void lua_setfield(lua_State *L, int idx, const char *k) {
+    PROF_ENTER(lua_setfield);
     if (idx == LUA51_GLOBALSINDEX) {
         lua55_setglobal(L, k);
         return;
@@ -413,21 +699,208 @@ void lua_setfield(lua_State *L, int idx, const char *k) {
 }
 
 void lua_rawset(lua_State *L, int idx) {
+    PROF_ENTER(lua_rawset);
     lua55_rawset(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
 }
 
 void lua_rawseti(lua_State *L, int idx, int n) {
+    PROF_ENTER(lua_rawseti);
+#if COMPAT55_REFSTORE
+    if (idx == LUA51_REGISTRYINDEX) {
+        lua55_pushvalue(L, -1);
+        if (lua55_setref(L, n)) {
+            lua55_settop(L, -2);
+            return;
+        }
+    }
+#endif
     lua55_rawseti(L, IS_PSEUDO51(idx) ? xidx(idx) : idx, (lua55_Integer)n);
 }
 
 int lua_setmetatable(lua_State *L, int objindex) {
+    PROF_ENTER(lua_setmetatable);
     return lua55_setmetatable(L, IS_PSEUDO51(objindex) ? xidx(objindex) : objindex);
 }
 
 int lua_setfenv(lua_State *L, int idx) {
-    (void)idx;
-    lua55_settop(L, -2);   /* pop the value that would have been the env */
-    return 0;
+    PROF_ENTER(lua_setfenv);
+    int i55 = lua55_absindex(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
+    if (lua55_type(L, i55) != LUA_TUSERDATA) {
+        lua55_settop(L, -2);   /* pop the value that would have been the env */
+        return 0;
+    }
+    lua55_pushvalue(L, -1);
+    if (lua55_setiuservalue(L, i55, 1)) {
+        lua55_settop(L, -2);
+        return 1;
+    }
+    /* no user value slot: attach through the side table */
+    push_fenvtable(L, 1);
+    lua55_pushvalue(L, i55);
+    lua55_pushvalue(L, -3);
+    lua55_rawset(L, -3);
+    lua55_settop(L, -3);
+    return 1;
+}
+
+/* ================================================================
+ *  Bulk array transfer (compat/compat55.h)
+ * ================================================================ */
+
+void compat55_rawsetnumbers(lua_State *L, int idx, int first,
+                            const lua_Number *v, int n) {
+    lua55_rawsetnumbers(L, IS_PSEUDO51(idx) ? xidx(idx) : idx, first, v, n);
+}
+
+/* The public header uses long long; lua55_Integer may be narrower */
+#if LUA_MAXINTEGER == LLONG_MAX
+#define BULK_SAMEINT  1
+#else
+#define BULK_SAMEINT  0
+#define BULK_CHUNK    256
+#endif
+
+void compat55_rawsetintegers(lua_State *L, int idx, int first,
+                             const long long *v, int n) {
+    int t = IS_PSEUDO51(idx) ? xidx(idx) : idx;
+#if BULK_SAMEINT
+    lua55_rawsetintegers(L, t, first, (const lua55_Integer *)v, n);
+#else
+    lua55_Integer buf[BULK_CHUNK];
+    int i, j, k;
+    for (i = 0; i < n; i += k) {
+        k = (n - i < BULK_CHUNK) ? n - i : BULK_CHUNK;
+        for (j = 0; j < k; j++) buf[j] = (lua55_Integer)v[i + j];
+        lua55_rawsetintegers(L, t, (lua55_Integer)first + i, buf, k);
+    }
+#endif
+}
+
+int compat55_rawgetnumbers(lua_State *L, int idx, int first,
+                           lua_Number *v, int n) {
+    return lua55_rawgetnumbers(L, IS_PSEUDO51(idx) ? xidx(idx) : idx, first, v, n);
+}
+
+int compat55_rawgetintegers(lua_State *L, int idx, int first,
+                            long long *v, int n) {
+    int t = IS_PSEUDO51(idx) ? xidx(idx) : idx;
+#if BULK_SAMEINT
+    return lua55_rawgetintegers(L, t, first, (lua55_Integer *)v, n);
+#else
+    lua55_Integer buf[BULK_CHUNK];
+    int i, j, k, got;
+    for (i = 0; i < n; i += got) {
+        k = (n - i < BULK_CHUNK) ? n - i : BULK_CHUNK;
+        got = lua55_rawgetintegers(L, t, (lua55_Integer)first + i, buf, k);
+        for (j = 0; j < got; j++) v[i + j] = buf[j];
+        if (got < k) return i + got;
+    }
+    return n;
+#endif
+}
+
+/* ================================================================
+ *  Sampling CPU profiler (compat/compat55.h)
+ * ================================================================ */
+
+int compat55_cpuprof_start(lua_State *L, int hz) {
+    return lua55_profstart(L, hz);
+}
+
+void compat55_cpuprof_stop(lua_State *L) {
+    lua55_profstop(L);
+}
+
+int compat55_cpuprof_dump(lua_State *L, lua_Writer writer, void *data) {
+    return lua55_profdump(L, writer, data);
+}
+
+/* ── Heap profiler ── */
+
+int compat55_heapprof_start(lua_State *L, size_t interval) {
+    return lua55_heapprofstart(L, interval);
+}
+
+void compat55_heapprof_stop(lua_State *L) {
+    lua55_heapprofstop(L);
+}
+
+int compat55_heapprof_dump(lua_State *L, lua_Writer writer, void *data,
+                           int live) {
+    return lua55_heapprofdump(L, writer, data, live);
+}
+
+/* ── Execution statistics ── */
+
+int compat55_opstats(lua_State *L, int reset) {
+    return lua55_opstats(L, reset);
+}
+
+/* ================================================================
+ *  GC statistics (compat/compat55.h)
+ * ================================================================ */
+
+#if LUA_GCSTATBUCKETS != COMPAT55_GCSTATBUCKETS || LUA_GCSN != 3 || \
+    LUA_NUMTYPES + 2 != 11
+#error "compat55_GCStats does not match lua55_GCStats"
+#endif
+
+void compat55_getstats(lua_State *L, compat55_GCStats *s) {
+    lua55_GCStats st;
+    lua55_getstats(L, &st);
+    s->allocated = st.allocated;
+    s->freed = st.freed;
+    s->incremental = st.incremental;
+    s->minor = st.minor;
+    s->major = st.major;
+    s->full = st.full;
+    s->promoted = st.promoted;
+    s->strsize = st.strsize;
+    s->strused = st.strused;
+    memcpy(s->objects, st.objects, sizeof(s->objects));
+    memcpy(s->pauses, st.pauses, sizeof(s->pauses));
+    memcpy(s->pausetime, st.pausetime, sizeof(s->pausetime));
+}
+
+/* ── Heap census ── */
+
+#if LUA_CENSUSPATHS != COMPAT55_CENSUSPATHS
+#error "COMPAT55_CENSUSPATHS does not match LUA_CENSUSPATHS"
+#endif
+
+int compat55_census(lua_State *L, lua_Writer writer, void *data, int flags) {
+    return lua55_census(L, writer, data, flags);
+}
+
+/* ================================================================
+ *  Slab allocator (compat/compat55.h)
+ * ================================================================ */
+
+compat55_Slab *compat55_slab_new(int hugepages) {
+    return (compat55_Slab *)lua55L_newslab(hugepages ? LUAL_SLABHUGE : 0);
+}
+
+void compat55_slab_free(compat55_Slab *S) {
+    lua55L_freeslab((lua55L_Slab *)S);
+}
+
+void *compat55_slab_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    return lua55L_slaballoc(ud, ptr, osize, nsize);
+}
+
+int compat55_slab_class(compat55_Slab *S, int i, compat55_SlabClass *c) {
+    lua55L_SlabClass st;
+    if (!lua55L_slabclass((lua55L_Slab *)S, i, &st)) return 0;
+    c->size = st.size;
+    c->live = st.live;
+    c->bytes = st.bytes;
+    c->allocs = st.allocs;
+    c->pages = st.pages;
+    return 1;
+}
+
+size_t compat55_slab_trim(compat55_Slab *S) {
+    return lua55L_slabtrim((lua55L_Slab *)S);
 }
 
 /* ================================================================
@@ -435,24 +908,29 @@ int lua_setfenv(lua_State *L, int idx) {
  * ================================================================ */
 
 void lua_call(lua_State *L, int nargs, int nresults) {
+    PROF_ENTER(lua_call);
     lua55_callk(L, nargs, nresults, 0, NULL);
 }
 
 int lua_pcall(lua_State *L, int nargs, int nresults, int msgh) {
+    PROF_ENTER(lua_pcall);
     return lua55_pcallk(L, nargs, nresults, msgh, 0, NULL);
 }
 
 int lua_cpcall(lua_State *L, lua_CFunction func, void *ud) {
+    PROF_ENTER(lua_cpcall);
     lua55_pushcclosure(L, func, 0);
     lua55_pushlightuserdata(L, ud);
     return lua55_pcallk(L, 1, 0, 0, 0, NULL);
 }
 
 int lua_load(lua_State *L, lua_Reader reader, void *data, const char *chunkname) {
+    PROF_ENTER(lua_load);
     return lua55_load(L, reader, data, chunkname, NULL);
 }
 
 int lua_dump(lua_State *L, lua_Writer writer, void *data) {
+    PROF_ENTER(lua_dump);
     return lua55_dump(L, writer, data, 0);
 }
 
@@ -461,19 +939,23 @@ int lua_dump(lua_State *L, lua_Writer writer, void *data) {
  * ================================================================ */
 
 int lua_yield(lua_State *L, int nresults) {
+    PROF_ENTER(lua_yield);
     return lua55_yieldk(L, nresults, 0, NULL);
 }
 
 int lua_resume(lua_State *L, int narg) {
+    PROF_ENTER(lua_resume);
     int nres = 0;
     return lua55_resume(L, NULL, narg, &nres);
 }
 
 int lua_status(lua_State *L) {
+    PROF_ENTER(lua_status);
     return lua55_status(L);
 }
 
 int lua_isyieldable(lua_State *L) {
+    PROF_ENTER(lua_isyieldable);
     return lua55_isyieldable(L);
 }
 
@@ -482,6 +964,7 @@ int lua_isyieldable(lua_State *L) {
  * ================================================================ */
 
 int lua_gc(lua_State *L, int what, int data) {
+    PROF_ENTER(lua_gc);
     switch (what) {
         case LUA_GCSTOP:
         case LUA_GCRESTART:
@@ -496,6 +979,12 @@ int lua_gc(lua_State *L, int what, int data) {
             return lua55_gc(L, LUA_GCPARAM, LUA_GCPPAUSE, data, 0);
         case LUA51_GCSETSTEPMUL:
             return lua55_gc(L, LUA_GCPARAM, LUA_GCPSTEPMUL, data, 0);
+        case LUA_GCDEFERFREE:
+            if (data && is_slaballoc(lua55_getallocf(L, NULL))) return -1;
+            return lua55_gc(L, what, data);
+        case LUA_GCBUDGET:
+        case LUA_GCPARMARK:
+            return lua55_gc(L, what, data);
         default:
             return lua55_gc(L, what);
     }
@@ -506,23 +995,28 @@ int lua_gc(lua_State *L, int what, int data) {
  * ================================================================ */
 
 int lua_error(lua_State *L) {
+    PROF_ENTER(lua_error);
     return lua55_error(L);
 }
 
 int lua_next(lua_State *L, int idx) {
+    PROF_ENTER(lua_next);
     return lua55_next(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
 }
 
 void lua_concat(lua_State *L, int n) {
+    PROF_ENTER(lua_concat);
     lua55_concat(L, n);
 }
 
 void lua_len(lua_State *L, int idx) {
+    PROF_ENTER(lua_len);
     lua55_len(L, IS_PSEUDO51(idx) ? xidx(idx) : idx);
 }
 
 /* lua51 compatibility */
 void lua_setlevel(lua_State *from, lua_State *to) {
+    PROF_ENTER(lua_setlevel);
     (void)from; (void)to;
 }
 
@@ -531,49 +1025,67 @@ void lua_setlevel(lua_State *from, lua_State *to) {
  * ================================================================ */
 
 int lua_getstack(lua_State *L, int level, void *ar_raw) {
-    (void)ar_raw;
-    return lua55_getstack(L, level, &g_debug55);
+    PROF_ENTER(lua_getstack);
+    struct lua51_Debug *ar51 = (struct lua51_Debug *)ar_raw;
+    lua55_Debug ar;
+    if (!lua55_getstack(L, level, &ar)) return 0;
+    ar51->i_ci = level;
+    return 1;
 }
 
 int lua_getinfo(lua_State *L, const char *what, void *ar_raw) {
+    PROF_ENTER(lua_getinfo);
     struct lua51_Debug *ar51 = (struct lua51_Debug *)ar_raw;
-    int result = lua55_getinfo(L, what, &g_debug55);
+    lua55_Debug ar;
+    int result;
+    memset(&ar, 0, sizeof(ar));
+    if (*what != '>' && !resolve_ar(L, ar51, &ar)) return 0;
+    result = lua55_getinfo(L, what, &ar);
     if (result) {
-        ar51->event           = g_debug55.event;
-        ar51->name            = g_debug55.name;
-        ar51->namewhat        = g_debug55.namewhat;
-        ar51->what            = g_debug55.what;
-        ar51->source          = g_debug55.source;
-        ar51->currentline     = g_debug55.currentline;
-        ar51->nups            = (int)g_debug55.nups;
-        ar51->linedefined     = g_debug55.linedefined;
-        ar51->lastlinedefined = g_debug55.lastlinedefined;
-        memcpy(ar51->short_src, g_debug55.short_src, sizeof(ar51->short_src));
-        ar51->i_ci            = 0;
+        ar51->event           = ar.event;
+        ar51->name            = ar.name;
+        ar51->namewhat        = ar.namewhat;
+        ar51->what            = ar.what;
+        ar51->source          = ar.source;
+        ar51->currentline     = ar.currentline;
+        ar51->nups            = (int)ar.nups;
+        ar51->linedefined     = ar.linedefined;
+        ar51->lastlinedefined = ar.lastlinedefined;
+        memcpy(ar51->short_src, ar.short_src, sizeof(ar51->short_src));
     }
     return result;
 }
 
-const char *lua_getlocal(lua_State *L, const void *ar, int n) {
-    (void)ar;
-    return lua55_getlocal(L, &g_debug55, n);
+const char *lua_getlocal(lua_State *L, const void *ar_raw, int n) {
+    PROF_ENTER(lua_getlocal);
+    lua55_Debug ar;
+    if (!resolve_ar(L, (const struct lua51_Debug *)ar_raw, &ar)) return NULL;
+    return lua55_getlocal(L, &ar, n);
 }
 
-const char *lua_setlocal(lua_State *L, const void *ar, int n) {
-    (void)ar;
-    return lua55_setlocal(L, &g_debug55, n);
+const char *lua_setlocal(lua_State *L, const void *ar_raw, int n) {
+    PROF_ENTER(lua_setlocal);
+    lua55_Debug ar;
+    if (!resolve_ar(L, (const struct lua51_Debug *)ar_raw, &ar)) {
+        lua55_settop(L, -2);   /* 5.1 pops the value even on failure */
+        return NULL;
+    }
+    return lua55_setlocal(L, &ar, n);
 }
 
 const char *lua_getupvalue(lua_State *L, int funcindex, int n) {
+    PROF_ENTER(lua_getupvalue);
     return lua55_getupvalue(L, IS_PSEUDO51(funcindex) ? xidx(funcindex) : funcindex, n);
 }
 
 const char *lua_setupvalue(lua_State *L, int funcindex, int n) {
+    PROF_ENTER(lua_setupvalue);
     return lua55_setupvalue(L, IS_PSEUDO51(funcindex) ? xidx(funcindex) : funcindex, n);
 }
 
 void lua_sethook(lua_State *L, void *func, int mask, int count) {
-    g_user_hook = (lua51_Hook)func;
+    PROF_ENTER(lua_sethook);
+    user_hook(L) = (lua51_Hook)func;
     if (func) {
         lua55_sethook(L, hook_bridge, mask, count);
     } else {
@@ -582,14 +1094,19 @@ void lua_sethook(lua_State *L, void *func, int mask, int count) {
 }
 
 lua55_Hook lua_gethook(lua_State *L) {
-    return lua55_gethook(L);
+    PROF_ENTER(lua_gethook);
+    lua55_Hook h = lua55_gethook(L);
+    /* report the hook the application installed, not the bridge */
+    return (h == hook_bridge) ? (lua55_Hook)user_hook(L) : h;
 }
 
 int lua_gethookmask(lua_State *L) {
+    PROF_ENTER(lua_gethookmask);
     return lua55_gethookmask(L);
 }
 
 int lua_gethookcount(lua_State *L) {
+    PROF_ENTER(lua_gethookcount);
     return lua55_gethookcount(L);
 }
 
@@ -598,10 +1115,14 @@ int lua_gethookcount(lua_State *L) {
  * ================================================================ */
 
 lua_State *luaL_newstate(void) {
-    return lua55L_newstate();
+    PROF_ENTER(luaL_newstate);
+    lua_State *L = lua55L_newstate();
+    if (L) user_hook(L) = NULL;
+    return L;
 }
 
 void luaL_register(lua_State *L, const char *libname, const luaL_Reg *l) {
+    PROF_ENTER(luaL_register);
     if (libname) {
         /* reuse existing table or create new one */
         lua55_getglobal(L, libname);
@@ -619,6 +1140,7 @@ void luaL_register(lua_State *L, const char *libname, const luaL_Reg *l) {
 }
 
 void luaL_openlib(lua_State *L, const char *libname, const luaL_Reg *l, int nup) {
+    PROF_ENTER(luaL_openlib);
     if (libname) {
         /* reuse existing global table or create a new one */
         lua55_getglobal(L, libname);
@@ -642,14 +1164,17 @@ static int compat51_gcinfo(lua_State *L);
 // static int compat51_tostring(lua_State *L);
 
 int luaL_getmetafield(lua_State *L, int obj, const char *e) {
+    PROF_ENTER(luaL_getmetafield);
     return lua55L_getmetafield(L, IS_PSEUDO51(obj) ? xidx(obj) : obj, e);
 }
 
 int luaL_callmeta(lua_State *L, int obj, const char *e) {
+    PROF_ENTER(luaL_callmeta);
     return lua55L_callmeta(L, IS_PSEUDO51(obj) ? xidx(obj) : obj, e);
 }
 
 int luaL_error(lua_State *L, const char *fmt, ...) {
+    PROF_ENTER(luaL_error);
     va_list argp;
     va_start(argp, fmt);
     lua55_pushvfstring(L, fmt, argp);
@@ -658,115 +1183,288 @@ int luaL_error(lua_State *L, const char *fmt, ...) {
 }
 
 int luaL_typerror(lua_State *L, int narg, const char *tname) {
+    PROF_ENTER(luaL_typerror);
     return lua55L_typeerror(L, narg, tname);
 }
 
 int luaL_argerror(lua_State *L, int narg, const char *extramsg) {
+    PROF_ENTER(luaL_argerror);
     return lua55L_argerror(L, narg, extramsg);
 }
 
 lua_Integer luaL_checkinteger(lua_State *L, int arg) {
+    PROF_ENTER(luaL_checkinteger);
     return lua55L_checkinteger(L, IS_PSEUDO51(arg) ? xidx(arg) : arg);
 }
 
 lua_Integer luaL_optinteger(lua_State *L, int arg, lua_Integer def) {
+    PROF_ENTER(luaL_optinteger);
     return lua55L_optinteger(L, IS_PSEUDO51(arg) ? xidx(arg) : arg, def);
 }
 
 lua_Number luaL_checknumber(lua_State *L, int arg) {
+    PROF_ENTER(luaL_checknumber);
     return lua55L_checknumber(L, IS_PSEUDO51(arg) ? xidx(arg) : arg);
 }
 
 lua_Number luaL_optnumber(lua_State *L, int arg, lua_Number def) {
+    PROF_ENTER(luaL_optnumber);
     return lua55L_optnumber(L, IS_PSEUDO51(arg) ? xidx(arg) : arg, def);
 }
 
 const char *luaL_checklstring(lua_State *L, int arg, size_t *l) {
+    PROF_ENTER(luaL_checklstring);
     return lua55L_checklstring(L, IS_PSEUDO51(arg) ? xidx(arg) : arg, l);
 }
 
 const char *luaL_optlstring(lua_State *L, int arg, const char *d, size_t *l) {
+    PROF_ENTER(luaL_optlstring);
     return lua55L_optlstring(L, IS_PSEUDO51(arg) ? xidx(arg) : arg, d, l);
 }
 
 void luaL_checkstack(lua_State *L, int sz, const char *msg) {
+    PROF_ENTER(luaL_checkstack);
     lua55L_checkstack(L, sz, msg);
 }
 
 void luaL_checktype(lua_State *L, int arg, int t) {
+    PROF_ENTER(luaL_checktype);
     lua55L_checktype(L, IS_PSEUDO51(arg) ? xidx(arg) : arg, t);
 }
 
 void luaL_checkany(lua_State *L, int arg) {
+    PROF_ENTER(luaL_checkany);
     lua55L_checkany(L, IS_PSEUDO51(arg) ? xidx(arg) : arg);
 }
 
 int luaL_newmetatable(lua_State *L, const char *tname) {
+    PROF_ENTER(luaL_newmetatable);
     return lua55L_newmetatable(L, tname);
 }
 
 void luaL_setmetatable(lua_State *L, const char *tname) {
+    PROF_ENTER(luaL_setmetatable);
     lua55L_setmetatable(L, tname);
 }
 
 void *luaL_testudata(lua_State *L, int ud, const char *tname) {
+    PROF_ENTER(luaL_testudata);
     return lua55L_testudata(L, IS_PSEUDO51(ud) ? xidx(ud) : ud, tname);
 }
 
 void *luaL_checkudata(lua_State *L, int ud, const char *tname) {
+    PROF_ENTER(luaL_checkudata);
     return lua55L_checkudata(L, IS_PSEUDO51(ud) ? xidx(ud) : ud, tname);
 }
 
 int luaL_checkoption(lua_State *L, int arg, const char *def, const char *const lst[]) {
+    PROF_ENTER(luaL_checkoption);
     return lua55L_checkoption(L, arg, def, lst);
 }
 
 void luaL_where(lua_State *L, int lvl) {
+    PROF_ENTER(luaL_where);
     lua55L_where(L, lvl);
 }
 
 int luaL_ref(lua_State *L, int t) {
+    PROF_ENTER(luaL_ref);
+#if COMPAT55_REFSTORE
+    if (t == LUA51_REGISTRYINDEX) return lua55_ref(L);
+#endif
     return lua55L_ref(L, IS_PSEUDO51(t) ? xidx(t) : t);
 }
 
 void luaL_unref(lua_State *L, int t, int ref) {
+    PROF_ENTER(luaL_unref);
+#if COMPAT55_REFSTORE
+    if (t == LUA51_REGISTRYINDEX) { lua55_unref(L, ref); return; }
+#endif
     lua55L_unref(L, IS_PSEUDO51(t) ? xidx(t) : t, ref);
 }
 
+/* ── Bytecode cache for luaL_loadfile ────────────────────────── */
+/* When the application has set a cache directory (compat55_setcachedir),
+   luaL_loadfile keys each source file by a 128-bit hash of its
+   contents, its chunk name and the lua55 version/number format, and
+   keeps the lua55_dump output in <dir>/<key>.luac.  Entries are
+   written to a temporary file and renamed into place, so processes can
+   share the directory.  Hits are loaded as binary chunks without any
+   verification, hence no environment variable can turn the cache on. */
+
+#define CACHE_STAMP  LUA_RELEASE " compat55-cache-1"
+
+static char cache_dir[1024];
+
+void compat55_setcachedir(const char *dir) {
+    cache_dir[0] = '\0';
+    if (dir && strlen(dir) < sizeof(cache_dir))
+        strcpy(cache_dir, dir);
+}
+
+static const char *cache_getdir(void) {
+    return cache_dir[0] ? cache_dir : NULL;
+}
+
+/* Two independent 64-bit hashes (FNV-1a and a multiplicative mix) */
+typedef struct CacheKey { unsigned long long a, b; } CacheKey;
+
+static void cache_hash(CacheKey *k, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        k->a = (k->a ^ p[i]) * 0x100000001b3ull;
+        k->b = (k->b + p[i] + 1) * 0x9e3779b97f4a7c15ull;
+        k->b ^= k->b >> 29;
+    }
+}
+
+static char *cache_readfile(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    char *buf = NULL;
+    size_t size = 0, n = 0;
+    if (!f) return NULL;
+    for (;;) {
+        if (n == size) {
+            char *nb = (char *)realloc(buf, size = size ? size * 2 : 16384);
+            if (!nb) { free(buf); fclose(f); return NULL; }
+            buf = nb;
+        }
+        n += fread(buf + n, 1, size - n, f);
+        if (n < size) break;
+    }
+    if (ferror(f)) { free(buf); buf = NULL; }
+    fclose(f);
+    *len = n;
+    return buf;
+}
+
+static int cache_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+    (void)L;
+    return sz > 0 && fwrite(p, 1, sz, (FILE *)ud) != sz;  /* (NULL, 0) ends the dump */
+}
+
+/* Temp file numbers: states on different threads share the counter,
+   so it is incremented atomically. */
+#if defined(__GNUC__)
+static unsigned cache_tmpcount;
+#define cache_nexttmp()  __atomic_fetch_add(&cache_tmpcount, 1u, __ATOMIC_RELAXED)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+static volatile long cache_tmpcount;
+#define cache_nexttmp()  (unsigned)_InterlockedIncrement(&cache_tmpcount)
+#else
+static unsigned cache_tmpcount;
+#define cache_nexttmp()  (cache_tmpcount++)
+#endif
+
+/* Dumps the function on top of the stack to 'path' via a temp file */
+static void cache_store(lua_State *L, const char *path) {
+    char tmp[1100];
+    FILE *f;
+    int err;
+    snprintf(tmp, sizeof(tmp), "%s.%ld.%u.tmp", path,
+             (long)compat55_getpid(), cache_nexttmp());
+    f = fopen(tmp, "wb");
+    if (!f) return;
+    err = lua55_dump(L, cache_writer, f, 0);
+    err |= (fclose(f) != 0);
+    if (err || rename(tmp, path) != 0)
+        remove(tmp);   /* another process may have won the race */
+}
+
+/* Returns -1 when the cache does not apply, else a lua_load status */
+static int cache_loadfile(lua_State *L, const char *filename) {
+    const char *dir = cache_getdir();
+    char path[1100], *src;
+    const char *code;
+    size_t len, codelen, binlen;
+    CacheKey key = { 0xcbf29ce484222325ull, 0x84222325cbf29ce4ull };
+    int status;
+    if (!dir || !filename) return -1;
+    if (!(src = cache_readfile(filename, &len))) return -1;
+    code = src; codelen = len;
+    /* same preprocessing as lua55L_loadfilex: BOM, then a '#' line */
+    if (codelen >= 3 && memcmp(code, "\xEF\xBB\xBF", 3) == 0) {
+        code += 3; codelen -= 3;
+    }
+    if (codelen > 0 && code[0] == LUA_SIGNATURE[0]) {   /* binary chunk */
+        free(src);
+        return -1;
+    }
+    if (codelen > 0 && code[0] == '#') {   /* keep the '\n' for line numbers */
+        while (codelen > 0 && code[0] != '\n') { code++; codelen--; }
+    }
+    cache_hash(&key, CACHE_STAMP, sizeof(CACHE_STAMP));
+    cache_hash(&key, filename, strlen(filename) + 1);
+    cache_hash(&key, code, codelen);
+    snprintf(path, sizeof(path), "%s/%016llx%016llx.luac", dir, key.a, key.b);
+    lua55_pushfstring(L, "@%s", filename);
+    {
+        char *bin = cache_readfile(path, &binlen);
+        if (bin) {   /* hit */
+            status = lua55L_loadbufferx(L, bin, binlen, lua55_tostring(L, -1), "b");
+            free(bin);
+            if (status == LUA_OK) {
+                free(src);
+                lua55_remove(L, -2);
+                return status;
+            }
+            lua55_settop(L, -2);   /* bad entry: recompile and overwrite */
+        }
+    }
+    status = lua55L_loadbufferx(L, code, codelen, lua55_tostring(L, -1), "t");
+    free(src);
+    if (status == LUA_OK) cache_store(L, path);
+    lua55_remove(L, -2);
+    return status;
+}
+
 int luaL_loadfile(lua_State *L, const char *filename) {
+    PROF_ENTER(luaL_loadfile);
+    int status = cache_loadfile(L, filename);
+    if (status >= 0) return status;
     return lua55L_loadfilex(L, filename, NULL);
 }
 
 int luaL_loadbuffer(lua_State *L, const char *buff, size_t sz, const char *name) {
+    PROF_ENTER(luaL_loadbuffer);
     return lua55L_loadbufferx(L, buff, sz, name, NULL);
 }
 
 int luaL_loadstring(lua_State *L, const char *s) {
+    PROF_ENTER(luaL_loadstring);
     return lua55L_loadstring(L, s);
 }
 
 const char *luaL_gsub(lua_State *L, const char *s, const char *p, const char *r) {
+    PROF_ENTER(luaL_gsub);
     lua55L_gsub(L, s, p, r);
     return lua55_tostring(L, -1);
 }
 
 void luaL_setfuncs(lua_State *L, const luaL_Reg *l, int nup) {
+    PROF_ENTER(luaL_setfuncs);
     lua55L_setfuncs(L, l, nup);
 }
 
 int luaL_getsubtable(lua_State *L, int idx, const char *fname) {
+    PROF_ENTER(luaL_getsubtable);
     return lua55L_getsubtable(L, IS_PSEUDO51(idx) ? xidx(idx) : idx, fname);
 }
 
 void luaL_traceback(lua_State *L, lua_State *L1, const char *msg, int level) {
+    PROF_ENTER(luaL_traceback);
     lua55L_traceback(L, L1, msg, level);
 }
 
 void luaL_requiref(lua_State *L, const char *modname, lua_CFunction openf, int glb) {
+    PROF_ENTER(luaL_requiref);
     lua55L_requiref(L, modname, openf, glb);
 }
 
 const char *luaL_findtable(lua_State *L, int idx, const char *fname, int szhint) {
+    PROF_ENTER(luaL_findtable);
     (void)szhint;
     int i55 = IS_PSEUDO51(idx) ? xidx(idx) : idx;
     if (lua55L_getsubtable(L, i55, fname))
@@ -778,16 +1476,86 @@ const char *luaL_findtable(lua_State *L, int idx, const char *fname, int szhint)
  *  Buffer API — implemented with lua51 struct layout
  * ================================================================ */
 
-static void buf_flush(struct lua51_Buffer *B) {
+/* B->buffer is only a staging area for the luaL_addchar/luaL_addsize
+   macros.  When it fills up, its contents spill into one growable
+   block owned by a box userdata, which is kept on the stack where 5.1
+   would have kept its string pieces (B->lvl is 0 or 1).  The result is
+   created once, from that block, in luaL_pushresult. */
+
+typedef struct BufBox {
+    char  *b;
+    size_t size;    /* allocated */
+    size_t n;       /* used */
+} BufBox;
+
+static int bufbox_gc(lua_State *L) {
+    BufBox *box = (BufBox *)lua55_touserdata(L, 1);
+    void *ud;
+    lua_Alloc allocf = lua55_getallocf(L, &ud);
+    if (box->b) allocf(ud, box->b, box->size, 0);
+    box->b = NULL;
+    box->size = box->n = 0;
+    return 0;
+}
+
+static BufBox *bufbox_new(lua_State *L) {
+    BufBox *box = (BufBox *)lua55_newuserdatauv(L, sizeof(BufBox), 0);
+    box->b = NULL;
+    box->size = box->n = 0;
+    if (lua55L_newmetatable(L, "_UBOX51*")) {
+        lua55_pushcclosure(L, bufbox_gc, 0);
+        lua55_setfield(L, -2, "__gc");
+    }
+    lua55_setmetatable(L, -2);
+    return box;
+}
+
+/* Make room for sz more bytes in the box */
+static char *bufbox_prep(lua_State *L, BufBox *box, size_t sz) {
+    if (box->size - box->n < sz) {
+        void *ud;
+        lua_Alloc allocf = lua55_getallocf(L, &ud);
+        size_t newsize = box->size ? box->size : 2 * LUA51_BUFFERSIZE;
+        char *nb;
+        if (sz >= (size_t)-1 / 2 - box->n)
+            lua55L_error(L, "resulting string too large");
+        while (newsize - box->n < sz + 1)   /* +1 for the final '\0' */
+            newsize += newsize >> 1;
+        nb = (char *)allocf(ud, box->b, box->size, newsize);
+        if (nb == NULL) {
+            lua55_pushstring(L, "not enough memory");
+            lua55_error(L);
+        }
+        box->b = nb;
+        box->size = newsize;
+    }
+    return box->b + box->n;
+}
+
+/* Box of B at stack slot idx, created there on first use */
+static BufBox *buf_box(struct lua51_Buffer *B, int idx) {
+    if (B->lvl == 0) {
+        bufbox_new(B->L);
+        if (idx != -1) lua55_insert(B->L, idx);
+        B->lvl = 1;
+    }
+    return (BufBox *)lua55_touserdata(B->L, idx);
+}
+
+/* Move the staged bytes into the box (at stack slot idx) */
+static BufBox *buf_spill(struct lua51_Buffer *B, int idx) {
     size_t len = (size_t)(B->p - B->buffer);
+    BufBox *box = buf_box(B, idx);
     if (len > 0) {
-        lua55_pushlstring(B->L, B->buffer, len);
-        B->lvl++;
+        memcpy(bufbox_prep(B->L, box, len), B->buffer, len);
+        box->n += len;
         B->p = B->buffer;
     }
+    return box;
 }
 
 void luaL_buffinit(lua_State *L, void *B_raw) {
+    PROF_ENTER(luaL_buffinit);
     struct lua51_Buffer *B = (struct lua51_Buffer *)B_raw;
     B->p   = B->buffer;
     B->lvl = 0;
@@ -795,60 +1563,82 @@ void luaL_buffinit(lua_State *L, void *B_raw) {
 }
 
 char *luaL_prepbuffer(void *B_raw) {
+    PROF_ENTER(luaL_prepbuffer);
     struct lua51_Buffer *B = (struct lua51_Buffer *)B_raw;
-    buf_flush(B);
+    buf_spill(B, -1);
     return B->buffer;
 }
 
 void luaL_addlstring(void *B_raw, const char *s, size_t l) {
+    PROF_ENTER(luaL_addlstring);
     struct lua51_Buffer *B = (struct lua51_Buffer *)B_raw;
-    while (l > 0) {
-        size_t space = (size_t)(LUA51_BUFFERSIZE - (B->p - B->buffer));
-        if (l <= space) {
-            memcpy(B->p, s, l);
-            B->p += l;
-            return;
-        }
-        memcpy(B->p, s, space);
-        B->p += space;
-        s += space;
-        l -= space;
-        buf_flush(B);
+    size_t space = (size_t)(LUA51_BUFFERSIZE - (B->p - B->buffer));
+    if (l <= space) {
+        memcpy(B->p, s, l);
+        B->p += l;
+    } else {
+        BufBox *box = buf_spill(B, -1);
+        memcpy(bufbox_prep(B->L, box, l), s, l);
+        box->n += l;
     }
 }
 
 void luaL_addstring(void *B_raw, const char *s) {
+    PROF_ENTER(luaL_addstring);
     luaL_addlstring(B_raw, s, strlen(s));
 }
 
 void luaL_addvalue(void *B_raw) {
+    PROF_ENTER(luaL_addvalue);
     struct lua51_Buffer *B = (struct lua51_Buffer *)B_raw;
     size_t vl;
     const char *s = lua55_tolstring(B->L, -1, &vl);
     size_t space = (size_t)(LUA51_BUFFERSIZE - (B->p - B->buffer));
     if (vl <= space) {
-        /* fits in buffer: copy and pop */
         memcpy(B->p, s, vl);
         B->p += vl;
-        lua55_settop(B->L, -2);
     } else {
-        int old_lvl = B->lvl;
-        buf_flush(B);
-        /* if buf_flush pushed a string, it's above value; move it below */
-        if (B->lvl > old_lvl)
-            lua55_insert(B->L, -2);
-        B->lvl++;
+        /* value is on top, so the box lives just below it */
+        BufBox *box = buf_spill(B, -2);
+        memcpy(bufbox_prep(B->L, box, vl), s, vl);
+        box->n += vl;
     }
+    lua55_settop(B->L, -2);
 }
 
 void luaL_pushresult(void *B_raw) {
+    PROF_ENTER(luaL_pushresult);
     struct lua51_Buffer *B = (struct lua51_Buffer *)B_raw;
-    buf_flush(B);
     if (B->lvl == 0) {
-        lua55_pushlstring(B->L, "", 0);
+        lua55_pushlstring(B->L, B->buffer, (size_t)(B->p - B->buffer));
     } else {
-        lua55_concat(B->L, B->lvl);
+        lua_State *L = B->L;
+        BufBox *box = buf_spill(B, -1);
+        void *ud;
+        lua_Alloc allocf = lua55_getallocf(L, &ud);
+        size_t len = box->n;
+        char *s;
+        bufbox_prep(L, box, 1);
+        if (box->size != len + 1) {   /* trim to the final size */
+            s = (char *)allocf(ud, box->b, box->size, len + 1);
+            if (s == NULL) {
+                lua55_pushstring(L, "not enough memory");
+                lua55_error(L);
+            }
+            box->b = s;
+            box->size = len + 1;
+        }
+        s = box->b;
+        s[len] = '\0';
+        /* Lua takes ownership of the block */
+        box->b = NULL;
+        box->size = box->n = 0;
+        lua55_pushexternalstring(L, s, len, allocf, ud);
+        lua55_remove(L, -2);   /* remove the box */
+        lua55_gc(L, LUA_GCSTEP, len);
+        B->lvl = 0;
     }
+    B->p = B->buffer;
 }
 
 /* ================================================================
@@ -971,6 +1761,7 @@ static const luaL_Reg compat51_tablib[] = {
 };
 
 void luaL_openlibs(lua_State *L) {
+    PROF_ENTER(luaL_openlibs);
     lua55L_openlibs(L);
     /* Re-register compat51 additions (lua55L_openlibs calls lua55open_*
        directly, bypassing our luaopen_* wrappers) */
@@ -1096,3 +1887,569 @@ int luaopen_math(lua_State *L) {
 
 int luaopen_utf8(lua_State *L)      { return lua55open_utf8(L); }
 int luaopen_debug(lua_State *L)     { return lua55open_debug(L); }
+
+/* ================================================================
+ *  API call profiler queries (compat/compat55.h)
+ * ================================================================ */
+
+#if COMPAT55_PROFILE
+
+int compat55_prof_count(void) {
+    return PROF_N;
+}
+
+int compat55_prof_get(int i, compat55_ProfEntry *e) {
+    if (i < 0 || i >= PROF_N) return 0;
+    e->name    = prof_names[i];
+    e->calls   = prof_data[i].calls;
+    e->sampled = prof_data[i].sampled;
+    e->ticks   = prof_data[i].ticks;
+    return 1;
+}
+
+const char *compat55_prof_unit(void) {
+    return PROF_UNIT;
+}
+
+void compat55_prof_reset(void) {
+    memset(prof_data, 0, sizeof(prof_data));
+}
+
+static int prof_cmp(const void *a, const void *b) {
+    unsigned long long ca = prof_data[*(const int *)a].calls;
+    unsigned long long cb = prof_data[*(const int *)b].calls;
+    return (ca < cb) - (ca > cb);
+}
+
+int compat55_prof_dump(const char *path) {
+    int order[PROF_N], i, first = 1;
+    FILE *f = fopen(path, "w");
+    if (!f) return 0;
+    for (i = 0; i < PROF_N; i++) order[i] = i;
+    qsort(order, PROF_N, sizeof(int), prof_cmp);
+    fprintf(f, "{\n  \"unit\": \"%s\",\n  \"sample_every\": %d,\n  \"functions\": [",
+            PROF_UNIT, COMPAT55_PROFILE_SAMPLE);
+    for (i = 0; i < PROF_N; i++) {
+        int k = order[i];
+        if (prof_data[k].calls == 0) break;
+        fprintf(f, "%s\n    {\"name\": \"%s\", \"calls\": %llu, \"sampled\": %llu, "
+                   "\"ticks\": %llu, \"avg_ticks\": %.1f}",
+                first ? "" : ",", prof_names[k], prof_data[k].calls,
+                prof_data[k].sampled, prof_data[k].ticks,
+                prof_data[k].sampled
+                    ? (double)prof_data[k].ticks / (double)prof_data[k].sampled : 0.0);
+        first = 0;
+    }
+    fprintf(f, "\n  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+#else
+
+int compat55_prof_count(void) { return 0; }
+int compat55_prof_get(int i, compat55_ProfEntry *e) { (void)i; (void)e; return 0; }
+const char *compat55_prof_unit(void) { return ""; }
+void compat55_prof_reset(void) { }
+int compat55_prof_dump(const char *path) { (void)path; return 0; }
+
+#endif
+
+/* ================================================================
+ *  State pool (compat/compat55.h)
+ * ================================================================ */
+
+/* ── Threads ─────────────────────────────────────────────────── */
+#ifdef _WIN32
+#include <windows.h>
+typedef CRITICAL_SECTION   pool_mutex_t;
+typedef CONDITION_VARIABLE pool_cond_t;
+typedef HANDLE             pool_thread_t;
+#define pool_mutex_init(m)  InitializeCriticalSection(m)
+#define pool_mutex_free(m)  DeleteCriticalSection(m)
+#define pool_lock(m)        EnterCriticalSection(m)
+#define pool_unlock(m)      LeaveCriticalSection(m)
+#define pool_cond_init(c)   InitializeConditionVariable(c)
+#define pool_cond_free(c)   ((void)0)
+#define pool_wait(c, m)     SleepConditionVariableCS(c, m, INFINITE)
+#define pool_signal(c)      WakeConditionVariable(c)
+#define pool_broadcast(c)   WakeAllConditionVariable(c)
+#else
+#include <pthread.h>
+typedef pthread_mutex_t    pool_mutex_t;
+typedef pthread_cond_t     pool_cond_t;
+typedef pthread_t          pool_thread_t;
+#define pool_mutex_init(m)  pthread_mutex_init(m, NULL)
+#define pool_mutex_free(m)  pthread_mutex_destroy(m)
+#define pool_lock(m)        pthread_mutex_lock(m)
+#define pool_unlock(m)      pthread_mutex_unlock(m)
+#define pool_cond_init(c)   pthread_cond_init(c, NULL)
+#define pool_cond_free(c)   pthread_cond_destroy(c)
+#define pool_wait(c, m)     pthread_cond_wait(c, m)
+#define pool_signal(c)      pthread_cond_signal(c)
+#define pool_broadcast(c)   pthread_cond_broadcast(c)
+#endif
+
+static int pool_ncpu(void) {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int)si.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+/* ── Copied values ───────────────────────────────────────────── */
+/* Values cross states in the serialize library's format (lserlib.c),
+   light userdata included, as all the states live in one process.  A
+   job keeps its arguments and results as malloc'ed copies of the
+   serialized strings. */
+
+typedef struct PoolBuf {
+    char *b;
+    size_t n;
+} PoolBuf;
+
+/* Replaces the bytes in buf with a copy of s; 0 if out of memory */
+static int poolbuf_set(PoolBuf *buf, const char *s, size_t len) {
+    char *b = (char *)malloc(len ? len : 1);
+    if (!b) return 0;
+    memcpy(b, s, len);
+    free(buf->b);
+    buf->b = b;
+    buf->n = len;
+    return 1;
+}
+
+/* Serializes the values from index first on into buf; protected */
+static int pool_pack(lua_State *L, int first, PoolBuf *buf) {
+    size_t len;
+    const char *s;
+    lua55L_serialize(L, first, lua55_gettop(L) - first + 1, LUA_SERLIGHTUD);
+    s = lua55_tolstring(L, -1, &len);
+    if (!poolbuf_set(buf, s, len)) return lua55L_error(L, "not enough memory");
+    lua55_pop(L, 1);
+    return 0;
+}
+
+/* Runs in the submitting state: packs the arguments into the PoolBuf
+   passed last */
+static int pool_packargs(lua_State *L) {
+    PoolBuf *buf = (PoolBuf *)lua55_touserdata(L, -1);
+    lua55_pop(L, 1);
+    return pool_pack(L, 1, buf);
+}
+
+/* ── Jobs and queues ─────────────────────────────────────────── */
+
+enum { JOB_QUEUED, JOB_DONE, JOB_FAILED };
+
+struct compat55_Job {
+    compat55_Pool *pool;
+    char *func;                 /* global function to call */
+    PoolBuf args;               /* serialized arguments */
+    PoolBuf results;            /* serialized results, or the error message */
+    int state;                  /* JOB_*; guarded by pool->done_lock */
+    int stolen;                 /* run by a worker it was not queued on */
+    int in_done;                /* linked in the pool's done list */
+    compat55_Job *prev, *next;  /* done list */
+};
+
+/* A worker's job queue.  The owner takes jobs from the front; idle
+   workers steal from the back. */
+typedef struct PoolDeque {
+    pool_mutex_t lock;
+    compat55_Job **items;
+    unsigned head, tail, cap;   /* items[head..tail) modulo cap (2^k) */
+} PoolDeque;
+
+typedef struct PoolWorker {
+    compat55_Pool *pool;
+    int id;
+    PoolDeque q;
+    lua_State **states;
+    int nstates, next_state;
+    pool_thread_t thread;
+} PoolWorker;
+
+struct compat55_Pool {
+    PoolWorker *workers;
+    int nworkers, nstates, started;
+    pool_mutex_t lock;          /* guards sleeping, closing, next */
+    pool_cond_t work;           /* signalled on submit and shutdown */
+    int sleeping, closing;
+    unsigned next;              /* worker the next job is queued on */
+    pool_mutex_t done_lock;     /* guards the fields below and job states */
+    pool_cond_t done_cv;        /* broadcast when a job finishes */
+    compat55_Job *done_head, *done_tail;
+    int outstanding;            /* submitted and not finished */
+    unsigned long long jobs, steals;
+};
+
+static int deque_push(PoolDeque *q, compat55_Job *job) {
+    int ok = 1;
+    pool_lock(&q->lock);
+    if (q->tail - q->head == q->cap) {
+        unsigned cap = q->cap ? q->cap * 2 : 64, i;
+        compat55_Job **items = (compat55_Job **)malloc(cap * sizeof(*items));
+        if (items) {
+            for (i = 0; i < q->tail - q->head; i++)
+                items[i] = q->items[(q->head + i) & (q->cap - 1)];
+            free(q->items);
+            q->items = items;
+            q->tail -= q->head;
+            q->head = 0;
+            q->cap = cap;
+        } else
+            ok = 0;
+    }
+    if (ok) q->items[q->tail++ & (q->cap - 1)] = job;
+    pool_unlock(&q->lock);
+    return ok;
+}
+
+static compat55_Job *deque_pop(PoolDeque *q) {
+    compat55_Job *job = NULL;
+    pool_lock(&q->lock);
+    if (q->head != q->tail) job = q->items[q->head++ & (q->cap - 1)];
+    pool_unlock(&q->lock);
+    return job;
+}
+
+static compat55_Job *deque_steal(PoolDeque *q) {
+    compat55_Job *job = NULL;
+    pool_lock(&q->lock);
+    if (q->head != q->tail) job = q->items[--q->tail & (q->cap - 1)];
+    pool_unlock(&q->lock);
+    return job;
+}
+
+static void job_free(compat55_Job *job) {
+    free(job->func);
+    free(job->args.b);
+    free(job->results.b);
+    free(job);
+}
+
+/* Caller holds done_lock */
+static void done_unlink(compat55_Pool *P, compat55_Job *job) {
+    if (job->prev) job->prev->next = job->next;
+    else P->done_head = job->next;
+    if (job->next) job->next->prev = job->prev;
+    else P->done_tail = job->prev;
+    job->prev = job->next = NULL;
+    job->in_done = 0;
+}
+
+/* ── Workers ─────────────────────────────────────────────────── */
+
+/* Runs in the worker state, protected: unpacks the arguments, calls the
+   function and packs its results */
+static int pool_call(lua_State *L) {
+    compat55_Job *job = (compat55_Job *)lua55_touserdata(L, 1);
+    int n;
+    lua55_settop(L, 0);
+    if (lua55_getglobal(L, job->func) == LUA_TNIL)
+        return lua55L_error(L, "global function '%s' not defined", job->func);
+    n = lua55L_deserialize(L, job->args.b, job->args.n, LUA_SERLIGHTUD);
+    lua55_callk(L, n, LUA_MULTRET, 0, NULL);
+    return pool_pack(L, 1, &job->results);
+}
+
+static compat55_Job *pool_take(PoolWorker *w) {
+    compat55_Pool *P = w->pool;
+    compat55_Job *job = deque_pop(&w->q);
+    int i;
+    for (i = 1; !job && i < P->nworkers; i++) {
+        job = deque_steal(&P->workers[(w->id + i) % P->nworkers].q);
+        if (job) job->stolen = 1;
+    }
+    return job;
+}
+
+static void pool_run(PoolWorker *w, compat55_Job *job) {
+    compat55_Pool *P = w->pool;
+    lua_State *L = w->states[w->next_state];
+    int state = JOB_DONE;
+    w->next_state = (w->next_state + 1) % w->nstates;
+    lua55_settop(L, 0);
+    lua55_pushcclosure(L, pool_call, 0);
+    lua55_pushlightuserdata(L, job);
+    if (lua55_pcallk(L, 1, 0, 0, 0, NULL) != LUA_OK) {
+        size_t len = 0;
+        const char *msg = lua55_tolstring(L, -1, &len);
+        if (!msg) {
+            msg = "(error object is not a string)";
+            len = strlen(msg);
+        }
+        if (!poolbuf_set(&job->results, msg, len)) job->results.n = 0;
+        state = JOB_FAILED;
+    }
+    lua55_settop(L, 0);
+    free(job->args.b);
+    job->args.b = NULL;
+
+    pool_lock(&P->done_lock);
+    job->state = state;
+    job->prev = P->done_tail;
+    job->next = NULL;
+    if (P->done_tail) P->done_tail->next = job;
+    else P->done_head = job;
+    P->done_tail = job;
+    job->in_done = 1;
+    P->outstanding--;
+    P->jobs++;
+    if (job->stolen) P->steals++;
+    pool_broadcast(&P->done_cv);
+    pool_unlock(&P->done_lock);
+}
+
+static void pool_loop(PoolWorker *w) {
+    compat55_Pool *P = w->pool;
+    for (;;) {
+        compat55_Job *job = pool_take(w);
+        if (!job) {
+            /* Look again under the lock: submit queues before signalling
+               under it, so a job cannot slip in between */
+            pool_lock(&P->lock);
+            while (!(job = pool_take(w)) && !P->closing) {
+                P->sleeping++;
+                pool_wait(&P->work, &P->lock);
+                P->sleeping--;
+            }
+            pool_unlock(&P->lock);
+            if (!job) return;   /* closing and all queues drained */
+        }
+        pool_run(w, job);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI pool_thread(LPVOID arg) {
+    pool_loop((PoolWorker *)arg);
+    return 0;
+}
+#else
+static void *pool_thread(void *arg) {
+    pool_loop((PoolWorker *)arg);
+    return NULL;
+}
+#endif
+
+/* ── Pool API ────────────────────────────────────────────────── */
+
+typedef struct PoolInit {
+    compat55_PoolInit init;
+    void *ud;
+    int result;
+} PoolInit;
+
+static int pool_init_call(lua_State *L) {
+    PoolInit *pi = (PoolInit *)lua55_touserdata(L, 1);
+    lua55_settop(L, 0);
+    pi->result = pi->init(L, pi->ud);
+    return 0;
+}
+
+/* Stops the started workers, then frees everything */
+static void pool_destroy(compat55_Pool *P) {
+    int i, j;
+    pool_lock(&P->lock);
+    P->closing = 1;
+    pool_broadcast(&P->work);
+    pool_unlock(&P->lock);
+    for (i = 0; i < P->started; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(P->workers[i].thread, INFINITE);
+        CloseHandle(P->workers[i].thread);
+#else
+        pthread_join(P->workers[i].thread, NULL);
+#endif
+    }
+    for (i = 0; i < P->nworkers; i++) {
+        PoolWorker *w = &P->workers[i];
+        for (j = 0; j < w->nstates; j++)
+            if (w->states[j]) lua55_close(w->states[j]);
+        free(w->states);
+        free(w->q.items);
+        pool_mutex_free(&w->q.lock);
+    }
+    while (P->done_head) {
+        compat55_Job *job = P->done_head;
+        done_unlink(P, job);
+        job_free(job);
+    }
+    pool_mutex_free(&P->lock);
+    pool_cond_free(&P->work);
+    pool_mutex_free(&P->done_lock);
+    pool_cond_free(&P->done_cv);
+    free(P->workers);
+    free(P);
+}
+
+compat55_Pool *compat55_pool_new(int nthreads, int nstates,
+                                 compat55_PoolInit init, void *ud) {
+    compat55_Pool *P;
+    int i, j;
+    if (nthreads <= 0) nthreads = pool_ncpu();
+    if (nstates <= 0) nstates = 1;
+    P = (compat55_Pool *)calloc(1, sizeof(*P));
+    if (!P) return NULL;
+    P->workers = (PoolWorker *)calloc((size_t)nthreads, sizeof(PoolWorker));
+    if (!P->workers) {
+        free(P);
+        return NULL;
+    }
+    P->nworkers = nthreads;
+    P->nstates = nstates;
+    pool_mutex_init(&P->lock);
+    pool_cond_init(&P->work);
+    pool_mutex_init(&P->done_lock);
+    pool_cond_init(&P->done_cv);
+    for (i = 0; i < nthreads; i++) {   /* pool_destroy frees every lock */
+        PoolWorker *w = &P->workers[i];
+        w->pool = P;
+        w->id = i;
+        pool_mutex_init(&w->q.lock);
+    }
+    for (i = 0; i < nthreads; i++) {
+        PoolWorker *w = &P->workers[i];
+        w->states = (lua_State **)calloc((size_t)nstates, sizeof(lua_State *));
+        if (!w->states) goto fail;
+        w->nstates = nstates;
+    }
+    for (i = 0; i < nthreads; i++) {
+        for (j = 0; j < nstates; j++) {
+            lua_State *L = luaL_newstate();
+            P->workers[i].states[j] = L;
+            if (!L) goto fail;
+            luaL_openlibs(L);
+            if (init) {
+                PoolInit pi;
+                pi.init = init;
+                pi.ud = ud;
+                pi.result = 1;
+                lua55_pushcclosure(L, pool_init_call, 0);
+                lua55_pushlightuserdata(L, &pi);
+                if (lua55_pcallk(L, 1, 0, 0, 0, NULL) != LUA_OK || pi.result != 0)
+                    goto fail;
+                lua55_settop(L, 0);
+            }
+        }
+    }
+    for (i = 0; i < nthreads; i++) {
+        PoolWorker *w = &P->workers[i];
+#ifdef _WIN32
+        w->thread = CreateThread(NULL, 0, pool_thread, w, 0, NULL);
+        if (w->thread == NULL) goto fail;
+#else
+        if (pthread_create(&w->thread, NULL, pool_thread, w) != 0) goto fail;
+#endif
+        P->started++;
+    }
+    return P;
+fail:
+    pool_destroy(P);
+    return NULL;
+}
+
+void compat55_pool_free(compat55_Pool *P) {
+    if (P) pool_destroy(P);
+}
+
+compat55_Job *compat55_pool_submit(compat55_Pool *P, lua_State *L,
+                                   const char *func, int nargs) {
+    int first = lua55_gettop(L) - nargs + 1;
+    size_t flen = strlen(func) + 1;
+    compat55_Job *job = (compat55_Job *)calloc(1, sizeof(*job));
+    PoolWorker *w;
+    int ok;
+    if (!job || !(job->func = (char *)malloc(flen))) {
+        free(job);
+        lua55_settop(L, first - 1);
+        lua55_pushliteral(L, "not enough memory");
+        return NULL;
+    }
+    memcpy(job->func, func, flen);
+    job->pool = P;
+    if (!lua55_checkstack(L, 2)) {
+        job_free(job);
+        lua55_settop(L, first - 1);
+        lua55_pushliteral(L, "stack overflow");
+        return NULL;
+    }
+    lua55_pushcclosure(L, pool_packargs, 0);
+    lua55_insert(L, first);
+    lua55_pushlightuserdata(L, &job->args);
+    if (lua55_pcallk(L, nargs + 1, 0, 0, 0, NULL) != LUA_OK) {
+        job_free(job);   /* the error message replaced the arguments */
+        return NULL;
+    }
+
+    pool_lock(&P->done_lock);
+    P->outstanding++;
+    pool_unlock(&P->done_lock);
+    pool_lock(&P->lock);
+    w = &P->workers[P->next++ % (unsigned)P->nworkers];
+    ok = deque_push(&w->q, job);
+    if (ok && P->sleeping) pool_signal(&P->work);
+    pool_unlock(&P->lock);
+    if (!ok) {
+        pool_lock(&P->done_lock);
+        P->outstanding--;
+        pool_unlock(&P->done_lock);
+        job_free(job);
+        lua55_pushliteral(L, "not enough memory");
+        return NULL;
+    }
+    return job;
+}
+
+void compat55_pool_wait(compat55_Job *job) {
+    compat55_Pool *P = job->pool;
+    pool_lock(&P->done_lock);
+    while (job->state == JOB_QUEUED) pool_wait(&P->done_cv, &P->done_lock);
+    pool_unlock(&P->done_lock);
+}
+
+compat55_Job *compat55_pool_next(compat55_Pool *P, int wait) {
+    compat55_Job *job;
+    pool_lock(&P->done_lock);
+    while (!P->done_head && wait && P->outstanding > 0)
+        pool_wait(&P->done_cv, &P->done_lock);
+    job = P->done_head;
+    if (job) done_unlink(P, job);
+    pool_unlock(&P->done_lock);
+    return job;
+}
+
+int compat55_pool_result(compat55_Job *job, lua_State *L) {
+    compat55_Pool *P = job->pool;
+    int failed, base, n;
+    size_t len;
+    const char *s;
+    compat55_pool_wait(job);
+    pool_lock(&P->done_lock);
+    if (job->in_done) done_unlink(P, job);
+    pool_unlock(&P->done_lock);
+    failed = job->state == JOB_FAILED;
+    lua55_pushlstring(L, job->results.b ? job->results.b : "", job->results.n);
+    job_free(job);
+    if (failed) return -1;
+    base = lua55_gettop(L);   /* the string keeps the bytes while unpacking */
+    s = lua55_tolstring(L, base, &len);
+    n = lua55L_deserialize(L, s, len, LUA_SERLIGHTUD);
+    lua55_remove(L, base);
+    return n;
+}
+
+void compat55_pool_stats(compat55_Pool *P, compat55_PoolStats *s) {
+    s->threads = P->nworkers;
+    s->states = P->nworkers * P->nstates;
+    pool_lock(&P->done_lock);
+    s->pending = P->outstanding;
+    s->jobs = P->jobs;
+    s->steals = P->steals;
+    pool_unlock(&P->done_lock);
+}
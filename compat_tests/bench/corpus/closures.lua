@@ -0,0 +1,34 @@
+-- Closure creation and calls through upvalues, including counters
+-- shared between closures and higher-order helpers.
+
+local function counter()
+  local n = 0
+  return function(d) n = n + d return n end, function() return n end
+end
+
+local function map(t, f)
+  local r = {}
+  for i = 1, #t do r[i] = f(t[i]) end
+  return r
+end
+
+local function compose(f, g)
+  return function(x) return f(g(x)) end
+end
+
+local data = {}
+for i = 1, 100 do data[i] = i end
+
+return function()
+  local sum = 0
+  for round = 1, 8000 do
+    local inc, get = counter()
+    for i = 1, 20 do inc(i) end
+    sum = sum + get()
+    local scale = compose(function(x) return x * 2 end,
+                          function(x) return x + round end)
+    local r = map(data, scale)
+    sum = sum + r[#r]
+  end
+  return sum
+end
@@ -0,0 +1,34 @@
+-- Coroutine switches: a producer and a filter passing values through
+-- resume/yield, plus short-lived coroutines created per batch.
+
+local function producer(n)
+  return coroutine.create(function()
+    for i = 1, n do coroutine.yield(i) end
+    return nil
+  end)
+end
+
+local function filter(src)
+  return coroutine.wrap(function()
+    while true do
+      local _, v = coroutine.resume(src)
+      if v == nil then return nil end
+      if v % 3 ~= 0 then coroutine.yield(v * 2) end
+    end
+  end)
+end
+
+return function()
+  local sum = 0
+  local f = filter(producer(400000))
+  local v = f()
+  while v do sum = sum + v v = f() end
+  for i = 1, 2000 do
+    local co = coroutine.wrap(function(a)
+      local b = coroutine.yield(a + 1)
+      return a + b
+    end)
+    sum = sum + co(i) + co(1)
+  end
+  return sum
+end
@@ -0,0 +1,6 @@
+-- gc_incremental.lua's workload in generational mode (skipped where
+-- collectgarbage has no generational mode, e.g. Lua 5.1).
+
+local path = ...
+local dir = path:match("^(.*[/\\])") or ""
+return assert(loadfile(dir .. "gc_incremental.lua"))(path, "generational")
@@ -0,0 +1,30 @@
+-- GC stress: a long-lived graph that keeps being mutated (old objects
+-- pointing at new ones) under a stream of short-lived tables, strings
+-- and closures.  Runs in incremental mode; gc_generational.lua reuses
+-- it with mode "generational".
+
+local _, mode = ...
+mode = mode or "incremental"
+if not pcall(collectgarbage, mode) and mode ~= "incremental" then
+  return nil, mode .. " mode not supported"
+end
+
+local old = {}
+for i = 1, 20000 do old[i] = {id = i, data = {i, i + 1, i + 2}} end
+
+return function()
+  local live = 0
+  local seed = 42
+  for round = 1, 60000 do
+    seed = seed * 16807 % 2147483647
+    local tmp = {round, tostring(round), {round}}
+    local f = function() return tmp[1] end
+    old[seed % #old + 1].data = {f(), tmp[2]}
+    if round % 8 == 0 then
+      local s = "x" .. round .. "y"
+      live = live + #s
+    end
+  end
+  for i = 1, #old, 97 do live = live + #old[i].data end
+  return live
+end
@@ -0,0 +1,55 @@
+-- Metamethod-heavy OOP: a three-level class chain resolved through
+-- __index, property setters through __newindex, and vector arithmetic
+-- and comparisons through __add, __mul, __eq, __lt and __call.
+
+local Vec = {}
+Vec.__index = Vec
+
+local function vec(x, y) return setmetatable({x = x, y = y}, Vec) end
+
+Vec.__add = function(a, b) return vec(a.x + b.x, a.y + b.y) end
+Vec.__mul = function(a, s) return vec(a.x * s, a.y * s) end
+Vec.__eq = function(a, b) return a.x == b.x and a.y == b.y end
+Vec.__lt = function(a, b) return a.x * a.x + a.y * a.y < b.x * b.x + b.y * b.y end
+
+local Base = {}
+Base.__index = Base
+function Base:kind() return "base" end
+function Base:speed() return 1 end
+
+local Mover = setmetatable({}, {__index = Base})
+Mover.__index = Mover
+function Mover:step(dt) self.pos = self.pos + self.vel * (dt * self:speed()) end
+
+local Unit = setmetatable({}, {__index = Mover})
+Unit.__call = function(self, dt) self:step(dt) return self.pos end
+Unit.__index = function(self, k)
+  local v = rawget(self, "_props")[k]
+  if v ~= nil then return v end
+  return Unit[k]
+end
+Unit.__newindex = function(self, k, v)
+  rawget(self, "_props")[k] = v
+end
+
+local function unit(i)
+  return setmetatable({_props = {pos = vec(i, 0), vel = vec(1, 1)}}, Unit)
+end
+
+local units = {}
+for i = 1, 200 do units[i] = unit(i) end
+
+return function()
+  local hits = 0
+  local origin = vec(0, 0)
+  for _ = 1, 200 do
+    for i = 1, #units do
+      local u = units[i]
+      local p = u(0.5)
+      if origin < p then hits = hits + 1 end
+      if p == u.pos then hits = hits + 1 end
+      if u:kind() == "base" then hits = hits + 1 end
+    end
+  end
+  return hits
+end
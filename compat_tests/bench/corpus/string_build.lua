@@ -0,0 +1,24 @@
+-- String building: repeated concatenation, table.concat buffers,
+-- string.format and string.rep.
+
+return function()
+  local total = 0
+  for round = 1, 40 do
+    local s = ""
+    for i = 1, 300 do s = s .. i .. "," end
+    total = total + #s
+
+    local parts = {}
+    for i = 1, 2000 do
+      parts[#parts + 1] = string.format("%d:%0.2f:%s", i, i / 7, "item")
+    end
+    total = total + #table.concat(parts, ";")
+
+    local buf = {}
+    for i = 1, 1000 do
+      buf[i] = "<" .. string.rep("ab", i % 13) .. ">" .. tostring(i * round)
+    end
+    total = total + #table.concat(buf)
+  end
+  return total
+end
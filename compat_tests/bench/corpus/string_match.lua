@@ -0,0 +1,30 @@
+-- Pattern matching over generated text: find, match, gmatch and gsub
+-- with captures and character classes.
+
+local lines = {}
+for i = 1, 2000 do
+  lines[i] = string.format("%04d-%02d-%02d user%d@host%d.example.org GET /path/%d?q=%x 200 %d",
+    2000 + i % 25, i % 12 + 1, i % 28 + 1, i, i % 17, i, i * 31, i * 7 % 5000)
+end
+local text = table.concat(lines, "\n")
+
+return function()
+  local count = 0
+  for _ = 1, 5 do
+    for y, m, d in text:gmatch("(%d%d%d%d)%-(%d%d)%-(%d%d)") do
+      count = count + y + m + d
+    end
+    for user, host in text:gmatch("(%w+)@([%w%.]+)") do
+      count = count + #user + #host
+    end
+    local s, n = text:gsub("/path/(%d+)", "/p/%1")
+    count = count + n + #s
+    for i = 1, #lines, 10 do
+      local code, size = lines[i]:match("(%d%d%d) (%d+)$")
+      count = count + code + size
+      if lines[i]:find("host3.", 1, true) then count = count + 1 end
+    end
+    count = count + select(2, text:upper():gsub("[AEIOU]", ""))
+  end
+  return count
+end
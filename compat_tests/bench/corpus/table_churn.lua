@@ -0,0 +1,26 @@
+-- Short-lived tables: array growth, table.insert/remove, hash inserts
+-- and deletes with string keys, and rehashing.
+
+local keys = {}
+for i = 1, 256 do keys[i] = "key" .. i end
+
+return function()
+  local sum = 0
+  for round = 1, 200 do
+    local arr = {}
+    for i = 1, 500 do arr[#arr + 1] = i end
+    for i = 1, 100 do table.insert(arr, 1, i) end
+    for _ = 1, 100 do sum = sum + table.remove(arr, 1) end
+    sum = sum + #arr
+
+    local h = {}
+    for i = 1, #keys do h[keys[i]] = i + round end
+    for i = 1, #keys, 2 do h[keys[i]] = nil end
+    for _, v in pairs(h) do sum = sum + v end
+
+    local list = {}
+    for i = 1, 200 do list[i] = {id = i, tag = keys[i], next = list[i - 1]} end
+    sum = sum + list[200].next.id
+  end
+  return sum
+end
@@ -0,0 +1,63 @@
+-- Field- and method-heavy OOP workload: every frame each entity reads
+-- and writes the same fields and calls the same methods.
+-- Usage: lua oop_fields.lua [frames]   (reports the best of 5 rounds)
+
+local frames = tonumber(arg and arg[1]) or 200
+local N = 2000
+
+local Vec = {}
+Vec.__index = Vec
+
+function Vec.new(x, y)
+  return setmetatable({x = x, y = y}, Vec)
+end
+
+function Vec:len2()
+  return self.x * self.x + self.y * self.y
+end
+
+local Entity = {}
+Entity.__index = Entity
+
+function Entity.new(i)
+  return setmetatable({
+    pos = Vec.new(i, -i), vel = Vec.new(1, 0.5),
+    hp = 100, alive = true, age = 0, name = "e" .. i,
+  }, Entity)
+end
+
+function Entity:update(dt)
+  local pos, vel = self.pos, self.vel
+  pos.x = pos.x + vel.x * dt
+  pos.y = pos.y + vel.y * dt
+  if pos:len2() > 1e8 then
+    vel.x, vel.y = -vel.x, -vel.y
+  end
+  self.age = self.age + dt
+  if self.hp <= 0 then self.alive = false end
+end
+
+function Entity:damage(n)
+  self.hp = self.hp - n
+end
+
+local entities = {}
+for i = 1, N do entities[i] = Entity.new(i) end
+
+local dt = math.huge
+for round = 1, 5 do  -- best of 5
+  local t0 = os.clock()
+  for f = 1, frames do
+    for i = 1, N do
+      local e = entities[i]
+      e:update(1 / 60)
+      if f % 50 == 0 then e:damage(1) end
+    end
+  end
+  dt = math.min(dt, os.clock() - t0)
+end
+
+local sum = 0
+for i = 1, N do sum = sum + entities[i].pos.x end
+print(string.format("oop_fields: %d entities x %d frames  %.3f s  (%.1f M updates/s, checksum %.6g)",
+  N, frames, dt, N * frames / dt / 1e6, sum))
@@ -0,0 +1,122 @@
+-- Benchmark driver: runs a bench_runner executable over the corpus and
+-- compares result files.  Works with any Lua from 5.1 on.
+--
+--   lua run.lua [-r repeats] [-a allocator] [-o results.json] runner [name...]
+--   lua run.lua compare base.json new.json
+--
+-- The first form runs every corpus script (or only the named ones)
+-- through 'runner' (bench_runner_lua51, bench_runner_lua55, ...), with
+-- the runner's default allocator unless one is given.  The second
+-- prints, per benchmark, both medians, the change and whether it
+-- exceeds the noise (twice the larger standard deviation), then the
+-- geometric mean of the ratios.
+
+local dir = arg[0]:match("^(.*[/\\])") or "./"
+package.path = dir .. "../lua_tests/json.lua/?.lua;" .. package.path
+local json = require("json")
+
+local corpus = {
+  "fib", "nbody", "spectral_norm",
+  "table_churn", "string_build", "string_match",
+  "closures", "coroutine_pingpong", "oop_meta",
+  "gc_incremental", "gc_generational",
+}
+
+local function usage()
+  io.stderr:write("usage: lua run.lua [-r repeats] [-a allocator] [-o results.json] runner [name...]\n",
+                  "       lua run.lua compare base.json new.json\n")
+  os.exit(1)
+end
+
+local function quote(s)
+  if s:find("^[%w%./\\_%-]+$") then return s end
+  return '"' .. s:gsub('"', '\\"') .. '"'
+end
+
+local function run(args)
+  local repeats, alloc, out, runner, names = 5, nil, nil, nil, {}
+  local i = 1
+  while i <= #args do
+    local a = args[i]
+    if a == "-r" then repeats = tonumber(args[i + 1]) or usage() i = i + 1
+    elseif a == "-a" then alloc = args[i + 1] or usage() i = i + 1
+    elseif a == "-o" then out = args[i + 1] or usage() i = i + 1
+    elseif not runner then runner = a
+    else names[#names + 1] = a end
+    i = i + 1
+  end
+  if not runner then usage() end
+  if #names == 0 then names = corpus end
+  local cmd = { quote(runner), "-r", tostring(repeats) }
+  if alloc then cmd[#cmd + 1] = "-a " .. quote(alloc) end
+  if out then cmd[#cmd + 1] = "--json " .. quote(out) end
+  for _, name in ipairs(names) do
+    cmd[#cmd + 1] = quote(dir .. "corpus/" .. name .. ".lua")
+  end
+  local ok, _, code = os.execute(table.concat(cmd, " "))
+  -- 5.1 returns the status code, later versions true/nil, "exit", code
+  if ok ~= true and ok ~= 0 then os.exit(tonumber(code) or 1) end
+end
+
+local function load_results(path)
+  local f, err = io.open(path, "r")
+  if not f then error(err, 0) end
+  local data = json.decode(f:read("*a"))
+  f:close()
+  local byname = {}
+  for _, r in ipairs(data.results) do byname[r.name] = r end
+  return data, byname
+end
+
+local function compare(base_path, new_path)
+  local base, bres = load_results(base_path)
+  local new = load_results(new_path)
+  print(string.format("%s (%s) -> %s (%s)", base_path, base.target,
+                      new_path, new.target))
+  print(string.format("  %-22s %10s %10s %8s %15s  %s", "", "base ms",
+                      "new ms", "change", "peak KB", ""))
+  local logsum, n = 0, 0
+  for _, r in ipairs(new.results) do
+    local b = bres[r.name]
+    if not b then
+      print(string.format("  %-22s only in %s", r.name, new_path))
+    elseif b.skipped or r.skipped then
+      print(string.format("  %-22s skipped (%s)", r.name, b.skipped or r.skipped))
+    else
+      local ratio = r.median_ms / b.median_ms
+      local noise = 2 * math.max(b.stddev_ms, r.stddev_ms)
+      local verdict = ""
+      if math.abs(r.median_ms - b.median_ms) > noise then
+        verdict = ratio < 1 and "faster" or "slower"
+      end
+      if b.checksum ~= r.checksum then
+        verdict = verdict .. " (checksum " .. b.checksum .. " ~= " .. r.checksum .. ")"
+      end
+      print(string.format("  %-22s %10.2f %10.2f %+7.1f%% %7.0f/%-7.0f  %s",
+                          r.name, b.median_ms, r.median_ms, (ratio - 1) * 100,
+                          b.peak_kb, r.peak_kb, verdict))
+      logsum, n = logsum + math.log(ratio), n + 1
+    end
+  end
+  for _, b in ipairs(base.results) do
+    local found = false
+    for _, r in ipairs(new.results) do
+      if r.name == b.name then found = true break end
+    end
+    if not found then
+      print(string.format("  %-22s only in %s", b.name, base_path))
+    end
+  end
+  if n > 0 then
+    print(string.format("  %-22s %21s %+7.1f%%", "geometric mean", "",
+                        (math.exp(logsum / n) - 1) * 100))
+  end
+end
+
+local args = { ... }
+if args[1] == "compare" then
+  if not args[3] then usage() end
+  compare(args[2], args[3])
+else
+  run(args)
+end
@@ -0,0 +1,96 @@
+-- Encode/decode round trip of the same data with the native serialize
+-- library, lume.serialize/deserialize and the JSON encoders shipped in
+-- lua_tests/json.lua (not json4lua, which takes minutes).  Prints
+-- best-of-N times and the encoded size.
+-- Usage: lua serialize.lua [rounds]   (with the lua55 interpreter)
+
+local rounds = tonumber(arg and arg[1]) or 10
+local dir = arg[0]:match("^(.*[/\\])") or "./"
+local tests = dir .. "../lua_tests/"
+
+-- Wikipedia example record stored 1000 times (as in json.lua's bench)
+local data = {}
+for i = 1, 1000 do
+  data[i] = {
+    firstName = "John",
+    lastName = "Smith",
+    isAlive = true,
+    age = 25 + i % 40,
+    height = 1.75 + i / 1e4,
+    address = {
+      streetAddress = "21 2nd Street",
+      city = "New York",
+      state = "NY",
+      postalCode = "10021-3100",
+    },
+    phoneNumbers = {
+      { type = "home", number = "212 555-1234" },
+      { type = "office", number = "646 555-4567" },
+    },
+    children = {},
+  }
+end
+
+local function loadlib(path)
+  local f = loadfile(path)
+  local ok, lib = pcall(f or error)
+  return ok and type(lib) == "table" and lib or nil
+end
+
+local codecs = {}
+
+local ser = require("serialize")
+codecs[#codecs + 1] = { "serialize", ser.encode, ser.decode }
+
+local lume = loadlib(tests .. "lume/lume.lua")
+if lume then
+  codecs[#codecs + 1] = { "lume", lume.serialize, lume.deserialize }
+end
+
+for _, name in ipairs({ "json.lua/json.lua", "json.lua/bench/dkjson.lua",
+                        "json.lua/bench/jfjson.lua" }) do
+  local json = loadlib(tests .. name)
+  if json then
+    local enc, dec = json.encode, json.decode
+    if name:find("jfjson") then  -- methods
+      enc = function(v) return json:encode(v) end
+      dec = function(s) return json:decode(s) end
+    end
+    codecs[#codecs + 1] = { name:match("([^/]+)%.lua$"), enc, dec }
+  end
+end
+
+local function best(f)
+  local dt = math.huge
+  for _ = 1, rounds do
+    local t0 = os.clock()
+    f()
+    dt = math.min(dt, os.clock() - t0)
+  end
+  return dt * 1000
+end
+
+print(string.format("%-12s %10s %10s %10s", "", "encode ms", "decode ms", "bytes"))
+for _, c in ipairs(codecs) do
+  local name, enc, dec = c[1], c[2], c[3]
+  local ok, s = pcall(enc, data)
+  if not ok then
+    print(string.format("%-12s failed: %s", name, tostring(s)))
+  else
+    local t_enc = best(function() enc(data) end)
+    local t_dec = best(function() dec(s) end)
+    local back = dec(s)
+    assert(back[1000].address.city == "New York" and back[7].age == data[7].age,
+           name .. ": round trip mismatch")
+    print(string.format("%-12s %10.2f %10.2f %10d", name, t_enc, t_dec, #s))
+  end
+end
+
+-- Shared references and cycles: only serialize keeps them
+local node = { name = "root", kids = {} }
+node.self = node
+for i = 1, 100 do node.kids[i] = { parent = node, shared = data[1] } end
+local back = ser.decode(ser.encode(node))
+assert(back.self == back and back.kids[1].parent == back and
+       back.kids[1].shared == back.kids[2].shared)
+print("serialize: cycles and shared tables preserved")
@@ -0,0 +1,971 @@
+/*
+ * C API micro-benchmark.
+ *
+ * Uses only the standard 5.1 headers, so the same source builds against
+ * lua51, the out-of-line compat55 shim, and compat55 with the inline
+ * header set (compat/inline), which calls lua55 directly.  Prints ns/op
+ * for each case, then the heap cost of small userdata.
+ *
+ *   bench_<target> [iterations] [--json file] [--cachedir dir]
+ *
+ * --json also writes every result as {"group", "name", "value", "unit"}
+ * so runs of different targets or revisions can be diffed by a script.
+ * --cachedir (compat55 only) loads files through the bytecode cache.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+#ifdef COMPAT55_EXT
+#include "compat55.h"
+#endif
+
+#ifndef BENCH_ITERS
+#define BENCH_ITERS 5000000
+#endif
+
+#if !defined(COMPAT55_EXT)
+#define BENCH_TARGET "lua51"
+#elif defined(LUA55_INLINE)
+#define BENCH_TARGET "compat55-inline"
+#else
+#define BENCH_TARGET "compat55"
+#endif
+
+static double now_ns(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart * 1e9 / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+#endif
+}
+
+static volatile double sink;
+
+/* ===== Results ===== */
+
+#define MAX_RESULTS 128
+
+static struct {
+    const char *group, *name, *unit;
+    double value;
+} results[MAX_RESULTS];
+static int nresults;
+static const char *group = "";
+
+/* Starts a group of results (one heading of the text output) */
+static void begin_group(const char *name) {
+    group = name;
+    printf("%s\n", name);
+}
+
+/* Records one result for the JSON output */
+static void record(const char *name, double value, const char *unit) {
+    if (nresults < MAX_RESULTS) {
+        results[nresults].group = group;
+        results[nresults].name = name;
+        results[nresults].unit = unit;
+        results[nresults].value = value;
+        nresults++;
+    }
+}
+
+static int write_json(const char *path, long iters) {
+    FILE *f = fopen(path, "w");
+    int i;
+    if (!f) return 0;
+    fprintf(f, "{\n  \"target\": \"%s\",\n  \"iterations\": %ld,\n  \"results\": [\n",
+            BENCH_TARGET, iters);
+    for (i = 0; i < nresults; i++)
+        fprintf(f, "    {\"group\": \"%s\", \"name\": \"%s\", \"value\": %.6g, \"unit\": \"%s\"}%s\n",
+                results[i].group, results[i].name, results[i].value,
+                results[i].unit, i + 1 < nresults ? "," : "");
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+#define BENCH(name) static void bench_##name(lua_State *L, long n)
+#define RUN(name) RUN_N(name, iters)
+#define RUN_N(name, count) do { \
+    long cnt_ = (count); \
+    double t0 = now_ns(), dt; \
+    bench_##name(L, cnt_); \
+    dt = (now_ns() - t0) / (double)cnt_; \
+    printf("  %-32s %8.2f ns/op\n", #name, dt); \
+    record(#name, dt, "ns/op"); \
+    lua_settop(L, 0); \
+} while(0)
+
+/* ===== Stack ===== */
+
+BENCH(push_pop) {
+    long i;
+    for (i = 0; i < n; i++) {
+        lua_pushinteger(L, (lua_Integer)i);
+        lua_pop(L, 1);
+    }
+}
+
+BENCH(pushvalue_insert_remove) {
+    long i;
+    lua_pushnil(L);
+    lua_pushboolean(L, 1);
+    for (i = 0; i < n; i++) {
+        lua_pushvalue(L, 1);
+        lua_insert(L, 1);
+        lua_remove(L, 1);
+    }
+}
+
+BENCH(tonumber_type) {
+    long i;
+    double acc = 0;
+    lua_pushnumber(L, 1.5);
+    for (i = 0; i < n; i++) {
+        if (lua_type(L, -1) == LUA_TNUMBER)
+            acc += lua_tonumber(L, -1);
+    }
+    sink = acc;
+}
+
+BENCH(tolstring) {
+    long i;
+    size_t len, total = 0;
+    lua_pushliteral(L, "benchmark");
+    for (i = 0; i < n; i++) {
+        lua_tolstring(L, -1, &len);
+        total += len;
+    }
+    sink = (double)total;
+}
+
+BENCH(gettop_settop) {
+    long i;
+    int acc = 0;
+    for (i = 0; i < n; i++) {
+        lua_settop(L, 4);
+        acc += lua_gettop(L);
+        lua_settop(L, 0);
+    }
+    sink = acc;
+}
+
+BENCH(checkstack) {
+    long i;
+    int acc = 0;
+    for (i = 0; i < n; i++)
+        acc += lua_checkstack(L, 20);
+    sink = acc;
+}
+
+/* ===== Push and to conversions ===== */
+
+BENCH(pushnumber_tonumber) {
+    long i;
+    double acc = 0;
+    for (i = 0; i < n; i++) {
+        lua_pushnumber(L, (lua_Number)i * 0.5);
+        acc += lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    }
+    sink = acc;
+}
+
+BENCH(pushinteger_tointeger) {
+    long i;
+    lua_Integer acc = 0;
+    for (i = 0; i < n; i++) {
+        lua_pushinteger(L, (lua_Integer)i);
+        acc += lua_tointeger(L, -1);
+        lua_pop(L, 1);
+    }
+    sink = (double)acc;
+}
+
+BENCH(pushboolean_toboolean) {
+    long i;
+    int acc = 0;
+    for (i = 0; i < n; i++) {
+        lua_pushboolean(L, (int)(i & 1));
+        acc += lua_toboolean(L, -1);
+        lua_pop(L, 1);
+    }
+    sink = acc;
+}
+
+BENCH(pushlightuserdata_touserdata) {
+    long i;
+    size_t acc = 0;
+    for (i = 0; i < n; i++) {
+        lua_pushlightuserdata(L, &results[i & 7]);
+        acc += (size_t)lua_touserdata(L, -1);
+        lua_pop(L, 1);
+    }
+    sink = (double)acc;
+}
+
+/* An existing short string: hashed and found in the string table */
+BENCH(pushstring_short) {
+    long i;
+    for (i = 0; i < n; i++) {
+        lua_pushstring(L, "position");
+        lua_pop(L, 1);
+    }
+}
+
+/* A new 64-byte string each time: allocation and collection */
+BENCH(pushlstring_64) {
+    char buf[64];
+    long i;
+    memset(buf, 'x', sizeof(buf));
+    for (i = 0; i < n; i++) {
+        memcpy(buf, &i, sizeof(i));
+        lua_pushlstring(L, buf, sizeof(buf));
+        lua_pop(L, 1);
+    }
+}
+
+BENCH(pushfstring) {
+    long i;
+    for (i = 0; i < n; i++) {
+        lua_pushfstring(L, "%s:%d", "node", (int)(i & 1023));
+        lua_pop(L, 1);
+    }
+}
+
+/* Number to string conversion in place, as in print or concatenation */
+BENCH(tolstring_number) {
+    long i;
+    size_t len, total = 0;
+    for (i = 0; i < n; i++) {
+        lua_pushnumber(L, (lua_Number)(i & 1023) + 0.25);
+        lua_tolstring(L, -1, &len);
+        total += len;
+        lua_pop(L, 1);
+    }
+    sink = (double)total;
+}
+
+BENCH(checknumber_checkinteger) {
+    long i;
+    double acc = 0;
+    lua_pushnumber(L, 2.5);
+    lua_pushinteger(L, 7);
+    for (i = 0; i < n; i++)
+        acc += luaL_checknumber(L, 1) + (double)luaL_checkinteger(L, 2);
+    sink = acc;
+}
+
+BENCH(checklstring_optinteger) {
+    long i;
+    size_t len, total = 0;
+    lua_pushliteral(L, "benchmark");
+    for (i = 0; i < n; i++) {
+        luaL_checklstring(L, 1, &len);
+        total += len + (size_t)luaL_optinteger(L, 2, 1);
+    }
+    sink = (double)total;
+}
+
+/* ===== Tables ===== */
+
+BENCH(rawseti_rawgeti) {
+    long i;
+    double acc = 0;
+    lua_createtable(L, 64, 0);
+    for (i = 0; i < n; i++) {
+        int k = (int)(i & 63) + 1;
+        lua_pushinteger(L, (lua_Integer)i);
+        lua_rawseti(L, 1, k);
+        lua_rawgeti(L, 1, k);
+        acc += lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    }
+    sink = acc;
+}
+
+BENCH(getfield_setfield) {
+    long i;
+    double acc = 0;
+    lua_createtable(L, 0, 4);
+    for (i = 0; i < n; i++) {
+        lua_pushinteger(L, (lua_Integer)i);
+        lua_setfield(L, 1, "x");
+        lua_getfield(L, 1, "x");
+        acc += lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    }
+    sink = acc;
+}
+
+BENCH(gettable_settable) {
+    long i;
+    double acc = 0;
+    lua_createtable(L, 0, 4);
+    for (i = 0; i < n; i++) {
+        lua_pushliteral(L, "x");
+        lua_pushinteger(L, (lua_Integer)i);
+        lua_settable(L, 1);
+        lua_pushliteral(L, "x");
+        lua_gettable(L, 1);
+        acc += lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    }
+    sink = acc;
+}
+
+BENCH(rawget_rawset) {
+    long i;
+    double acc = 0;
+    lua_createtable(L, 0, 4);
+    for (i = 0; i < n; i++) {
+        lua_pushliteral(L, "x");
+        lua_pushinteger(L, (lua_Integer)i);
+        lua_rawset(L, 1);
+        lua_pushliteral(L, "x");
+        lua_rawget(L, 1);
+        acc += lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    }
+    sink = acc;
+}
+
+BENCH(createtable_small) {
+    long i;
+    for (i = 0; i < n; i++) {
+        lua_createtable(L, 0, 4);
+        lua_pop(L, 1);
+    }
+}
+
+/* One op = one lua_next step over a 16-field table */
+BENCH(next_16) {
+    long i;
+    int cnt = 0;
+    static const char *const keys[16] = {
+        "a", "b", "c", "d", "e", "f", "g", "h",
+        "i", "j", "k", "l", "m", "n", "o", "p"
+    };
+    lua_createtable(L, 0, 16);
+    for (i = 0; i < 16; i++) {
+        lua_pushinteger(L, (lua_Integer)i);
+        lua_setfield(L, 1, keys[i]);
+    }
+    lua_pushnil(L);
+    for (i = 0; i < n; i++) {
+        if (lua_next(L, 1)) {
+            cnt += lua_type(L, -1);
+            lua_pop(L, 1);
+        } else
+            lua_pushnil(L);
+    }
+    sink = cnt;
+}
+
+BENCH(objlen) {
+    long i;
+    size_t acc = 0;
+    lua_createtable(L, 100, 0);
+    for (i = 1; i <= 100; i++) {
+        lua_pushinteger(L, (lua_Integer)i);
+        lua_rawseti(L, 1, (int)i);
+    }
+    for (i = 0; i < n; i++)
+        acc += lua_objlen(L, 1);
+    sink = (double)acc;
+}
+
+BENCH(rawequal_lessthan) {
+    long i;
+    int acc = 0;
+    lua_pushinteger(L, 1);
+    lua_pushinteger(L, 2);
+    for (i = 0; i < n; i++)
+        acc += lua_rawequal(L, 1, 2) + lua_lessthan(L, 1, 2);
+    sink = acc;
+}
+
+BENCH(newuserdata_setmetatable) {
+    long i;
+    luaL_newmetatable(L, "bench.ud");
+    lua_pop(L, 1);
+    for (i = 0; i < n; i++) {
+        lua_newuserdata(L, 16);
+        luaL_getmetatable(L, "bench.ud");
+        lua_setmetatable(L, -2);
+        lua_pop(L, 1);
+    }
+}
+
+BENCH(checkudata) {
+    long i;
+    size_t acc = 0;
+    luaL_newmetatable(L, "bench.ud");
+    lua_pop(L, 1);
+    lua_newuserdata(L, 16);
+    luaL_getmetatable(L, "bench.ud");
+    lua_setmetatable(L, -2);
+    for (i = 0; i < n; i++)
+        acc += (size_t)luaL_checkudata(L, 1, "bench.ud");
+    sink = (double)acc;
+}
+
+BENCH(getglobal) {
+    long i;
+    int cnt = 0;
+    for (i = 0; i < n; i++) {
+        lua_getglobal(L, "string");
+        cnt += lua_istable(L, -1);
+        lua_pop(L, 1);
+    }
+    sink = cnt;
+}
+
+BENCH(registry_rawgeti) {
+    long i;
+    int ref, cnt = 0;
+    lua_newtable(L);
+    ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    for (i = 0; i < n; i++) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+        cnt += lua_istable(L, -1);
+        lua_pop(L, 1);
+    }
+    luaL_unref(L, LUA_REGISTRYINDEX, ref);
+    sink = cnt;
+}
+
+BENCH(ref_unref) {
+    long i;
+    lua_newtable(L);
+    for (i = 0; i < n; i++) {
+        lua_pushvalue(L, 1);
+        luaL_unref(L, LUA_REGISTRYINDEX, luaL_ref(L, LUA_REGISTRYINDEX));
+    }
+}
+
+BENCH(ref_unref_churn) {
+    /* steady state of 1000 live refs, one ref/deref/unref per op */
+    int live[1000], i;
+    long k;
+    for (i = 0; i < 1000; i++) {
+        lua_newtable(L);
+        live[i] = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    for (k = 0; k < n; k++) {
+        int slot = (int)(k % 1000);
+        luaL_unref(L, LUA_REGISTRYINDEX, live[slot]);
+        lua_pushlightuserdata(L, &live[slot]);
+        live[slot] = luaL_ref(L, LUA_REGISTRYINDEX);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, live[(slot * 7) % 1000]);
+        lua_pop(L, 1);
+    }
+    for (i = 0; i < 1000; i++)
+        luaL_unref(L, LUA_REGISTRYINDEX, live[i]);
+}
+
+/* ===== Calls ===== */
+
+static int upvalue_sum(lua_State *L) {
+    lua_Number v = lua_tonumber(L, lua_upvalueindex(1))
+                 + lua_tonumber(L, lua_upvalueindex(2));
+    lua_pushnumber(L, v);
+    return 1;
+}
+
+static int add2(lua_State *L) {
+    lua_pushnumber(L, luaL_checknumber(L, 1) + luaL_checknumber(L, 2));
+    return 1;
+}
+
+BENCH(upvalue_closure) {
+    long i;
+    double acc = 0;
+    lua_pushnumber(L, 1);
+    lua_pushnumber(L, 2);
+    lua_pushcclosure(L, upvalue_sum, 2);
+    for (i = 0; i < n; i++) {
+        lua_pushvalue(L, 1);
+        lua_call(L, 0, 1);
+        acc += lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    }
+    sink = acc;
+}
+
+static int raise_error(lua_State *L) {
+    return luaL_error(L, "bench");
+}
+
+BENCH(pcall_c) {
+    long i;
+    double acc = 0;
+    for (i = 0; i < n; i++) {
+        lua_pushcfunction(L, add2);
+        lua_pushnumber(L, 1);
+        lua_pushnumber(L, 2);
+        if (lua_pcall(L, 2, 1, 0) == 0)
+            acc += lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    }
+    sink = acc;
+}
+
+BENCH(pcall_lua) {
+    long i;
+    double acc = 0;
+    luaL_loadstring(L, "local a, b = ... return a + b");
+    for (i = 0; i < n; i++) {
+        lua_pushvalue(L, 1);
+        lua_pushnumber(L, 1);
+        lua_pushnumber(L, 2);
+        if (lua_pcall(L, 2, 1, 0) == 0)
+            acc += lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    }
+    sink = acc;
+}
+
+/* Error raised and caught: the longjmp path */
+BENCH(pcall_error) {
+    long i;
+    int cnt = 0;
+    for (i = 0; i < n; i++) {
+        lua_pushcfunction(L, raise_error);
+        cnt += lua_pcall(L, 0, 0, 0) != 0;
+        lua_pop(L, 1);
+    }
+    sink = cnt;
+}
+
+BENCH(concat2) {
+    long i;
+    size_t total = 0;
+    for (i = 0; i < n; i++) {
+        lua_pushliteral(L, "sprite_");
+        lua_pushinteger(L, (lua_Integer)(i & 255));
+        lua_concat(L, 2);
+        total += lua_objlen(L, -1);
+        lua_pop(L, 1);
+    }
+    sink = (double)total;
+}
+
+BENCH(lua_calls_c) {
+    char chunk[128];
+    sprintf(chunk, "local add2, s = add2, 0 for i = 1, %ld do s = add2(s, 1) end return s", n);
+    lua_register(L, "add2", add2);
+    if (luaL_loadstring(L, chunk) != 0 || lua_pcall(L, 0, 1, 0) != 0) {
+        fprintf(stderr, "bench error: %s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+    sink = lua_tonumber(L, -1);
+}
+
+/* ===== Buffers ===== */
+
+/* table.concat(t) through the 5.1 luaL_Buffer */
+static int concat_c(lua_State *L) {
+    luaL_Buffer b;
+    int i, n = (int)lua_objlen(L, 1);
+    luaL_buffinit(L, &b);
+    for (i = 1; i <= n; i++) {
+        lua_rawgeti(L, 1, i);
+        luaL_addvalue(&b);
+    }
+    luaL_pushresult(&b);
+    return 1;
+}
+
+/* A short string built per op, as in a __tostring method */
+BENCH(buffer_small) {
+    long i;
+    luaL_Buffer b;
+    for (i = 0; i < n; i++) {
+        luaL_buffinit(L, &b);
+        luaL_addlstring(&b, "vmath.vector3(", 14);
+        luaL_addstring(&b, "1, 2");
+        luaL_addchar(&b, ',');
+        luaL_addchar(&b, ' ');
+        luaL_addstring(&b, "3");
+        luaL_addchar(&b, ')');
+        luaL_pushresult(&b);
+        lua_pop(L, 1);
+    }
+}
+
+BENCH(buffer_addvalue) {
+    long i;
+    luaL_Buffer b;
+    lua_pushliteral(L, "0123456789abcdef");
+    for (i = 0; i < n; i++) {
+        luaL_buffinit(L, &b);
+        lua_pushvalue(L, 1);
+        luaL_addvalue(&b);
+        lua_pushvalue(L, 1);
+        luaL_addvalue(&b);
+        luaL_pushresult(&b);
+        lua_pop(L, 1);
+    }
+}
+
+/* Minimal JSON encoder (arrays, objects, numbers, strings).  The buffer
+   lives on its own thread so that the traversal can use L's stack
+   freely between buffer operations. */
+static void json_value(lua_State *L, luaL_Buffer *b, int idx) {
+    switch (lua_type(L, idx)) {
+        case LUA_TNUMBER: {
+            char num[32];
+            sprintf(num, "%.14g", lua_tonumber(L, idx));
+            luaL_addstring(b, num);
+            break;
+        }
+        case LUA_TSTRING: {
+            size_t len, i;
+            const char *str = lua_tolstring(L, idx, &len);
+            luaL_addchar(b, '"');
+            for (i = 0; i < len; i++) {
+                if (str[i] == '"' || str[i] == '\\') luaL_addchar(b, '\\');
+                luaL_addchar(b, str[i]);
+            }
+            luaL_addchar(b, '"');
+            break;
+        }
+        case LUA_TTABLE: {
+            int n = (int)lua_objlen(L, idx), i, first = 1;
+            if (n > 0) {
+                luaL_addchar(b, '[');
+                for (i = 1; i <= n; i++) {
+                    if (i > 1) luaL_addchar(b, ',');
+                    lua_rawgeti(L, idx, i);
+                    json_value(L, b, lua_gettop(L));
+                    lua_pop(L, 1);
+                }
+                luaL_addchar(b, ']');
+                break;
+            }
+            luaL_addchar(b, '{');
+            lua_pushnil(L);
+            while (lua_next(L, idx)) {
+                if (!first) luaL_addchar(b, ',');
+                first = 0;
+                json_value(L, b, lua_gettop(L) - 1);
+                luaL_addchar(b, ':');
+                json_value(L, b, lua_gettop(L));
+                lua_pop(L, 1);
+            }
+            luaL_addchar(b, '}');
+            break;
+        }
+        default:
+            luaL_addstring(b, "null");
+    }
+}
+
+static int json_c(lua_State *L) {
+    luaL_Buffer b;
+    lua_State *BL = lua_newthread(L);
+    luaL_buffinit(BL, &b);
+    json_value(L, &b, 1);
+    luaL_pushresult(&b);
+    lua_xmove(BL, L, 1);
+    return 1;
+}
+
+/* Times fname(data) reps times; prints ms/op and output MB/s */
+static void bench_buffer(lua_State *L, const char *label, lua_CFunction f,
+                         const char *setup, int reps) {
+    double t0, dt;
+    size_t len = 0;
+    int i;
+    lua_settop(L, 0);
+    if (luaL_loadstring(L, setup) != 0 || lua_pcall(L, 0, 1, 0) != 0) {
+        fprintf(stderr, "bench error: %s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+    t0 = now_ns();
+    for (i = 0; i < reps; i++) {
+        lua_pushcfunction(L, f);
+        lua_pushvalue(L, 1);
+        lua_call(L, 1, 1);
+        len = lua_objlen(L, -1);
+        lua_pop(L, 1);
+    }
+    dt = (now_ns() - t0) / reps;
+    printf("  %-32s %8.2f ms/op  %7.1f MB/s  (%.1f MB)\n", label, dt / 1e6,
+           (double)len / (dt / 1e9) / 1e6, (double)len / 1e6);
+    record(label, dt / 1e6, "ms/op");
+    lua_settop(L, 0);
+}
+
+/* ===== Bulk transfer ===== */
+
+#define BULK_N 1000000
+
+static lua_Number bulk_src[BULK_N], bulk_dst[BULK_N];
+
+static void set_loop(lua_State *L) {
+    int i;
+    for (i = 0; i < BULK_N; i++) {
+        lua_pushnumber(L, bulk_src[i]);
+        lua_rawseti(L, 1, i + 1);
+    }
+}
+
+/* Same, into a new empty table that grows as it goes */
+static void set_loop_new(lua_State *L) {
+    lua_newtable(L);
+    lua_replace(L, 1);
+    set_loop(L);
+}
+
+static void get_loop(lua_State *L) {
+    int i;
+    for (i = 0; i < BULK_N; i++) {
+        lua_rawgeti(L, 1, i + 1);
+        bulk_dst[i] = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    }
+    sink = bulk_dst[BULK_N - 1];
+}
+
+#ifdef COMPAT55_EXT
+static void set_bulk(lua_State *L) {
+    compat55_rawsetnumbers(L, 1, 1, bulk_src, BULK_N);
+}
+
+static void set_bulk_new(lua_State *L) {
+    lua_newtable(L);
+    lua_replace(L, 1);
+    set_bulk(L);
+}
+
+static void get_bulk(lua_State *L) {
+    compat55_rawgetnumbers(L, 1, 1, bulk_dst, BULK_N);
+    sink = bulk_dst[BULK_N - 1];
+}
+#endif
+
+/* Elements per second of f over 'reps' runs on a filled BULK_N array */
+static void bench_bulk(lua_State *L, const char *label,
+                       void (*f)(lua_State *L), int reps) {
+    double t0, rate;
+    int i;
+    lua_settop(L, 0);
+    lua_createtable(L, BULK_N, 0);
+    set_loop(L);
+    f(L);   /* warm up */
+    t0 = now_ns();
+    for (i = 0; i < reps; i++) f(L);
+    rate = (double)BULK_N * reps / ((now_ns() - t0) / 1e9) / 1e6;
+    printf("  %-32s %8.1f Melem/s\n", label, rate);
+    record(label, rate, "Melem/s");
+    lua_settop(L, 0);
+}
+
+/* ===== Loading ===== */
+
+/* Sources of the lume and json.lua suites, relative to compat_tests */
+static const char *const load_files[] = {
+    "lua_tests/lume/lume.lua",
+    "lua_tests/lume/test/test.lua",
+    "lua_tests/lume/util/tester.lua",
+    "lua_tests/json.lua/json.lua",
+    "lua_tests/json.lua/test/test.lua",
+    "lua_tests/json.lua/bench/jfjson.lua",
+    "lua_tests/json.lua/bench/dkjson.lua",
+    "lua_tests/json.lua/bench/json4lua.lua",
+    NULL
+};
+
+/* luaL_loadfile of every suite file; returns elapsed ns */
+static double load_suites(lua_State *L) {
+    double t0 = now_ns();
+    int i;
+    for (i = 0; load_files[i]; i++) {
+        if (luaL_loadfile(L, load_files[i]) != 0) {
+            fprintf(stderr, "bench error: %s\n", lua_tostring(L, -1));
+            exit(1);
+        }
+        lua_pop(L, 1);
+    }
+    return now_ns() - t0;
+}
+
+/* First pass (cold), then the average of reps further passes (warm) */
+static void bench_load(lua_State *L, int reps) {
+    double cold, warm = 0;
+    int i;
+    lua_settop(L, 0);
+    cold = load_suites(L);
+    for (i = 0; i < reps; i++) warm += load_suites(L);
+    printf("  %-32s %8.3f ms cold  %8.3f ms warm\n", "loadfile lume+json.lua",
+           cold / 1e6, warm / reps / 1e6);
+    record("loadfile lume+json.lua cold", cold / 1e6, "ms");
+    record("loadfile lume+json.lua warm", warm / reps / 1e6, "ms");
+}
+
+/* ===== Memory ===== */
+
+static double heap_bytes(lua_State *L) {
+    return (double)lua_gc(L, LUA_GCCOUNT, 0) * 1024.0
+         + (double)lua_gc(L, LUA_GCCOUNTB, 0);
+}
+
+/* Bytes per 16-byte userdata kept alive in a preallocated array */
+static double userdata_bytes(lua_State *L, int n, int with_env) {
+    double before;
+    int i;
+    lua_settop(L, 0);
+    lua_createtable(L, n, 0);
+    lua_newtable(L);                    /* shared env */
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    before = heap_bytes(L);
+    for (i = 1; i <= n; i++) {
+        lua_newuserdata(L, 16);
+        if (with_env) {
+            lua_pushvalue(L, 2);
+            lua_setfenv(L, -2);
+        }
+        lua_rawseti(L, 1, i);
+    }
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    before = (heap_bytes(L) - before) / (double)n;
+    lua_settop(L, 0);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    return before;
+}
+
+int main(int argc, char **argv) {
+    long iters = BENCH_ITERS;
+    const char *json_path = NULL;
+    lua_State *L;
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            json_path = argv[++i];
+#ifdef COMPAT55_EXT
+        else if (strcmp(argv[i], "--cachedir") == 0 && i + 1 < argc)
+            compat55_setcachedir(argv[++i]);
+#endif
+        else
+            iters = atol(argv[i]);
+    }
+    if (iters <= 0) iters = BENCH_ITERS;
+    L = luaL_newstate();
+    luaL_openlibs(L);
+
+    printf("C API micro-benchmark, %s (%ld iterations)\n", BENCH_TARGET, iters);
+    begin_group("Stack");
+    RUN(push_pop);
+    RUN(pushvalue_insert_remove);
+    RUN(gettop_settop);
+    RUN(checkstack);
+    RUN(tonumber_type);
+    RUN(tolstring);
+
+    begin_group("Push and to conversions");
+    RUN(pushnumber_tonumber);
+    RUN(pushinteger_tointeger);
+    RUN(pushboolean_toboolean);
+    RUN(pushlightuserdata_touserdata);
+    RUN(pushstring_short);
+    RUN(pushlstring_64);
+    RUN(pushfstring);
+    RUN(tolstring_number);
+    RUN(checknumber_checkinteger);
+    RUN(checklstring_optinteger);
+
+    begin_group("Tables");
+    RUN(rawseti_rawgeti);
+    RUN(getfield_setfield);
+    RUN(gettable_settable);
+    RUN(rawget_rawset);
+    RUN(createtable_small);
+    RUN(next_16);
+    RUN(objlen);
+    RUN(rawequal_lessthan);
+    RUN(newuserdata_setmetatable);
+    RUN(checkudata);
+    RUN(getglobal);
+
+    begin_group("References");
+    RUN(registry_rawgeti);
+    RUN(ref_unref);
+    RUN(ref_unref_churn);
+
+    begin_group("Calls");
+    RUN(upvalue_closure);
+    RUN(pcall_c);
+    RUN(pcall_lua);
+    RUN_N(pcall_error, iters / 10);
+    RUN(concat2);
+    RUN(lua_calls_c);
+
+    begin_group("Buffers");
+    RUN(buffer_small);
+    RUN(buffer_addvalue);
+    bench_buffer(L, "concat 200k x 24B", concat_c,
+        "local t = {} for i = 1, 200000 do t[i] = string.format('item-%018d', i) end return t", 10);
+    bench_buffer(L, "concat 100 x 64KB", concat_c,
+        "local t, s = {}, string.rep('x', 65536) for i = 1, 100 do t[i] = s end return t", 10);
+    bench_buffer(L, "json encode 50k records", json_c,
+        "local t = {} for i = 1, 50000 do t[i] = {id = i, name = 'user' .. i, tags = {'a', 'b', 'c'}, score = i / 7} end return t", 5);
+
+    begin_group("Bulk transfer (1M doubles)");
+    {
+        int i;
+        for (i = 0; i < BULK_N; i++) bulk_src[i] = i * 0.25;
+    }
+    bench_bulk(L, "pushnumber+rawseti loop", set_loop, 10);
+    bench_bulk(L, "pushnumber+rawseti, new table", set_loop_new, 10);
+    bench_bulk(L, "rawgeti+tonumber loop", get_loop, 10);
+#ifdef COMPAT55_EXT
+    bench_bulk(L, "compat55_rawsetnumbers", set_bulk, 10);
+    bench_bulk(L, "compat55_rawsetnumbers, new table", set_bulk_new, 10);
+    bench_bulk(L, "compat55_rawgetnumbers", get_bulk, 10);
+#endif
+
+    begin_group("Loading");
+    bench_load(L, 20);
+
+    begin_group("Memory");
+    {
+        double plain = userdata_bytes(L, 100000, 0);
+        double env = userdata_bytes(L, 100000, 1);
+        printf("  %-32s %8.1f bytes/object\n", "userdata(16)", plain);
+        printf("  %-32s %8.1f bytes/object\n", "userdata(16)+setfenv", env);
+        record("userdata(16)", plain, "bytes/object");
+        record("userdata(16)+setfenv", env, "bytes/object");
+    }
+
+    lua_close(L);
+
+#ifdef COMPAT55_PROFILE
+    if (compat55_prof_dump("bench_profile.json"))
+        printf("API call profile written to bench_profile.json\n");
+#endif
+    if (json_path) {
+        if (!write_json(json_path, iters)) {
+            fprintf(stderr, "cannot write %s\n", json_path);
+            return 1;
+        }
+        printf("Results written to %s\n", json_path);
+    }
+    return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Garbage collector pause benchmark (compat55 only).
+ *
+ * Builds a live heap of small tables and strings, then repeatedly
+ * creates garbage and collects it, once per collector setting:
+ *   full    time of lua_gc(LUA_GCCOLLECT)
+ *   steps   a cycle driven by lua_gc(LUA_GCSTEP, 0) with the collector
+ *           stopped: longest single step and total time of the cycle
+ * Settings: the default, deferred freeing (LUA_GCDEFERFREE) and
+ * parallel marking with 2 and 4 threads (LUA_GCPARMARK).  The live heap
+ * size can be a comma-separated list, to compare settings across sizes.
+ *
+ *   bench_gc [live_tables[,live_tables...]] [garbage_tables] [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "compat55.h"
+
+#define MAX_ROUNDS 100
+
+static const char *setup_script =
+    "local n = ...\n"
+    "live = {}\n"
+    "for i = 1, n do live[i] = {i, tostring(i), x = i * 0.5} end\n"
+    "function garbage(n)\n"
+    "  for i = 1, n do local t = {i, 'g' .. i, {}} end\n"
+    "end\n";
+
+static double now_ms(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart * 1e3 / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec * 1e-6;
+#endif
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double median(double *v, int n) {
+    qsort(v, (size_t)n, sizeof(double), cmp_double);
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static void make_garbage(lua_State *L, int n) {
+    lua_getglobal(L, "garbage");
+    lua_pushinteger(L, n);
+    lua_call(L, 1, 0);
+}
+
+typedef struct Setting {
+    const char *name;
+    int what, data;     /* lua_gc option to apply, or -1 */
+} Setting;
+
+static const Setting settings[] = {
+    {"default", -1, 0},
+    {"deferfree", LUA_GCDEFERFREE, 1},
+    {"parmark2", LUA_GCPARMARK, 2},
+    {"parmark4", LUA_GCPARMARK, 4},
+};
+
+static void run(const Setting *s, int live, int garbage, int rounds) {
+    double full[MAX_ROUNDS], maxstep[MAX_ROUNDS], cycle[MAX_ROUNDS];
+    lua_State *L = luaL_newstate();
+    double heap;
+    int r;
+    luaL_openlibs(L);
+    if (s->what >= 0 && lua_gc(L, s->what, s->data) < 0) {
+        printf("  %-12s not available\n", s->name);
+        lua_close(L);
+        return;
+    }
+    if (luaL_loadstring(L, setup_script) != 0) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+    lua_pushinteger(L, live);
+    lua_call(L, 1, 0);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    heap = lua_gc(L, LUA_GCCOUNT, 0) / 1024.0;
+    for (r = 0; r < rounds; r++) {
+        double t0;
+        make_garbage(L, garbage);
+        t0 = now_ms();
+        lua_gc(L, LUA_GCCOLLECT, 0);
+        full[r] = now_ms() - t0;
+
+        lua_gc(L, LUA_GCSTOP, 0);
+        make_garbage(L, garbage);
+        maxstep[r] = 0;
+        cycle[r] = 0;
+        for (;;) {
+            double dt;
+            int done;
+            t0 = now_ms();
+            done = lua_gc(L, LUA_GCSTEP, 0);
+            dt = now_ms() - t0;
+            cycle[r] += dt;
+            if (dt > maxstep[r]) maxstep[r] = dt;
+            if (done) break;
+        }
+        lua_gc(L, LUA_GCRESTART, 0);
+    }
+    printf("  %-12s %8.1f %10.2f %12.1f %10.2f\n", s->name, heap,
+           median(full, rounds), median(maxstep, rounds) * 1e3,
+           median(cycle, rounds));
+    lua_close(L);
+}
+
+int main(int argc, char **argv) {
+    const char *sizes = argc > 1 ? argv[1] : "500000";
+    int garbage = argc > 2 ? atoi(argv[2]) : 500000;
+    int rounds = argc > 3 ? atoi(argv[3]) : 5;
+    if (rounds < 1) rounds = 1;
+    if (rounds > MAX_ROUNDS) rounds = MAX_ROUNDS;
+    printf("GC pauses: %d garbage tables, median of %d rounds\n",
+           garbage, rounds);
+    while (*sizes) {
+        char *end;
+        int live = (int)strtol(sizes, &end, 10);
+        size_t i;
+        if (end == sizes) break;
+        printf("%d live tables\n", live);
+        printf("  %-12s %8s %10s %12s %10s\n", "", "heap MB", "full ms",
+               "max step us", "cycle ms");
+        for (i = 0; i < sizeof(settings) / sizeof(settings[0]); i++)
+            run(&settings[i], live, garbage, rounds);
+        sizes = *end == ',' ? end + 1 : end;
+    }
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * State pool throughput benchmark (compat55 only).
+ *
+ * Submits a stream of short script jobs to a compat55_Pool and collects
+ * their results, with 1, 2, 4, ... worker threads up to the CPU count
+ * (or the given maximum).  Each job takes a small table of numbers,
+ * does some arithmetic and string work, and returns a table, so the
+ * copied-value format is exercised both ways.  Prints jobs/s, the
+ * speedup over one thread and how many jobs were stolen.
+ *
+ *   bench_pool [jobs] [max_threads]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "compat55.h"
+
+static const char *job_script =
+    "function job(t)\n"
+    "  local s, parts = 0, {}\n"
+    "  for r = 1, 20 do\n"
+    "    for i = 1, #t do s = s + t[i] * r end\n"
+    "  end\n"
+    "  for i = 1, 8 do parts[i] = tostring(t[i] + s) end\n"
+    "  return {sum = s, text = table.concat(parts, ',')}\n"
+    "end\n";
+
+static double now_sec(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+static int ncpu(void) {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int)si.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+static int init_state(lua_State *L, void *ud) {
+    return luaL_dostring(L, (const char *)ud);
+}
+
+/* Keeps up to 'window' jobs in flight; returns the sum of the results */
+static double run(compat55_Pool *P, lua_State *L, int njobs, int window) {
+    compat55_Job *job;
+    double check = 0;
+    int submitted = 0, inflight = 0, i;
+    while (submitted < njobs || inflight > 0) {
+        for (; submitted < njobs && inflight < window; submitted++, inflight++) {
+            lua_createtable(L, 16, 0);
+            for (i = 1; i <= 16; i++) {
+                lua_pushinteger(L, submitted + i);
+                lua_rawseti(L, -2, i);
+            }
+            if (!compat55_pool_submit(P, L, "job", 1)) {
+                fprintf(stderr, "submit: %s\n", lua_tostring(L, -1));
+                exit(1);
+            }
+        }
+        job = compat55_pool_next(P, 1);
+        if (compat55_pool_result(job, L) != 1) {
+            fprintf(stderr, "job: %s\n", lua_tostring(L, -1));
+            exit(1);
+        }
+        inflight--;
+        lua_getfield(L, -1, "sum");
+        check += lua_tonumber(L, -1);
+        lua_pop(L, 2);
+    }
+    return check;
+}
+
+int main(int argc, char **argv) {
+    int njobs = argc > 1 ? atoi(argv[1]) : 50000;
+    int maxthreads = argc > 2 ? atoi(argv[2]) : ncpu();
+    lua_State *L = luaL_newstate();
+    double base = 0;
+    int n;
+    if (maxthreads < 1) maxthreads = 1;
+    printf("State pool: %d jobs, %d CPU(s)\n", njobs, ncpu());
+    printf("  %-8s %12s %9s %9s\n", "threads", "jobs/s", "speedup", "stolen");
+    for (n = 1; n <= maxthreads; n *= 2) {
+        compat55_Pool *P = compat55_pool_new(n, 1, init_state, (void *)job_script);
+        compat55_PoolStats st;
+        double t0, dt, check;
+        if (!P) {
+            fprintf(stderr, "cannot create pool\n");
+            return 1;
+        }
+        run(P, L, n * 100, 64 * n);   /* warm up */
+        compat55_pool_stats(P, &st);
+        t0 = now_sec();
+        check = run(P, L, njobs, 64 * n);
+        dt = now_sec() - t0;
+        if (n == 1) base = njobs / dt;
+        {
+            unsigned long long steals = st.steals;
+            compat55_pool_stats(P, &st);
+            printf("  %-8d %12.0f %8.2fx %9llu  (checksum %.0f)\n", n, njobs / dt,
+                   njobs / dt / base, st.steals - steals, check);
+        }
+        compat55_pool_free(P);
+        if (n < maxthreads && n * 2 > maxthreads) n = maxthreads / 2;  /* last: max */
+    }
+    lua_close(L);
+    return 0;
+}
@@ -0,0 +1,314 @@
+/*
+ * Lua benchmark runner.
+ *
+ * Runs each benchmark script of compat_tests/bench/corpus in a fresh
+ * state and times it.  A script does its setup when loaded and returns
+ * the function to time (or nil and a reason to be skipped); that
+ * function's first result is reported as a checksum so targets can be
+ * checked against each other.  The script receives its own path as the
+ * first argument.
+ *
+ *   bench_runner_<target> [-r repeats] [-w warmups] [-a allocator]
+ *                         [--json file] script.lua...
+ *
+ * Every timed run starts after a full collection.  Reports the median,
+ * mean, standard deviation and minimum of the repeats, and the peak heap
+ * size during them.  Uses only the 5.1 API, so it builds against lua51
+ * and compat55 alike; bench/run.lua drives it over the whole corpus and
+ * compares result files.  The allocator is realloc ("malloc"), or for
+ * compat55 also the slab allocator ("slab", or "slab-huge" with huge
+ * pages); the target name then gets a "+slab" suffix.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+#if !defined(COMPAT55_EXT)
+#define BENCH_TARGET "lua51"
+#else
+#define BENCH_TARGET "compat55"
+#include "compat55.h"
+#endif
+
+#define MAX_REPEATS 100
+
+static const char *allocator = "malloc";
+static char target[32] = BENCH_TARGET;
+
+static double now_ns(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart * 1e9 / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+#endif
+}
+
+/* ===== Heap accounting ===== */
+
+typedef struct Heap {
+    size_t cur, peak;
+    void *slab;   /* compat55_Slab, or NULL for realloc */
+} Heap;
+
+static void *heap_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    Heap *h = (Heap *)ud;
+    /* lua55 passes the object type in osize when ptr is NULL */
+    size_t old = ptr ? osize : 0;
+#ifdef COMPAT55_EXT
+    if (h->slab) {
+        ptr = compat55_slab_alloc(h->slab, ptr, osize, nsize);
+        if (ptr || nsize == 0) {
+            h->cur = h->cur - old + nsize;
+            if (h->cur > h->peak) h->peak = h->cur;
+        }
+        return ptr;
+    }
+#endif
+    if (nsize == 0) {
+        free(ptr);
+        h->cur -= old;
+        return NULL;
+    }
+    ptr = realloc(ptr, nsize);
+    if (ptr) {
+        h->cur = h->cur - old + nsize;
+        if (h->cur > h->peak) h->peak = h->cur;
+    }
+    return ptr;
+}
+
+static int panic(lua_State *L) {
+    fprintf(stderr, "bench_runner: unprotected error: %s\n", lua_tostring(L, -1));
+    return 0;
+}
+
+/* ===== Results ===== */
+
+typedef struct Result {
+    char name[64];
+    char checksum[64];
+    char skipped[128];
+    int n;
+    double median, mean, stddev, min;  /* ms */
+    double peak_kb;
+} Result;
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void summarize(Result *r, double *t, int n) {
+    double sum = 0, sq = 0;
+    int i;
+    qsort(t, (size_t)n, sizeof(double), cmp_double);
+    for (i = 0; i < n; i++) sum += t[i];
+    r->n = n;
+    r->min = t[0];
+    r->mean = sum / n;
+    r->median = n % 2 ? t[n / 2] : (t[n / 2 - 1] + t[n / 2]) / 2;
+    for (i = 0; i < n; i++) sq += (t[i] - r->mean) * (t[i] - r->mean);
+    r->stddev = n > 1 ? sqrt(sq / (n - 1)) : 0;
+}
+
+/* Base name of path without ".lua" */
+static void bench_name(char *dst, size_t size, const char *path) {
+    const char *b = path, *p;
+    size_t len;
+    for (p = path; *p; p++)
+        if (*p == '/' || *p == '\\') b = p + 1;
+    len = strlen(b);
+    if (len > 4 && strcmp(b + len - 4, ".lua") == 0) len -= 4;
+    if (len >= size) len = size - 1;
+    memcpy(dst, b, len);
+    dst[len] = '\0';
+}
+
+static void copy_str(char *dst, size_t size, const char *s) {
+    size_t len = s ? strlen(s) : 0;
+    if (len >= size) len = size - 1;
+    memcpy(dst, s ? s : "", len);
+    dst[len] = '\0';
+}
+
+/* Loads, warms up and times one script; returns 0 on error */
+static void close_state(lua_State *L, Heap *h) {
+    lua_close(L);
+#ifdef COMPAT55_EXT
+    compat55_slab_free((compat55_Slab *)h->slab);
+#endif
+}
+
+static int run_script(const char *path, int repeats, int warmups, Result *r) {
+    Heap heap = {0, 0, NULL};
+    double t[MAX_REPEATS];
+    lua_State *L;
+    int i;
+#ifdef COMPAT55_EXT
+    if (strncmp(allocator, "slab", 4) == 0)
+        heap.slab = compat55_slab_new(strcmp(allocator, "slab-huge") == 0);
+#endif
+    L = lua_newstate(heap_alloc, &heap);
+    memset(r, 0, sizeof(*r));
+    bench_name(r->name, sizeof(r->name), path);
+    if (!L) {
+        fprintf(stderr, "%s: cannot create state\n", r->name);
+        return 0;
+    }
+    lua_atpanic(L, panic);
+    luaL_openlibs(L);
+    if (luaL_loadfile(L, path) != 0) goto error;
+    lua_pushstring(L, path);
+    if (lua_pcall(L, 1, 2, 0) != 0) goto error;
+    if (lua_type(L, 1) != LUA_TFUNCTION) {
+        copy_str(r->skipped, sizeof(r->skipped),
+                 lua_isstring(L, 2) ? lua_tostring(L, 2) : "no function returned");
+        close_state(L, &heap);
+        return 1;
+    }
+    lua_settop(L, 1);
+    for (i = 0; i < warmups; i++) {
+        lua_pushvalue(L, 1);
+        if (lua_pcall(L, 0, 0, 0) != 0) goto error;
+    }
+    for (i = 0; i < repeats; i++) {
+        double t0;
+        lua_gc(L, LUA_GCCOLLECT, 0);
+        heap.peak = heap.cur;
+        lua_pushvalue(L, 1);
+        t0 = now_ns();
+        if (lua_pcall(L, 0, 1, 0) != 0) goto error;
+        t[i] = (now_ns() - t0) / 1e6;
+        if (heap.peak / 1024.0 > r->peak_kb) r->peak_kb = heap.peak / 1024.0;
+        if (i == repeats - 1)
+            copy_str(r->checksum, sizeof(r->checksum),
+                     lua_isstring(L, -1) ? lua_tostring(L, -1) : luaL_typename(L, -1));
+        lua_pop(L, 1);
+    }
+    summarize(r, t, repeats);
+    close_state(L, &heap);
+    return 1;
+error:
+    fprintf(stderr, "%s: %s\n", r->name, lua_tostring(L, -1));
+    close_state(L, &heap);
+    return 0;
+}
+
+/* Writes s as a JSON string */
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if (c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+static int write_json(const char *path, const Result *res, int n,
+                      int repeats) {
+    FILE *f = fopen(path, "w");
+    int i;
+    if (!f) return 0;
+    fprintf(f, "{\n  \"target\": \"%s\",\n  \"repeats\": %d,\n  \"results\": [\n",
+            target, repeats);
+    for (i = 0; i < n; i++) {
+        const Result *r = &res[i];
+        fprintf(f, "    {\"name\": ");
+        json_string(f, r->name);
+        if (r->skipped[0]) {
+            fprintf(f, ", \"skipped\": ");
+            json_string(f, r->skipped);
+        } else {
+            fprintf(f, ", \"median_ms\": %.6g, \"mean_ms\": %.6g, \"stddev_ms\": %.6g, "
+                       "\"min_ms\": %.6g, \"peak_kb\": %.1f, \"checksum\": ",
+                    r->median, r->mean, r->stddev, r->min, r->peak_kb);
+            json_string(f, r->checksum);
+        }
+        fprintf(f, "}%s\n", i + 1 < n ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+int main(int argc, char **argv) {
+    int repeats = 5, warmups = 1, nscripts = 0, failed = 0, i;
+    const char *json_path = NULL;
+    Result *res = (Result *)calloc((size_t)argc, sizeof(Result));
+    if (!res) return 1;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            repeats = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            warmups = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+            allocator = argv[++i];
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            json_path = argv[++i];
+        else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [-r repeats] [-w warmups] [-a allocator] "
+                            "[--json file] script.lua...\n", argv[0]);
+            return 1;
+        }
+    }
+#ifdef COMPAT55_EXT
+    if (strcmp(allocator, "slab") == 0 || strcmp(allocator, "slab-huge") == 0)
+        strcat(target, "+slab");
+    else
+#endif
+    if (strcmp(allocator, "malloc") != 0) {
+        fprintf(stderr, "unknown allocator '%s'\n", allocator);
+        return 1;
+    }
+    if (repeats < 1) repeats = 1;
+    if (repeats > MAX_REPEATS) repeats = MAX_REPEATS;
+    if (warmups < 0) warmups = 0;
+
+    printf("Lua benchmarks, %s (%d repeats, %s)\n", target, repeats, allocator);
+    printf("  %-24s %10s %10s %10s %10s  %s\n", "", "median ms", "stddev",
+           "min ms", "peak KB", "checksum");
+    for (i = 1; i < argc; i++) {
+        Result *r = &res[nscripts];
+        if (argv[i][0] == '-') {
+            i++;   /* option value */
+            continue;
+        }
+        if (!run_script(argv[i], repeats, warmups, r)) {
+            failed++;
+            continue;
+        }
+        nscripts++;
+        if (r->skipped[0])
+            printf("  %-24s skipped (%s)\n", r->name, r->skipped);
+        else
+            printf("  %-24s %10.2f %10.2f %10.2f %10.0f  %s\n", r->name,
+                   r->median, r->stddev, r->min, r->peak_kb, r->checksum);
+        fflush(stdout);
+    }
+    if (json_path) {
+        if (!write_json(json_path, res, nscripts, repeats)) {
+            fprintf(stderr, "cannot write %s\n", json_path);
+            return 1;
+        }
+        printf("Results written to %s\n", json_path);
+    }
+    free(res);
+    return failed != 0;
+}
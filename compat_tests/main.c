@@ -7,12 +7,17 @@
 #define chdir _chdir
 #else
 #include <unistd.h>
+#include <dirent.h>
 #endif
 
 #include "lua.h"
 #include "lauxlib.h"
 #include "lualib.h"
 
+#ifdef COMPAT55_EXT
+#include "compat55.h"
+#endif
+
 #define TEST(name) static int test_##name(lua_State *L)
 #define RUN(name) do { \
     printf("  %-40s", #name); \
@@ -281,6 +286,23 @@ TEST(userdata) {
     return 0;
 }
 
+TEST(userdata_fenv) {
+    int ok;
+    lua_newuserdata(L, sizeof(int));
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    if (lua_setfenv(L, -3) != 1) { lua_pop(L, 2); return 1; }
+    lua_getfenv(L, -2);
+    ok = lua_rawequal(L, -1, -2);
+    lua_pop(L, 3);
+    /* non-userdata values are rejected without touching the stack */
+    lua_pushnumber(L, 1);
+    lua_newtable(L);
+    ok = ok && lua_setfenv(L, -2) == 0 && lua_gettop(L) == 1;
+    lua_pop(L, 1);
+    return ok ? 0 : 1;
+}
+
 TEST(metatable) {
     lua_newtable(L);
     lua_newtable(L);
@@ -299,6 +321,95 @@ TEST(global) {
     return 0;
 }
 
+/*
+** Field access through one call site as the tables under it change
+** (lua55 caches the node of a constant key per instruction): each site
+** is warmed up first, then must notice the change.
+*/
+TEST(field_caches) {
+    const char *code =
+        "local function get(o) return o.x end\n"
+        "local function set(o, v) o.x = v end\n"
+        "local function call(o) return o:name() end\n"
+        "local A = {name = function() return 'A' end}\n"
+        "local B = {name = function() return 'B' end}\n"
+        "A.__index, B.__index = A, B\n"
+        "local o = setmetatable({}, A)\n"
+        "for i = 1, 3 do assert(call(o) == 'A') end\n"
+        /* metatable swap */
+        "setmetatable(o, B)\n"
+        "assert(call(o) == 'B')\n"
+        /* __index replaced by another table, then by a function */
+        "A.__index = {name = function() return 'C' end}\n"
+        "setmetatable(o, A)\n"
+        "assert(call(o) == 'C')\n"
+        "A.__index = function(t, k) return function() return 'F' .. k end end\n"
+        "assert(call(o) == 'Fname')\n"
+        /* method moved into the class, then shadowed by the object */
+        "A.__index = A\n"
+        "assert(call(o) == 'A')\n"
+        "o.name = function() return 'own' end\n"
+        "assert(call(o) == 'own')\n"
+        "o.name = nil\n"
+        "assert(call(o) == 'A')\n"
+        /* rehash: the node of 'x' moves as the table grows and shrinks */
+        "local t = {x = 1}\n"
+        "for i = 1, 3 do assert(get(t) == 1) end\n"
+        "for i = 1, 1000 do t['k' .. i] = i; assert(get(t) == 1) end\n"
+        "set(t, 2)\n"
+        "for i = 1, 1000 do t['k' .. i] = nil end\n"
+        "t.y = 0\n"
+        "assert(get(t) == 2 and t.k1 == nil)\n"
+        /* key removal, with and without a collection in between */
+        "set(t, nil)\n"
+        "assert(get(t) == nil and next({}) == nil)\n"
+        "setmetatable(t, {__index = {x = 'meta'}})\n"
+        "assert(get(t) == 'meta')\n"
+        "collectgarbage()\n"
+        "assert(get(t) == 'meta')\n"
+        "set(t, 3)\n"
+        "assert(get(t) == 3 and rawget(t, 'x') == 3)\n"
+        /* stores into a removed key go through __newindex */
+        "local log = {}\n"
+        "local u = setmetatable({x = 1}, {__newindex = function(t, k, v)\n"
+        "  log[#log + 1] = v; rawset(t, k, v) end})\n"
+        "for i = 1, 3 do set(u, i) end\n"
+        "u.x = nil\n"
+        "set(u, 'new')\n"
+        "assert(#log == 1 and log[1] == 'new' and u.x == 'new')\n"
+        /* tables of different shapes through the same sites */
+        "local shapes = {{x = 1}, {y = 0, x = 2}, {a = 0, b = 0, c = 0, x = 3},\n"
+        "  {y = 4}, setmetatable({}, {__index = function() return 5 end})}\n"
+        "for r = 1, 3 do\n"
+        "  for i, s in ipairs(shapes) do\n"
+        "    if i == 4 then assert(get(s) == nil) else assert(get(s) == i) end\n"
+        "  end\n"
+        "end\n"
+        "for i = 1, 3 do set(shapes[i], -i) end\n"
+        "assert(shapes[1].x == -1 and shapes[2].x == -2 and shapes[3].x == -3)\n"
+        /* a big table: nodes past what the cache can index */
+        "local big = {}\n"
+        "for i = 1, 100000 do big['f' .. i] = i end\n"
+        "local function bget(t) return t.f99999 end\n"
+        "for i = 1, 3 do assert(bget(big) == 99999) end\n"
+        "big.f99999 = nil\n"
+        "assert(bget(big) == nil)\n"
+        /* globals through _ENV */
+        "local function gget() return cached_global end\n"
+        "cached_global = 1\n"
+        "for i = 1, 3 do assert(gget() == 1) end\n"
+        "cached_global = nil\n"
+        "assert(gget() == nil)\n"
+        "return true\n";
+    int top = lua_gettop(L), ok = 1;
+    if (luaL_dostring(L, code) != 0 || !lua_toboolean(L, -1)) {
+        printf("(%s) ", lua_isstring(L, -1) ? lua_tostring(L, -1) : "false");
+        ok = 0;
+    }
+    lua_settop(L, top);
+    return ok ? 0 : 1;
+}
+
 /* ===== Load and call ===== */
 
 TEST(call_pcall) {
@@ -505,6 +616,47 @@ TEST(getstack_getinfo) {
     return ok ? 0 : 1;
 }
 
+static int getlocal_helper(lua_State *L) {
+    lua_Debug ar;
+    const char *name;
+    if (!lua_getstack(L, 1, &ar)) return 0;
+    lua_getinfo(L, "Sl", &ar);          /* must not disturb `ar' */
+    name = lua_getlocal(L, &ar, 1);
+    if (!name) return 0;
+    lua_pushstring(L, name);
+    lua_insert(L, -2);                  /* name, value */
+    return 2;
+}
+
+TEST(getlocal) {
+    lua_register(L, "getlocal_helper", getlocal_helper);
+    if (luaL_dostring(L, "local answer = 42 return getlocal_helper()") != 0) {
+        printf("(%s) ", lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return 1;
+    }
+    int ok = lua_gettop(L) == 2 && strcmp(lua_tostring(L, -2), "answer") == 0
+             && lua_tonumber(L, -1) == 42;
+    lua_settop(L, 0);
+    return ok ? 0 : 1;
+}
+
+static int hook_calls;
+
+static void counting_hook(lua_State *L, lua_Debug *ar) {
+    if (lua_getinfo(L, "S", ar) && ar->what && strcmp(ar->what, "Lua") == 0)
+        hook_calls++;
+}
+
+TEST(hook_getinfo) {
+    hook_calls = 0;
+    lua_sethook(L, counting_hook, LUA_MASKCALL, 0);
+    if (lua_gethook(L) != counting_hook) { lua_sethook(L, NULL, 0, 0); return 1; }
+    luaL_dostring(L, "local function f() end f() f() f()");
+    lua_sethook(L, NULL, 0, 0);
+    return hook_calls >= 3 ? 0 : 1;
+}
+
 TEST(upvalue) {
     lua_pushnumber(L, 99);
     lua_pushcclosure(L, my_cfunction, 1);
@@ -662,6 +814,735 @@ TEST(ref_unref) {
     return 0;
 }
 
+/* refs are registry keys, as in 5.1 (unless built with COMPAT55_REFSTORE) */
+TEST(ref_registry) {
+#if defined(COMPAT55_REFSTORE) && COMPAT55_REFSTORE
+    (void)L;
+    return 0;
+#else
+    int ref, ok = 1;
+    lua_pushstring(L, "refd");
+    ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_pushvalue(L, LUA_REGISTRYINDEX);
+    lua_rawgeti(L, -1, ref);
+    if (!lua_isstring(L, -1) || strcmp(lua_tostring(L, -1), "refd") != 0) ok = 0;
+    lua_pop(L, 2);
+    lua_pushinteger(L, ref);
+    lua_setglobal(L, "ref_registry_key");
+    if (luaL_dostring(L, "return debug.getregistry()[ref_registry_key]") != 0 ||
+        !lua_isstring(L, -1) || strcmp(lua_tostring(L, -1), "refd") != 0) ok = 0;
+    lua_pop(L, 1);
+    lua_pushnil(L);
+    lua_setglobal(L, "ref_registry_key");
+    luaL_unref(L, LUA_REGISTRYINDEX, ref);
+    return ok ? 0 : 1;
+#endif
+}
+
+TEST(ref_churn) {
+    /* refs survive collections, get reused after unref, nil is LUA_REFNIL */
+    int refs[1000], i, ok = 1;
+    for (i = 0; i < 1000; i++) {
+        lua_newtable(L);
+        lua_pushinteger(L, i);
+        lua_setfield(L, -2, "i");
+        refs[i] = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    for (i = 0; i < 1000; i += 2)
+        luaL_unref(L, LUA_REGISTRYINDEX, refs[i]);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    for (i = 1; i < 1000 && ok; i += 2) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, refs[i]);
+        lua_getfield(L, -1, "i");
+        ok = lua_tointeger(L, -1) == i;
+        lua_pop(L, 2);
+    }
+    lua_pushstring(L, "reused");
+    i = luaL_ref(L, LUA_REGISTRYINDEX);
+    if (i <= 0) ok = 0;
+    /* lua_rawseti on a live ref replaces its value */
+    lua_pushstring(L, "replaced");
+    lua_rawseti(L, LUA_REGISTRYINDEX, i);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, i);
+    if (!lua_isstring(L, -1) || strcmp(lua_tostring(L, -1), "replaced") != 0) ok = 0;
+    lua_pop(L, 1);
+    luaL_unref(L, LUA_REGISTRYINDEX, i);
+    lua_pushnil(L);
+    if (luaL_ref(L, LUA_REGISTRYINDEX) != LUA_REFNIL) ok = 0;
+    for (i = 1; i < 1000; i += 2)
+        luaL_unref(L, LUA_REGISTRYINDEX, refs[i]);
+    return ok ? 0 : 1;
+}
+
+#ifdef COMPAT55_EXT
+#ifndef _WIN32
+static int write_bytes(const char *path, const void *b, size_t len) {
+    FILE *f = fopen(path, "wb");
+    int ok = f != NULL && fwrite(b, 1, len, f) == len;
+    if (f && fclose(f) != 0) ok = 0;
+    return ok;
+}
+
+static size_t read_bytes(const char *path, char *b, size_t size) {
+    FILE *f = fopen(path, "rb");
+    size_t n = 0;
+    if (f) {
+        n = fread(b, 1, size, f);
+        fclose(f);
+    }
+    return n;
+}
+
+static int dump_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+    (void)L;
+    return sz > 0 && fwrite(p, 1, sz, (FILE *)ud) != sz;
+}
+
+/* Counts the .luac files in dir; the path of the last one goes to path */
+static int cache_entries(const char *dir, char *path, size_t size) {
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    int n = 0;
+    if (!d) return -1;
+    while ((e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        if (len > 5 && strcmp(e->d_name + len - 5, ".luac") == 0) {
+            snprintf(path, size, "%s/%s", dir, e->d_name);
+            n++;
+        }
+    }
+    closedir(d);
+    return n;
+}
+
+/* Loads path and calls it with no argument, then with true; describes
+   the results, the chunk name and the error message in out */
+static void cache_run(lua_State *L, const char *path, char *out, size_t size) {
+    int top = lua_gettop(L);
+    if (luaL_loadfile(L, path) != 0) {
+        snprintf(out, size, "load: %s", lua_tostring(L, -1));
+    } else {
+        lua_pushvalue(L, -1);
+        if (lua_pcall(L, 0, 2, 0) != 0) {
+            snprintf(out, size, "run: %s", lua_tostring(L, -1));
+        } else {
+            char first[256];
+            snprintf(first, sizeof(first), "%s %s", lua_tostring(L, -2),
+                     lua_tostring(L, -1));
+            lua_pop(L, 2);
+            lua_pushboolean(L, 1);
+            lua_pcall(L, 1, 0, 0);
+            snprintf(out, size, "%s / %s", first,
+                     lua_isstring(L, -1) ? lua_tostring(L, -1) : "no error");
+        }
+    }
+    lua_settop(L, top);
+}
+#endif
+
+/* luaL_loadfile through the bytecode cache: misses write one entry,
+   hits come from it, edits change the key, bad entries are replaced,
+   and chunk names and line numbers do not change */
+TEST(loadfile_cache) {
+#ifdef _WIN32
+    (void)L;
+    return 0;
+#else
+    static const char *src =
+        "#!/usr/bin/env lua\n"
+        "local fail = ...\n"
+        "if fail then\n"
+        "  error('boom')\n"
+        "end\n"
+        "return 42, debug.getinfo(1, 'S').source\n";
+    char dir[] = "/tmp/compat55_cacheXXXXXX";
+    char file[256], entry[512], entry2[512], plain[1024], got[1024];
+    char bin[4096], bin2[4096];
+    size_t binlen;
+    FILE *f;
+    int ok = 1;
+    if (!mkdtemp(dir)) return 1;
+    snprintf(file, sizeof(file), "%s/s.lua", dir);
+    if (!write_bytes(file, src, strlen(src))) ok = 0;
+
+    compat55_setcachedir(NULL);
+    cache_run(L, file, plain, sizeof(plain));
+    if (!strstr(plain, "42 @") || !strstr(plain, "s.lua:4: boom")) ok = 0;
+    if (cache_entries(dir, entry, sizeof(entry)) != 0) ok = 0;
+
+    /* a miss writes one entry; a hit gives the same results */
+    compat55_setcachedir(dir);
+    cache_run(L, file, got, sizeof(got));
+    if (strcmp(got, plain) != 0 || cache_entries(dir, entry, sizeof(entry)) != 1)
+        ok = 0;
+    binlen = read_bytes(entry, bin, sizeof(bin));
+    if (binlen == 0 || binlen == sizeof(bin) || bin[0] != '\033') ok = 0;
+    cache_run(L, file, got, sizeof(got));
+    if (strcmp(got, plain) != 0 || cache_entries(dir, entry2, sizeof(entry2)) != 1)
+        ok = 0;
+
+    /* the hit really comes from the entry */
+    luaL_loadstring(L, "return 7, 'cached'");
+    f = fopen(entry, "wb");
+    if (!f || lua_dump(L, dump_writer, f) != 0) ok = 0;
+    if (f) fclose(f);
+    lua_pop(L, 1);
+    cache_run(L, file, got, sizeof(got));
+    if (strcmp(got, "7 cached / no error") != 0) ok = 0;
+
+    /* a corrupted entry is recompiled and overwritten */
+    if (!write_bytes(entry, "\033Lua garbage", 12)) ok = 0;
+    cache_run(L, file, got, sizeof(got));
+    if (strcmp(got, plain) != 0) ok = 0;
+    if (read_bytes(entry, bin2, sizeof(bin2)) != binlen || memcmp(bin, bin2, binlen) != 0)
+        ok = 0;
+
+    /* an edited source gets a new key */
+    snprintf(bin, sizeof(bin), "%s", src);
+    *strstr(bin, "42") = '5';
+    if (!write_bytes(file, bin, strlen(bin))) ok = 0;
+    cache_run(L, file, got, sizeof(got));
+    if (strncmp(got, "52 @", 4) != 0 || cache_entries(dir, entry2, sizeof(entry2)) != 2)
+        ok = 0;
+
+    compat55_setcachedir(NULL);
+    while (cache_entries(dir, entry, sizeof(entry)) > 0) remove(entry);
+    remove(file);
+    rmdir(dir);
+    return ok ? 0 : 1;
+#endif
+}
+
+TEST(bulk_transfer) {
+    lua_Number nums[100], back[100];
+    long long ints[100], iback[100];
+    int i, ok = 1;
+    for (i = 0; i < 100; i++) {
+        nums[i] = i * 0.5;
+        ints[i] = (lua_Integer)i * 1000000007;
+    }
+    lua_newtable(L);
+    lua_pushstring(L, "keep");
+    lua_rawseti(L, -2, 150);
+    compat55_rawsetnumbers(L, -1, 1, nums, 100);
+    compat55_rawsetintegers(L, -1, 101, ints, 100);
+    if (lua_objlen(L, -1) != 200) ok = 0;
+    lua_rawgeti(L, -1, 150);   /* overwritten by the integer range */
+    if (lua_type(L, -1) != LUA_TNUMBER || lua_tointeger(L, -1) != ints[49]) ok = 0;
+    lua_pop(L, 1);
+    if (compat55_rawgetnumbers(L, -1, 1, back, 100) != 100 ||
+        memcmp(back, nums, sizeof(nums)) != 0) ok = 0;
+    if (compat55_rawgetintegers(L, -1, 101, iback, 100) != 100 ||
+        memcmp(iback, ints, sizeof(ints)) != 0) ok = 0;
+    /* integral floats convert; 0.5 and strings stop the copy */
+    if (compat55_rawgetintegers(L, -1, 1, iback, 10) != 1 || iback[0] != 0) ok = 0;
+    lua_pushstring(L, "x");
+    lua_rawseti(L, -2, 5);
+    if (compat55_rawgetnumbers(L, -1, 1, back, 10) != 4) ok = 0;
+    if (compat55_rawgetnumbers(L, -1, 300, back, 10) != 0) ok = 0;
+    lua_pop(L, 1);
+    /* a range far beyond the array part goes to the hash part */
+    lua_newtable(L);
+    compat55_rawsetintegers(L, -1, 1000000000, ints, 3);
+    if (compat55_rawgetintegers(L, -1, 1000000000, iback, 3) != 3 ||
+        iback[2] != ints[2]) ok = 0;
+    lua_rawgeti(L, -1, 1000000001);
+    if (lua_tointeger(L, -1) != (lua_Integer)ints[1]) ok = 0;
+    lua_pop(L, 1);
+    if (lua_objlen(L, -1) != 0) ok = 0;
+    lua_pop(L, 1);
+    return ok ? 0 : 1;
+}
+
+static int cpuprof_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+    luaL_addlstring((luaL_Buffer *)ud, (const char *)p, sz);
+    (void)L;
+    return 0;
+}
+
+TEST(cpuprof) {
+    const char *code =
+        "function cpuprof_busy()\n"
+        "  local t0, x = os.clock(), 0\n"
+        "  while os.clock() - t0 < 0.05 do\n"
+        "    for i = 1, 1000 do x = x + i end\n"
+        "  end\n"
+        "  return x\n"
+        "end\n"
+        "cpuprof_busy()\n";
+    luaL_Buffer b;
+    const char *out;
+    int ok = 1;
+    if (!compat55_cpuprof_start(L, 1000)) return 1;
+    if (compat55_cpuprof_start(L, 1000)) ok = 0;  /* already running */
+    if (luaL_dostring(L, code) != 0) {
+        lua_pop(L, 1);
+        ok = 0;
+    }
+    compat55_cpuprof_stop(L);
+    luaL_buffinit(L, &b);
+    compat55_cpuprof_dump(L, cpuprof_writer, &b);
+    luaL_pushresult(&b);
+    out = lua_tostring(L, -1);
+    /* e.g. "[C];[string \"...\"];cpuprof_busy@[string \"...\"]:1 12" */
+    if (!strstr(out, ";cpuprof_busy@") || out[strlen(out) - 1] != '\n') ok = 0;
+    lua_pop(L, 1);
+    lua_pushnil(L);
+    lua_setglobal(L, "cpuprof_busy");
+    return ok ? 0 : 1;
+}
+
+static const char *heapprof_dump(lua_State *L, int live) {
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    compat55_heapprof_dump(L, cpuprof_writer, &b, live);
+    luaL_pushresult(&b);
+    return lua_tostring(L, -1);
+}
+
+TEST(heapprof) {
+    const char *code =
+        "function heapprof_churn()\n"
+        "  for i = 1, 100000 do local t = {i, i} end\n"
+        "end\n"
+        "function heapprof_keep()\n"
+        "  heapprof_kept = {}\n"
+        "  for i = 1, 20000 do heapprof_kept[i] = {i} end\n"
+        "end\n"
+        "heapprof_churn()\n"
+        "heapprof_keep()\n"
+        "collectgarbage()\n";
+    const char *alloc, *live;
+    int ok = 1;
+    if (!compat55_heapprof_start(L, 4096)) return 1;
+    if (compat55_heapprof_start(L, 4096)) ok = 0;  /* already running */
+    if (luaL_dostring(L, code) != 0) {
+        lua_pop(L, 1);
+        ok = 0;
+    }
+    alloc = heapprof_dump(L, 0);
+    live = heapprof_dump(L, 1);
+    /* e.g. "[string \"...\"];heapprof_churn@[string \"...\"]:1 2400256" */
+    if (!strstr(alloc, ";heapprof_churn@") || !strstr(alloc, ";heapprof_keep@"))
+        ok = 0;
+    if (strstr(live, ";heapprof_churn@") || !strstr(live, ";heapprof_keep@"))
+        ok = 0;
+    lua_pop(L, 2);
+    compat55_heapprof_stop(L);
+    if (heapprof_dump(L, 0)[0] != '\0') ok = 0;  /* results discarded */
+    lua_pop(L, 1);
+    lua_pushnil(L);
+    lua_setglobal(L, "heapprof_churn");
+    lua_pushnil(L);
+    lua_setglobal(L, "heapprof_keep");
+    lua_pushnil(L);
+    lua_setglobal(L, "heapprof_kept");
+    return ok ? 0 : 1;
+}
+
+/* Counters exist only in a LUA_OPSTATS build; check whichever this is */
+TEST(opstats) {
+    int top = lua_gettop(L), ok = 1;
+    if (!compat55_opstats(L, 1)) return lua_gettop(L) == top ? 0 : 1;
+    lua_pop(L, 1);
+    (void)luaL_dostring(L, "local s = 0 for i = 1, 10 do s = s + i end");
+    compat55_opstats(L, 0);
+    lua_getfield(L, -1, "ops");
+    lua_getfield(L, -1, "FORLOOP");
+    if (lua_tointeger(L, -1) != 10) ok = 0;
+    lua_pop(L, 3);
+    return ok && lua_gettop(L) == top ? 0 : 1;
+}
+
+/*
+** opstats between small incremental steps, while dead prototypes wait
+** to be swept: long chunk names give each one a source string newer
+** than itself, which the sweep frees first.
+*/
+TEST(opstats_gc) {
+    const char *code =
+        "local keep = {}\n"
+        "collectgarbage('incremental'); collectgarbage()\n"
+        "collectgarbage('param', 'stepsize', 160)\n"
+        "collectgarbage('param', 'stepmul', 100)\n"
+        "collectgarbage('stop')\n"
+        "for i = 1, 1000 do\n"
+        "  local f = load('return function() return ' .. i .. ' end',\n"
+        "                 '=' .. ('c'):rep(60) .. i)\n"
+        "  f()()\n"
+        "  keep[i] = {}  -- live objects between the dead ones\n"
+        "end\n"
+        "local steps, done = 0, false\n"
+        "repeat\n"
+        "  done = collectgarbage('step', 0)\n"
+        "  for _, f in ipairs(debug.opstats().functions) do\n"
+        "    assert(#f.source > 0 and f.calls >= 0)\n"
+        "  end\n"
+        "  steps = steps + 1\n"
+        "until done or steps > 100000\n"
+        "return done and steps > 100\n";
+    lua_State *L1;
+    int ok = 1;
+    if (!compat55_opstats(L, 0)) return 0;
+    lua_pop(L, 1);
+    L1 = luaL_newstate();
+    luaL_openlibs(L1);
+    if (luaL_dostring(L1, code) != 0 || !lua_toboolean(L1, -1)) ok = 0;
+    lua_close(L1);
+    return ok ? 0 : 1;
+}
+
+TEST(serialize) {
+    const char *code =
+        "local ser = require 'serialize'\n"
+        "local t = {1, 2.5, 'x', true, k = {n = -300, s = 'x'}}\n"
+        "t.self = t; t.shared = t.k\n"
+        "local u = ser.decode(ser.encode(t))\n"
+        "assert(u.self == u and u.shared == u.k and u.k.n == -300)\n"
+        "assert(u[1] == 1 and u[2] == 2.5 and u[3] == 'x' and u[4] == true)\n"
+        "assert(not pcall(ser.encode, print))\n"
+        "assert(not pcall(ser.decode, ser.encode(t):sub(1, -2)))\n";
+    if (luaL_dostring(L, code) != 0) {
+        lua_pop(L, 1);
+        return 1;
+    }
+    return 0;
+}
+
+TEST(gc_budget) {
+    int i, done = 0;
+    lua_gc(L, LUA_GCCOLLECT, 0);   /* start from a finished cycle */
+    lua_gc(L, LUA_GCSTOP, 0);
+    if (luaL_dostring(L, "local t = {} for i = 1, 50000 do t[i] = {i} end") != 0)
+        return 1;
+    /* the cycle is split over several steps, even with the GC stopped */
+    for (i = 0; i < 1000000 && !done; i++)
+        done = lua_gc(L, LUA_GCBUDGET, 50);
+    lua_gc(L, LUA_GCRESTART, 0);
+    if (!done || i < 2) return 1;
+    if (luaL_dostring(L, "return type(collectgarbage('budget', 10)) == 'boolean'") != 0)
+        return 1;
+    i = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    return i ? 0 : 1;
+}
+
+TEST(deferfree) {
+    const char *code =
+        "local keep = {}\n"
+        "for r = 1, 3 do\n"
+        "  for i = 1, 30000 do keep[i % 1000 + 1] = {i, tostring(i) .. 'x'} end\n"
+        "  collectgarbage()\n"
+        "end\n"
+        "collectgarbage('generational')\n"
+        "for i = 1, 100000 do local t = {i, {}} end\n"
+        "collectgarbage('incremental')\n"
+        "return #keep\n";
+    lua_State *L1 = luaL_newstate();
+    int ok = 1;
+    (void)L;
+    luaL_openlibs(L1);
+    if (lua_gc(L1, LUA_GCDEFERFREE, 1) != 0) {   /* off by default */
+        lua_close(L1);
+        return 1;
+    }
+    if (luaL_dostring(L1, code) != 0 || lua_tointeger(L1, -1) != 1000) ok = 0;
+    lua_pop(L1, 1);
+    if (lua_gc(L1, LUA_GCDEFERFREE, 0) != 1) ok = 0;
+    if (lua_gc(L1, LUA_GCDEFERFREE, 1) != 0) ok = 0;
+    if (luaL_dostring(L1, code) != 0) ok = 0;
+    lua_close(L1);   /* with deferred freeing still on */
+    return ok ? 0 : 1;
+}
+
+TEST(parmark) {
+    const char *code =
+        "local live, weak = {}, setmetatable({}, {__mode = 'k'})\n"
+        "for i = 1, 40000 do\n"
+        "  live[i] = {i, tostring(i), f = function() return i end}\n"
+        "end\n"
+        "local co = coroutine.wrap(function()\n"
+        "  local t = {}\n"
+        "  for i = 1, 1000 do t[i] = {i} end\n"
+        "  coroutine.yield()\n"
+        "  return #t\n"
+        "end)\n"
+        "co()\n"
+        "for i = 1, 1000 do weak[live[i]] = {live[i]}; weak[{}] = i end\n"
+        "for r = 1, 3 do\n"
+        "  for i = 1, 20000 do local g = {i, {}} end\n"
+        "  collectgarbage()\n"
+        "end\n"
+        "local n = 0\n"
+        "for k, v in pairs(weak) do\n"
+        "  assert(v[1] == k); n = n + 1\n"
+        "end\n"
+        "collectgarbage('generational'); collectgarbage()\n"
+        "collectgarbage('incremental')\n"
+        "return n + co() + live[40000].f()\n";
+    lua_State *L1 = luaL_newstate();
+    int ok = 1;
+    (void)L;
+    luaL_openlibs(L1);
+    if (lua_gc(L1, LUA_GCPARMARK, 4) != 0) {   /* off by default */
+        lua_close(L1);
+        return 1;
+    }
+    if (luaL_dostring(L1, code) != 0 || lua_tointeger(L1, -1) != 42000) ok = 0;
+    lua_pop(L1, 1);
+    if (lua_gc(L1, LUA_GCPARMARK, 1) != 4) ok = 0;
+    if (lua_gc(L1, LUA_GCPARMARK, 2) != 0) ok = 0;
+    if (luaL_dostring(L1, code) != 0) ok = 0;
+    lua_close(L1);   /* with the helpers still running */
+    return ok ? 0 : 1;
+}
+
+TEST(gc_stats) {
+    const char *code =
+        "collectgarbage('incremental')\n"
+        "keep = {}\n"
+        "for i = 1, 20000 do keep[i % 100 + 1] = {tostring(i)} end\n"
+        "collectgarbage()\n"
+        "collectgarbage('generational')\n"
+        "for i = 1, 50000 do keep[i % 100 + 1] = {i} end\n"
+        "collectgarbage('incremental')\n"
+        "local s = collectgarbage('stats')\n"
+        "local n = 0\n"
+        "for _, c in ipairs(s.pauses.full) do n = n + c end\n"
+        "assert(n == s.cycles.full and s.objects.table >= 100)\n"
+        "assert(s.strings.load == s.strings.used / s.strings.size)\n"
+        "return s.cycles.minor\n";
+    lua_State *L1 = luaL_newstate();
+    compat55_GCStats s0, s1;
+    size_t steps = 0, total;
+    int i, ok = 1;
+    (void)L;
+    luaL_openlibs(L1);
+    compat55_getstats(L1, &s0);
+    if (luaL_dostring(L1, code) != 0 || lua_tointeger(L1, -1) <= 0) ok = 0;
+    lua_pop(L1, 1);
+    compat55_getstats(L1, &s1);
+    if (s1.full < s0.full + 1 || s1.minor == 0 || s1.incremental == 0) ok = 0;
+    total = (size_t)lua_gc(L1, LUA_GCCOUNT, 0) * 1024 +
+            (size_t)lua_gc(L1, LUA_GCCOUNTB, 0);
+    /* everything but the global state is counted */
+    if (s1.allocated - s1.freed >= total ||
+        total - (s1.allocated - s1.freed) > 8192) ok = 0;
+    if (s1.freed <= s0.freed || s1.objects[LUA_TTABLE] < 100) ok = 0;
+    if (s1.strused == 0 || s1.strused > s1.strsize * 2) ok = 0;
+    for (i = 0; i < COMPAT55_GCSTATBUCKETS; i++)
+        steps += s1.pauses[COMPAT55_GCS_STEP][i];
+    if (steps == 0) ok = 0;
+    lua_close(L1);
+    return ok ? 0 : 1;
+}
+
+typedef struct CensusBuf {
+    char data[16384];
+    size_t n;
+} CensusBuf;
+
+static int census_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+    CensusBuf *b = (CensusBuf *)ud;
+    (void)L;
+    if (b->n + sz >= sizeof(b->data)) return 1;
+    memcpy(b->data + b->n, p, sz);
+    b->n += sz;
+    b->data[b->n] = '\0';
+    return 0;
+}
+
+TEST(census) {
+    const char *code =
+        "local census = require 'census'\n"
+        "local old = census.snapshot()\n"
+        "local mt = {__name = 'Player'}\n"
+        "players = {}\n"
+        "for i = 1, 1000 do players[i] = setmetatable({id = i}, mt) end\n"
+        "local d = census.diff(old, census.snapshot(nil, true))\n"
+        "assert(d:find('table\\tPlayer\\t%+1000\\t'), d)\n"
+        "assert(d:find('registry%[2%]%.players%[1%]'), d)\n"
+        "assert(d:find('total\\t%+100%d\\t'), d)\n"
+        /* a path too long to print ends with '...' */
+        "deep = {}\n"
+        "local t = deep\n"
+        "for i = 1, 100 do t.x = {}; t = t.x end\n"
+        "t.leaf = setmetatable({}, {__name = 'Leaf'}); t = nil\n"
+        "local s = census.snapshot(nil, true)\n"
+        "local p = s:match('table\\tLeaf\\t1\\t%d+\\t([^\\n]*)')\n"
+        "assert(p and p:find('^registry%[2%]%.deep%.x%.x') and\n"
+        "       p:sub(-3) == '...', p)\n"
+        "deep = nil\n";
+    lua_State *L1 = luaL_newstate();
+    static CensusBuf b;
+    compat55_GCStats s0, s1;
+    int ok = 1;
+    (void)L;
+    luaL_openlibs(L1);
+    if (luaL_dostring(L1, code) != 0) {
+        fprintf(stderr, "    %s\n", lua_tostring(L1, -1));
+        ok = 0;
+    }
+    lua_gc(L1, LUA_GCCOLLECT, 0);
+    b.n = 0;
+    compat55_getstats(L1, &s0);
+    if (compat55_census(L1, census_writer, &b,
+                        COMPAT55_CENSUSPATHS) != 0) ok = 0;
+    compat55_getstats(L1, &s1);
+    /* the walk creates no Lua objects */
+    if (s1.allocated != s0.allocated) ok = 0;
+    if (strncmp(b.data, "census\t1\t", 9) != 0) ok = 0;
+    if (!strstr(b.data, "table\tPlayer\t1000\t")) ok = 0;
+    if (!strstr(b.data, "\tmainthread\n")) ok = 0;
+    lua_close(L1);
+    return ok ? 0 : 1;
+}
+
+TEST(slab_alloc) {
+    const char *code =
+        "local t, s = {}, {}\n"
+        "for i = 1, 20000 do\n"
+        "  t[i % 500 + 1] = {i, tostring(i), function() return i end}\n"
+        "  s[i % 50 + 1] = string.rep('x', i % 2000)\n"
+        "end\n"
+        "collectgarbage()\n"
+        "return #t + #s\n";
+    compat55_Slab *S = compat55_slab_new(0);
+    compat55_SlabClass c;
+    lua_State *L1;
+    size_t small = 0, pages = 0;
+    int i, ok = 1;
+    (void)L;
+    if (!S) return 1;
+    L1 = lua_newstate(compat55_slab_alloc, S);
+    luaL_openlibs(L1);
+    if (lua_gc(L1, LUA_GCDEFERFREE, 1) != -1) ok = 0;   /* slabs have no locks */
+    if (luaL_dostring(L1, code) != 0 || lua_tointeger(L1, -1) != 550) ok = 0;
+    for (i = 0; compat55_slab_class(S, i, &c); i++)
+        if (c.size > 0) small += c.live;
+    if (small == 0 || c.size != 0 || c.live == 0 || c.allocs == 0) ok = 0;
+    lua_close(L1);
+    /* every block came back; only the kept empty pages remain */
+    for (i = 0; compat55_slab_class(S, i, &c); i++)
+        if (c.live != 0 || c.bytes != 0) ok = 0;
+    if (compat55_slab_trim(S) == 0) ok = 0;
+    for (i = 0; compat55_slab_class(S, i, &c); i++) pages += c.pages;
+    if (pages != 0) ok = 0;
+
+    /* switching allocators with blocks from realloc still alive */
+    L1 = luaL_newstate();
+    luaL_openlibs(L1);
+    if (luaL_dostring(L1, code) != 0) ok = 0;
+    lua_gc(L1, LUA_GCDEFERFREE, 1);
+    lua_setallocf(L1, compat55_slab_alloc, S);   /* turns it off again */
+    if (lua_gc(L1, LUA_GCDEFERFREE, 0) != 0) ok = 0;
+    if (luaL_dostring(L1, code) != 0 || lua_tointeger(L1, -1) != 550) ok = 0;
+    lua_close(L1);
+    for (i = 0; compat55_slab_class(S, i, &c); i++)
+        if (c.size > 0 && c.live != 0) ok = 0;
+    compat55_slab_free(S);
+    return ok ? 0 : 1;
+}
+
+static int pool_init(lua_State *L, void *ud) {
+    return luaL_dostring(L, (const char *)ud);
+}
+
+TEST(state_pool) {
+    const char *jobs =
+        "function echo(...) return ... end\n"
+        "function sum(t) local s = 0 for _, v in ipairs(t) do s = s + v end\n"
+        "  return s, t.name .. '!' end\n"
+        "function fail() error('boom', 0) end\n";
+    compat55_Pool *P = compat55_pool_new(2, 2, pool_init, (void *)jobs);
+    compat55_Job *job;
+    compat55_PoolStats st;
+    int top = lua_gettop(L), ok = 1, i, n = 0;
+    if (!P) return 1;
+
+    /* values survive the copy both ways */
+    (void)luaL_dostring(L, "return 42, -7, 0.5, 'a\\0b', true, nil, "
+                           "{1, 2, {x = {y = 'deep'}}, k = false}");
+    job = compat55_pool_submit(P, L, "echo", 7);
+    if (!job || lua_gettop(L) != top) ok = 0;
+    if (compat55_pool_result(job, L) != 7) ok = 0;
+    lua_setglobal(L, "pool_t");
+    if (luaL_dostring(L, "return pool_t[3].x.y == 'deep' and pool_t.k == false "
+                         "and #pool_t == 3") != 0 || !lua_toboolean(L, -1)) ok = 0;
+    lua_pop(L, 1);
+    if (!lua_isnil(L, -1) || !lua_toboolean(L, -2) || lua_objlen(L, -3) != 3 ||
+        lua_tonumber(L, -4) != 0.5 || lua_tointeger(L, -5) != -7 ||
+        lua_tointeger(L, -6) != 42) ok = 0;
+    lua_settop(L, top);
+
+    /* many jobs, collected in completion order */
+    for (i = 1; i <= 100; i++) {
+        lua_createtable(L, 2, 1);
+        lua_pushinteger(L, i);
+        lua_rawseti(L, -2, 1);
+        lua_pushinteger(L, 1);
+        lua_rawseti(L, -2, 2);
+        lua_pushliteral(L, "job");
+        lua_setfield(L, -2, "name");
+        if (!compat55_pool_submit(P, L, "sum", 1)) ok = 0;
+    }
+    while ((job = compat55_pool_next(P, 1)) != NULL) {
+        if (compat55_pool_result(job, L) != 2) ok = 0;
+        n += (int)lua_tointeger(L, -2);
+        if (strcmp(lua_tostring(L, -1), "job!") != 0) ok = 0;
+        lua_settop(L, top);
+    }
+    if (n != 5050 + 100) ok = 0;
+
+    /* errors come back as messages */
+    job = compat55_pool_submit(P, L, "fail", 0);
+    if (compat55_pool_result(job, L) != -1 || strcmp(lua_tostring(L, -1), "boom") != 0)
+        ok = 0;
+    lua_settop(L, top);
+    job = compat55_pool_submit(P, L, "missing", 0);
+    if (compat55_pool_result(job, L) != -1) ok = 0;
+    lua_settop(L, top);
+
+    /* shared subtables are copied once and stay shared; so do cycles */
+    (void)luaL_dostring(L, "local t = {} for i = 1, 30 do t = {t, t} end\n"
+                           "local c = {} c.self = c\n"
+                           "return t, c, t");
+    job = compat55_pool_submit(P, L, "echo", 3);
+    if (!job || compat55_pool_result(job, L) != 3) ok = 0;
+    lua_setglobal(L, "pool_t2");
+    lua_setglobal(L, "pool_c");
+    lua_setglobal(L, "pool_t");
+    if (luaL_dostring(L, "local t, n = pool_t, 0\n"
+                         "while t[1] do\n"
+                         "  if t[1] ~= t[2] then return false end\n"
+                         "  t, n = t[1], n + 1\n"
+                         "end\n"
+                         "return n == 30 and pool_t == pool_t2 and pool_c.self == pool_c")
+            != 0 || !lua_toboolean(L, -1)) ok = 0;
+    lua_settop(L, top);
+    (void)luaL_dostring(L, "pool_t2, pool_c = nil");
+
+    /* light userdata keeps its pointer */
+    lua_pushlightuserdata(L, &st);
+    job = compat55_pool_submit(P, L, "echo", 1);
+    if (!job || compat55_pool_result(job, L) != 1 || lua_touserdata(L, -1) != &st)
+        ok = 0;
+    lua_settop(L, top);
+
+    /* functions stay in their state */
+    lua_getglobal(L, "print");
+    if (compat55_pool_submit(P, L, "echo", 1) != NULL || !lua_isstring(L, -1)) ok = 0;
+    lua_settop(L, top);
+
+    compat55_pool_stats(P, &st);
+    if (st.threads != 2 || st.states != 4 || st.jobs != 105 || st.pending != 0) ok = 0;
+    compat55_pool_free(P);
+    lua_pushnil(L);
+    lua_setglobal(L, "pool_t");
+    return ok ? 0 : 1;
+}
+#endif
+
 TEST(loadbuffer) {
     const char *code = "return 1 + 2";
     if (luaL_loadbuffer(L, code, strlen(code), "test") != 0) {
@@ -714,6 +1595,43 @@ TEST(buffer_api) {
     return 0;
 }
 
+TEST(buffer_large) {
+    /* spans many LUAL_BUFFERSIZE blocks through every entry point */
+    luaL_Buffer b;
+    size_t len, i, n = 0;
+    const char *s;
+    int ok = 1, top = lua_gettop(L);
+    luaL_buffinit(L, &b);
+    for (i = 0; i < 100000; i++) {
+        luaL_addchar(&b, (char)('a' + i % 26));
+        n++;
+        if (i % 1000 == 0) {
+            char *p = luaL_prepbuffer(&b);
+            memset(p, '#', 100);
+            luaL_addsize(&b, 100);
+            n += 100;
+            lua_pushfstring(L, "<%d>", (int)i);
+            n += lua_objlen(L, -1);
+            luaL_addvalue(&b);
+        }
+        if (i % 25000 == 0) {
+            static char big[20000];
+            memset(big, '=', sizeof(big));
+            luaL_addlstring(&b, big, sizeof(big));
+            n += sizeof(big);
+            lua_pushlstring(L, big, sizeof(big));
+            luaL_addvalue(&b);
+            n += sizeof(big);
+        }
+    }
+    luaL_pushresult(&b);
+    s = lua_tolstring(L, -1, &len);
+    if (lua_gettop(L) != top + 1 || len != n) ok = 0;
+    else if (s[0] != 'a' || s[len] != '\0' || strstr(s, "<99000>") == NULL) ok = 0;
+    lua_settop(L, top);
+    return ok ? 0 : 1;
+}
+
 TEST(typename_macro) {
     lua_pushnumber(L, 1);
     const char *tn = luaL_typename(L, -1);
@@ -979,8 +1897,10 @@ int main(int argc, char *argv[]) {
     /* Table / get / set */
     RUN(table_ops);
     RUN(userdata);
+    RUN(userdata_fenv);
     RUN(metatable);
     RUN(global);
+    RUN(field_caches);
 
     /* Load and call */
     RUN(call_pcall);
@@ -1001,6 +1921,8 @@ int main(int argc, char *argv[]) {
     RUN(getstack_getinfo);
     RUN(upvalue);
     RUN(sethook);
+    RUN(getlocal);
+    RUN(hook_getinfo);
 
     /* Aux library */
     RUN(luaL_register_test);
@@ -1011,12 +1933,33 @@ int main(int argc, char *argv[]) {
     RUN(where_error);
     RUN(checkoption);
     RUN(ref_unref);
+    RUN(ref_registry);
+    RUN(ref_churn);
     RUN(loadbuffer);
     RUN(loadstring);
     RUN(dostring);
     RUN(buffer_api);
+    RUN(buffer_large);
     RUN(typename_macro);
 
+#ifdef COMPAT55_EXT
+    /* compat55 extensions */
+    RUN(loadfile_cache);
+    RUN(bulk_transfer);
+    RUN(cpuprof);
+    RUN(heapprof);
+    RUN(opstats);
+    RUN(opstats_gc);
+    RUN(state_pool);
+    RUN(serialize);
+    RUN(gc_budget);
+    RUN(deferfree);
+    RUN(parmark);
+    RUN(gc_stats);
+    RUN(census);
+    RUN(slab_alloc);
+#endif
+
     /* Standard libs */
     RUN(openlibs);
 
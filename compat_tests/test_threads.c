@@ -0,0 +1,196 @@
+/*
+ * Multi-threaded stress and throughput test.
+ *
+ * Runs one independent lua_State per worker thread.  Each worker sets a
+ * count hook and repeatedly calls into a C function that walks the
+ * stack with lua_getstack/lua_getinfo/lua_getlocal, checking that it
+ * only ever sees its own chunk and locals.  Any cross-state leakage of
+ * debug or hook storage shows up as a failure.  Then the same workload
+ * is timed with 1..N threads to show how throughput scales.
+ *
+ * Uses only the standard 5.1 headers; builds against lua51 and compat55.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE thread_t;
+#define THREAD_FUNC DWORD WINAPI
+#define THREAD_RETURN return 0
+#else
+#include <pthread.h>
+#include <time.h>
+typedef pthread_t thread_t;
+#define THREAD_FUNC void *
+#define THREAD_RETURN return NULL
+#endif
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+#define MAX_THREADS 64
+
+typedef struct Worker {
+    int id;
+    int iters;
+    long hooks;
+    int failures;
+    char chunkname[32];
+} Worker;
+
+static double now_sec(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+static int thread_start(thread_t *t, THREAD_FUNC (*fn)(void *), void *arg) {
+#ifdef _WIN32
+    *t = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)fn, arg, 0, NULL);
+    return *t != NULL;
+#else
+    return pthread_create(t, NULL, fn, arg) == 0;
+#endif
+}
+
+static void thread_join(thread_t t) {
+#ifdef _WIN32
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+#else
+    pthread_join(t, NULL);
+#endif
+}
+
+static Worker *get_worker(lua_State *L) {
+    Worker *w;
+    lua_getfield(L, LUA_REGISTRYINDEX, "test_threads.worker");
+    w = (Worker *)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return w;
+}
+
+static void count_hook(lua_State *L, lua_Debug *ar) {
+    (void)ar;
+    get_worker(L)->hooks++;
+}
+
+/* check(id): caller's chunk and first local must belong to this worker */
+static int l_check(lua_State *L) {
+    Worker *w = get_worker(L);
+    int id = (int)luaL_checkinteger(L, 1);
+    lua_Debug ar;
+    const char *name;
+    if (!lua_getstack(L, 1, &ar) || !lua_getinfo(L, "Sl", &ar)) {
+        w->failures++;
+        return 0;
+    }
+    if (strcmp(ar.source, w->chunkname) != 0 || id != w->id)
+        w->failures++;
+    name = lua_getlocal(L, &ar, 1);
+    if (!name || strcmp(name, "mine") != 0 || lua_tointeger(L, -1) != w->id)
+        w->failures++;
+    if (name) lua_pop(L, 1);
+    return 0;
+}
+
+static const char *workload =
+    "local mine = ...\n"
+    "local t, s = {}, 0\n"
+    "for i = 1, 200 do\n"
+    "  t[i] = i * mine\n"
+    "  s = s + t[i] % 7\n"
+    "  if i % 50 == 0 then check(mine) end\n"
+    "end\n"
+    "return s\n";
+
+static THREAD_FUNC worker_main(void *arg) {
+    Worker *w = (Worker *)arg;
+    lua_State *L = luaL_newstate();
+    int i;
+    luaL_openlibs(L);
+    lua_pushlightuserdata(L, w);
+    lua_setfield(L, LUA_REGISTRYINDEX, "test_threads.worker");
+    lua_register(L, "check", l_check);
+    lua_sethook(L, count_hook, LUA_MASKCOUNT, 1000);
+    sprintf(w->chunkname, "=worker%d", w->id);
+    if (luaL_loadbuffer(L, workload, strlen(workload), w->chunkname) != 0) {
+        w->failures++;
+        lua_close(L);
+        THREAD_RETURN;
+    }
+    for (i = 0; i < w->iters; i++) {
+        lua_pushvalue(L, -1);
+        lua_pushinteger(L, w->id);
+        if (lua_pcall(L, 1, 1, 0) != 0) {
+            w->failures++;
+            break;
+        }
+        lua_pop(L, 1);
+    }
+    if (lua_gethook(L) != count_hook) w->failures++;
+    lua_close(L);
+    THREAD_RETURN;
+}
+
+/* Runs n workers of iters each; returns elapsed seconds */
+static double run_workers(int n, int iters, int *failures, long *hooks) {
+    Worker workers[MAX_THREADS];
+    thread_t threads[MAX_THREADS];
+    double t0 = now_sec();
+    int i;
+    for (i = 0; i < n; i++) {
+        memset(&workers[i], 0, sizeof(Worker));
+        workers[i].id = i + 1;
+        workers[i].iters = iters;
+        if (!thread_start(&threads[i], worker_main, &workers[i])) {
+            fprintf(stderr, "cannot start thread %d\n", i);
+            exit(1);
+        }
+    }
+    for (i = 0; i < n; i++) thread_join(threads[i]);
+    for (i = 0; i < n; i++) {
+        *failures += workers[i].failures;
+        *hooks += workers[i].hooks;
+    }
+    return now_sec() - t0;
+}
+
+int main(int argc, char **argv) {
+    int maxthreads = argc > 1 ? atoi(argv[1]) : 8;
+    int iters = argc > 2 ? atoi(argv[2]) : 2000;
+    int failures = 0, n;
+    long hooks = 0;
+    double base = 0;
+
+    if (maxthreads < 1) maxthreads = 1;
+    if (maxthreads > MAX_THREADS) maxthreads = MAX_THREADS;
+
+    printf("Stress: %d threads x %d runs\n", maxthreads, iters);
+    run_workers(maxthreads, iters, &failures, &hooks);
+    printf("  failures: %d, hook calls: %ld\n", failures, hooks);
+    if (hooks == 0) failures++;
+
+    printf("Throughput (runs/s, same work per thread)\n");
+    for (n = 1; n <= maxthreads; n *= 2) {
+        double t = run_workers(n, iters, &failures, &hooks);
+        double rate = (double)n * iters / t;
+        if (n == 1) base = rate;
+        printf("  %2d thread(s): %10.0f runs/s  speedup %.2fx\n",
+               n, rate, rate / base);
+    }
+
+    printf("Results: %d failure(s)\n", failures);
+    return failures ? 1 : 0;
+}
@@ -378,6 +378,14 @@ LUA_API unsigned (lua55_numbertocstring) (lua55_State *L, int idx, char *buff) {
 }
 
 
+/*
+** Shortest-digits "%.<prec>g"; 0 means "use sprintf" (see lua.h)
+*/
+LUA_API unsigned (lua55_formatnumber) (lua_Number n, int prec, char *buff) {
+  return luaO_fmtfloat(n, prec, buff);
+}
+
+
 LUA_API size_t lua55_stringtonumber (lua55_State *L, const char *s) {
   size_t sz = luaO_str2num(s, s2v(L->top.p));
   if (sz != 0)
@@ -1212,6 +1220,22 @@ LUA_API int lua55_gc (lua55_State *L, int what, ...) {
       g->gcstp = oldstp;  /* restore previous state */
       break;
     }
+    case LUA_GCBUDGET: {
+      lu_byte oldstp = g->gcstp;
+      int us = va_arg(argp, int);  /* time budget in microseconds */
+      g->gcstp = 0;  /* allow GC to run (other bits must be zero here) */
+      res = luaC_budgetstep(L, us);
+      g->gcstp = oldstp;  /* restore previous state */
+      break;
+    }
+    case LUA_GCDEFERFREE: {
+      res = luaM_setdeferfree(L, va_arg(argp, int));
+      break;
+    }
+    case LUA_GCPARMARK: {
+      res = luaC_setparmark(L, va_arg(argp, int));
+      break;
+    }
     case LUA_GCISRUNNING: {
       res = gcrunning(g);
       break;
@@ -1243,6 +1267,21 @@ LUA_API int lua55_gc (lua55_State *L, int what, ...) {
 }
 
 
+/*
+** Copies the collector statistics, which are updated as the state
+** runs, and adds the current state of the string table.
+*/
+LUA_API void lua55_getstats (lua55_State *L, lua55_GCStats *s) {
+  global_State *g;
+  lua_lock(L);
+  g = G(L);
+  *s = g->gcstats;
+  s->strsize = cast_sizet(g->strt.size);
+  s->strused = cast_sizet(g->strt.nuse);
+  lua_unlock(L);
+}
+
+
 
 /*
 ** miscellaneous functions
@@ -1328,6 +1367,7 @@ LUA_API lua_Alloc lua55_getallocf (lua55_State *L, void **ud) {
 
 LUA_API void lua55_setallocf (lua55_State *L, lua_Alloc f, void *ud) {
   lua_lock(L);
+  luaM_syncfree(L);  /* blocks queued for the old function */
   G(L)->ud = ud;
   G(L)->frealloc = f;
   lua_unlock(L);
@@ -1350,6 +1390,228 @@ void lua55_warning (lua55_State *L, const char *msg, int tocont) {
 
 
 
+/*
+** {======================================================
+** Reference store
+** A dense array of values that the collector marks as a root. Free
+** slots hold an empty value whose integer field links the free list,
+** so creating, releasing and dereferencing a reference are all O(1).
+** References are 1-based; slot 'ref' is 'g->refs[ref - 1]'.
+** =======================================================
+*/
+
+#define isfreeref(o)	checktag((o), LUA_VEMPTY)
+
+static TValue *getrefslot (global_State *g, int ref) {
+  if (ref <= 0 || ref > g->nrefs || isfreeref(&g->refs[ref - 1]))
+    return NULL;
+  return &g->refs[ref - 1];
+}
+
+
+/*
+** Pops a value and stores it in the reference store, returning its
+** reference.  'nil' gets the fixed reference -1 (same as LUA_REFNIL).
+*/
+LUA_API int lua55_ref (lua55_State *L) {
+  global_State *g = G(L);
+  int ref;
+  lua_lock(L);
+  api_checkpop(L, 1);
+  if (ttisnil(s2v(L->top.p - 1))) {
+    L->top.p--;
+    lua_unlock(L);
+    return -1;
+  }
+  if (g->freeref != 0) {  /* reuse a free slot? */
+    ref = g->freeref;
+    g->freeref = cast_int(val_(&g->refs[ref - 1]).i);
+  }
+  else {
+    luaM_growvector(L, g->refs, g->nrefs, g->sizerefs, TValue, INT_MAX,
+                       "references");
+    ref = ++g->nrefs;
+  }
+  setobj2n(L, &g->refs[ref - 1], s2v(L->top.p - 1));
+  L->top.p--;
+  lua_unlock(L);
+  return ref;
+}
+
+
+LUA_API void lua55_unref (lua55_State *L, int ref) {
+  global_State *g = G(L);
+  TValue *o;
+  lua_lock(L);
+  o = getrefslot(g, ref);
+  if (o != NULL) {  /* ignore LUA_NOREF, LUA_REFNIL and stale refs */
+    val_(o).i = g->freeref;
+    settt_(o, LUA_VEMPTY);
+    g->freeref = ref;
+  }
+  lua_unlock(L);
+}
+
+
+/*
+** Pushes the value of a reference and returns its type.  Returns
+** LUA_TNONE, pushing nothing, when 'ref' is not a live reference.
+*/
+LUA_API int lua55_getref (lua55_State *L, int ref) {
+  const TValue *o;
+  lua_lock(L);
+  o = getrefslot(G(L), ref);
+  if (o == NULL) {
+    lua_unlock(L);
+    return LUA_TNONE;
+  }
+  setobj2s(L, L->top.p, o);
+  api_incr_top(L);
+  lua_unlock(L);
+  return ttype(o);
+}
+
+
+/*
+** Pops a value and stores it in live reference 'ref'.  Returns 0 (the
+** value is still popped) when 'ref' is not a live reference.
+*/
+LUA_API int lua55_setref (lua55_State *L, int ref) {
+  TValue *o;
+  lua_lock(L);
+  api_checkpop(L, 1);
+  o = getrefslot(G(L), ref);
+  if (o != NULL)
+    setobj2n(L, o, s2v(L->top.p - 1));
+  L->top.p--;
+  lua_unlock(L);
+  return (o != NULL);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Bulk array transfer
+** Copies between C arrays and t[first .. first+n-1] without going
+** through the stack. The 'set' functions first size the array part
+** (luaH_resizearray) to cover the range, so each element is a plain
+** store into it; numbers need no write barrier. A range so far beyond
+** the array part that the grown array would be less than half full
+** goes to the hash part instead, as 'rehash' would do. The 'get' functions
+** stop at the first value that is not a number (or, for integers,
+** has no exact integer value) and return how many they copied.
+** =======================================================
+*/
+
+static Table *bulktable (lua55_State *L, int idx, lua_Integer first, int n,
+                                                int grow) {
+  Table *t = gettable(L, idx);
+  api_check(L, first >= 1 && n >= 0, "invalid range");
+  if (grow && n > 0) {
+    lua_Unsigned last = l_castS2U(first) - 1u + cast_uint(n);
+    if (last > t->asize && t->asize + cast(lua_Unsigned, n) > last / 2) {
+      if (last > UINT_MAX)
+        luaG_runerror(L, "table overflow");
+      luaH_resizearray(L, t, cast_uint(last));
+    }
+  }
+  return t;
+}
+
+
+LUA_API void lua55_rawsetnumbers (lua55_State *L, int idx, lua_Integer first,
+                                  const lua_Number *v, int n) {
+  Table *t;
+  lua_Unsigned u;
+  int i;
+  lua_lock(L);
+  t = bulktable(L, idx, first, n, 1);
+  u = l_castS2U(first) - 1u;
+  for (i = 0; i < n; i++, u++) {
+    if (u < t->asize) {
+      *getArrTag(t, u) = LUA_VNUMFLT;
+      getArrVal(t, u)->n = v[i];
+    }
+    else {  /* beyond the array part */
+      TValue o;
+      setfltvalue(&o, v[i]);
+      luaH_setint(L, t, l_castU2S(u + 1u), &o);
+    }
+  }
+  lua_unlock(L);
+}
+
+
+LUA_API void lua55_rawsetintegers (lua55_State *L, int idx, lua_Integer first,
+                                   const lua_Integer *v, int n) {
+  Table *t;
+  lua_Unsigned u;
+  int i;
+  lua_lock(L);
+  t = bulktable(L, idx, first, n, 1);
+  u = l_castS2U(first) - 1u;
+  for (i = 0; i < n; i++, u++) {
+    if (u < t->asize) {
+      *getArrTag(t, u) = LUA_VNUMINT;
+      getArrVal(t, u)->i = v[i];
+    }
+    else {  /* beyond the array part */
+      TValue o;
+      setivalue(&o, v[i]);
+      luaH_setint(L, t, l_castU2S(u + 1u), &o);
+    }
+  }
+  lua_unlock(L);
+}
+
+
+LUA_API int lua55_rawgetnumbers (lua55_State *L, int idx, lua_Integer first,
+                                 lua_Number *v, int n) {
+  Table *t;
+  int i;
+  lua_lock(L);
+  t = bulktable(L, idx, first, n, 0);
+  for (i = 0; i < n; i++) {
+    TValue res;
+    lu_byte tag;
+    luaH_fastgeti(t, first + i, &res, tag);
+    if (tag == LUA_VNUMFLT)
+      v[i] = fltvalue(&res);
+    else if (tag == LUA_VNUMINT)
+      v[i] = cast_num(ivalue(&res));
+    else
+      break;
+  }
+  lua_unlock(L);
+  return i;
+}
+
+
+LUA_API int lua55_rawgetintegers (lua55_State *L, int idx, lua_Integer first,
+                                  lua_Integer *v, int n) {
+  Table *t;
+  int i;
+  lua_lock(L);
+  t = bulktable(L, idx, first, n, 0);
+  for (i = 0; i < n; i++) {
+    TValue res;
+    lu_byte tag;
+    luaH_fastgeti(t, first + i, &res, tag);
+    if (tag == LUA_VNUMINT)
+      v[i] = ivalue(&res);
+    else if (!(tag == LUA_VNUMFLT &&
+               luaV_flttointeger(fltvalue(&res), &v[i], F2Ieq)))
+      break;
+  }
+  lua_unlock(L);
+  return i;
+}
+
+/* }====================================================== */
+
+
 LUA_API void *lua55_newuserdatauv (lua55_State *L, size_t size, int nuvalue) {
   Udata *u;
   lua_lock(L);
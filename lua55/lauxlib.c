@@ -7,6 +7,10 @@
 #define lauxlib_c
 #define LUA_LIB
 
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE	/* 'madvise' for the slab allocator's huge pages */
+#endif
+
 #include "lprefix.h"
 
 
@@ -1057,6 +1061,425 @@ void *lua55L_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
 }
 
 
+/*
+** {======================================================
+** Slab allocator
+** =======================================================
+*/
+
+/*
+** Blocks of up to LUAL_SLABMAX bytes come from pages of one size class
+** each: 16-byte steps up to 256 bytes, then 64-byte steps. A page is
+** aligned to its size, so masking a block address gives its page; a
+** hash set of all pages tells our blocks from 'realloc' ones (large
+** blocks, and blocks from the allocator used before 'lua55_setallocf').
+** Each page keeps its own free list and a bump pointer for blocks never
+** handed out; pages with free blocks are linked per class. A page whose
+** last block is freed is released, unless it is the only empty page of
+** its class.
+*/
+
+#if defined(LUA_USE_POSIX)
+#include <sys/mman.h>
+#if defined(MAP_ANONYMOUS) && defined(MADV_HUGEPAGE)
+#define SLAB_MMAP
+#endif
+#endif
+
+#define SLABSHIFT	16	/* log2 of the page size (64 KB) */
+#define SLABHUGESHIFT	21	/* log2 of the huge page size (2 MB) */
+
+#define NCLASSES	20
+
+#define classsize(c)  \
+	((c) < 16 ? (cast_sizet(c) + 1) * 16 : (cast_sizet(c) - 11) * 64)
+
+#define sizeclass(n)	((n) <= 256 ? cast_int(((n) - 1) / 16)  \
+                                    : cast_int(((n) - 1) / 64) + 12)
+
+
+typedef struct SlabPage {
+  struct SlabPage *next, *prev;  /* list of pages with free blocks */
+  void *raw;  /* memory to 'free' when it is not the page itself */
+  char *freelist;  /* freed blocks */
+  char *bump;  /* first block never handed out */
+  char *limit;  /* end of the last block */
+  unsigned int live;  /* blocks in use */
+  int cls;
+} SlabPage;
+
+/* blocks start after the page header, 16-byte aligned */
+#define PAGEHEADER	((sizeof(SlabPage) + 15) & ~cast_sizet(15))
+
+#define pagefull(pg)	((pg)->freelist == NULL && (pg)->bump == (pg)->limit)
+
+
+struct lua55L_Slab {
+  SlabPage **map;  /* all pages (open addressing, linear probing) */
+  size_t mapsize;  /* size of 'map' (a power of 2) */
+  size_t npages;
+  int shift;  /* log2 of the page size */
+  int huge;  /* pages are mapped with huge pages */
+  struct {
+    SlabPage *partial;  /* pages with free blocks */
+    size_t empty;  /* pages in 'partial' with no block in use */
+    lua55L_SlabClass st;
+  } c[NCLASSES + 1];  /* last one counts large blocks */
+};
+
+
+static size_t pagehash (lua55L_Slab *S, L_P2I page) {
+  return cast_sizet((page >> S->shift) * 2654435761u) & (S->mapsize - 1);
+}
+
+
+static SlabPage *findpage (lua55L_Slab *S, const void *block) {
+  L_P2I page = cast(L_P2I, block) & ~((cast(L_P2I, 1) << S->shift) - 1);
+  size_t i = pagehash(S, page);
+  SlabPage *pg;
+  while ((pg = S->map[i]) != NULL) {
+    if (cast(L_P2I, pg) == page)
+      return pg;
+    i = (i + 1) & (S->mapsize - 1);
+  }
+  return NULL;
+}
+
+
+static void insertpage (lua55L_Slab *S, SlabPage **map, SlabPage *pg) {
+  size_t i = pagehash(S, cast(L_P2I, pg));
+  while (map[i] != NULL)
+    i = (i + 1) & (S->mapsize - 1);
+  map[i] = pg;
+}
+
+
+/* adds a page to the set, doubling it when half full; 0 if no memory */
+static int mappage (lua55L_Slab *S, SlabPage *pg) {
+  if (2 * (S->npages + 1) > S->mapsize) {
+    SlabPage **old = S->map;
+    size_t oldsize = S->mapsize, i;
+    SlabPage **map = cast(SlabPage **, calloc(2 * oldsize, sizeof(SlabPage *)));
+    if (map == NULL)
+      return 0;
+    S->mapsize = 2 * oldsize;
+    for (i = 0; i < oldsize; i++) {
+      if (old[i] != NULL)
+        insertpage(S, map, old[i]);
+    }
+    S->map = map;
+    free(old);
+  }
+  insertpage(S, S->map, pg);
+  S->npages++;
+  return 1;
+}
+
+
+/* removes a page, moving later entries of its probe run back */
+static void unmappage (lua55L_Slab *S, SlabPage *pg) {
+  size_t mask = S->mapsize - 1;
+  size_t i = pagehash(S, cast(L_P2I, pg));
+  size_t j;
+  while (S->map[i] != pg)
+    i = (i + 1) & mask;
+  for (j = (i + 1) & mask; S->map[j] != NULL; j = (j + 1) & mask) {
+    size_t home = pagehash(S, cast(L_P2I, S->map[j]));
+    if (((j - home) & mask) >= ((j - i) & mask)) {  /* can fill the hole? */
+      S->map[i] = S->map[j];
+      i = j;
+    }
+  }
+  S->map[i] = NULL;
+  S->npages--;
+}
+
+
+static void *getpagemem (lua55L_Slab *S, void **raw) {
+  size_t size = cast_sizet(1) << S->shift;
+  *raw = NULL;
+#if defined(SLAB_MMAP)
+  if (S->huge) {  /* map twice the size and trim it to an aligned page */
+    char *p = cast_charp(mmap(NULL, 2 * size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    size_t lead;
+    if (p == cast_charp(MAP_FAILED))
+      return NULL;
+    lead = (size - (cast(L_P2I, p) & (size - 1))) & (size - 1);
+    if (lead > 0)
+      munmap(p, lead);
+    munmap(p + lead + size, size - lead);
+    p += lead;
+    madvise(p, size, MADV_HUGEPAGE);  /* only a hint */
+    return p;
+  }
+#endif
+#if defined(LUA_USE_POSIX)
+  {
+    void *p;
+    return (posix_memalign(&p, size, size) == 0) ? p : NULL;
+  }
+#else
+  {
+    char *p = cast_charp(malloc(2 * size));
+    if (p == NULL)
+      return NULL;
+    *raw = p;
+    return p + ((size - (cast(L_P2I, p) & (size - 1))) & (size - 1));
+  }
+#endif
+}
+
+
+static void freepagemem (lua55L_Slab *S, SlabPage *pg) {
+#if defined(SLAB_MMAP)
+  if (S->huge) {
+    munmap(pg, cast_sizet(1) << S->shift);
+    return;
+  }
+#endif
+  free(pg->raw != NULL ? pg->raw : pg);
+}
+
+
+static void linkpage (lua55L_Slab *S, SlabPage *pg) {
+  SlabPage **list = &S->c[pg->cls].partial;
+  pg->prev = NULL;
+  pg->next = *list;
+  if (*list != NULL)
+    (*list)->prev = pg;
+  *list = pg;
+}
+
+
+static void unlinkpage (lua55L_Slab *S, SlabPage *pg) {
+  if (pg->prev != NULL)
+    pg->prev->next = pg->next;
+  else
+    S->c[pg->cls].partial = pg->next;
+  if (pg->next != NULL)
+    pg->next->prev = pg->prev;
+}
+
+
+static SlabPage *newpage (lua55L_Slab *S, int c) {
+  size_t size = cast_sizet(1) << S->shift;
+  void *raw;
+  SlabPage *pg = cast(SlabPage *, getpagemem(S, &raw));
+  if (pg == NULL)
+    return NULL;
+  pg->raw = raw;
+  if (!mappage(S, pg)) {
+    freepagemem(S, pg);
+    return NULL;
+  }
+  pg->cls = c;
+  pg->live = 0;
+  pg->freelist = NULL;
+  pg->bump = cast_charp(pg) + PAGEHEADER;
+  pg->limit = pg->bump + (size - PAGEHEADER) / classsize(c) * classsize(c);
+  linkpage(S, pg);
+  S->c[c].empty++;
+  S->c[c].st.pages++;
+  return pg;
+}
+
+
+/* releases an empty page */
+static void releasepage (lua55L_Slab *S, SlabPage *pg) {
+  unlinkpage(S, pg);
+  unmappage(S, pg);
+  S->c[pg->cls].empty--;
+  S->c[pg->cls].st.pages--;
+  freepagemem(S, pg);
+}
+
+
+static void *smallalloc (lua55L_Slab *S, int c) {
+  SlabPage *pg = S->c[c].partial;
+  char *b;
+  if (pg == NULL && (pg = newpage(S, c)) == NULL)
+    return NULL;
+  if (pg->freelist != NULL) {
+    b = pg->freelist;
+    pg->freelist = *cast(char **, b);
+  }
+  else {
+    b = pg->bump;
+    pg->bump += classsize(c);
+  }
+  if (pg->live++ == 0)
+    S->c[c].empty--;
+  if (pagefull(pg))
+    unlinkpage(S, pg);
+  S->c[c].st.live++;
+  S->c[c].st.allocs++;
+  S->c[c].st.bytes += classsize(c);
+  return b;
+}
+
+
+static void smallfree (lua55L_Slab *S, SlabPage *pg, void *b) {
+  int c = pg->cls;
+  if (pagefull(pg))
+    linkpage(S, pg);
+  *cast(char **, b) = pg->freelist;
+  pg->freelist = cast_charp(b);
+  S->c[c].st.live--;
+  S->c[c].st.bytes -= classsize(c);
+  if (--pg->live == 0) {
+    S->c[c].empty++;
+    if (S->c[c].empty > 1)  /* keep one empty page per class */
+      releasepage(S, pg);
+  }
+}
+
+
+/*
+** Large blocks go to 'realloc'. Blocks from the allocator used before
+** 'lua55_setallocf' go here too; they were never counted, hence the
+** saturating subtractions.
+*/
+static void *largealloc (lua55L_Slab *S, void *ptr, size_t osize,
+                                                    size_t nsize) {
+  lua55L_SlabClass *st = &S->c[NCLASSES].st;
+  void *b;
+  if (nsize == 0) {
+    free(ptr);
+    b = NULL;
+  }
+  else if ((b = realloc(ptr, nsize)) == NULL)
+    return NULL;
+  if (ptr != NULL) {  /* old block gone */
+    st->live -= (st->live > 0);
+    st->bytes -= (osize < st->bytes) ? osize : st->bytes;
+  }
+  if (b != NULL) {
+    st->live++;
+    st->allocs += (ptr == NULL);
+    st->bytes += nsize;
+  }
+  return b;
+}
+
+
+LUALIB_API void *lua55L_slaballoc (void *ud, void *ptr, size_t osize,
+                                                      size_t nsize) {
+  lua55L_Slab *S = cast(lua55L_Slab *, ud);
+  SlabPage *pg = (ptr != NULL) ? findpage(S, ptr) : NULL;
+  void *b;
+  if (ptr == NULL)
+    osize = 0;  /* it holds the type of a new object */
+  if (pg == NULL) {  /* no block yet, or a large one */
+    if (nsize == 0 || nsize > LUAL_SLABMAX)
+      return largealloc(S, ptr, osize, nsize);
+    b = smallalloc(S, sizeclass(nsize));
+    if (b == NULL)  /* keep a large block when shrinking */
+      return (nsize <= osize) ? largealloc(S, ptr, osize, nsize) : NULL;
+    if (ptr != NULL) {
+      memcpy(b, ptr, (osize < nsize) ? osize : nsize);
+      largealloc(S, ptr, osize, 0);
+    }
+    return b;
+  }
+  else if (nsize == 0) {
+    smallfree(S, pg, ptr);
+    return NULL;
+  }
+  else if (nsize <= LUAL_SLABMAX && sizeclass(nsize) == pg->cls)
+    return ptr;  /* same class */
+  b = (nsize > LUAL_SLABMAX) ? largealloc(S, NULL, 0, nsize)
+                             : smallalloc(S, sizeclass(nsize));
+  if (b == NULL)  /* a shrinking block can stay where it is */
+    return (nsize < classsize(pg->cls)) ? ptr : NULL;
+  memcpy(b, ptr, (osize < nsize) ? osize : nsize);
+  smallfree(S, pg, ptr);
+  return b;
+}
+
+
+/*
+** Creates a slab; with LUAL_SLABHUGE, pages are 2 MB and mapped with
+** transparent huge pages where the system has them, which pays off only
+** for heaps of many megabytes.
+*/
+LUALIB_API lua55L_Slab *lua55L_newslab (int flags) {
+  lua55L_Slab *S = cast(lua55L_Slab *, calloc(1, sizeof(lua55L_Slab)));
+  int c;
+  if (S == NULL)
+    return NULL;
+  S->mapsize = 64;
+  S->map = cast(SlabPage **, calloc(S->mapsize, sizeof(SlabPage *)));
+  if (S->map == NULL) {
+    free(S);
+    return NULL;
+  }
+  S->shift = SLABSHIFT;
+#if defined(SLAB_MMAP)
+  if (flags & LUAL_SLABHUGE) {
+    S->shift = SLABHUGESHIFT;
+    S->huge = 1;
+  }
+#else
+  UNUSED(flags);
+#endif
+  for (c = 0; c < NCLASSES; c++)
+    S->c[c].st.size = classsize(c);
+  return S;
+}
+
+
+/*
+** Releases all pages at once; call it after closing the state. Large
+** blocks still in use are not freed.
+*/
+LUALIB_API void lua55L_freeslab (lua55L_Slab *S) {
+  size_t i;
+  if (S == NULL)
+    return;
+  for (i = 0; i < S->mapsize; i++) {
+    if (S->map[i] != NULL)
+      freepagemem(S, S->map[i]);
+  }
+  free(S->map);
+  free(S);
+}
+
+
+/*
+** Fills 'c' with the statistics of class 'i' (from 0; the last class
+** counts the large blocks) and returns 1, or returns 0 when there is
+** no such class.
+*/
+LUALIB_API int lua55L_slabclass (lua55L_Slab *S, int i, lua55L_SlabClass *c) {
+  if (i < 0 || i > NCLASSES)
+    return 0;
+  *c = S->c[i].st;
+  return 1;
+}
+
+
+/* releases all empty pages; returns the number of bytes released */
+LUALIB_API size_t lua55L_slabtrim (lua55L_Slab *S) {
+  size_t n = 0;
+  int c;
+  for (c = 0; c < NCLASSES; c++) {
+    SlabPage *pg = S->c[c].partial;
+    while (pg != NULL) {
+      SlabPage *next = pg->next;
+      if (pg->live == 0) {
+        releasepage(S, pg);
+        n += cast_sizet(1) << S->shift;
+      }
+      pg = next;
+    }
+  }
+  return n;
+}
+
+/* }====================================================== */
+
+
 /*
 ** Standard panic function just prints an error message. The test
 ** with 'lua55_type' avoids possible memory errors in 'lua55_tostring'.
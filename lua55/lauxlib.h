@@ -246,6 +246,48 @@ typedef struct lua55L_Stream {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Slab allocator
+** =======================================================
+*/
+
+/*
+** 'lua55L_slaballoc' is a 'lua55_Alloc' serving blocks of up to
+** LUAL_SLABMAX bytes from pages split into fixed size classes, and
+** larger ones from 'realloc'. Each 'lua55L_Slab' is meant for one
+** state (it has no locks): pass it as the 'ud' of 'lua55_newstate',
+** or of 'lua55_setallocf' for a state that used 'lua55L_alloc' so far.
+** Do not turn on LUA_GCDEFERFREE for such a state: its helper thread
+** would free blocks concurrently.
+*/
+
+typedef struct lua55L_Slab lua55L_Slab;
+
+/* flags for 'lua55L_newslab' */
+#define LUAL_SLABHUGE	1	/* back pages with 2 MB huge pages if possible */
+
+#define LUAL_SLABMAX	512	/* largest block size served from pages */
+
+typedef struct lua55L_SlabClass {
+  size_t size;  /* block size; 0 for blocks above LUAL_SLABMAX */
+  size_t live;  /* blocks in use */
+  size_t bytes;  /* bytes in use */
+  size_t allocs;  /* blocks handed out since creation */
+  size_t pages;  /* pages owned */
+} lua55L_SlabClass;
+
+LUALIB_API lua55L_Slab *(lua55L_newslab) (int flags);
+LUALIB_API void (lua55L_freeslab) (lua55L_Slab *S);
+LUALIB_API void *(lua55L_slaballoc) (void *ud, void *ptr, size_t osize,
+                                                         size_t nsize);
+LUALIB_API int (lua55L_slabclass) (lua55L_Slab *S, int i,
+                                                   lua55L_SlabClass *c);
+LUALIB_API size_t (lua55L_slabtrim) (lua55L_Slab *S);
+
+/* }====================================================== */
+
+
 /*
 ** {============================================================
 ** Compatibility with deprecated conversions
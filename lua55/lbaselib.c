@@ -193,6 +193,62 @@ static int pushmode (lua55_State *L, int oldmode) {
 }
 
 
+static void setstat (lua55_State *L, const char *k, size_t v) {
+  lua55_pushinteger(L, l_castU2S(cast(lua_Unsigned, v)));
+  lua55_setfield(L, -2, k);
+}
+
+
+/*
+** collectgarbage("stats"): a table with the fields of 'lua55_GCStats';
+** pause histograms are arrays with one entry per bucket.
+*/
+static int pushgcstats (lua55_State *L) {
+  static const char *const pausenames[LUA_GCSN] = {"step", "atomic", "full"};
+  lua55_GCStats s;
+  int i, b;
+  lua55_getstats(L, &s);  /* before creating the tables */
+  lua55_createtable(L, 0, 8);
+  setstat(L, "allocated", s.allocated);
+  setstat(L, "freed", s.freed);
+  setstat(L, "promoted", s.promoted);
+  lua55_createtable(L, 0, 4);
+  setstat(L, "incremental", s.incremental);
+  setstat(L, "minor", s.minor);
+  setstat(L, "major", s.major);
+  setstat(L, "full", s.full);
+  lua55_setfield(L, -2, "cycles");
+  lua55_createtable(L, 0, 3);
+  setstat(L, "size", s.strsize);
+  setstat(L, "used", s.strused);
+  lua55_pushnumber(L, (s.strsize > 0) ? (lua_Number)s.strused / (lua_Number)s.strsize
+                                      : 0);
+  lua55_setfield(L, -2, "load");
+  lua55_setfield(L, -2, "strings");
+  lua55_createtable(L, 0, LUA_NUMTYPES + 2 - LUA_TSTRING);
+  for (i = LUA_TSTRING; i < LUA_NUMTYPES; i++)
+    setstat(L, lua55_typename(L, i), s.objects[i]);
+  setstat(L, "upvalue", s.objects[LUA_NUMTYPES]);
+  setstat(L, "proto", s.objects[LUA_NUMTYPES + 1]);
+  lua55_setfield(L, -2, "objects");
+  lua55_createtable(L, 0, LUA_GCSN);
+  for (i = 0; i < LUA_GCSN; i++) {
+    lua55_createtable(L, LUA_GCSTATBUCKETS, 0);
+    for (b = 0; b < LUA_GCSTATBUCKETS; b++) {
+      lua55_pushinteger(L, l_castU2S(cast(lua_Unsigned, s.pauses[i][b])));
+      lua55_rawseti(L, -2, b + 1);
+    }
+    lua55_setfield(L, -2, pausenames[i]);
+  }
+  lua55_setfield(L, -2, "pauses");
+  lua55_createtable(L, 0, LUA_GCSN);
+  for (i = 0; i < LUA_GCSN; i++)
+    setstat(L, pausenames[i], s.pausetime[i]);
+  lua55_setfield(L, -2, "pausetime");
+  return 1;
+}
+
+
 /*
 ** check whether call to 'lua55_gc' was valid (not inside a finalizer)
 */
@@ -201,11 +257,15 @@ static int pushmode (lua55_State *L, int oldmode) {
 static int luaB_collectgarbage (lua55_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "isrunning", "generational", "incremental",
-    "param", NULL};
+    "param", "budget", "stats", NULL};
   static const char optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC,
-    LUA_GCPARAM};
-  int o = optsnum[lua55L_checkoption(L, 1, "collect", opts)];
+    LUA_GCPARAM, LUA_GCBUDGET};
+  int i = lua55L_checkoption(L, 1, "collect", opts);
+  int o;
+  if (i == cast_int(sizeof(optsnum)))  /* "stats" is not a 'lua55_gc' option */
+    return pushgcstats(L);
+  o = optsnum[i];
   switch (o) {
     case LUA_GCCOUNT: {
       int k = lua55_gc(L, o);
@@ -221,6 +281,13 @@ static int luaB_collectgarbage (lua55_State *L) {
       lua55_pushboolean(L, res);
       return 1;
     }
+    case LUA_GCBUDGET: {
+      lua_Integer us = lua55L_optinteger(L, 2, 0);
+      int res = lua55_gc(L, o, (int)((us > INT_MAX) ? INT_MAX : us));
+      checkvalres(res);
+      lua55_pushboolean(L, res);
+      return 1;
+    }
     case LUA_GCISRUNNING: {
       int res = lua55_gc(L, o);
       checkvalres(res);
@@ -0,0 +1,618 @@
+/*
+** $Id: lcensus.c $
+** Heap census
+** See Copyright Notice in lua.h
+*/
+
+#define lcensus_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lapi.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+
+
+/*
+** A census walks the lists of collectable objects ('allgc', 'finobj',
+** 'tobefnz' and 'fixedgc') and adds up the number and size of the
+** objects by type and, for tables and userdata, by the '__name' field
+** of their metatables ("-" for no metatable, the metatable's address
+** when it has no name). Objects already known to be dead are skipped.
+** With LUA_CENSUSPATHS it also does a breadth-first walk of the object
+** graph from the roots, to give each group the path to the first of
+** its objects reached, e.g. "registry._LOADED._G.players[3]". All
+** memory comes from the state's allocation function, not counted as
+** in use and freed before returning, so no Lua object is created and
+** no collection can run during the walk. The snapshot is a text with
+** a header line and a line per group, heaviest first:
+**   census <tab> 1 <tab> objects <tab> bytes
+**   type <tab> name <tab> count <tab> bytes [<tab> path]
+*/
+
+
+#define CENSUSVERSION	1
+
+/* maximum length of names and path elements in a snapshot */
+#define MAXNAME		64
+
+/* maximum number of steps in a path (the ones nearer the root) */
+#define MAXPATH		32
+
+
+typedef struct Group {
+  const void *id;  /* '__name' string, unnamed metatable, or NULL */
+  int type;  /* basic type of its objects */
+  int named;  /* 'id' is a '__name' string */
+  int path;  /* first node reached in the group, or -1 */
+  size_t count;
+  size_t bytes;
+} Group;
+
+
+/* kinds of references in paths */
+enum { RROOT, RFIELD, RINDEX, RKEY, RVALUE, RMETA, RUPVAL, RUSERVAL,
+       RSTACK, RPROTO, RCONST, RCONTENT };
+
+typedef struct CNode {
+  GCObject *o;
+  int parent;  /* -1 for roots */
+  int how;  /* kind of reference from 'parent' */
+  union {
+    const char *root;  /* root name */
+    const TString *name;  /* field or upvalue name (may be NULL) */
+    lua_Integer i;  /* array index */
+  } u;
+} CNode;
+
+
+typedef struct Census {
+  global_State *g;
+  TString *namekey;  /* "__name" */
+  Group *groups;  /* hash set of groups */
+  int sizegroups;  /* a power of 2 */
+  int ngroups;
+  size_t nobjects;
+  size_t nbytes;
+  CNode *nodes;  /* objects reached by the path walk, in order */
+  int nnodes;
+  int sizenodes;
+  int *seen;  /* hash set of indices in 'nodes' */
+  size_t sizeseen;  /* a power of 2 */
+  char *out;  /* snapshot text */
+  size_t nout;
+  size_t sizeout;
+  int failed;  /* ran out of memory */
+} Census;
+
+
+static void *rawalloc (Census *C, void *p, size_t osize, size_t nsize) {
+  global_State *g = C->g;
+  void *np = (*g->frealloc)(g->ud, p, osize, nsize);
+  if (np == NULL && nsize > 0)
+    C->failed = 1;
+  return np;
+}
+
+
+static size_t hashptr (const void *p) {
+  size_t h = cast_sizet((L_P2I)(p));
+  return h ^ (h >> 7) ^ (h >> 17);
+}
+
+
+/*
+** {======================================================
+** Groups
+** =======================================================
+*/
+
+/*
+** Group id of an object: its metatable's '__name' when that is a
+** string, or else the metatable itself. (Reads the metatable without
+** touching its metamethod cache.)
+*/
+static const void *groupid (Census *C, GCObject *o, int *named) {
+  Table *mt = NULL;
+  *named = 0;
+  if (o->tt == LUA_VTABLE)
+    mt = gco2t(o)->metatable;
+  else if (o->tt == LUA_VUSERDATA)
+    mt = gco2u(o)->metatable;
+  if (mt != NULL) {
+    const TValue *name = luaH_Hgetshortstr(mt, C->namekey);
+    if (ttisstring(name)) {
+      *named = 1;
+      return tsvalue(name);
+    }
+  }
+  return mt;
+}
+
+
+static Group *getgroup (Census *C, GCObject *o) {
+  int named;
+  const void *id = groupid(C, o, &named);
+  int type = novariant(o->tt);
+  size_t mask = cast_sizet(C->sizegroups - 1);
+  size_t i = (hashptr(id) + cast_sizet(type)) & mask;
+  Group *gr;
+  for (;;) {
+    gr = &C->groups[i];
+    if (gr->type == LUA_TNONE)  /* free slot? */
+      break;
+    if (gr->id == id && gr->type == type)
+      return gr;
+    i = (i + 1) & mask;
+  }
+  if ((C->ngroups + 1) * 4 > C->sizegroups * 3) {  /* too full? */
+    int osize = C->sizegroups;
+    Group *old = C->groups;
+    int k;
+    C->groups = cast(Group *, rawalloc(C, NULL, 0, 2 * osize * sizeof(Group)));
+    if (C->groups == NULL) {
+      C->groups = old;
+      return NULL;
+    }
+    C->sizegroups = 2 * osize;
+    C->ngroups = 0;
+    for (k = 0; k < C->sizegroups; k++)
+      C->groups[k].type = LUA_TNONE;
+    for (k = 0; k < osize; k++) {  /* reinsert old groups */
+      if (old[k].type != LUA_TNONE) {
+        size_t j = (hashptr(old[k].id) + cast_sizet(old[k].type)) &
+                   cast_sizet(C->sizegroups - 1);
+        while (C->groups[j].type != LUA_TNONE)
+          j = (j + 1) & cast_sizet(C->sizegroups - 1);
+        C->groups[j] = old[k];
+        C->ngroups++;
+      }
+    }
+    rawalloc(C, old, osize * sizeof(Group), 0);
+    return getgroup(C, o);
+  }
+  gr->id = id;
+  gr->type = type;
+  gr->named = named;
+  gr->path = -1;
+  gr->count = gr->bytes = 0;
+  C->ngroups++;
+  return gr;
+}
+
+
+static void countlist (Census *C, GCObject *o) {
+  for (; o != NULL && !C->failed; o = o->next) {
+    if (!isdead(C->g, o)) {
+      Group *gr = getgroup(C, o);
+      size_t sz = cast_sizet(luaC_objsize(o));
+      if (gr == NULL)
+        return;
+      gr->count++;
+      gr->bytes += sz;
+      C->nobjects++;
+      C->nbytes += sz;
+    }
+  }
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Reference paths
+** =======================================================
+*/
+
+/* adds 'o' to the walk, if it was not reached yet */
+static CNode *reach (Census *C, GCObject *o, int parent, int how) {
+  size_t mask = C->sizeseen - 1;
+  size_t i = hashptr(o) & mask;
+  CNode *n;
+  Group *gr;
+  int k;
+  if (isdead(C->g, o))  /* not counted? */
+    return NULL;
+  while ((k = C->seen[i]) >= 0) {
+    if (C->nodes[k].o == o)
+      return NULL;  /* already reached */
+    i = (i + 1) & mask;
+  }
+  if (C->nnodes == C->sizenodes)  /* cannot happen; objects were counted */
+    return NULL;
+  k = C->nnodes++;
+  C->seen[i] = k;
+  n = &C->nodes[k];
+  n->o = o;
+  n->parent = parent;
+  n->how = how;
+  n->u.name = NULL;
+  gr = getgroup(C, o);
+  if (gr != NULL && gr->path < 0)
+    gr->path = k;
+  return n;
+}
+
+
+static void reachvalue (Census *C, const TValue *v, int parent, int how,
+                        const TString *name) {
+  if (iscollectable(v)) {
+    CNode *n = reach(C, gcvalue(v), parent, how);
+    if (n != NULL)
+      n->u.name = name;
+  }
+}
+
+
+static void reachobj (Census *C, void *o, int parent, int how) {
+  if (o != NULL)
+    reach(C, cast(GCObject *, o), parent, how);
+}
+
+
+static void reachroot (Census *C, GCObject *o, const char *root) {
+  CNode *n = reach(C, o, -1, RROOT);
+  if (n != NULL)
+    n->u.root = root;
+}
+
+
+static void walktable (Census *C, Table *h, int k) {
+  unsigned i;
+  Node *n, *limit = gnode(h, cast_sizet(sizenode(h)));
+  reachobj(C, h->metatable, k, RMETA);
+  for (i = 0; i < h->asize; i++) {
+    if (*getArrTag(h, i) & BIT_ISCOLLECTABLE) {
+      CNode *nd = reach(C, getArrVal(h, i)->gc, k, RINDEX);
+      if (nd != NULL)
+        nd->u.i = l_castU2S(i) + 1;
+    }
+  }
+  for (n = gnode(h, 0); n < limit; n++) {
+    if (isempty(gval(n)))
+      continue;
+    if (keyiscollectable(n))
+      reach(C, gckey(n), k, RKEY);
+    if (!iscollectable(gval(n)))
+      continue;
+    if (keyisshrstr(n))
+      reachvalue(C, gval(n), k, RFIELD, keystrval(n));
+    else if (keyisinteger(n)) {
+      CNode *nd = reach(C, gcvalue(gval(n)), k, RINDEX);
+      if (nd != NULL)
+        nd->u.i = keyival(n);
+    }
+    else
+      reachvalue(C, gval(n), k, RVALUE, NULL);
+  }
+}
+
+
+/* visits the references of the node 'k' */
+static void walknode (Census *C, int k) {
+  GCObject *o = C->nodes[k].o;
+  int i;
+  switch (o->tt) {
+    case LUA_VTABLE: {
+      walktable(C, gco2t(o), k);
+      break;
+    }
+    case LUA_VUSERDATA: {
+      Udata *u = gco2u(o);
+      reachobj(C, u->metatable, k, RMETA);
+      for (i = 0; i < u->nuvalue; i++)
+        reachvalue(C, &u->uv[i].uv, k, RUSERVAL, NULL);
+      break;
+    }
+    case LUA_VLCL: {
+      LClosure *cl = gco2lcl(o);
+      Proto *p = cl->p;
+      reachobj(C, p, k, RPROTO);
+      for (i = 0; i < cl->nupvalues; i++) {
+        CNode *n = (cl->upvals[i] == NULL) ? NULL
+                 : reach(C, obj2gco(cl->upvals[i]), k, RUPVAL);
+        if (n != NULL && p != NULL && i < p->sizeupvalues)
+          n->u.name = p->upvalues[i].name;
+      }
+      break;
+    }
+    case LUA_VCCL: {
+      CClosure *cl = gco2ccl(o);
+      for (i = 0; i < cl->nupvalues; i++)
+        reachvalue(C, &cl->upvalue[i], k, RUPVAL, NULL);
+      break;
+    }
+    case LUA_VUPVAL: {
+      reachvalue(C, gco2upv(o)->v.p, k, RCONTENT, NULL);
+      break;
+    }
+    case LUA_VPROTO: {
+      Proto *f = gco2p(o);
+      reachobj(C, f->source, k, RCONST);
+      for (i = 0; i < f->sizek; i++)
+        reachvalue(C, &f->k[i], k, RCONST, NULL);
+      for (i = 0; i < f->sizep; i++)
+        reachobj(C, f->p[i], k, RPROTO);
+      for (i = 0; i < f->sizeupvalues; i++)
+        reachobj(C, f->upvalues[i].name, k, RCONST);
+      for (i = 0; i < f->sizelocvars; i++)
+        reachobj(C, f->locvars[i].varname, k, RCONST);
+      break;
+    }
+    case LUA_VTHREAD: {
+      lua55_State *th = gco2th(o);
+      StkId s;
+      if (th->stack.p == NULL)
+        break;
+      for (s = th->stack.p; s < th->top.p; s++)
+        reachvalue(C, s2v(s), k, RSTACK, NULL);
+      break;
+    }
+    default: break;  /* strings have no references */
+  }
+}
+
+
+static void walkpaths (Census *C) {
+  global_State *g = C->g;
+  size_t i;
+  int k;
+  C->sizenodes = cast_int(C->nobjects);
+  for (C->sizeseen = 4; C->sizeseen < 2 * cast_sizet(C->sizenodes); )
+    C->sizeseen *= 2;
+  C->nodes = cast(CNode *,
+               rawalloc(C, NULL, 0, cast_sizet(C->sizenodes) * sizeof(CNode)));
+  C->seen = cast(int *, rawalloc(C, NULL, 0, C->sizeseen * sizeof(int)));
+  if (C->failed)
+    return;
+  for (i = 0; i < C->sizeseen; i++)
+    C->seen[i] = -1;
+  if (iscollectable(&g->l_registry))
+    reachroot(C, gcvalue(&g->l_registry), "registry");
+  reachroot(C, obj2gco(mainthread(g)), "mainthread");
+  for (k = 0; k < LUA_NUMTYPES; k++) {
+    if (g->mt[k] != NULL)
+      reachroot(C, obj2gco(g->mt[k]), "metatables");
+  }
+  for (k = 0; k < g->nrefs; k++) {
+    if (iscollectable(&g->refs[k]))
+      reachroot(C, gcvalue(&g->refs[k]), "refs");
+  }
+  for (k = 0; k < C->nnodes; k++)  /* breadth first */
+    walknode(C, k);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Output
+** =======================================================
+*/
+
+static void addout (Census *C, const char *s, size_t l) {
+  if (C->failed)
+    return;
+  if (C->nout + l > C->sizeout) {
+    size_t nsize = (C->sizeout == 0) ? 4096 : C->sizeout;
+    char *nb;
+    while (nsize < C->nout + l)
+      nsize *= 2;
+    nb = cast_charp(rawalloc(C, C->out, C->sizeout, nsize));
+    if (nb == NULL)
+      return;
+    C->out = nb;
+    C->sizeout = nsize;
+  }
+  memcpy(C->out + C->nout, s, l);
+  C->nout += l;
+}
+
+
+#define addliteral(C,s)	addout(C, "" s, sizeof(s) - 1)
+
+
+/* adds 's' without tabs, newlines and other control characters */
+static void addclean (Census *C, const char *s, size_t l) {
+  char buff[MAXNAME];
+  size_t i;
+  if (l > MAXNAME)
+    l = MAXNAME;
+  for (i = 0; i < l; i++)
+    buff[i] = (cast_uchar(s[i]) < ' ') ? '?' : s[i];
+  addout(C, buff, l);
+}
+
+
+static void addnumber (Census *C, lua_Integer n) {
+  char buff[LUA_N2SBUFFSZ];
+  unsigned l = luaO_int2str(n, buff);
+  addout(C, buff, l);
+}
+
+
+static void addstep (Census *C, const CNode *n) {
+  char buff[32];
+  switch (n->how) {
+    case RROOT: addout(C, n->u.root, strlen(n->u.root)); break;
+    case RFIELD: {
+      addliteral(C, ".");
+      addclean(C, getstr(n->u.name), tsslen(n->u.name));
+      break;
+    }
+    case RINDEX: {
+      addliteral(C, "[");
+      addnumber(C, n->u.i);
+      addliteral(C, "]");
+      break;
+    }
+    case RKEY: addliteral(C, "(key)"); break;
+    case RVALUE: addliteral(C, "[?]"); break;
+    case RMETA: addliteral(C, "(metatable)"); break;
+    case RUPVAL: {
+      if (n->u.name != NULL) {
+        addliteral(C, "(upvalue ");
+        addclean(C, getstr(n->u.name), tsslen(n->u.name));
+        addliteral(C, ")");
+      }
+      else
+        addliteral(C, "(upvalue)");
+      break;
+    }
+    case RUSERVAL: addliteral(C, "(uservalue)"); break;
+    case RSTACK: addliteral(C, "(stack)"); break;
+    case RPROTO: addliteral(C, "(proto)"); break;
+    case RCONST: addliteral(C, "(constant)"); break;
+    case RCONTENT: addliteral(C, "(value)"); break;
+    default: {
+      snprintf(buff, sizeof(buff), "(%d)", n->how);
+      addout(C, buff, strlen(buff));
+    }
+  }
+}
+
+
+/*
+** Adds the path from a root to node 'k'. A path longer than MAXPATH
+** keeps the steps nearer the root and ends with "...".
+*/
+static void addpath (Census *C, int k) {
+  int steps[MAXPATH];
+  int n = 0, cut = 0;
+  for (; k >= 0; k = C->nodes[k].parent) {
+    if (n == MAXPATH) {  /* too deep? drop the step nearest the leaf */
+      memmove(steps, steps + 1, (MAXPATH - 1) * sizeof(int));
+      n--;
+      cut = 1;
+    }
+    steps[n++] = k;
+  }
+  addliteral(C, "\t");
+  while (n > 0)
+    addstep(C, &C->nodes[steps[--n]]);
+  if (cut)
+    addliteral(C, "...");
+}
+
+
+static void addgroup (Census *C, const Group *gr) {
+  static const char *const names[] = {"upvalue", "proto"};
+  const char *tname = (gr->type < LUA_NUMTYPES) ? lua55_typename(NULL, gr->type)
+                                                : names[gr->type - LUA_NUMTYPES];
+  addout(C, tname, strlen(tname));
+  addliteral(C, "\t");
+  if (gr->named) {
+    const TString *ts = cast(const TString *, gr->id);
+    addclean(C, getstr(ts), tsslen(ts));
+  }
+  else if (gr->id != NULL) {
+    char buff[32];
+    snprintf(buff, sizeof(buff), "%p", gr->id);
+    addout(C, buff, strlen(buff));
+  }
+  else
+    addliteral(C, "-");
+  addliteral(C, "\t");
+  addnumber(C, l_castU2S(cast(lua_Unsigned, gr->count)));
+  addliteral(C, "\t");
+  addnumber(C, l_castU2S(cast(lua_Unsigned, gr->bytes)));
+  if (C->nodes != NULL && gr->path >= 0)
+    addpath(C, gr->path);
+  addliteral(C, "\n");
+}
+
+
+static int heavier (const void *a, const void *b) {
+  const Group *ga = cast(const Group *, a);
+  const Group *gb = cast(const Group *, b);
+  if (ga->bytes != gb->bytes)
+    return (ga->bytes < gb->bytes) ? 1 : -1;
+  return (ga->count < gb->count) - (ga->count > gb->count);
+}
+
+
+static void writesnapshot (Census *C) {
+  int i, n = 0;
+  for (i = 0; i < C->sizegroups; i++) {  /* move groups to the front */
+    if (C->groups[i].type != LUA_TNONE)
+      C->groups[n++] = C->groups[i];
+  }
+  qsort(C->groups, cast_sizet(n), sizeof(Group), heavier);
+  addliteral(C, "census\t");
+  addnumber(C, CENSUSVERSION);
+  addliteral(C, "\t");
+  addnumber(C, l_castU2S(cast(lua_Unsigned, C->nobjects)));
+  addliteral(C, "\t");
+  addnumber(C, l_castU2S(cast(lua_Unsigned, C->nbytes)));
+  addliteral(C, "\n");
+  for (i = 0; i < n; i++)
+    addgroup(C, &C->groups[i]);
+}
+
+/* }====================================================== */
+
+
+static void freecensus (Census *C) {
+  rawalloc(C, C->groups, cast_sizet(C->sizegroups) * sizeof(Group), 0);
+  rawalloc(C, C->nodes, cast_sizet(C->sizenodes) * sizeof(CNode), 0);
+  rawalloc(C, C->seen, C->sizeseen * sizeof(int), 0);
+  rawalloc(C, C->out, C->sizeout, 0);
+}
+
+
+/*
+** Takes a census of the heap and hands the snapshot to 'writer' (in
+** one or more pieces) after the walk is done. 'flags' may have
+** LUA_CENSUSPATHS. Run a full collection first to count only live
+** objects. Returns the first non-zero value returned by 'writer',
+** LUA_ERRMEM if the census ran out of memory, or 0.
+*/
+LUA_API int lua55_census (lua55_State *L, lua55_Writer writer, void *data,
+                          int flags) {
+  Census C;
+  global_State *g;
+  int status = 0;
+  int i;
+  lua_lock(L);
+  g = G(L);
+  memset(&C, 0, sizeof(C));
+  C.g = g;
+  C.namekey = luaS_newliteral(L, "__name");  /* before the walk */
+  C.sizegroups = 64;
+  C.groups = cast(Group *,
+               rawalloc(&C, NULL, 0, cast_sizet(C.sizegroups) * sizeof(Group)));
+  if (C.groups != NULL) {
+    for (i = 0; i < C.sizegroups; i++)
+      C.groups[i].type = LUA_TNONE;
+    countlist(&C, g->allgc);
+    countlist(&C, g->finobj);
+    countlist(&C, g->tobefnz);
+    countlist(&C, g->fixedgc);
+    if ((flags & LUA_CENSUSPATHS) && !C.failed)
+      walkpaths(&C);
+    writesnapshot(&C);
+  }
+  lua_unlock(L);
+  if (C.failed)
+    status = LUA_ERRMEM;
+  else
+    status = writer(L, C.out, C.nout, data);
+  freecensus(&C);
+  return status;
+}
@@ -0,0 +1,280 @@
+/*
+** $Id: lcensuslib.c $
+** Heap census library
+** See Copyright Notice in lua.h
+*/
+
+#define lcensuslib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+#include "llimits.h"
+
+
+#define HEADER		"census\t"
+
+
+static int bufwriter (lua55_State *L, const void *b, size_t size, void *ud) {
+  UNUSED(L);
+  lua55L_addlstring((luaL_Buffer *)ud, (const char *)b, size);
+  return 0;
+}
+
+
+static int filewriter (lua55_State *L, const void *b, size_t size, void *ud) {
+  UNUSED(L);
+  return fwrite(b, 1, size, (FILE *)ud) != size;
+}
+
+
+/*
+** snapshot([filename [, paths]]): runs a full collection and takes a
+** census of the heap, as a string or written to 'filename'; 'paths'
+** also records a path from the roots to an object of each group.
+*/
+static int census_snapshot (lua55_State *L) {
+  const char *fname = lua55L_optstring(L, 1, NULL);
+  int flags = lua55_toboolean(L, 2) ? LUA_CENSUSPATHS : 0;
+  int status;
+  lua55_gc(L, LUA_GCCOLLECT);
+  if (fname == NULL) {
+    luaL_Buffer b;
+    lua55L_buffinit(L, &b);
+    status = lua55_census(L, bufwriter, &b, flags);
+    if (status == LUA_ERRMEM)
+      return lua55L_error(L, "not enough memory for census");
+    lua55L_pushresult(&b);
+    return 1;
+  }
+  else {
+    FILE *f = fopen(fname, "w");
+    if (f == NULL)
+      return lua55L_fileresult(L, 0, fname);
+    status = lua55_census(L, filewriter, f, flags);
+    if (fclose(f) != 0 || status != 0) {
+      if (status == LUA_ERRMEM) {
+        lua55L_pushfail(L);
+        lua55_pushliteral(L, "not enough memory for census");
+        return 2;
+      }
+      return lua55L_fileresult(L, 0, fname);
+    }
+    lua55_pushboolean(L, 1);
+    return 1;
+  }
+}
+
+
+/*
+** {======================================================
+** Diff
+** =======================================================
+*/
+
+typedef struct Entry {
+  const char *key;  /* "type <tab> name" */
+  size_t keylen;
+  const char *path;  /* may be NULL */
+  size_t pathlen;
+  lua_Integer count[2];  /* in the old and the new snapshot */
+  lua_Integer bytes[2];
+} Entry;
+
+
+/*
+** Pushes the text of the snapshot 'arg', given either as a snapshot
+** or as the name of a file holding one.
+*/
+static const char *getsnapshot (lua55_State *L, int arg) {
+  const char *s = lua55L_checkstring(L, arg);
+  if (strncmp(s, HEADER, sizeof(HEADER) - 1) != 0) {  /* a file name? */
+    luaL_Buffer b;
+    char *p;
+    size_t n;
+    FILE *f = fopen(s, "r");
+    if (f == NULL)
+      lua55L_error(L, "cannot open %s", s);
+    lua55L_buffinit(L, &b);
+    do {
+      p = lua55L_prepbuffer(&b);
+      n = fread(p, 1, LUAL_BUFFERSIZE, f);
+      lua55L_addsize(&b, n);
+    } while (n == LUAL_BUFFERSIZE);
+    fclose(f);
+    lua55L_pushresult(&b);
+    lua55_replace(L, arg);
+    s = lua55_tostring(L, arg);
+    if (strncmp(s, HEADER, sizeof(HEADER) - 1) != 0)
+      lua55L_argerror(L, arg, "not a census snapshot");
+  }
+  return s;
+}
+
+
+/* returns the 'n'-th field (from 0) of a line, and its length */
+static const char *field (const char *line, const char *end, int n,
+                          size_t *len) {
+  const char *tab;
+  for (; n > 0; n--) {
+    line = cast_charp(memchr(line, '\t', cast_sizet(end - line)));
+    if (line == NULL)
+      return NULL;
+    line++;
+  }
+  tab = cast_charp(memchr(line, '\t', cast_sizet(end - line)));
+  *len = cast_sizet(((tab != NULL) ? tab : end) - line);
+  return line;
+}
+
+
+/*
+** Adds the groups of snapshot 's' (0 old, 1 new) to the 'n' entries
+** in 'e', indexed by key in the table at 'idx'; returns the new 'n'.
+*/
+static int readsnapshot (lua55_State *L, const char *s, int which,
+                         Entry *e, int n, int idx) {
+  const char *line = strchr(s, '\n');  /* skip header */
+  while (line != NULL && *++line != '\0') {
+    const char *end = strchr(line, '\n');
+    const char *key, *count, *bytes, *path;
+    size_t lkey, lname, lcount, lbytes, lpath;
+    int i;
+    if (end == NULL)
+      end = line + strlen(line);
+    key = field(line, end, 0, &lkey);
+    if (field(line, end, 1, &lname) == NULL ||
+        (count = field(line, end, 2, &lcount)) == NULL ||
+        (bytes = field(line, end, 3, &lbytes)) == NULL)
+      return lua55L_error(L, "bad census line '%s'",
+                             lua55_pushlstring(L, line, end - line));
+    lkey += 1 + lname;
+    path = field(line, end, 4, &lpath);
+    lua55_pushlstring(L, key, lkey);
+    if (lua55_rawget(L, idx) == LUA_TNUMBER)
+      i = cast_int(lua55_tointeger(L, -1));
+    else {
+      i = n++;
+      e[i].key = key;
+      e[i].keylen = lkey;
+      e[i].path = NULL;
+      e[i].count[0] = e[i].count[1] = e[i].bytes[0] = e[i].bytes[1] = 0;
+      lua55_pushlstring(L, key, lkey);
+      lua55_pushinteger(L, i);
+      lua55_rawset(L, idx);
+    }
+    lua55_pop(L, 1);
+    if (path != NULL) {  /* prefer the path in the new snapshot */
+      e[i].path = path;
+      e[i].pathlen = lpath;
+    }
+    e[i].count[which] += strtoll(count, NULL, 10);
+    e[i].bytes[which] += strtoll(bytes, NULL, 10);
+    line = end;
+    if (*line == '\0')
+      break;
+  }
+  return n;
+}
+
+
+static int countlines (const char *s) {
+  int n = 0;
+  while ((s = strchr(s, '\n')) != NULL)
+    n++, s++;
+  return n + 1;
+}
+
+
+/* adds a tab and 'v' with its sign */
+static void addsigned (luaL_Buffer *b, lua_Integer v) {
+  lua55_pushfstring(b->L, "\t%s%I", (v >= 0) ? "+" : "", (LUAI_UACINT)v);
+  lua55L_addvalue(b);
+}
+
+
+static lua_Integer delta (const Entry *e) {
+  return e->bytes[1] - e->bytes[0];
+}
+
+
+static int bigger (const void *a, const void *b) {
+  lua_Integer da = delta(cast(const Entry *, a));
+  lua_Integer db = delta(cast(const Entry *, b));
+  if (da < 0) da = -da;
+  if (db < 0) db = -db;
+  return (da < db) - (da > db);
+}
+
+
+/*
+** diff(old, new): what changed between two snapshots (strings or file
+** names), one line per group whose count or size changed, largest
+** change in size first:
+**   type <tab> name <tab> +count <tab> +bytes <tab> bytes [<tab> path]
+** followed by a line 'total <tab> +objects <tab> +bytes'.
+*/
+static int census_diff (lua55_State *L) {
+  const char *olds, *news;
+  int max, n, i;
+  lua_Integer tcount = 0, tbytes = 0;
+  Entry *e;
+  luaL_Buffer b;
+  lua55_settop(L, 2);
+  olds = getsnapshot(L, 1);
+  news = getsnapshot(L, 2);
+  max = countlines(olds) + countlines(news);
+  e = (Entry *)lua55_newuserdatauv(L, cast_sizet(max) * sizeof(Entry), 0);
+  lua55_createtable(L, 0, max);  /* index of entries by key */
+  n = readsnapshot(L, olds, 0, e, 0, 4);
+  n = readsnapshot(L, news, 1, e, n, 4);
+  qsort(e, cast_sizet(n), sizeof(Entry), bigger);
+  lua55L_buffinit(L, &b);
+  for (i = 0; i < n; i++) {
+    lua_Integer dc = e[i].count[1] - e[i].count[0];
+    if (dc == 0 && delta(&e[i]) == 0)
+      continue;
+    tcount += dc;
+    tbytes += delta(&e[i]);
+    lua55L_addlstring(&b, e[i].key, e[i].keylen);
+    addsigned(&b, dc);
+    addsigned(&b, delta(&e[i]));
+    lua55_pushfstring(L, "\t%I", (LUAI_UACINT)e[i].bytes[1]);
+    lua55L_addvalue(&b);
+    if (e[i].path != NULL) {
+      lua55L_addchar(&b, '\t');
+      lua55L_addlstring(&b, e[i].path, e[i].pathlen);
+    }
+    lua55L_addchar(&b, '\n');
+  }
+  lua55L_addstring(&b, "total");
+  addsigned(&b, tcount);
+  addsigned(&b, tbytes);
+  lua55L_addchar(&b, '\n');
+  lua55L_pushresult(&b);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+static const luaL_Reg census_funcs[] = {
+  {"snapshot", census_snapshot},
+  {"diff", census_diff},
+  {NULL, NULL}
+};
+
+
+LUAMOD_API int lua55open_census (lua55_State *L) {
+  lua55L_newlib(L, census_funcs);
+  return 1;
+}
@@ -435,6 +435,20 @@ static int db_debug (lua55_State *L) {
 }
 
 
+/*
+** opstats([reset]): execution counters of a LUA_OPSTATS build (see
+** 'lua55_opstats'), optionally resetting them.
+*/
+static int db_opstats (lua55_State *L) {
+  if (!lua55_opstats(L, lua55_toboolean(L, 1))) {
+    lua55L_pushfail(L);
+    lua55_pushliteral(L, "Lua built without LUA_OPSTATS");
+    return 2;
+  }
+  return 1;
+}
+
+
 static int db_traceback (lua55_State *L) {
   int arg;
   lua55_State *L1 = getthread(L, &arg);
@@ -453,6 +467,7 @@ static const luaL_Reg dblib[] = {
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
   {"gethook", db_gethook},
+  {"opstats", db_opstats},
   {"getinfo", db_getinfo},
   {"getlocal", db_getlocal},
   {"getregistry", db_getregistry},
@@ -21,6 +21,7 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "lgc.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -977,3 +978,143 @@ int luaG_traceexec (lua55_State *L, const Instruction *pc) {
   return 1;  /* keep 'trap' on */
 }
 
+
+
+/*
+** {======================================================
+** Execution statistics
+** =======================================================
+*/
+
+#if defined(LUA_OPSTATS)
+
+#include <stdlib.h>
+
+#include "lopnames.h"
+
+
+typedef struct FuncStat {
+  char source[LUA_IDSIZE];
+  int line;
+  lua_Unsigned calls;
+  lua_Unsigned instrs;
+} FuncStat;
+
+
+static int cmpfuncstat (const void *a, const void *b) {
+  lua_Unsigned na = cast(const FuncStat *, a)->instrs;
+  lua_Unsigned nb = cast(const FuncStat *, b)->instrs;
+  return (na < nb) - (na > nb);  /* busiest first */
+}
+
+
+static void setcount (lua55_State *L, const char *k, lua_Unsigned n) {
+  lua55_pushinteger(L, l_castU2S(n));
+  lua55_setfield(L, -2, k);
+}
+
+
+/*
+** A prototype with counters to report. Dead prototypes (not yet swept)
+** are skipped: their source strings may have been freed already.
+*/
+#define ranproto(g,o)  ((o)->tt == LUA_VPROTO && !isdead(g, o) && \
+                        gco2p(o)->ncalls + gco2p(o)->ninstrs > 0)
+
+
+/*
+** Pushes the list of functions that ran, busiest first. Counters are
+** copied into a userdata before anything else is allocated, as any
+** allocation may run the collector and free prototypes. Creating the
+** userdata itself may run a collection step (and finalizers), so the
+** second walk can see fewer or more prototypes than the first.
+*/
+static void pushfuncstats (lua55_State *L, int reset) {
+  global_State *g = G(L);
+  GCObject *o;
+  FuncStat *fs;
+  size_t n = 0, i = 0;
+  for (o = g->allgc; o != NULL; o = o->next)
+    if (ranproto(g, o))
+      n++;
+  fs = cast(FuncStat *, lua55_newuserdatauv(L, n * sizeof(FuncStat), 0));
+  for (o = g->allgc; o != NULL && i < n; o = o->next) {
+    if (ranproto(g, o)) {
+      Proto *p = gco2p(o);
+      if (p->source)
+        luaO_chunkid(fs[i].source, getstr(p->source), tsslen(p->source));
+      else
+        strcpy(fs[i].source, "?");
+      fs[i].line = p->linedefined;
+      fs[i].calls = p->ncalls;
+      fs[i].instrs = p->ninstrs;
+      if (reset)
+        p->ncalls = p->ninstrs = 0;
+      i++;
+    }
+  }
+  n = i;  /* (new prototypes may have been created meanwhile) */
+  qsort(fs, n, sizeof(FuncStat), cmpfuncstat);
+  lua55_createtable(L, cast_int(n), 0);
+  for (i = 0; i < n; i++) {
+    lua55_createtable(L, 0, 4);
+    lua55_pushstring(L, fs[i].source);
+    lua55_setfield(L, -2, "source");
+    lua55_pushinteger(L, fs[i].line);
+    lua55_setfield(L, -2, "line");
+    setcount(L, "calls", fs[i].calls);
+    setcount(L, "instructions", fs[i].instrs);
+    lua55_rawseti(L, -2, l_castU2S(i + 1));
+  }
+  lua55_remove(L, -2);  /* remove buffer */
+}
+
+
+/*
+** Pushes a table with the counters collected since the state was
+** created (or last reset):
+**   ops: opcode name -> executions
+**   jumps: opcode name -> {taken = n, nottaken = n} (conditional jumps)
+**   functions: list of {source, line, calls, instructions}
+** Opcodes and jumps that never ran are omitted. Returns 0 (and pushes
+** nothing) if Lua was not built with LUA_OPSTATS.
+*/
+LUA_API int lua55_opstats (lua55_State *L, int reset) {
+  global_State *g = G(L);
+  int op;
+  lua55_createtable(L, 0, 3);
+  lua55_createtable(L, 0, 0);
+  for (op = 0; op < NUM_OPCODES; op++) {
+    if (g->opcount[op] > 0)
+      setcount(L, opnames[op], g->opcount[op]);
+  }
+  lua55_setfield(L, -2, "ops");
+  lua55_createtable(L, 0, 0);
+  for (op = 0; op < NUM_OPCODES; op++) {
+    if (g->jumpcount[op][0] + g->jumpcount[op][1] > 0) {
+      lua55_createtable(L, 0, 2);
+      setcount(L, "taken", g->jumpcount[op][1]);
+      setcount(L, "nottaken", g->jumpcount[op][0]);
+      lua55_setfield(L, -2, opnames[op]);
+    }
+  }
+  lua55_setfield(L, -2, "jumps");
+  pushfuncstats(L, reset);
+  lua55_setfield(L, -2, "functions");
+  if (reset) {
+    memset(g->opcount, 0, sizeof(g->opcount));
+    memset(g->jumpcount, 0, sizeof(g->jumpcount));
+  }
+  return 1;
+}
+
+#else
+
+LUA_API int lua55_opstats (lua55_State *L, int reset) {
+  UNUSED(L); UNUSED(reset);
+  return 0;
+}
+
+#endif
+
+/* }====================================================== */
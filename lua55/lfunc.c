@@ -11,6 +11,7 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -249,6 +250,7 @@ Proto *luaF_newproto (lua55_State *L) {
   f->sizep = 0;
   f->code = NULL;
   f->sizecode = 0;
+  f->icache = NULL;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
   f->abslineinfo = NULL;
@@ -263,16 +265,32 @@ Proto *luaF_newproto (lua55_State *L) {
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
+#if defined(LUA_OPSTATS)
+  f->ncalls = f->ninstrs = 0;
+#endif
   return f;
 }
 
 
+/*
+** Allocates the inline caches of a complete prototype, one per
+** instruction; zero is as good a starting slot as any.
+*/
+void luaF_initicache (lua55_State *L, Proto *f) {
+  lua_assert(f->icache == NULL);
+  f->icache = luaM_newvector(L, f->sizecode, unsigned short);
+  memset(f->icache, 0, cast_sizet(f->sizecode) * sizeof(unsigned short));
+}
+
+
 lu_mem luaF_protosize (Proto *p) {
   lu_mem sz = cast(lu_mem, sizeof(Proto))
             + cast_uint(p->sizep) * sizeof(Proto*)
             + cast_uint(p->sizek) * sizeof(TValue)
             + cast_uint(p->sizelocvars) * sizeof(LocVar)
             + cast_uint(p->sizeupvalues) * sizeof(Upvaldesc);
+  if (p->icache != NULL)
+    sz += cast_uint(p->sizecode) * sizeof(unsigned short);
   if (!(p->flag & PF_FIXED)) {
     sz += cast_uint(p->sizecode) * sizeof(Instruction);
     sz += cast_uint(p->sizelineinfo) * sizeof(lu_byte);
@@ -288,6 +306,8 @@ void luaF_freeproto (lua55_State *L, Proto *f) {
     luaM_freearray(L, f->lineinfo, cast_sizet(f->sizelineinfo));
     luaM_freearray(L, f->abslineinfo, cast_sizet(f->sizeabslineinfo));
   }
+  if (f->icache != NULL)
+    luaM_freearray(L, f->icache, cast_sizet(f->sizecode));
   luaM_freearray(L, f->p, cast_sizet(f->sizep));
   luaM_freearray(L, f->k, cast_sizet(f->sizek));
   luaM_freearray(L, f->locvars, cast_sizet(f->sizelocvars));
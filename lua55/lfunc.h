@@ -48,6 +48,7 @@
 
 
 LUAI_FUNC Proto *luaF_newproto (lua55_State *L);
+LUAI_FUNC void luaF_initicache (lua55_State *L, Proto *f);
 LUAI_FUNC CClosure *luaF_newCclosure (lua55_State *L, int nupvals);
 LUAI_FUNC LClosure *luaF_newLclosure (lua55_State *L, int nupvals);
 LUAI_FUNC void luaF_initupvals (lua55_State *L, LClosure *cl);
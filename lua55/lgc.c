@@ -10,6 +10,7 @@
 #include "lprefix.h"
 
 #include <string.h>
+#include <time.h>
 
 
 #include "lua.h"
@@ -97,6 +98,39 @@ static void atomic (lua55_State *L);
 static void entersweep (lua55_State *L);
 
 
+/*
+** Microseconds from a monotonic clock where there is one; otherwise
+** from 'clock', which counts processor time. Only differences are used.
+*/
+#if !defined(luai_gcclock)
+#if defined(LUA_USE_POSIX) && defined(CLOCK_MONOTONIC)
+static lu_mem gcclock (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast(lu_mem, ts.tv_sec) * 1000000u + cast(lu_mem, ts.tv_nsec / 1000);
+}
+#define luai_gcclock()	gcclock()
+#else
+#define luai_gcclock()  \
+	cast(lu_mem, cast(double, clock()) * (1e6 / CLOCKS_PER_SEC))
+#endif
+#endif
+
+
+/*
+** Counts a pause of kind 'kind' that started at 'start' (a reading of
+** 'luai_gcclock') in the collector statistics.
+*/
+static void addpause (global_State *g, int kind, lu_mem start) {
+  lu_mem us = luai_gcclock() - start;
+  int b = (us >= (1u << (LUA_GCSTATBUCKETS - 2)))
+        ? LUA_GCSTATBUCKETS - 1
+        : luaO_ceillog2(cast_uint(us) + 1);
+  g->gcstats.pauses[kind][b]++;
+  g->gcstats.pausetime[kind] += us;
+}
+
+
 /*
 ** {======================================================
 ** Generic functions
@@ -160,6 +194,11 @@ static l_mem objsize (GCObject *o) {
 }
 
 
+l_mem luaC_objsize (GCObject *o) {
+  return objsize(o);
+}
+
+
 static GCObject **getgclist (GCObject *o) {
   switch (o->tt) {
     case LUA_VTABLE: return &gco2t(o)->gclist;
@@ -302,6 +341,7 @@ GCObject *luaC_newobjdt (lua55_State *L, lu_byte tt, size_t sz, size_t offset) {
   o->tt = tt;
   o->next = g->allgc;
   g->allgc = o;
+  g->gcstats.objects[novariant(tt)]++;
   return o;
 }
 
@@ -437,11 +477,23 @@ static void cleargraylists (global_State *g) {
 ** 'GCmarked' is initialized to count the total number of live bytes
 ** during a cycle.
 */
+/*
+** mark values in the reference store (free slots hold empty values,
+** which are not collectable)
+*/
+static void markrefs (global_State *g) {
+  int i;
+  for (i = 0; i < g->nrefs; i++)
+    markvalue(g, &g->refs[i]);
+}
+
+
 static void restartcollection (global_State *g) {
   cleargraylists(g);
   g->GCmarked = 0;
   markobject(g, mainthread(g));
   markvalue(g, &g->l_registry);
+  markrefs(g);
   markmt(g);
   markbeingfnz(g);  /* mark any finalizing object left from previous cycle */
 }
@@ -746,6 +798,527 @@ static void propagateall (global_State *g) {
 }
 
 
+/*
+** {======================================================
+** Parallel marking
+** =======================================================
+*/
+
+/*
+** With parallel marking on, the propagations of the atomic phase are
+** shared among 'nworkers' threads. That phase does all the marking of
+** a full collection and of the first cycle in generational mode. The
+** threads are the collector and helpers that sleep between
+** collections. Each worker keeps a private stack of gray objects in
+** chunks. While some worker is idle, the others hand chunks of their
+** stacks to a shared pool. A worker claims a white object by clearing
+** its white bits with an atomic compare-and-swap, so each object is
+** traversed only once. Workers traverse only strong tables, closures,
+** prototypes and userdata. Threads, tables with a '__mode' field and
+** touched objects stay gray for the collector, which traverses them
+** after the round and then starts another round with what they marked.
+** Chunks come from 'frealloc' under the pool lock, so the allocator
+** does not need to be thread safe; they are not counted as memory in
+** use and are freed at the end of each atomic phase.
+*/
+
+#if defined(LUA_USE_POSIX) && defined(__GNUC__)	/* { */
+
+#include <pthread.h>
+
+#define MARKCHUNK	256	/* gray objects per chunk */
+#define MINSHARE	16	/* minimum number of objects to share */
+#define MAXMARKERS	64	/* maximum number of workers */
+
+/* minimum heap size (in bytes) to mark in parallel */
+#if !defined(PARMARKMIN)
+#define PARMARKMIN	(1 << 20)
+#endif
+
+
+/* atomic access to mark bits (the mutator is paused) */
+#define pmarked(o)	__atomic_load_n(&(o)->marked, __ATOMIC_RELAXED)
+#define pblacken(o)  \
+	__atomic_fetch_or(&(o)->marked, bitmask(BLACKBIT), __ATOMIC_RELAXED)
+
+#define pmarkvalue(w,o)	{ if (iscollectable(o)) pmark(w, gcvalue(o)); }
+
+#define pmarkkey(w,n)	{ if (keyiscollectable(n)) pmark(w, gckey(n)); }
+
+#define pmarkobjectN(w,t)	{ if (t) pmark(w, obj2gco(t)); }
+
+
+typedef struct MarkChunk {
+  struct MarkChunk *next;
+  int n;  /* number of objects */
+  GCObject *o[MARKCHUNK];
+} MarkChunk;
+
+typedef struct MarkWorker {
+  struct ParMark *pm;
+  MarkChunk *stack;  /* private gray objects (top chunk first) */
+  MarkChunk *spare;  /* an emptied chunk */
+  GCObject *left;  /* gray objects left to the collector */
+  l_mem marked;  /* bytes marked in this round */
+  pthread_t thread;
+} MarkWorker;
+
+typedef struct ParMark {
+  pthread_mutex_t lock;
+  pthread_cond_t start;  /* a round started, or 'stop' was set */
+  pthread_cond_t more;  /* chunks were shared, or the round finished */
+  pthread_cond_t done;  /* the last helper left the round */
+  global_State *g;
+  MarkChunk *shared;  /* chunks waiting for an idle worker */
+  MarkChunk *free;  /* unused chunks */
+  int nworkers;  /* number of workers, including the collector */
+  int nidle;  /* workers waiting for shared chunks */
+  int nbusy;  /* helpers still in the round */
+  int round;  /* number of the current round */
+  int finished;  /* true when every worker ran out of work */
+  int stop;  /* helpers must exit */
+  MarkWorker w[1];  /* workers; 'w[0]' is the collector */
+} ParMark;
+
+#define sizeparmark(n)	(offsetof(ParMark, w) + cast_sizet(n) * sizeof(MarkWorker))
+
+
+static MarkChunk *newchunk (ParMark *pm) {
+  MarkChunk *c;
+  pthread_mutex_lock(&pm->lock);
+  c = pm->free;
+  if (c != NULL)
+    pm->free = c->next;
+  else {  /* the lock also keeps allocations from overlapping */
+    global_State *g = pm->g;
+    c = cast(MarkChunk *, (*g->frealloc)(g->ud, NULL, 0, sizeof(MarkChunk)));
+  }
+  pthread_mutex_unlock(&pm->lock);
+  if (c != NULL)
+    c->n = 0;
+  return c;
+}
+
+
+static void pushgray (MarkWorker *w, GCObject *o) {
+  MarkChunk *c = w->stack;
+  if (c == NULL || c->n == MARKCHUNK) {  /* needs a new chunk? */
+    MarkChunk *nc = w->spare;
+    if (nc != NULL)
+      w->spare = NULL;
+    else if ((nc = newchunk(w->pm)) == NULL) {  /* no memory? */
+      *getgclist(o) = w->left;  /* leave object to the collector */
+      w->left = o;
+      return;
+    }
+    nc->n = 0;
+    nc->next = c;
+    w->stack = c = nc;
+  }
+  c->o[c->n++] = o;
+}
+
+
+static GCObject *popgray (MarkWorker *w) {
+  MarkChunk *c;
+  while ((c = w->stack) != NULL && c->n == 0) {  /* drop empty chunks */
+    w->stack = c->next;
+    if (w->spare == NULL)
+      w->spare = c;
+    else {
+      ParMark *pm = w->pm;
+      pthread_mutex_lock(&pm->lock);
+      c->next = pm->free;
+      pm->free = c;
+      pthread_mutex_unlock(&pm->lock);
+    }
+  }
+  return (c != NULL) ? c->o[--c->n] : NULL;
+}
+
+
+/*
+** Hands the chunk below the top of the stack to the shared pool, or
+** half of the top chunk when it is the only one.
+*/
+static void sharework (MarkWorker *w) {
+  ParMark *pm = w->pm;
+  MarkChunk *c = w->stack;
+  MarkChunk *s;
+  if (c == NULL)
+    return;
+  if ((s = c->next) != NULL)
+    c->next = s->next;
+  else if (c->n >= MINSHARE && (s = newchunk(pm)) != NULL) {
+    s->n = c->n / 2;  /* give away the older half */
+    memcpy(s->o, c->o, cast_sizet(s->n) * sizeof(GCObject *));
+    c->n -= s->n;
+    memmove(c->o, c->o + s->n, cast_sizet(c->n) * sizeof(GCObject *));
+  }
+  else
+    return;
+  pthread_mutex_lock(&pm->lock);
+  s->next = pm->shared;
+  pm->shared = s;
+  pthread_cond_signal(&pm->more);
+  pthread_mutex_unlock(&pm->lock);
+}
+
+
+/*
+** Parallel version of 'reallymarkobject': claims object 'o' if it is
+** still white, turning it gray. Objects with something to traverse go
+** to the worker's stack.
+*/
+static void pmark (MarkWorker *w, GCObject *o) {
+  lu_byte m = pmarked(o);
+  do {
+    if (!(m & WHITEBITS))
+      return;  /* already claimed */
+  } while (!__atomic_compare_exchange_n(&o->marked, &m,
+                cast_byte(m & ~WHITEBITS), 1,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  w->marked += objsize(o);
+  switch (o->tt) {
+    case LUA_VSHRSTR:
+    case LUA_VLNGSTR: {
+      pblacken(o);  /* nothing to visit */
+      break;
+    }
+    case LUA_VUPVAL: {
+      UpVal *uv = gco2upv(o);
+      if (!upisopen(uv))  /* open upvalues are kept gray */
+        pblacken(o);
+      pmarkvalue(w, uv->v.p);
+      break;
+    }
+    case LUA_VUSERDATA: {
+      Udata *u = gco2u(o);
+      if (u->nuvalue == 0) {  /* no user values? */
+        pmarkobjectN(w, u->metatable);
+        pblacken(o);
+        break;
+      }
+    }  /* FALLTHROUGH */
+    default: {
+      pushgray(w, o);
+      break;
+    }
+  }
+}
+
+
+/*
+** Whether table 'h' may be weak, without updating the metamethod cache
+** of its metatable as 'getmode' does.
+*/
+static int mayweak (global_State *g, Table *h) {
+  Table *mt = h->metatable;
+  if (mt == NULL || (mt->flags & (1u << TM_MODE)))
+    return 0;
+  return !notm(luaH_Hgetshortstr(mt, g->tmname[TM_MODE]));
+}
+
+
+static void ptraversetable (MarkWorker *w, Table *h) {
+  Node *n, *limit = gnodelast(h);
+  unsigned i;
+  pmarkobjectN(w, h->metatable);
+  for (i = 0; i < h->asize; i++) {
+    GCObject *o = gcvalarr(h, i);
+    if (o != NULL)
+      pmark(w, o);
+  }
+  for (n = gnode(h, 0); n < limit; n++) {
+    if (isempty(gval(n)))  /* entry is empty? */
+      clearkey(n);  /* clear its key */
+    else {
+      pmarkkey(w, n);
+      pmarkvalue(w, gval(n));
+    }
+  }
+}
+
+
+static void ptraverse (MarkWorker *w, GCObject *o) {
+  int i;
+  if (getage(o) >= G_TOUCHED1 || o->tt == LUA_VTHREAD ||
+      (o->tt == LUA_VTABLE && mayweak(w->pm->g, gco2t(o)))) {
+    *getgclist(o) = w->left;  /* leave it to the collector */
+    w->left = o;
+    return;
+  }
+  pblacken(o);
+  switch (o->tt) {
+    case LUA_VTABLE: {
+      ptraversetable(w, gco2t(o));
+      break;
+    }
+    case LUA_VUSERDATA: {
+      Udata *u = gco2u(o);
+      pmarkobjectN(w, u->metatable);
+      for (i = 0; i < u->nuvalue; i++)
+        pmarkvalue(w, &u->uv[i].uv);
+      break;
+    }
+    case LUA_VLCL: {
+      LClosure *cl = gco2lcl(o);
+      pmarkobjectN(w, cl->p);
+      for (i = 0; i < cl->nupvalues; i++)
+        pmarkobjectN(w, cl->upvals[i]);
+      break;
+    }
+    case LUA_VCCL: {
+      CClosure *cl = gco2ccl(o);
+      for (i = 0; i < cl->nupvalues; i++)
+        pmarkvalue(w, &cl->upvalue[i]);
+      break;
+    }
+    case LUA_VPROTO: {
+      Proto *f = gco2p(o);
+      pmarkobjectN(w, f->source);
+      for (i = 0; i < f->sizek; i++)
+        pmarkvalue(w, &f->k[i]);
+      for (i = 0; i < f->sizeupvalues; i++)
+        pmarkobjectN(w, f->upvalues[i].name);
+      for (i = 0; i < f->sizep; i++)
+        pmarkobjectN(w, f->p[i]);
+      for (i = 0; i < f->sizelocvars; i++)
+        pmarkobjectN(w, f->locvars[i].varname);
+      break;
+    }
+    default: lua_assert(0);
+  }
+}
+
+
+/*
+** Traverses gray objects until every worker runs out of them. A worker
+** with no work waits for shared chunks; the last one to become idle
+** finishes the round.
+*/
+static void drain (MarkWorker *w) {
+  ParMark *pm = w->pm;
+  for (;;) {
+    GCObject *o;
+    MarkChunk *c;
+    while ((o = popgray(w)) != NULL) {
+      ptraverse(w, o);
+      if (__atomic_load_n(&pm->nidle, __ATOMIC_RELAXED) > 0)
+        sharework(w);
+    }
+    pthread_mutex_lock(&pm->lock);
+    while (pm->shared == NULL && !pm->finished) {
+      if (pm->nidle + 1 == pm->nworkers) {  /* all others are idle too? */
+        pm->finished = 1;
+        pthread_cond_broadcast(&pm->more);
+      }
+      else {
+        __atomic_store_n(&pm->nidle, pm->nidle + 1, __ATOMIC_RELAXED);
+        pthread_cond_wait(&pm->more, &pm->lock);
+        __atomic_store_n(&pm->nidle, pm->nidle - 1, __ATOMIC_RELAXED);
+      }
+    }
+    if (pm->finished) {
+      pthread_mutex_unlock(&pm->lock);
+      return;
+    }
+    c = pm->shared;
+    pm->shared = c->next;
+    c->next = w->stack;
+    w->stack = c;
+    pthread_mutex_unlock(&pm->lock);
+  }
+}
+
+
+static void *markworker (void *arg) {
+  MarkWorker *w = cast(MarkWorker *, arg);
+  ParMark *pm = w->pm;
+  int round = 0;
+  pthread_mutex_lock(&pm->lock);
+  for (;;) {
+    while (!pm->stop && pm->round == round)
+      pthread_cond_wait(&pm->start, &pm->lock);
+    if (pm->stop)
+      break;
+    round = pm->round;
+    pthread_mutex_unlock(&pm->lock);
+    drain(w);
+    pthread_mutex_lock(&pm->lock);
+    if (--pm->nbusy == 0)
+      pthread_cond_signal(&pm->done);
+  }
+  pthread_mutex_unlock(&pm->lock);
+  return NULL;
+}
+
+
+/*
+** Marks everything reachable from the 'gray' list with all workers.
+** Returns the list of gray objects left to the collector.
+*/
+static GCObject *markround (global_State *g, ParMark *pm) {
+  GCObject *left = NULL;
+  int i;
+  while (g->gray != NULL) {  /* move 'gray' list to the collector's stack */
+    GCObject *o = g->gray;
+    g->gray = *getgclist(o);
+    pushgray(&pm->w[0], o);
+  }
+  pthread_mutex_lock(&pm->lock);
+  pm->nidle = 0;
+  pm->finished = 0;
+  pm->nbusy = pm->nworkers - 1;
+  pm->round++;
+  pthread_cond_broadcast(&pm->start);
+  pthread_mutex_unlock(&pm->lock);
+  drain(&pm->w[0]);
+  pthread_mutex_lock(&pm->lock);
+  while (pm->nbusy > 0)
+    pthread_cond_wait(&pm->done, &pm->lock);
+  pthread_mutex_unlock(&pm->lock);
+  for (i = 0; i < pm->nworkers; i++) {
+    MarkWorker *w = &pm->w[i];
+    g->GCmarked += w->marked;
+    w->marked = 0;
+    while (w->left != NULL) {
+      GCObject *o = w->left;
+      w->left = *getgclist(o);
+      *getgclist(o) = left;
+      left = o;
+    }
+  }
+  return left;
+}
+
+
+static void freechunks (global_State *g, ParMark *pm) {
+  int i;
+  for (i = 0; i < pm->nworkers; i++) {
+    MarkChunk *c = pm->w[i].spare;
+    if (c != NULL) {
+      c->next = pm->free;
+      pm->free = c;
+      pm->w[i].spare = NULL;
+    }
+  }
+  while (pm->free != NULL) {
+    MarkChunk *c = pm->free;
+    pm->free = c->next;
+    (*g->frealloc)(g->ud, c, sizeof(MarkChunk), 0);
+  }
+}
+
+
+/*
+** Replaces 'propagateall' in the atomic phase. Minor collections, small
+** heaps and emergency collections are marked by the collector alone.
+*/
+static void parpropagateall (global_State *g) {
+  ParMark *pm = g->parmark;
+  if (pm == NULL || g->gckind == KGC_GENMINOR || g->gcemergency ||
+      gettotalbytes(g) < PARMARKMIN) {
+    propagateall(g);
+    return;
+  }
+  while (g->gray != NULL) {
+    GCObject *left = markround(g, pm);
+    while (left != NULL) {  /* traverse objects left by the workers */
+      GCObject *o = left;
+      left = *getgclist(o);
+      *getgclist(o) = g->gray;  /* put it first in 'gray' list... */
+      g->gray = o;
+      propagatemark(g);  /* ...and traverse it */
+    }
+  }
+  freechunks(g, pm);
+}
+
+
+static void stopmarkers (global_State *g, ParMark *pm, int nhelpers) {
+  int i;
+  pthread_mutex_lock(&pm->lock);
+  pm->stop = 1;
+  pthread_cond_broadcast(&pm->start);
+  pthread_mutex_unlock(&pm->lock);
+  for (i = 1; i <= nhelpers; i++)
+    pthread_join(pm->w[i].thread, NULL);
+  freechunks(g, pm);
+  pthread_cond_destroy(&pm->done);
+  pthread_cond_destroy(&pm->more);
+  pthread_cond_destroy(&pm->start);
+  pthread_mutex_destroy(&pm->lock);
+  (*g->frealloc)(g->ud, pm, sizeparmark(pm->nworkers), 0);
+}
+
+
+/*
+** Sets the number of threads that mark in the atomic phase; 0 or 1
+** turns parallel marking off. Returns the previous number (0 when it
+** was off), or -1 if the helper threads cannot be started.
+*/
+int luaC_setparmark (lua55_State *L, int n) {
+  global_State *g = G(L);
+  ParMark *pm = g->parmark;
+  int old = (pm != NULL) ? pm->nworkers : 0;
+  int i;
+  if (n < 2)
+    n = 0;
+  else if (n > MAXMARKERS)
+    n = MAXMARKERS;
+  if (n == old)
+    return old;
+  if (pm != NULL) {
+    g->parmark = NULL;
+    stopmarkers(g, pm, pm->nworkers - 1);
+  }
+  if (n == 0)
+    return old;
+  pm = cast(ParMark *, (*g->frealloc)(g->ud, NULL, 0, sizeparmark(n)));
+  if (pm == NULL)
+    return -1;
+  pthread_mutex_init(&pm->lock, NULL);
+  pthread_cond_init(&pm->start, NULL);
+  pthread_cond_init(&pm->more, NULL);
+  pthread_cond_init(&pm->done, NULL);
+  pm->g = g;
+  pm->shared = pm->free = NULL;
+  pm->nworkers = n;
+  pm->nidle = pm->nbusy = pm->round = pm->finished = pm->stop = 0;
+  for (i = 0; i < n; i++) {
+    MarkWorker *w = &pm->w[i];
+    w->pm = pm;
+    w->stack = w->spare = NULL;
+    w->left = NULL;
+    w->marked = 0;
+  }
+  for (i = 1; i < n; i++) {
+    if (pthread_create(&pm->w[i].thread, NULL, markworker, &pm->w[i]) != 0) {
+      stopmarkers(g, pm, i - 1);
+      return -1;
+    }
+  }
+  g->parmark = pm;
+  return old;
+}
+
+#else				/* }{ */
+
+/* no threads or atomics: the collector marks alone */
+
+#define parpropagateall(g)	propagateall(g)
+
+int luaC_setparmark (lua55_State *L, int n) {
+  UNUSED(L);
+  return (n > 1) ? -1 : 0;
+}
+
+#endif				/* } */
+
+/* }====================================================== */
+
+
 /*
 ** Traverse all ephemeron tables propagating marks from keys to values.
 ** Repeat until it converges, that is, nothing new is marked. 'dir'
@@ -835,6 +1408,8 @@ static void freeupval (lua55_State *L, UpVal *uv) {
 
 static void freeobj (lua55_State *L, GCObject *o) {
   assert_code(l_mem newmem = gettotalbytes(G(L)) - objsize(o));
+  G(L)->gcstats.objects[novariant(o->tt)]--;
+  G(L)->gcfreeing = 1;  /* blocks may go to deferred freeing */
   switch (o->tt) {
     case LUA_VPROTO:
       luaF_freeproto(L, gco2p(o));
@@ -878,6 +1453,7 @@ static void freeobj (lua55_State *L, GCObject *o) {
     }
     default: lua_assert(0);
   }
+  G(L)->gcfreeing = 0;
   lua_assert(gettotalbytes(G(L)) == newmem);
 }
 
@@ -1201,6 +1777,7 @@ static GCObject **sweepgen (lua55_State *L, global_State *g, GCObject **p,
         setage(curr, nextage[age]);
         if (getage(curr) == G_OLD1) {
           addedold += objsize(curr);  /* bytes becoming old */
+          g->gcstats.promoted++;
           if (*pfirstold1 == NULL)
             *pfirstold1 = curr;  /* first OLD1 object in the list */
         }
@@ -1292,6 +1869,7 @@ static void markold (global_State *g, GCObject *from, GCObject *to) {
 static void finishgencycle (lua55_State *L, global_State *g) {
   correctgraylists(g);
   checkSizes(L, g);
+  luaM_submitfree(L);  /* hand over the last deferred frees */
   g->gcstate = GCSpropagate;  /* skip restart */
   if (!g->gcemergency && luaD_checkminstack(L))
     callallpendingfinalizers(L);
@@ -1496,16 +2074,19 @@ static int checkmajorminor (lua55_State *L, global_State *g) {
 
 /*
 ** Enter first sweep phase.
-** The call to 'sweeptolive' makes the pointer point to an object
+** The first sweep step usually makes the pointer point to an object
 ** inside the list (instead of to the header), so that the real sweep do
 ** not need to skip objects created between "now" and the start of the
-** real sweep.
+** real sweep. It is not run to the first live object ('sweeptolive'):
+** the young garbage at the head of the list can be arbitrarily long,
+** and freeing all of it here would make this the longest step of the
+** cycle. Sweep steps go on from the header instead.
 */
 static void entersweep (lua55_State *L) {
   global_State *g = G(L);
   g->gcstate = GCSswpallgc;
   lua_assert(g->sweepgc == NULL);
-  g->sweepgc = sweeptolive(L, &g->allgc);
+  g->sweepgc = sweeplist(L, &g->allgc, GCSWEEPMAX);
 }
 
 
@@ -1542,6 +2123,7 @@ void luaC_freeallobjects (lua55_State *L) {
 
 static void atomic (lua55_State *L) {
   global_State *g = G(L);
+  lu_mem start = luai_gcclock();
   GCObject *origweak, *origall;
   GCObject *grayagain = g->grayagain;  /* save original list */
   g->grayagain = NULL;
@@ -1551,13 +2133,14 @@ static void atomic (lua55_State *L) {
   markobject(g, L);  /* mark running thread */
   /* registry and global metatables may be changed by API */
   markvalue(g, &g->l_registry);
+  markrefs(g);  /* values stored after the cycle started */
   markmt(g);  /* mark global metatables */
-  propagateall(g);  /* empties 'gray' list */
+  parpropagateall(g);  /* empties 'gray' list */
   /* remark occasional upvalues of (maybe) dead threads */
   remarkupvals(g);
-  propagateall(g);  /* propagate changes */
+  parpropagateall(g);  /* propagate changes */
   g->gray = grayagain;
-  propagateall(g);  /* traverse 'grayagain' list */
+  parpropagateall(g);  /* traverse 'grayagain' list */
   convergeephemerons(g);
   /* at this point, all strongly accessible objects are marked. */
   /* Clear values from weak tables, before checking finalizers */
@@ -1566,7 +2149,7 @@ static void atomic (lua55_State *L) {
   origweak = g->weak; origall = g->allweak;
   separatetobefnz(g, 0);  /* separate objects to be finalized */
   markbeingfnz(g);  /* mark objects that will be finalized */
-  propagateall(g);  /* remark, to propagate 'resurrection' */
+  parpropagateall(g);  /* remark, to propagate 'resurrection' */
   convergeephemerons(g);
   /* at this point, all resurrected objects are marked. */
   /* remove dead objects from weak tables */
@@ -1578,6 +2161,12 @@ static void atomic (lua55_State *L) {
   luaS_clearcache(g);
   g->currentwhite = cast_byte(otherwhite(g));  /* flip current white */
   lua_assert(g->gray == NULL);
+  switch (g->gckind) {
+    case KGC_INC: g->gcstats.incremental++; break;
+    case KGC_GENMINOR: g->gcstats.minor++; break;
+    case KGC_GENMAJOR: g->gcstats.major++; break;
+  }
+  addpause(g, LUA_GCSATOMIC, start);
 }
 
 
@@ -1662,6 +2251,7 @@ static l_mem singlestep (lua55_State *L, int fast) {
     }
     case GCSswpend: {  /* finish sweeps */
       checkSizes(L, g);
+      luaM_submitfree(L);  /* hand over the last deferred frees */
       g->gcstate = GCScallfin;
       stepresult = GCSWEEPMAX;
       break;
@@ -1745,6 +2335,7 @@ void luaC_step (lua55_State *L) {
       luaE_setdebt(g, 20000);
   }
   else {
+    lu_mem start = luai_gcclock();
     luai_tracegc(L, 1);  /* for internal debugging */
     switch (g->gckind) {
       case KGC_INC: case KGC_GENMAJOR:
@@ -1756,9 +2347,77 @@ void luaC_step (lua55_State *L) {
         break;
     }
     luai_tracegc(L, 0);  /* for internal debugging */
+    addpause(g, LUA_GCSSTEP, start);
+  }
+}
+
+
+/*
+** {======================================================
+** Time-budgeted steps
+** =======================================================
+*/
+
+/* number of single steps between clock readings */
+#if !defined(GCBUDGETCHECK)
+#define GCBUDGETCHECK	8
+#endif
+
+
+/*
+** Performs single steps until 'us' microseconds have passed or the
+** cycle ends. The clock is read every GCBUDGETCHECK steps and after
+** the atomic step, which cannot be split and may overrun the budget
+** by itself. In generational mode, the work is one minor collection,
+** regardless of the budget. Returns 1 if that finished a cycle (or a
+** minor collection).
+*/
+static int budgetstep (lua55_State *L, l_mem us) {
+  global_State *g = G(L);
+  int done = 0;
+  luai_tracegc(L, 1);
+  if (g->gckind == KGC_GENMINOR) {
+    youngcollection(L, g);
+    setminordebt(g);
+    done = 1;
   }
+  else {
+    lu_mem start = luai_gcclock();
+    int n = 0;
+    for (;;) {
+      l_mem stres = singlestep(L, 0);
+      if (stres == step2minor) {  /* returned to minor collections? */
+        luai_tracegc(L, 0);
+        return 1;  /* debt already set */
+      }
+      else if (stres == step2pause) {
+        done = 1;
+        break;
+      }
+      else if ((++n % GCBUDGETCHECK == 0 || stres == atomicstep) &&
+               cast(l_mem, luai_gcclock() - start) >= us)
+        break;
+    }
+    if (g->gcstate == GCSpause)
+      setpause(g);  /* pause until next cycle */
+    else
+      luaE_setdebt(g, applygcparam(g, STEPSIZE, 100));
+  }
+  luai_tracegc(L, 0);
+  return done;
+}
+
+
+/* a budgeted step counts as a collector step in the statistics */
+int luaC_budgetstep (lua55_State *L, l_mem us) {
+  lu_mem start = luai_gcclock();
+  int done = budgetstep(L, us);
+  addpause(G(L), LUA_GCSSTEP, start);
+  return done;
 }
 
+/* }====================================================== */
+
 
 /*
 ** Perform a full collection in incremental mode.
@@ -1785,6 +2444,7 @@ static void fullinc (lua55_State *L, global_State *g) {
 */
 void luaC_fullgc (lua55_State *L, int isemergency) {
   global_State *g = G(L);
+  lu_mem start = luai_gcclock();
   lua_assert(!g->gcemergency);
   g->gcemergency = cast_byte(isemergency);  /* set flag */
   switch (g->gckind) {
@@ -1797,6 +2457,8 @@ void luaC_fullgc (lua55_State *L, int isemergency) {
       break;
   }
   g->gcemergency = 0;
+  g->gcstats.full++;
+  addpause(g, LUA_GCSFULL, start);
 }
 
 /* }====================================================== */
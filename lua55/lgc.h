@@ -254,6 +254,8 @@
 LUAI_FUNC void luaC_fix (lua55_State *L, GCObject *o);
 LUAI_FUNC void luaC_freeallobjects (lua55_State *L);
 LUAI_FUNC void luaC_step (lua55_State *L);
+LUAI_FUNC int luaC_budgetstep (lua55_State *L, l_mem us);
+LUAI_FUNC int luaC_setparmark (lua55_State *L, int n);
 LUAI_FUNC void luaC_runtilstate (lua55_State *L, int state, int fast);
 LUAI_FUNC void luaC_fullgc (lua55_State *L, int isemergency);
 LUAI_FUNC GCObject *luaC_newobj (lua55_State *L, lu_byte tt, size_t sz);
@@ -263,6 +265,7 @@ LUAI_FUNC void luaC_barrier_ (lua55_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback_ (lua55_State *L, GCObject *o);
 LUAI_FUNC void luaC_checkfinalizer (lua55_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_changemode (lua55_State *L, int newmode);
+LUAI_FUNC l_mem luaC_objsize (GCObject *o);
 
 
 #endif
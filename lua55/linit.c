@@ -58,6 +58,12 @@ LUALIB_API void lua55L_openselectedlibs (lua55_State *L, int load, int preload)
     }
   }
   lua_assert((mask >> 1) == LUA_UTF8LIBK);
+  lua55_pushcfunction(L, lua55open_profiler);  /* always just preloaded */
+  lua55_setfield(L, -2, LUA_PROFLIBNAME);
+  lua55_pushcfunction(L, lua55open_serialize);
+  lua55_setfield(L, -2, LUA_SERLIBNAME);
+  lua55_pushcfunction(L, lua55open_census);
+  lua55_setfield(L, -2, LUA_CENSUSLIBNAME);
   lua55_pop(L, 1);  /* remove PRELOAD table */
 }
 
@@ -19,6 +19,7 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lprof.h"
 #include "lstate.h"
 
 
@@ -80,6 +81,234 @@ static void *firsttry (global_State *g, void *block, size_t os, size_t ns) {
 
 
 
+/*
+** {==================================================================
+** Deferred freeing
+** ===================================================================
+*/
+
+/*
+** With deferred freeing on, the blocks of objects freed by the
+** collector ('gcfreeing' set) are collected in batches, and a helper
+** thread hands them back to the allocation function, which therefore
+** must be thread safe (as 'lua55L_alloc' is). When the helper falls
+** MAXQUEUED batches behind, the collector frees a full batch itself.
+** Memory counts as free as soon as a block is queued. Queued blocks
+** are really freed before the state changes its allocation function,
+** after an emergency collection and when the state is closed.
+*/
+
+#if defined(LUA_USE_POSIX)	/* { */
+
+#include <pthread.h>
+
+#define FREEBATCH	512	/* blocks per batch */
+#define MAXQUEUED	32	/* batches waiting for the helper */
+
+typedef struct FreeBatch {
+  struct FreeBatch *next;
+  int n;  /* number of blocks */
+  struct {
+    void *block;
+    size_t osize;
+  } b[FREEBATCH];
+} FreeBatch;
+
+typedef struct FreeQueue {
+  pthread_mutex_t lock;
+  pthread_cond_t work;  /* a batch was queued, or 'stop' was set */
+  pthread_cond_t idle;  /* the helper finished a batch */
+  pthread_t thread;
+  global_State *g;
+  FreeBatch *cur;  /* batch being filled by the collector */
+  FreeBatch *head, *tail;  /* queued batches */
+  FreeBatch *spare;  /* emptied batches */
+  int nqueued;  /* number of queued batches */
+  int busy;  /* true while the helper frees a batch */
+  int stop;  /* helper must exit */
+} FreeQueue;
+
+
+static void freebatch (lua55_Alloc f, void *ud, FreeBatch *b) {
+  int i;
+  for (i = 0; i < b->n; i++)
+    f(ud, b->b[i].block, b->b[i].osize, 0);
+  b->n = 0;
+}
+
+
+static void *freeworker (void *arg) {
+  FreeQueue *q = cast(FreeQueue *, arg);
+  pthread_mutex_lock(&q->lock);
+  for (;;) {
+    FreeBatch *b = q->head;
+    if (b == NULL) {
+      if (q->stop)
+        break;
+      pthread_cond_wait(&q->work, &q->lock);
+    }
+    else {
+      /* 'frealloc' only changes when the queue is empty */
+      lua55_Alloc f = q->g->frealloc;
+      void *ud = q->g->ud;
+      q->head = b->next;
+      if (q->head == NULL)
+        q->tail = NULL;
+      q->nqueued--;
+      q->busy = 1;
+      pthread_mutex_unlock(&q->lock);
+      freebatch(f, ud, b);
+      pthread_mutex_lock(&q->lock);
+      q->busy = 0;
+      b->next = q->spare;
+      q->spare = b;
+      pthread_cond_signal(&q->idle);
+    }
+  }
+  pthread_mutex_unlock(&q->lock);
+  return NULL;
+}
+
+
+/*
+** Hands the batch being filled to the helper; if the helper is too far
+** behind, frees its blocks here and keeps the batch.
+*/
+void luaM_submitfree (lua55_State *L) {
+  global_State *g = G(L);
+  FreeQueue *q = g->freeq;
+  FreeBatch *b;
+  if (q == NULL || (b = q->cur) == NULL || b->n == 0)
+    return;
+  pthread_mutex_lock(&q->lock);
+  if (q->nqueued >= MAXQUEUED) {
+    pthread_mutex_unlock(&q->lock);
+    freebatch(g->frealloc, g->ud, b);
+    return;
+  }
+  b->next = NULL;
+  if (q->tail != NULL)
+    q->tail->next = b;
+  else
+    q->head = b;
+  q->tail = b;
+  q->nqueued++;
+  q->cur = q->spare;  /* reuse an emptied batch, if any */
+  if (q->spare != NULL)
+    q->spare = q->spare->next;
+  pthread_cond_signal(&q->work);
+  pthread_mutex_unlock(&q->lock);
+}
+
+
+static void queuefree (lua55_State *L, void *block, size_t osize) {
+  global_State *g = G(L);
+  FreeQueue *q = g->freeq;
+  FreeBatch *b = q->cur;
+  if (b == NULL) {
+    b = cast(FreeBatch *, callfrealloc(g, NULL, 0, sizeof(FreeBatch)));
+    if (b == NULL) {  /* no memory for a new batch? */
+      callfrealloc(g, block, osize, 0);  /* free block right away */
+      return;
+    }
+    b->n = 0;
+    q->cur = b;
+  }
+  b->b[b->n].block = block;
+  b->b[b->n].osize = osize;
+  if (++b->n == FREEBATCH)
+    luaM_submitfree(L);
+}
+
+
+/* waits until all queued blocks are freed */
+void luaM_syncfree (lua55_State *L) {
+  FreeQueue *q = G(L)->freeq;
+  if (q == NULL)
+    return;
+  luaM_submitfree(L);
+  pthread_mutex_lock(&q->lock);
+  while (q->head != NULL || q->busy)
+    pthread_cond_wait(&q->idle, &q->lock);
+  pthread_mutex_unlock(&q->lock);
+}
+
+
+static void freequeue (global_State *g, FreeQueue *q) {
+  FreeBatch *b = q->spare;
+  while (b != NULL) {
+    FreeBatch *next = b->next;
+    callfrealloc(g, b, sizeof(FreeBatch), 0);
+    b = next;
+  }
+  if (q->cur != NULL)
+    callfrealloc(g, q->cur, sizeof(FreeBatch), 0);
+  pthread_cond_destroy(&q->idle);
+  pthread_cond_destroy(&q->work);
+  pthread_mutex_destroy(&q->lock);
+  callfrealloc(g, q, sizeof(FreeQueue), 0);
+}
+
+
+/*
+** Turns deferred freeing on or off for the whole state. Returns the
+** previous setting, or -1 if the helper thread cannot be started.
+** (Batches and the queue are not counted as memory in use.)
+*/
+int luaM_setdeferfree (lua55_State *L, int on) {
+  global_State *g = G(L);
+  FreeQueue *q = g->freeq;
+  int old = (q != NULL);
+  if (on && q == NULL) {
+    q = cast(FreeQueue *, callfrealloc(g, NULL, 0, sizeof(FreeQueue)));
+    if (q == NULL)
+      return -1;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->work, NULL);
+    pthread_cond_init(&q->idle, NULL);
+    q->g = g;
+    q->cur = q->head = q->tail = q->spare = NULL;
+    q->nqueued = q->busy = q->stop = 0;
+    if (pthread_create(&q->thread, NULL, freeworker, q) != 0) {
+      freequeue(g, q);
+      return -1;
+    }
+    g->freeq = q;
+  }
+  else if (!on && q != NULL) {
+    luaM_syncfree(L);
+    pthread_mutex_lock(&q->lock);
+    q->stop = 1;
+    pthread_cond_signal(&q->work);
+    pthread_mutex_unlock(&q->lock);
+    pthread_join(q->thread, NULL);
+    g->freeq = NULL;
+    freequeue(g, q);
+  }
+  return old;
+}
+
+#else				/* }{ */
+
+/* no threads: deferred freeing is not available */
+
+#define queuefree(L,block,osize)	callfrealloc(G(L), block, osize, 0)
+
+void luaM_submitfree (lua55_State *L) { UNUSED(L); }
+
+void luaM_syncfree (lua55_State *L) { UNUSED(L); }
+
+int luaM_setdeferfree (lua55_State *L, int on) {
+  UNUSED(L);
+  return on ? -1 : 0;
+}
+
+#endif				/* } */
+
+/* }================================================================== */
+
+
+
 /*
 ** {==================================================================
 ** Functions to allocate/deallocate arrays for the Parser
@@ -150,8 +379,14 @@ l_noret luaM_toobig (lua55_State *L) {
 void luaM_free_ (lua55_State *L, void *block, size_t osize) {
   global_State *g = G(L);
   lua_assert((osize == 0) == (block == NULL));
-  callfrealloc(g, block, osize, 0);
+  if (l_unlikely(g->heapprof != NULL))  /* sampling allocations? */
+    luaR_heapfree(g, block);
+  if (g->freeq != NULL && g->gcfreeing)  /* part of a dead object? */
+    queuefree(L, block, osize);  /* let the helper thread free it */
+  else
+    callfrealloc(g, block, osize, 0);
   g->GCdebt += cast(l_mem, osize);
+  g->gcstats.freed += osize;
 }
 
 
@@ -164,6 +399,7 @@ static void *tryagain (lua55_State *L, void *block,
   global_State *g = G(L);
   if (cantryagain(g)) {
     luaC_fullgc(L, 1);  /* try to free some memory... */
+    luaM_syncfree(L);  /* ...and make sure it is really free */
     return callfrealloc(g, block, osize, nsize);  /* try again */
   }
   else return NULL;  /* cannot run an emergency collection */
@@ -185,6 +421,14 @@ void *luaM_realloc_ (lua55_State *L, void *block, size_t osize, size_t nsize) {
   }
   lua_assert((nsize == 0) == (newblock == NULL));
   g->GCdebt -= cast(l_mem, nsize) - cast(l_mem, osize);
+  g->gcstats.allocated += nsize;
+  g->gcstats.freed += osize;
+  if (l_unlikely(g->heapprof != NULL)) {  /* sampling allocations? */
+    if (block != NULL)
+      luaR_heapfree(g, block);
+    if (newblock != NULL)
+      luaR_heapalloc(L, newblock, nsize);
+  }
   return newblock;
 }
 
@@ -210,6 +454,9 @@ void *luaM_malloc_ (lua55_State *L, size_t size, int tag) {
         luaM_error(L);
     }
     g->GCdebt -= cast(l_mem, size);
+    g->gcstats.allocated += size;
+    if (l_unlikely(g->heapprof != NULL))  /* sampling allocations? */
+      luaR_heapalloc(L, newblock, size);
     return newblock;
   }
 }
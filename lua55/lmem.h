@@ -85,6 +85,9 @@ LUAI_FUNC void *luaM_realloc_ (lua55_State *L, void *block, size_t oldsize,
 LUAI_FUNC void *luaM_saferealloc_ (lua55_State *L, void *block, size_t oldsize,
                                                               size_t size);
 LUAI_FUNC void luaM_free_ (lua55_State *L, void *block, size_t osize);
+LUAI_FUNC int luaM_setdeferfree (lua55_State *L, int on);
+LUAI_FUNC void luaM_submitfree (lua55_State *L);
+LUAI_FUNC void luaM_syncfree (lua55_State *L);
 LUAI_FUNC void *luaM_growaux_ (lua55_State *L, void *block, int nelems,
                                int *size, unsigned size_elem, int limit,
                                const char *what);
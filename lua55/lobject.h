@@ -615,6 +615,7 @@ typedef struct Proto {
   int lastlinedefined;  /* debug information  */
   TValue *k;  /* constants used by the function */
   Instruction *code;  /* opcodes */
+  unsigned short *icache;  /* per-instruction node slots (see lvm.c) */
   struct Proto **p;  /* functions defined inside the function */
   Upvaldesc *upvalues;  /* upvalue information */
   ls_byte *lineinfo;  /* information about source lines (debug information) */
@@ -622,6 +623,10 @@ typedef struct Proto {
   LocVar *locvars;  /* information about local variables (debug information) */
   TString  *source;  /* used for debug information */
   GCObject *gclist;
+#if defined(LUA_OPSTATS)
+  lua_Unsigned ncalls;  /* calls to this function */
+  lua_Unsigned ninstrs;  /* instructions executed by this function */
+#endif
 } Proto;
 
 /* }================================================================== */
@@ -851,6 +856,8 @@ LUAI_FUNC int luaO_rawarith (lua55_State *L, int op, const TValue *p1,
 LUAI_FUNC void luaO_arith (lua55_State *L, int op, const TValue *p1,
                            const TValue *p2, StkId res);
 LUAI_FUNC size_t luaO_str2num (const char *s, TValue *o);
+LUAI_FUNC unsigned luaO_int2str (lua_Integer x, char *buff);
+LUAI_FUNC unsigned luaO_fmtfloat (lua_Number n, int prec, char *buff);
 LUAI_FUNC unsigned luaO_tostringbuff (const TValue *obj, char *buff);
 LUAI_FUNC lu_byte luaO_hexavalue (int c);
 LUAI_FUNC void luaO_tostring (lua55_State *L, TValue *obj);
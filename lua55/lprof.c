@@ -0,0 +1,796 @@
+/*
+** $Id: lprof.c $
+** Sampling profiler
+** See Copyright Notice in lua.h
+*/
+
+#define lprof_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "ldebug.h"
+#include "lobject.h"
+#include "lprof.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+
+
+/*
+** A timer signal (SIGPROF, counting process CPU time) only increments
+** the 'profticks' of the profiled state. The interpreter polls it at
+** calls, returns and backward jumps (other states always find zero
+** there) and, at that safe point, walks the CallInfo chain of
+** the running thread. Each function is interned once as a frame with
+** a printable label, and each distinct stack once as a node of a trie
+** of frames, so a sample is just (node, weight) pushed to a
+** single-producer, single-consumer ring. 'lua55_profdump' drains the
+** ring into per-node counts and prints every stack seen as a "folded"
+** line ("outer;inner;leaf count"), the input format of flame-graph
+** tools.
+**
+** There is one profiler per process (the timer is per process) and it
+** samples one state, including its coroutines. Frames, nodes and the
+** ring never move once allocated and are published to the consumer
+** after they are written, so 'lua55_profdump' may run on another thread
+** while the profiled state keeps running. Tables are fixed-size: when
+** one fills up, further distinct functions or stacks are reported as
+** "?" and samples that find the ring full are counted as dropped.
+**
+** The heap sampler (see 'lua55_heapprofstart') reuses the frame and
+** stack tables, one set per sampled state. 'luaM_malloc_' and
+** 'luaM_realloc_' call it when the state has one; it counts down the
+** bytes allocated and, every 'interval' bytes on average (random
+** intervals, so periodic allocation patterns do not bias it), charges
+** the interval to the Lua stack that made the allocation. Sampled
+** blocks are remembered until freed, so each stack has an estimate of
+** both the bytes it allocated and the bytes it still holds. As an
+** allocation may happen with any table half-built, function names are
+** only looked up when the results are dumped.
+*/
+
+
+/* frames kept per sample (the innermost ones) */
+#if !defined(LUAI_PROFDEPTH)
+#define LUAI_PROFDEPTH		64
+#endif
+
+/* distinct functions */
+#if !defined(LUAI_PROFFRAMES)
+#define LUAI_PROFFRAMES		2048
+#endif
+
+/* distinct stacks */
+#if !defined(LUAI_PROFNODES)
+#define LUAI_PROFNODES		32768
+#endif
+
+/* samples not yet drained (a power of 2) */
+#if !defined(LUAI_PROFRING)
+#define LUAI_PROFRING		16384
+#endif
+
+/* sampled blocks tracked for live bytes (a power of 2) */
+#if !defined(LUAI_HEAPBLOCKS)
+#define LUAI_HEAPBLOCKS		65536
+#endif
+
+/* largest mean interval between heap samples */
+#define MAXHEAPINTERVAL		(1u << 30)
+
+#define PROFLABEL	96
+
+/* names from lauxlib.h: loaded modules (in the registry) and globals */
+#define PROFLOADED	"_LOADED"
+#define PROFGNAME	"_G"
+
+
+#if defined(__GNUC__)
+#define loadacq(p)	__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define storerel(p,v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#else
+#define loadacq(p)	(*(volatile size_t *)(p))
+#define storerel(p,v)	(*(volatile size_t *)(p) = (v))
+#endif
+
+
+typedef struct PFrame {
+  const void *f;  /* Proto or lua_CFunction */
+  const TString *source;  /* to tell reused Proto addresses apart */
+  int line;
+  int named;  /* 'label' has the function name, if any */
+  char label[PROFLABEL];
+} PFrame;
+
+
+typedef struct PNode {
+  int parent;  /* -1 for a root */
+  int frame;
+} PNode;
+
+
+/* interned frames and stacks (written by the producer) */
+typedef struct PStacks {
+  size_t nframes;
+  size_t nnodes;
+  int fhash[2 * LUAI_PROFFRAMES];  /* frame index + 1, or 0 */
+  int nhash[2 * LUAI_PROFNODES];  /* node index + 1, or 0 */
+  PFrame frames[LUAI_PROFFRAMES];
+  PNode nodes[LUAI_PROFNODES];
+} PStacks;
+
+
+typedef struct PSample {
+  int node;
+  int weight;  /* timer ticks since the previous sample */
+} PSample;
+
+
+typedef struct Profiler {
+  global_State *g;  /* profiled state (NULL when stopped) */
+  /* written by the producer */
+  PStacks st;
+  size_t head;
+  size_t dropped;
+  PSample ring[LUAI_PROFRING];
+  /* written by the consumer */
+  size_t tail;
+  size_t counts[LUAI_PROFNODES];
+} Profiler;
+
+
+/* 'profticks' of the profiled state, for the signal handler */
+static volatile l_signalT *volatile ticks = NULL;
+
+/* allocated by the first 'lua55_profstart' and then reused */
+static Profiler *prof = NULL;
+
+
+
+/*
+** {======================================================
+** Frame labels
+** =======================================================
+*/
+
+static size_t addstr (char *buff, size_t n, const char *s) {
+  size_t l = strlen(s);
+  if (l > PROFLABEL - 1 - n)
+    l = PROFLABEL - 1 - n;
+  memcpy(buff + n, s, l);
+  buff[n + l] = '\0';
+  return n + l;
+}
+
+
+/* identity of a function: its Proto or its C function (NULL if none) */
+static const void *funckey (const TValue *f) {
+  if (ttisLclosure(f))
+    return clLvalue(f)->p;
+  else if (ttislcf(f))
+    return cast_voidp(cast_sizet(fvalue(f)));
+  else if (ttisCclosure(f))
+    return cast_voidp(cast_sizet(clCvalue(f)->f));
+  else
+    return NULL;
+}
+
+
+/*
+** Looks for a string key of 't' whose value is the function 'key'
+** (only the hash part: functions in module tables live there). Plain
+** traversal, as nothing can be allocated at a sampling point.
+*/
+static const char *findfield (Table *t, const void *key) {
+  unsigned i;
+  for (i = 0; i < sizenode(t); i++) {
+    Node *n = gnode(t, i);
+    if (keyisshrstr(n) && !isempty(gval(n)) && funckey(gval(n)) == key)
+      return getstr(keystrval(n));
+  }
+  return NULL;
+}
+
+
+static const TValue *getfield (Table *t, const char *k) {
+  unsigned i;
+  for (i = 0; i < sizenode(t); i++) {
+    Node *n = gnode(t, i);
+    if (keyisshrstr(n) && !isempty(gval(n)) &&
+        strcmp(getstr(keystrval(n)), k) == 0)
+      return gval(n);
+  }
+  return NULL;
+}
+
+
+/*
+** Name of function 'key' as a field of a loaded module ("print",
+** "string.rep"), or 0 if it is not one.
+*/
+static size_t funcname (global_State *g, const void *key, char *buff) {
+  const TValue *loaded = getfield(hvalue(&g->l_registry), PROFLOADED);
+  const TValue *gt;
+  const char *name;
+  unsigned i;
+  if (loaded == NULL || !ttistable(loaded))
+    return 0;
+  gt = getfield(hvalue(loaded), PROFGNAME);  /* try globals first */
+  if (gt != NULL && ttistable(gt) &&
+      (name = findfield(hvalue(gt), key)) != NULL)
+    return addstr(buff, 0, name);
+  for (i = 0; i < sizenode(hvalue(loaded)); i++) {
+    Node *n = gnode(hvalue(loaded), i);
+    if (keyisshrstr(n) && ttistable(gval(n)) && gval(n) != gt &&
+        (name = findfield(hvalue(gval(n)), key)) != NULL) {
+      size_t l = addstr(buff, 0, getstr(keystrval(n)));
+      l = addstr(buff, l, ".");
+      return addstr(buff, l, name);
+    }
+  }
+  return 0;
+}
+
+
+/* adds "source:line" of a Lua function ("source" for a main chunk) */
+static void addsource (char *buff, size_t l, const Proto *p) {
+  char src[LUA_IDSIZE];
+  if (p->source)
+    luaO_chunkid(src, getstr(p->source), tsslen(p->source));
+  else
+    strcpy(src, "?");
+  l = addstr(buff, l, src);
+  if (p->linedefined > 0) {
+    char line[LUA_N2SBUFFSZ];
+    luaO_int2str(p->linedefined, line);
+    l = addstr(buff, l, ":");
+    addstr(buff, l, line);
+  }
+}
+
+
+/*
+** Label of a function: "name@source:line" for Lua functions ("source"
+** alone for a main chunk, "source:line" if it has no known name) and
+** the name, or "[C]", for C functions.
+*/
+static void makelabel (global_State *g, const TValue *f, char *buff) {
+  size_t l = funcname(g, funckey(f), buff);
+  if (ttisLclosure(f)) {
+    if (l > 0)
+      l = addstr(buff, l, "@");
+    addsource(buff, l, clLvalue(f)->p);
+  }
+  else if (l == 0)
+    addstr(buff, 0, "[C]");
+}
+
+
+/*
+** Completes the label of a frame interned without its name (only
+** "source:line" for a Lua function, empty for a C function), as in
+** 'makelabel'.
+*/
+static void namelabel (global_State *g, PFrame *fr) {
+  char buff[PROFLABEL];
+  size_t l = funcname(g, fr->f, buff);
+  if (fr->label[0] != '\0') {  /* Lua function? */
+    if (l > 0)
+      l = addstr(buff, l, "@");
+    addstr(buff, l, fr->label);
+  }
+  else if (l == 0)
+    addstr(buff, 0, "[C]");
+  memcpy(fr->label, buff, PROFLABEL);
+  fr->named = 1;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Frames and stacks
+** =======================================================
+*/
+
+#define hashptr(p)	(point2uint(p) * 2654435761u)
+
+
+/* frame 0 is "?" (for overflows); node 0 is the stack "?" */
+static void initstacks (PStacks *S) {
+  addstr(S->frames[0].label, 0, "?");
+  S->frames[0].named = 1;
+  S->nframes = S->nnodes = 1;
+  S->nodes[0].parent = -1;
+}
+
+
+/*
+** Interns function 'f' as a frame. With 'named' false, its name is
+** left for 'namelabel', as looking it up reads the tables of the
+** loaded modules.
+*/
+static int getframe (global_State *g, PStacks *S, const TValue *f,
+                     int named) {
+  const void *key = funckey(f);
+  const TString *source = NULL;
+  int line = 0;
+  unsigned mask = 2 * LUAI_PROFFRAMES - 1;
+  unsigned h;
+  if (ttisLclosure(f)) {
+    Proto *p = clLvalue(f)->p;
+    source = p->source; line = p->linedefined;
+  }
+  for (h = hashptr(key) & mask; S->fhash[h] != 0; h = (h + 1) & mask) {
+    PFrame *fr = &S->frames[S->fhash[h] - 1];
+    if (fr->f == key && fr->source == source && fr->line == line)
+      return S->fhash[h] - 1;
+  }
+  if (S->nframes == LUAI_PROFFRAMES)  /* table full? */
+    return 0;  /* reuse frame 0 ("?") */
+  else {
+    size_t n = S->nframes;
+    PFrame *fr = &S->frames[n];
+    fr->f = key; fr->source = source; fr->line = line;
+    fr->named = 1;
+    if (key == NULL)
+      addstr(fr->label, 0, "?");
+    else if (named)
+      makelabel(g, f, fr->label);
+    else {
+      fr->label[0] = '\0';
+      if (ttisLclosure(f))
+        addsource(fr->label, 0, clLvalue(f)->p);
+      fr->named = 0;
+    }
+    S->fhash[h] = cast_int(n) + 1;
+    storerel(&S->nframes, n + 1);
+    return cast_int(n);
+  }
+}
+
+
+static int getnode (PStacks *S, int parent, int frame) {
+  unsigned mask = 2 * LUAI_PROFNODES - 1;
+  unsigned h = (cast_uint(parent) * 31u + cast_uint(frame)) * 2654435761u;
+  for (h &= mask; S->nhash[h] != 0; h = (h + 1) & mask) {
+    PNode *nd = &S->nodes[S->nhash[h] - 1];
+    if (nd->parent == parent && nd->frame == frame)
+      return S->nhash[h] - 1;
+  }
+  if (S->nnodes == LUAI_PROFNODES)  /* table full? */
+    return 0;  /* node 0 is the stack "?" */
+  else {
+    size_t n = S->nnodes;
+    S->nodes[n].parent = parent;
+    S->nodes[n].frame = frame;
+    S->nhash[h] = cast_int(n) + 1;
+    storerel(&S->nnodes, n + 1);
+    return cast_int(n);
+  }
+}
+
+
+/* interns the stack of 'L' (its innermost LUAI_PROFDEPTH frames) */
+static int getstack (lua55_State *L, PStacks *S, int named) {
+  int frames[LUAI_PROFDEPTH];
+  int n = 0;
+  int node = -1;
+  CallInfo *ci;
+  for (ci = L->ci; ci != &L->base_ci && n < LUAI_PROFDEPTH; ci = ci->previous)
+    frames[n++] = getframe(G(L), S, s2v(ci->func.p), named);
+  while (n > 0)  /* insert stack from its root */
+    node = getnode(S, node, frames[--n]);
+  return (node < 0) ? 0 : node;  /* empty stack? */
+}
+
+
+static int writelabel (lua55_State *L, PStacks *S, int node,
+                       lua_Writer writer, void *data) {
+  int status;
+  PNode *nd = &S->nodes[node];
+  if (nd->parent >= 0) {
+    if ((status = writelabel(L, S, nd->parent, writer, data)) != 0)
+      return status;
+    if ((status = writer(L, ";", 1, data)) != 0)
+      return status;
+  }
+  return writer(L, S->frames[nd->frame].label,
+                   strlen(S->frames[nd->frame].label), data);
+}
+
+
+static int writecount (lua55_State *L, size_t count,
+                       lua_Writer writer, void *data) {
+  char buff[LUA_N2SBUFFSZ + 2];
+  unsigned l;
+  buff[0] = ' ';
+  l = luaO_int2str(l_castU2S(cast(lua_Unsigned, count)), buff + 1);
+  buff[l + 1] = '\n';
+  return writer(L, buff, l + 2, data);
+}
+
+
+/*
+** Writes one folded line per node with a non-zero count, followed by
+** a line for 'extra' (if non-zero).
+*/
+static int writestacks (lua55_State *L, PStacks *S, const size_t *counts,
+                        const char *extra, size_t nextra,
+                        lua_Writer writer, void *data) {
+  size_t i;
+  size_t nnodes = loadacq(&S->nnodes);
+  int status = 0;
+  for (i = 0; i < nnodes && status == 0; i++) {
+    if (counts[i] > 0) {
+      status = writelabel(L, S, cast_int(i), writer, data);
+      if (status == 0)
+        status = writecount(L, counts[i], writer, data);
+    }
+  }
+  if (status == 0 && nextra > 0) {
+    status = writer(L, extra, strlen(extra), data);
+    if (status == 0)
+      status = writecount(L, nextra, writer, data);
+  }
+  return status;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Sampling (producer side)
+** =======================================================
+*/
+
+
+/*
+** Called by the interpreter with pending ticks, at a point where the
+** CallInfo chain is consistent.
+*/
+void luaR_sample (lua55_State *L) {
+  Profiler *P = prof;
+  global_State *g = G(L);
+  int node;
+  int weight = g->profticks;
+  g->profticks = 0;
+  if (P == NULL || P->g != g)  /* ticks left from a stopped profile? */
+    return;
+  if (P->head - loadacq(&P->tail) == LUAI_PROFRING) {  /* ring full? */
+    P->dropped += cast_sizet(weight);
+    return;
+  }
+  node = getstack(L, &P->st, 1);
+  P->ring[P->head & (LUAI_PROFRING - 1)].node = node;
+  P->ring[P->head & (LUAI_PROFRING - 1)].weight = weight;
+  storerel(&P->head, P->head + 1);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Timer
+** =======================================================
+*/
+
+#if defined(LUA_USE_POSIX)
+
+#include <signal.h>
+#include <sys/time.h>
+
+static struct sigaction oldaction;
+
+
+static void proftick (int sig) {
+  volatile l_signalT *t = ticks;
+  UNUSED(sig);
+  if (t != NULL)
+    (*t)++;
+}
+
+
+static int settimer (int hz) {
+  struct sigaction sa;
+  struct itimerval tv;
+  long us = (hz > 0) ? 1000000L / hz : 0;
+  if (hz > 0) {
+    sa.sa_handler = proftick;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGPROF, &sa, &oldaction) != 0)
+      return 0;
+  }
+  tv.it_interval.tv_sec = us / 1000000L;
+  tv.it_interval.tv_usec = us % 1000000L;
+  tv.it_value = tv.it_interval;
+  if (setitimer(ITIMER_PROF, &tv, NULL) != 0) {
+    sigaction(SIGPROF, &oldaction, NULL);
+    return 0;
+  }
+  if (hz == 0)  /* stopping? */
+    sigaction(SIGPROF, &oldaction, NULL);
+  return 1;
+}
+
+#else
+
+/* no interval timer: the profiler is not available */
+#define settimer(hz)	((hz) == 0)
+
+#endif
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** API
+** =======================================================
+*/
+
+/*
+** Starts sampling 'L' (with its coroutines) 'hz' times per second of
+** CPU time, discarding previous results. Returns 0 if the profiler is
+** not available, is already running, or cannot get its memory.
+*/
+LUA_API int lua55_profstart (lua55_State *L, int hz) {
+  if (hz <= 0 || (prof != NULL && prof->g != NULL))
+    return 0;
+  if (prof == NULL && (prof = (Profiler *)malloc(sizeof(Profiler))) == NULL)
+    return 0;
+  memset(prof, 0, sizeof(Profiler));
+  initstacks(&prof->st);
+  G(L)->profticks = 0;
+  ticks = &G(L)->profticks;
+  prof->g = G(L);
+  if (!settimer(hz)) {
+    prof->g = NULL;
+    ticks = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+
+/*
+** Stops sampling. Results stay available to 'lua55_profdump' until the
+** next 'lua55_profstart'.
+*/
+LUA_API void lua55_profstop (lua55_State *L) {
+  if (prof != NULL && prof->g == G(L)) {
+    settimer(0);
+    ticks = NULL;
+    prof->g = NULL;
+    G(L)->profticks = 0;
+  }
+}
+
+
+/*
+** Writes the folded stacks sampled so far through 'writer', one per
+** line, followed by a "[dropped] n" line if the ring ever overflowed.
+** Must not run concurrently with another call to itself. Returns the
+** first non-zero value returned by 'writer', or 0.
+*/
+LUA_API int lua55_profdump (lua55_State *L, lua_Writer writer, void *data) {
+  Profiler *P = prof;
+  size_t head, i;
+  if (P == NULL)
+    return 0;
+  head = loadacq(&P->head);
+  for (i = P->tail; i != head; i++) {  /* drain the ring */
+    PSample *s = &P->ring[i & (LUAI_PROFRING - 1)];
+    P->counts[s->node] += cast_sizet(s->weight);
+  }
+  storerel(&P->tail, head);
+  return writestacks(L, &P->st, P->counts, "[dropped]", P->dropped,
+                     writer, data);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Heap sampling
+** =======================================================
+*/
+
+typedef struct HBlock {
+  void *block;  /* NULL for a free slot */
+  int node;  /* stack that allocated it */
+  size_t weight;  /* bytes it stands for */
+} HBlock;
+
+
+typedef struct HeapProf {
+  size_t interval;  /* mean number of bytes between samples */
+  l_mem next;  /* bytes to allocate until the next sample */
+  unsigned seed;  /* for the random intervals */
+  size_t nblocks;  /* sampled blocks not freed yet */
+  size_t untracked;  /* bytes sampled when 'blocks' was full */
+  PStacks st;
+  size_t alloc[LUAI_PROFNODES];  /* bytes allocated, per stack */
+  size_t live[LUAI_PROFNODES];  /* bytes not freed yet, per stack */
+  HBlock blocks[LUAI_HEAPBLOCKS];  /* sampled blocks not freed yet */
+} HeapProf;
+
+
+/* uses the high bits of the product: blocks are aligned */
+#define hashblock(p)	(hashptr(p) >> 8)
+
+
+/* a random interval, uniform in [1, 2 * interval] */
+static l_mem nextinterval (HeapProf *H) {
+  unsigned x = H->seed;  /* xorshift32 */
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  H->seed = x;
+  return cast(l_mem, x % (2 * H->interval)) + 1;
+}
+
+
+static void addblock (HeapProf *H, void *block, int node, size_t weight) {
+  unsigned mask = LUAI_HEAPBLOCKS - 1;
+  unsigned i;
+  if (H->nblocks >= LUAI_HEAPBLOCKS / 4 * 3) {  /* table too full? */
+    H->untracked += weight;
+    return;
+  }
+  for (i = hashblock(block) & mask; H->blocks[i].block != NULL;
+       i = (i + 1) & mask)
+    ;
+  H->blocks[i].block = block;
+  H->blocks[i].node = node;
+  H->blocks[i].weight = weight;
+  H->nblocks++;
+  H->live[node] += weight;
+}
+
+
+/*
+** Called for every block allocated while 'g->heapprof' is set. At a
+** sample, the stack is only walked when it is consistent: not during
+** a collection step nor while the stack is being reallocated (both set
+** 'gcstopem').
+*/
+void luaR_heapalloc (lua55_State *L, void *block, size_t size) {
+  global_State *g = G(L);
+  HeapProf *H = g->heapprof;
+  size_t weight = 0;
+  int node;
+  H->next -= cast(l_mem, size);
+  if (l_likely(H->next > 0))
+    return;
+  do {  /* one interval for each sampling point passed */
+    weight += H->interval;
+    H->next += nextinterval(H);
+  } while (H->next <= 0);
+  if (g->gcstopem || L->ci == NULL)
+    node = 0;
+  else
+    node = getstack(L, &H->st, 0);
+  H->alloc[node] += weight;
+  addblock(H, block, node, weight);
+}
+
+
+/*
+** Called for every block freed while 'g->heapprof' is set; forgets the
+** block if it was sampled.
+*/
+void luaR_heapfree (global_State *g, void *block) {
+  HeapProf *H = g->heapprof;
+  unsigned mask = LUAI_HEAPBLOCKS - 1;
+  unsigned i, j;
+  if (H->nblocks == 0 || block == NULL)
+    return;
+  for (i = hashblock(block) & mask; H->blocks[i].block != block;
+       i = (i + 1) & mask) {
+    if (H->blocks[i].block == NULL)
+      return;  /* not a sampled block */
+  }
+  H->live[H->blocks[i].node] -= H->blocks[i].weight;
+  H->nblocks--;
+  for (j = i;;) {  /* close the gap, moving back later entries */
+    unsigned k;
+    H->blocks[i].block = NULL;
+    do {
+      j = (j + 1) & mask;
+      if (H->blocks[j].block == NULL)
+        return;
+      k = hashblock(H->blocks[j].block) & mask;
+    } while ((i <= j) ? (i < k && k <= j) : (i < k || k <= j));
+    H->blocks[i] = H->blocks[j];
+    i = j;
+  }
+}
+
+
+/*
+** Starts sampling the allocations of 'L' (and its coroutines) every
+** 'interval' bytes on average, discarding previous results. Returns 0
+** if the sampler is already running, 'interval' is out of range, or
+** there is no memory for it. (Its memory, about 3 MB with the default
+** sizes, is not counted as in use by the state.)
+*/
+LUA_API int lua55_heapprofstart (lua55_State *L, size_t interval) {
+  global_State *g = G(L);
+  HeapProf *H;
+  if (interval == 0 || interval > MAXHEAPINTERVAL || g->heapprof != NULL)
+    return 0;
+  H = cast(HeapProf *, (*g->frealloc)(g->ud, NULL, 0, sizeof(HeapProf)));
+  if (H == NULL)
+    return 0;
+  memset(H, 0, sizeof(HeapProf));
+  initstacks(&H->st);
+  H->interval = interval;
+  H->seed = point2uint(H) | 1;
+  H->next = nextinterval(H);
+  g->heapprof = H;
+  return 1;
+}
+
+
+/* Stops sampling and discards the results */
+LUA_API void lua55_heapprofstop (lua55_State *L) {
+  global_State *g = G(L);
+  if (g->heapprof != NULL) {
+    (*g->frealloc)(g->ud, g->heapprof, sizeof(HeapProf), 0);
+    g->heapprof = NULL;
+  }
+}
+
+
+/*
+** Writes, as folded stacks, the bytes allocated by each stack since
+** sampling started or, with 'live' true, the bytes it allocated that
+** are not freed yet (followed by an "[untracked] n" line for samples
+** that did not fit the table of blocks). Counts are estimates, in
+** multiples of the sampling interval. Returns the first non-zero
+** value returned by 'writer', or 0.
+*/
+LUA_API int lua55_heapprofdump (lua55_State *L, lua_Writer writer, void *data,
+                                int live) {
+  global_State *g = G(L);
+  HeapProf *H = g->heapprof;
+  size_t i, nframes;
+  if (H == NULL)
+    return 0;
+  nframes = H->st.nframes;
+  for (i = 0; i < nframes; i++) {
+    if (!H->st.frames[i].named)
+      namelabel(g, &H->st.frames[i]);
+  }
+  if (live)
+    return writestacks(L, &H->st, H->live, "[untracked]", H->untracked,
+                       writer, data);
+  else
+    return writestacks(L, &H->st, H->alloc, "", 0, writer, data);
+}
+
+/* }====================================================== */
+
+
+void luaR_close (lua55_State *L) {
+  lua55_profstop(L);
+  lua55_heapprofstop(L);
+}
@@ -0,0 +1,26 @@
+/*
+** $Id: lprof.h $
+** Sampling profiler
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lprof_h
+#define lprof_h
+
+
+#include "lstate.h"
+
+
+/*
+** 'luaV_execute' polls the timer ticks counted for its state at calls,
+** returns and backward jumps. Only the profiled state ever has any.
+*/
+#define luaR_poll(L)	{ if (l_unlikely(G(L)->profticks)) luaR_sample(L); }
+
+
+LUAI_FUNC void luaR_sample (lua55_State *L);
+LUAI_FUNC void luaR_heapalloc (lua55_State *L, void *block, size_t size);
+LUAI_FUNC void luaR_heapfree (global_State *g, void *block);
+LUAI_FUNC void luaR_close (lua55_State *L);
+
+#endif
@@ -0,0 +1,148 @@
+/*
+** $Id: lproflib.c $
+** Sampling profiler library
+** See Copyright Notice in lua.h
+*/
+
+#define lproflib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+#include "llimits.h"
+
+
+static int prof_start (lua55_State *L) {
+  lua_Integer hz = lua55L_optinteger(L, 1, 1000);
+  lua55L_argcheck(L, 0 < hz && hz <= 100000, 1, "out of range");
+  if (!lua55_profstart(L, cast_int(hz))) {
+    lua55L_pushfail(L);
+    lua55_pushliteral(L, "profiler not available or already running");
+    return 2;
+  }
+  lua55_pushboolean(L, 1);
+  return 1;
+}
+
+
+static int prof_stop (lua55_State *L) {
+  lua55_profstop(L);
+  return 0;
+}
+
+
+static int bufwriter (lua55_State *L, const void *b, size_t size, void *ud) {
+  UNUSED(L);
+  lua55L_addlstring((luaL_Buffer *)ud, (const char *)b, size);
+  return 0;
+}
+
+
+static int filewriter (lua55_State *L, const void *b, size_t size, void *ud) {
+  UNUSED(L);
+  return fwrite(b, 1, size, (FILE *)ud) != size;
+}
+
+
+/* writes a report through 'writer'; 'live' is for heap reports */
+typedef int (*Dumper) (lua55_State *L, lua55_Writer writer, void *data,
+                       int live);
+
+
+/* pushes the report as a string, or writes it to file 'fname' */
+static int dumpto (lua55_State *L, const char *fname, Dumper dump,
+                   int live) {
+  if (fname == NULL) {
+    luaL_Buffer b;
+    lua55L_buffinit(L, &b);
+    dump(L, bufwriter, &b, live);
+    lua55L_pushresult(&b);
+    return 1;
+  }
+  else {
+    FILE *f = fopen(fname, "w");
+    int status;
+    if (f == NULL)
+      return lua55L_fileresult(L, 0, fname);
+    status = dump(L, filewriter, f, live);
+    if (fclose(f) != 0 || status != 0)
+      return lua55L_fileresult(L, 0, fname);
+    lua55_pushboolean(L, 1);
+    return 1;
+  }
+}
+
+
+static int cpudump (lua55_State *L, lua55_Writer writer, void *data,
+                    int live) {
+  UNUSED(live);
+  return lua55_profdump(L, writer, data);
+}
+
+
+/*
+** dump([filename]): folded stacks sampled so far, as a string or
+** written to 'filename'.
+*/
+static int prof_dump (lua55_State *L) {
+  return dumpto(L, lua55L_optstring(L, 1, NULL), cpudump, 0);
+}
+
+
+static int prof_heapstart (lua55_State *L) {
+  lua_Integer interval = lua55L_optinteger(L, 1, 512 * 1024);
+  lua55L_argcheck(L, 0 < interval && interval <= (1 << 30), 1,
+                     "out of range");
+  if (!lua55_heapprofstart(L, cast_sizet(interval))) {
+    lua55L_pushfail(L);
+    lua55_pushliteral(L, "heap profiler already running or no memory");
+    return 2;
+  }
+  lua55_pushboolean(L, 1);
+  return 1;
+}
+
+
+static int prof_heapstop (lua55_State *L) {
+  lua55_heapprofstop(L);
+  return 0;
+}
+
+
+/*
+** heapdump([filename [, what]]): folded stacks of the bytes allocated
+** ('what' == "alloc", the default) or still held ("live") by each
+** stack since 'heapstart', as a string or written to 'filename'.
+*/
+static int prof_heapdump (lua55_State *L) {
+  static const char *const opts[] = {"alloc", "live", NULL};
+  const char *fname = lua55L_optstring(L, 1, NULL);
+  int live = lua55L_checkoption(L, 2, "alloc", opts);
+  return dumpto(L, fname, lua55_heapprofdump, live);
+}
+
+
+static const luaL_Reg prof_funcs[] = {
+  {"start", prof_start},
+  {"stop", prof_stop},
+  {"dump", prof_dump},
+  {"heapstart", prof_heapstart},
+  {"heapstop", prof_heapstop},
+  {"heapdump", prof_heapdump},
+  {NULL, NULL}
+};
+
+
+LUAMOD_API int lua55open_profiler (lua55_State *L) {
+  lua55L_newlib(L, prof_funcs);
+  return 1;
+}
@@ -0,0 +1,496 @@
+/*
+** $Id: lserlib.c $
+** Binary serialization library
+** See Copyright Notice in lua.h
+*/
+
+#define lserlib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+#include "llimits.h"
+
+
+/*
+** Format: a version byte, then the values ('serialize.encode' writes
+** exactly one).  Each value starts with a tag byte:
+**   0x80 | n      integer 0 <= n < 128
+**   SER_INT       other integer, zigzag varint
+**   SER_FLT       float, as a little-endian IEEE double
+**   SER_STR       varint length and bytes; gets the next string index
+**   SER_STRREF    varint index of a string seen before
+**   SER_TABLE     varint array size and hash size, the array items, then
+**                 the key/value pairs; gets the next table index before
+**                 its contents, so it can contain itself
+**   SER_TABLEREF  varint index of a table seen before
+**   SER_LIGHTUD   the pointer's native bytes; only with LUA_SERLIGHTUD
+** Varints are little-endian base-128.  Metatables are not kept.
+*/
+
+#define SER_VERSION	1
+
+enum { SER_NIL, SER_FALSE, SER_TRUE, SER_INT, SER_FLT, SER_STR, SER_STRREF,
+       SER_TABLE, SER_TABLEREF, SER_LIGHTUD };
+
+#define SER_SMALLINT	0x80
+
+/* maximum nesting of tables */
+#define SER_MAXDEPTH	200
+
+/* table size hint from a decoded count */
+#define sizehint(n)	((n) > INT_MAX ? INT_MAX : cast_int(n))
+
+
+static const union {
+  int dummy;
+  char little;  /* true iff machine is little endian */
+} nativeendian = {1};
+
+
+/* Copies a double, swapping bytes on big-endian machines */
+static void copyle (void *dst, const void *src) {
+  if (nativeendian.little)
+    memcpy(dst, src, sizeof(double));
+  else {
+    const char *s = cast(const char *, src);
+    char *d = cast(char *, dst);
+    size_t i;
+    for (i = 0; i < sizeof(double); i++)
+      d[i] = s[sizeof(double) - 1 - i];
+  }
+}
+
+
+/*
+** {======================================================
+** Encoding
+** =======================================================
+*/
+
+typedef struct Encoder {
+  lua55_State *L;
+  char *b;  /* buffer, a userdata kept at stack slot 'buf' */
+  size_t n;  /* bytes in use */
+  size_t size;
+  int buf;  /* stack slot of the buffer */
+  int tables;  /* stack slot of table -> index map */
+  int strings;  /* stack slot of string -> index map */
+  lua_Integer ntables, nstrings;
+  int flags;
+} Encoder;
+
+
+/* Makes room for 'len' more bytes, replacing the buffer with a bigger one */
+static void reserve (Encoder *e, size_t len) {
+  if (e->size - e->n < len) {
+    size_t size = e->size;
+    char *b;
+    if (len > MAX_SIZE - e->n)
+      lua55L_error(e->L, "serialized data too large");
+    while (size - e->n < len)
+      size = (size <= MAX_SIZE / 2) ? size * 2 : MAX_SIZE;
+    b = (char *)lua55_newuserdatauv(e->L, size, 0);
+    memcpy(b, e->b, e->n);
+    lua55_replace(e->L, e->buf);
+    e->b = b;
+    e->size = size;
+  }
+}
+
+
+static void addbytes (Encoder *e, const void *s, size_t len) {
+  reserve(e, len);
+  memcpy(e->b + e->n, s, len);
+  e->n += len;
+}
+
+
+static void addbyte (Encoder *e, int c) {
+  reserve(e, 1);
+  e->b[e->n++] = cast_char(c);
+}
+
+
+static void addvarint (Encoder *e, lua_Unsigned v) {
+  char buf[(sizeof(lua_Unsigned) * CHAR_BIT + 6) / 7];
+  size_t n = 0;
+  do {
+    buf[n] = cast_char(v & 0x7f);
+    v >>= 7;
+    if (v) buf[n] |= cast_char(0x80);
+    n++;
+  } while (v);
+  addbytes(e, buf, n);
+}
+
+
+static void addfloat (Encoder *e, lua_Number x) {
+  double d = cast(double, x);
+  char buf[sizeof(double)];
+  copyle(buf, &d);
+  addbytes(e, buf, sizeof(buf));
+}
+
+
+/*
+** Looks up the value at the top in map 'map'; if found, writes 'reftag'
+** and its index and returns 1.  Otherwise gives it index '*count' + 1
+** and returns 0.  The value stays on the stack.
+*/
+static int checkref (Encoder *e, int map, lua_Integer *count, int reftag) {
+  lua55_State *L = e->L;
+  lua55_pushvalue(L, -1);
+  if (lua55_rawget(L, map) == LUA_TNUMBER) {
+    lua_Integer idx = lua55_tointeger(L, -1);
+    lua55_pop(L, 1);
+    addbyte(e, reftag);
+    addvarint(e, l_castS2U(idx));
+    return 1;
+  }
+  lua55_pop(L, 1);
+  lua55_pushvalue(L, -1);
+  lua55_pushinteger(L, ++*count);
+  lua55_rawset(L, map);
+  return 0;
+}
+
+
+static void encode (Encoder *e, int depth);
+
+
+/* Encodes the table at the top */
+static void encodetable (Encoder *e, int depth) {
+  lua55_State *L = e->L;
+  int t = lua55_gettop(L);
+  lua_Integer narr, nhash = 0, i;
+  if (depth >= SER_MAXDEPTH)
+    lua55L_error(L, "table nesting too deep to serialize");
+  lua55L_checkstack(L, 4, "table nesting too deep to serialize");
+  if (checkref(e, e->tables, &e->ntables, SER_TABLEREF))
+    return;
+  /* array part: 1..n up to the first nil */
+  for (narr = 0; lua55_rawgeti(L, t, narr + 1) != LUA_TNIL; narr++)
+    lua55_pop(L, 1);
+  lua55_pop(L, 1);
+  lua55_pushnil(L);
+  while (lua55_next(L, t)) {
+    lua55_pop(L, 1);
+    if (!(lua55_isinteger(L, -1) &&
+          l_castS2U(lua55_tointeger(L, -1)) - 1u < l_castS2U(narr)))
+      nhash++;
+  }
+  addbyte(e, SER_TABLE);
+  addvarint(e, l_castS2U(narr));
+  addvarint(e, l_castS2U(nhash));
+  for (i = 1; i <= narr; i++) {
+    lua55_rawgeti(L, t, i);
+    encode(e, depth + 1);
+  }
+  lua55_pushnil(L);
+  while (lua55_next(L, t)) {
+    if (lua55_isinteger(L, -2) &&
+        l_castS2U(lua55_tointeger(L, -2)) - 1u < l_castS2U(narr)) {
+      lua55_pop(L, 1);  /* already in the array items */
+      continue;
+    }
+    lua55_pushvalue(L, -2);
+    encode(e, depth + 1);  /* key */
+    encode(e, depth + 1);  /* value */
+  }
+}
+
+
+/* Encodes the value at the top and pops it */
+static void encode (Encoder *e, int depth) {
+  lua55_State *L = e->L;
+  switch (lua55_type(L, -1)) {
+    case LUA_TNIL: addbyte(e, SER_NIL); break;
+    case LUA_TBOOLEAN:
+      addbyte(e, lua55_toboolean(L, -1) ? SER_TRUE : SER_FALSE);
+      break;
+    case LUA_TNUMBER: {
+      if (lua55_isinteger(L, -1)) {
+        lua_Integer i = lua55_tointeger(L, -1);
+        if (0 <= i && i < 128)
+          addbyte(e, SER_SMALLINT | cast_int(i));
+        else {
+          lua_Unsigned u = l_castS2U(i) << 1;
+          addbyte(e, SER_INT);
+          addvarint(e, (i < 0) ? ~u : u);
+        }
+      }
+      else {
+        addbyte(e, SER_FLT);
+        addfloat(e, lua55_tonumber(L, -1));
+      }
+      break;
+    }
+    case LUA_TSTRING: {
+      if (!checkref(e, e->strings, &e->nstrings, SER_STRREF)) {
+        size_t len;
+        const char *s = lua55_tolstring(L, -1, &len);
+        addbyte(e, SER_STR);
+        addvarint(e, len);
+        addbytes(e, s, len);
+      }
+      break;
+    }
+    case LUA_TTABLE: {
+      int top = lua55_gettop(L);
+      encodetable(e, depth);
+      lua55_settop(L, top);
+      break;
+    }
+    case LUA_TLIGHTUSERDATA:
+      if (e->flags & LUA_SERLIGHTUD) {
+        void *p = lua55_touserdata(L, -1);
+        addbyte(e, SER_LIGHTUD);
+        addbytes(e, &p, sizeof(p));
+        break;
+      }
+      /* else go through */
+    default:
+      lua55L_error(L, "cannot serialize a %s value", lua55L_typename(L, -1));
+  }
+  lua55_pop(L, 1);
+}
+
+
+/*
+** Pushes a string holding the 'n' values from index 'first' on.
+** Raises an error for values it cannot serialize.
+*/
+LUALIB_API void lua55L_serialize (lua55_State *L, int first, int n,
+                                  int flags) {
+  Encoder e;
+  int i;
+  first = lua55_absindex(L, first);
+  lua55L_checkstack(L, 8, "too many values to serialize");
+  e.L = L;
+  e.size = 256;
+  e.n = 0;
+  e.b = (char *)lua55_newuserdatauv(L, e.size, 0);
+  e.buf = lua55_gettop(L);
+  lua55_newtable(L);
+  e.tables = e.buf + 1;
+  lua55_newtable(L);
+  e.strings = e.buf + 2;
+  e.ntables = e.nstrings = 0;
+  e.flags = flags;
+  addbyte(&e, SER_VERSION);
+  for (i = 0; i < n; i++) {
+    lua55_pushvalue(L, first + i);
+    encode(&e, 0);
+  }
+  lua55_pushlstring(L, e.b, e.n);
+  lua55_replace(L, e.buf);
+  lua55_settop(L, e.buf);
+}
+
+
+static int ser_encode (lua55_State *L) {
+  lua55L_checkany(L, 1);
+  lua55L_serialize(L, 1, 1, 0);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Decoding
+** =======================================================
+*/
+
+typedef struct Decoder {
+  lua55_State *L;
+  const unsigned char *p;  /* next byte */
+  const unsigned char *end;
+  int tables;  /* stack slot of index -> table */
+  int strings;  /* stack slot of index -> string */
+  lua_Integer ntables, nstrings;
+  int flags;
+} Decoder;
+
+
+static void malformed (Decoder *d) {
+  lua55L_error(d->L, "malformed serialized data");
+}
+
+
+static int getbyte (Decoder *d) {
+  if (d->p >= d->end) malformed(d);
+  return *d->p++;
+}
+
+
+static lua_Unsigned getvarint (Decoder *d) {
+  lua_Unsigned v = 0;
+  int shift = 0, c;
+  do {
+    if (shift >= cast_int(sizeof(lua_Unsigned) * CHAR_BIT)) malformed(d);
+    c = getbyte(d);
+    v |= cast(lua_Unsigned, c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return v;
+}
+
+
+/* A count of items that each take at least 'minsize' more bytes */
+static lua_Integer getcount (Decoder *d, size_t minsize) {
+  lua_Unsigned n = getvarint(d);
+  if (n > cast_sizet(d->end - d->p) / minsize) malformed(d);
+  return l_castU2S(n);
+}
+
+
+/* Pushes entry 'idx' (1-based, read from the input) of list 'list' */
+static void getref (Decoder *d, int list, lua_Integer count) {
+  lua_Unsigned idx = getvarint(d);
+  if (idx - 1u >= l_castS2U(count)) malformed(d);
+  lua55_rawgeti(d->L, list, l_castU2S(idx));
+}
+
+
+static void decode (Decoder *d, int depth);
+
+
+static void decodetable (Decoder *d, int depth) {
+  lua55_State *L = d->L;
+  lua_Integer narr, nhash, i;
+  if (depth >= SER_MAXDEPTH) malformed(d);
+  lua55L_checkstack(L, 4, "table nesting too deep to deserialize");
+  narr = getcount(d, 1);
+  nhash = getcount(d, 2);
+  lua55_createtable(L, sizehint(narr), sizehint(nhash));
+  lua55_pushvalue(L, -1);
+  lua55_rawseti(L, d->tables, ++d->ntables);
+  for (i = 1; i <= narr; i++) {
+    decode(d, depth + 1);
+    lua55_rawseti(L, -2, i);
+  }
+  for (i = 0; i < nhash; i++) {
+    decode(d, depth + 1);
+    if (lua55_isnil(L, -1) ||
+        (lua55_type(L, -1) == LUA_TNUMBER && luai_numisnan(lua55_tonumber(L, -1))))
+      malformed(d);
+    decode(d, depth + 1);
+    lua55_rawset(L, -3);
+  }
+}
+
+
+/* Pushes the next value */
+static void decode (Decoder *d, int depth) {
+  lua55_State *L = d->L;
+  int tag = getbyte(d);
+  if (tag & SER_SMALLINT) {
+    lua55_pushinteger(L, tag & 0x7f);
+    return;
+  }
+  switch (tag) {
+    case SER_NIL: lua55_pushnil(L); break;
+    case SER_FALSE: lua55_pushboolean(L, 0); break;
+    case SER_TRUE: lua55_pushboolean(L, 1); break;
+    case SER_INT: {
+      lua_Unsigned u = getvarint(d);
+      lua55_pushinteger(L, l_castU2S((u & 1) ? ~(u >> 1) : (u >> 1)));
+      break;
+    }
+    case SER_FLT: {
+      double x;
+      if (cast_sizet(d->end - d->p) < sizeof(double)) malformed(d);
+      copyle(&x, d->p);
+      d->p += sizeof(double);
+      lua55_pushnumber(L, cast_num(x));
+      break;
+    }
+    case SER_STR: {
+      size_t len = cast_sizet(getcount(d, 1));
+      lua55_pushlstring(L, cast_charp(d->p), len);
+      d->p += len;
+      lua55_pushvalue(L, -1);
+      lua55_rawseti(L, d->strings, ++d->nstrings);
+      break;
+    }
+    case SER_STRREF: getref(d, d->strings, d->nstrings); break;
+    case SER_TABLE: decodetable(d, depth); break;
+    case SER_TABLEREF: getref(d, d->tables, d->ntables); break;
+    case SER_LIGHTUD: {
+      void *p;
+      if (!(d->flags & LUA_SERLIGHTUD) ||
+          cast_sizet(d->end - d->p) < sizeof(p))
+        malformed(d);
+      memcpy(&p, d->p, sizeof(p));
+      d->p += sizeof(p);
+      lua55_pushlightuserdata(L, p);
+      break;
+    }
+    default: malformed(d);
+  }
+}
+
+
+/*
+** Pushes the values in the 'len' bytes at 's', which must stay valid
+** meanwhile, and returns their number.  Raises an error for data that
+** 'lua55L_serialize' (with the same 'flags') cannot have written.
+*/
+LUALIB_API int lua55L_deserialize (lua55_State *L, const char *s, size_t len,
+                                   int flags) {
+  Decoder d;
+  int n = 0;
+  lua55L_checkstack(L, 2, "too many values to deserialize");
+  d.L = L;
+  d.p = cast(const unsigned char *, s);
+  d.end = d.p + len;
+  lua55_newtable(L);
+  d.tables = lua55_gettop(L);
+  lua55_newtable(L);
+  d.strings = d.tables + 1;
+  d.ntables = d.nstrings = 0;
+  d.flags = flags;
+  if (getbyte(&d) != SER_VERSION)
+    lua55L_error(L, "not serialized data (or unknown version)");
+  for (; d.p != d.end; n++) {
+    lua55L_checkstack(L, 2, "too many values to deserialize");
+    decode(&d, 0);
+  }
+  lua55_rotate(L, d.tables, -2);  /* move the lists above the values */
+  lua55_pop(L, 2);
+  return n;
+}
+
+
+static int ser_decode (lua55_State *L) {
+  size_t len;
+  const char *s = lua55L_checklstring(L, 1, &len);
+  if (lua55L_deserialize(L, s, len, 0) != 1)
+    return lua55L_error(L, "malformed serialized data");
+  return 1;
+}
+
+/* }====================================================== */
+
+
+static const luaL_Reg ser_funcs[] = {
+  {"encode", ser_encode},
+  {"decode", ser_decode},
+  {NULL, NULL}
+};
+
+
+LUAMOD_API int lua55open_serialize (lua55_State *L) {
+  lua55L_newlib(L, ser_funcs);
+  return 1;
+}
@@ -22,6 +22,7 @@
 #include "lgc.h"
 #include "llex.h"
 #include "lmem.h"
+#include "lprof.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -254,6 +255,7 @@ lu_mem luaE_threadsize (lua55_State *L) {
 
 static void close_state (lua55_State *L) {
   global_State *g = G(L);
+  luaR_close(L);  /* stop profiling this state */
   if (!completestate(g))  /* closing a partially built state? */
     luaC_freeallobjects(L);  /* just collect its objects */
   else {  /* closing a fully built state */
@@ -264,7 +266,10 @@ static void close_state (lua55_State *L) {
     luai_userstateclose(L);
   }
   luaM_freearray(L, G(L)->strt.hash, cast_sizet(G(L)->strt.size));
+  luaM_freearray(L, G(L)->refs, cast_sizet(G(L)->sizerefs));
   freestack(L);
+  luaM_setdeferfree(L, 0);  /* wait for deferred frees; stop helper */
+  luaC_setparmark(L, 0);  /* stop marking helpers */
   lua_assert(gettotalbytes(g) == sizeof(global_State));
   (*g->frealloc)(g->ud, g, sizeof(global_State), 0);  /* free main block */
 }
@@ -351,16 +356,28 @@ LUA_API lua55_State *lua55_newstate (lua_Alloc f, void *ud, unsigned seed) {
   g->ud = ud;
   g->warnf = NULL;
   g->ud_warn = NULL;
+#if defined(LUA_OPSTATS)
+  memset(g->opcount, 0, sizeof(g->opcount));
+  memset(g->jumpcount, 0, sizeof(g->jumpcount));
+#endif
   g->seed = seed;
   g->gcstp = GCSTPGC;  /* no GC while building state */
   g->strt.size = g->strt.nuse = 0;
   g->strt.hash = NULL;
   setnilvalue(&g->l_registry);
+  g->refs = NULL;
+  g->sizerefs = g->nrefs = g->freeref = 0;
   g->panic = NULL;
   g->gcstate = GCSpause;
   g->gckind = KGC_INC;
   g->gcstopem = 0;
   g->gcemergency = 0;
+  g->gcfreeing = 0;
+  g->freeq = NULL;
+  g->parmark = NULL;
+  g->heapprof = NULL;
+  g->profticks = 0;
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
   g->finobj = g->tobefnz = g->fixedgc = NULL;
   g->firstold1 = g->survival = g->old1 = g->reallyold = NULL;
   g->finobjsur = g->finobjold1 = g->finobjrold = NULL;
@@ -17,6 +17,9 @@ typedef struct CallInfo CallInfo;
 #include "lobject.h"
 #include "ltm.h"
 #include "lzio.h"
+#if defined(LUA_OPSTATS)
+#include "lopcodes.h"
+#endif
 
 
 /*
@@ -333,6 +336,10 @@ typedef struct global_State {
   l_mem GCmajorminor;  /* auxiliary counter to control major-minor shifts */
   stringtable strt;  /* hash table for strings */
   TValue l_registry;
+  TValue *refs;  /* reference store (see 'lua55_ref') */
+  int sizerefs;  /* size of 'refs' */
+  int nrefs;  /* number of slots in use or in the free list */
+  int freeref;  /* first free slot in 'refs' (0 if none) */
   TValue nilvalue;  /* a nil value */
   unsigned int seed;  /* randomized seed for hashes */
   lu_byte gcparams[LUA_GCPN];
@@ -342,6 +349,12 @@ typedef struct global_State {
   lu_byte gcstopem;  /* stops emergency collections */
   lu_byte gcstp;  /* control whether GC is running */
   lu_byte gcemergency;  /* true if this is an emergency collection */
+  lu_byte gcfreeing;  /* true while freeing a dead object */
+  struct FreeQueue *freeq;  /* deferred freeing (see 'luaM_setdeferfree') */
+  struct ParMark *parmark;  /* parallel marking (see 'luaC_setparmark') */
+  struct HeapProf *heapprof;  /* heap sampler (see lprof.c) */
+  volatile l_signalT profticks;  /* timer ticks not yet sampled (lprof.c) */
+  lua55_GCStats gcstats;  /* collector statistics (see 'lua55_getstats') */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -369,6 +382,10 @@ typedef struct global_State {
   lua_WarnFunction warnf;  /* warning function */
   void *ud_warn;         /* auxiliary data to 'warnf' */
   LX mainth;  /* main thread of this state */
+#if defined(LUA_OPSTATS)
+  lua_Unsigned opcount[NUM_OPCODES];  /* executions of each opcode */
+  lua_Unsigned jumpcount[NUM_OPCODES][2];  /* cond. jumps not taken/taken */
+#endif
 } global_State;
 
 
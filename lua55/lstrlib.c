@@ -1261,6 +1261,22 @@ static const char *getformat (lua55_State *L, const char *strfrmt,
 }
 
 
+/*
+** Precision of a plain "%g" or "%.<n>g" conversion, or 0 if it has
+** flags or a width (which the fast formatter does not handle).
+*/
+static int gprecision (const char *form) {
+  int prec = 0;
+  if (form[1] == 'g' && form[2] == '\0')
+    return 6;  /* default precision */
+  if (form[1] != '.')
+    return 0;
+  for (form += 2; isdigit(cast_uchar(*form)); form++)
+    prec = prec * 10 + (*form - '0');
+  return (form[0] == 'g' && form[1] == '\0') ? prec : 0;
+}
+
+
 /*
 ** add length modifier into formats
 */
@@ -1312,6 +1328,11 @@ static int str_format (lua55_State *L) {
           flags = L_FMTFLAGSX;
          intcase: {
           lua_Integer n = lua55L_checkinteger(L, arg);
+          if ((form[1] == 'd' || form[1] == 'i') && form[2] == '\0' &&
+              lua55_isinteger(L, arg)) {  /* plain "%d": no 'sprintf' */
+            nb = cast_int(lua55_numbertocstring(L, arg, buff)) - 1;
+            break;
+          }
           checkformat(L, form, flags, 1);
           addlenmod(form, LUA_INTEGER_FRMLEN);
           nb = l_sprintf(buff, maxitem, form, (LUAI_UACINT)n);
@@ -1329,6 +1350,9 @@ static int str_format (lua55_State *L) {
           /* FALLTHROUGH */
         case 'e': case 'E': case 'g': case 'G': {
           lua_Number n = lua55L_checknumber(L, arg);
+          if (strfrmt[-1] == 'g' &&
+              (nb = cast_int(lua55_formatnumber(n, gprecision(form), buff))) > 0)
+            break;  /* shortest digits matched "%g" */
           checkformat(L, form, L_FMTFLAGSF, 1);
           addlenmod(form, LUA_NUMBER_FRMLEN);
           nb = l_sprintf(buff, maxitem, form, (LUAI_UACNUMBER)n);
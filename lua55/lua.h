@@ -400,6 +400,9 @@ LUA_API void (lua55_warning)  (lua55_State *L, const char *msg, int tocont);
 #define LUA_GCGEN		7
 #define LUA_GCINC		8
 #define LUA_GCPARAM		9
+#define LUA_GCBUDGET		10
+#define LUA_GCDEFERFREE		11
+#define LUA_GCPARMARK		12
 
 
 /*
@@ -422,6 +425,38 @@ LUA_API void (lua55_warning)  (lua55_State *L, const char *msg, int tocont);
 LUA_API int (lua55_gc) (lua55_State *L, int what, ...);
 
 
+/*
+** garbage-collection statistics
+*/
+#define LUA_GCSTATBUCKETS	20  /* buckets in pause histograms */
+
+/* kinds of pauses */
+#define LUA_GCSSTEP		0  /* a collector step (or minor collection) */
+#define LUA_GCSATOMIC		1  /* an atomic phase */
+#define LUA_GCSFULL		2  /* a full collection */
+#define LUA_GCSN		3
+
+typedef struct lua55_GCStats {
+  size_t allocated;  /* bytes allocated since the state was created */
+  size_t freed;  /* bytes freed since the state was created */
+  size_t incremental;  /* cycles finished in incremental mode */
+  size_t minor;  /* minor collections */
+  size_t major;  /* major collections in generational mode */
+  size_t full;  /* full collections */
+  size_t promoted;  /* objects turned old by minor collections */
+  size_t strsize;  /* slots in the string table */
+  size_t strused;  /* strings in the string table */
+  /* objects not freed yet, by type; upvalues and prototypes come last */
+  size_t objects[LUA_NUMTYPES + 2];
+  /* bucket 0 counts pauses under 1 microsecond, bucket i pauses from
+     2^(i-1) to 2^i - 1 microseconds; the last one counts longer pauses */
+  size_t pauses[LUA_GCSN][LUA_GCSTATBUCKETS];
+  size_t pausetime[LUA_GCSN];  /* total microseconds */
+} lua55_GCStats;
+
+LUA_API void (lua55_getstats) (lua55_State *L, lua55_GCStats *s);
+
+
 /*
 ** miscellaneous functions
 */
@@ -435,6 +470,14 @@ LUA_API void  (lua55_len)    (lua55_State *L, int idx);
 
 #define LUA_N2SBUFFSZ	64
 LUA_API unsigned  (lua55_numbertocstring) (lua55_State *L, int idx, char *buff);
+/*
+** 'lua55_formatnumber' writes 'n' into 'buff' (LUA_N2SBUFFSZ bytes) as
+** "%.<prec>g" would and returns the length. It returns 0 when it
+** cannot match sprintf: 'prec' outside 1..DBL_DIG, subnormals,
+** infinities, NaN, a float type other than double, or more shortest
+** digits than 'prec'. The caller must then use 'sprintf' itself.
+*/
+LUA_API unsigned  (lua55_formatnumber) (lua55_Number n, int prec, char *buff);
 LUA_API size_t  (lua55_stringtonumber) (lua55_State *L, const char *s);
 
 LUA_API lua55_Alloc (lua55_getallocf) (lua55_State *L, void **ud);
@@ -444,6 +487,30 @@ LUA_API void (lua55_toclose) (lua55_State *L, int idx);
 LUA_API void (lua55_closeslot) (lua55_State *L, int idx);
 
 
+/*
+** reference store: a dense array of values kept alive by the GC,
+** indexed by small positive integers (see lapi.c)
+*/
+LUA_API int  (lua55_ref) (lua55_State *L);
+LUA_API void (lua55_unref) (lua55_State *L, int ref);
+LUA_API int  (lua55_getref) (lua55_State *L, int ref);
+LUA_API int  (lua55_setref) (lua55_State *L, int ref);
+
+
+/*
+** bulk transfer between C arrays and t[first .. first+n-1] of a table,
+** without metamethods (see lapi.c)
+*/
+LUA_API void (lua55_rawsetnumbers) (lua55_State *L, int idx,
+                         lua55_Integer first, const lua55_Number *v, int n);
+LUA_API void (lua55_rawsetintegers) (lua55_State *L, int idx,
+                         lua55_Integer first, const lua55_Integer *v, int n);
+LUA_API int  (lua55_rawgetnumbers) (lua55_State *L, int idx,
+                         lua55_Integer first, lua55_Number *v, int n);
+LUA_API int  (lua55_rawgetintegers) (lua55_State *L, int idx,
+                         lua55_Integer first, lua55_Integer *v, int n);
+
+
 /*
 ** {==============================================================
 ** some useful macros
@@ -545,6 +612,25 @@ LUA_API lua55_Hook (lua55_gethook) (lua55_State *L);
 LUA_API int (lua55_gethookmask) (lua55_State *L);
 LUA_API int (lua55_gethookcount) (lua55_State *L);
 
+/* sampling profiler, results as folded stacks (see lprof.c) */
+LUA_API int  (lua55_profstart) (lua55_State *L, int hz);
+LUA_API void (lua55_profstop) (lua55_State *L);
+LUA_API int  (lua55_profdump) (lua55_State *L, lua55_Writer writer, void *data);
+
+/* allocation sampler, results as folded stacks of bytes (see lprof.c) */
+LUA_API int  (lua55_heapprofstart) (lua55_State *L, size_t interval);
+LUA_API void (lua55_heapprofstop) (lua55_State *L);
+LUA_API int  (lua55_heapprofdump) (lua55_State *L, lua55_Writer writer,
+                                   void *data, int live);
+
+/* heap census, results as a snapshot text (see lcensus.c) */
+#define LUA_CENSUSPATHS	1	/* also record a path from the roots */
+LUA_API int (lua55_census) (lua55_State *L, lua55_Writer writer, void *data,
+                            int flags);
+
+/* opcode and function counters of a LUA_OPSTATS build (see ldebug.c) */
+LUA_API int (lua55_opstats) (lua55_State *L, int reset);
+
 
 struct lua55_Debug {
   int event;
@@ -622,6 +708,7 @@ typedef lua55_Alloc lua_Alloc;
 typedef lua55_WarnFunction lua_WarnFunction;
 typedef lua55_Debug lua_Debug;
 typedef lua55_Hook lua_Hook;
+typedef lua55_GCStats lua_GCStats;
 
 
 #endif
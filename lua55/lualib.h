@@ -54,6 +54,23 @@ LUAMOD_API int (lua55open_table) (lua55_State *L);
 #define LUA_UTF8LIBK	(LUA_TABLIBK << 1)
 LUAMOD_API int (lua55open_utf8) (lua55_State *L);
 
+/* not standard libraries: only preloaded (see linit.c) */
+#define LUA_PROFLIBNAME	"profiler"
+LUAMOD_API int (lua55open_profiler) (lua55_State *L);
+
+#define LUA_SERLIBNAME	"serialize"
+LUAMOD_API int (lua55open_serialize) (lua55_State *L);
+
+/* the same format from C (see lserlib.c) */
+#define LUA_SERLIGHTUD	1	/* copy light userdata (same process only) */
+LUALIB_API void (lua55L_serialize) (lua55_State *L, int first, int n,
+                                    int flags);
+LUALIB_API int (lua55L_deserialize) (lua55_State *L, const char *s,
+                                     size_t len, int flags);
+
+#define LUA_CENSUSLIBNAME	"census"
+LUAMOD_API int (lua55open_census) (lua55_State *L);
+
 
 /* open selected libraries */
 LUALIB_API void (lua55L_openselectedlibs) (lua55_State *L, int load, int preload);
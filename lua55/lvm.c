@@ -25,6 +25,7 @@
 #include "lgc.h"
 #include "lobject.h"
 #include "lopcodes.h"
+#include "lprof.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -914,6 +915,107 @@ void luaV_finishOp (lua55_State *L) {
 
 
 
+/*
+** {==================================================================
+** Inline caches for short-string keys
+**
+** OP_GETFIELD, OP_GETTABUP, OP_SELF, OP_SETFIELD and OP_SETTABUP keep,
+** per instruction, the node slot where their constant key was last
+** found ('Proto.icache'). A hit
+** needs only a bounds check and a key identity check, since a key can
+** be in only one node of a table; it works for any table with the same
+** layout, not only for the one that filled the cache. Slots that do not
+** fit in the cache just miss.
+** ===================================================================
+*/
+
+/* inline cache of the instruction being executed */
+#define icache(cl,pc)	((cl)->p->icache + pcRel(pc, (cl)->p))
+
+
+/*
+** Raw 'h[key]' for a short string 'key', through cache 'ic'; same
+** results as 'luaH_getshortstr'.
+*/
+l_sinline lu_byte getshortstr_ic (Table *h, TString *key, TValue *res,
+                                  unsigned short *ic) {
+  const TValue *slot;
+  unsigned s = *ic;
+  if (s < sizenode(h) && keyisshrstr(gnode(h, s)) &&
+      keystrval(gnode(h, s)) == key)
+    slot = gval(gnode(h, s));  /* hit */
+  else {
+    slot = luaH_Hgetshortstr(h, key);
+    if (!isabstkey(slot))  /* key present? remember its node */
+      *ic = cast(unsigned short, nodefromval(slot) - h->node);
+  }
+  if (!ttisnil(slot))
+    setobj(((lua55_State*)NULL), res, slot);
+  return ttypetag(slot);
+}
+
+
+/*
+** 'luaV_fastget' through an inline cache
+*/
+#define luaV_fastget_ic(t,k,res,ic,tag) \
+  (tag = (!ttistable(t) ? LUA_VNOTABLE : getshortstr_ic(hvalue(t), k, res, ic)))
+
+
+/*
+** 'luaH_psetshortstr' through cache 'ic': a hit on a key that already
+** has a value is a plain store.
+*/
+l_sinline int psetshortstr_ic (Table *h, TString *key, TValue *val,
+                               unsigned short *ic) {
+  TValue *slot;
+  unsigned s = *ic;
+  if (s < sizenode(h) && keyisshrstr(gnode(h, s)) &&
+      keystrval(gnode(h, s)) == key)
+    slot = gval(gnode(h, s));  /* hit */
+  else {
+    slot = cast(TValue *, luaH_Hgetshortstr(h, key));
+    if (!isabstkey(slot))
+      *ic = cast(unsigned short, nodefromval(slot) - h->node);
+  }
+  if (!ttisnil(slot)) {  /* key already has a value? */
+    setobj(((lua55_State*)NULL), slot, val);
+    return HOK;
+  }
+  return luaH_psetshortstr(h, key, val);  /* insertion or metamethod */
+}
+
+
+#define luaV_fastset_ic(t,k,val,ic,hres) \
+  (hres = (!ttistable(t) ? HNOTATABLE : psetshortstr_ic(hvalue(t), k, val, ic)))
+
+
+/*
+** Method lookup for OP_SELF: when the object is a table without the
+** method but with a table as '__index' (the usual class layout), the
+** cache also serves the lookup in that table; its slot is not
+** overwritten by the miss in the object.
+*/
+l_sinline lu_byte getmethod_ic (lua55_State *L, const TValue *obj,
+                                TString *key, TValue *res,
+                                unsigned short *ic) {
+  lu_byte tag;
+  const TValue *tm;
+  luaV_fastget_ic(obj, key, res, ic, tag);
+  if (tag == LUA_VNOTABLE || !tagisempty(tag))
+    return tag;
+  tm = fasttm(L, hvalue(obj)->metatable, TM_INDEX);
+  if (tm != NULL && ttistable(tm)) {
+    lu_byte ctag = getshortstr_ic(hvalue(tm), key, res, ic);
+    if (!tagisempty(ctag))
+      return ctag;
+  }
+  return tag;
+}
+
+/* }================================================================== */
+
+
 /*
 ** {==================================================================
 ** Macros for arithmetic/bitwise/comparison opcodes in 'luaV_execute'
@@ -1135,7 +1237,23 @@ void luaV_finishOp (lua55_State *L) {
 ** was expected (parameter 'k'), else do next instruction, which must
 ** be a jump.
 */
-#define docondjump()	if (cond != GETARG_k(i)) pc++; else donextjump(ci);
+#define docondjump()	if (cond != GETARG_k(i)) { opstatjump(L,i,0); pc++; } \
+                        else { opstatjump(L,i,1); donextjump(ci); }
+
+
+/*
+** Execution statistics (see 'lua55_opstats'; calls are counted by
+** 'luaD_precall'). Compiled only with LUA_OPSTATS; otherwise these
+** macros generate no code at all.
+*/
+#if defined(LUA_OPSTATS)
+#define opstatinstr(L,cl,i)  \
+	{ G(L)->opcount[GET_OPCODE(i)]++; (cl)->p->ninstrs++; }
+#define opstatjump(L,i,t)	(G(L)->jumpcount[GET_OPCODE(i)][t]++)
+#else
+#define opstatinstr(L,cl,i)	((void)0)
+#define opstatjump(L,i,t)	((void)0)
+#endif
 
 
 /*
@@ -1188,6 +1306,7 @@ void luaV_finishOp (lua55_State *L) {
     updatebase(ci);  /* correct stack */ \
   } \
   i = *(pc++); \
+  opstatinstr(L, cl, i); \
 }
 
 #define vmdispatch(o)	switch(o)
@@ -1303,7 +1422,7 @@ void luaV_execute (lua55_State *L, CallInfo *ci) {
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
         lu_byte tag;
-        luaV_fastget(upval, key, s2v(ra), luaH_getshortstr, tag);
+        luaV_fastget_ic(upval, key, s2v(ra), icache(cl, pc), tag);
         if (tagisempty(tag))
           Protect(luaV_finishget(L, upval, rc, ra, tag));
         vmbreak;
@@ -1341,7 +1460,7 @@ void luaV_execute (lua55_State *L, CallInfo *ci) {
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
         lu_byte tag;
-        luaV_fastget(rb, key, s2v(ra), luaH_getshortstr, tag);
+        luaV_fastget_ic(rb, key, s2v(ra), icache(cl, pc), tag);
         if (tagisempty(tag))
           Protect(luaV_finishget(L, rb, rc, ra, tag));
         vmbreak;
@@ -1352,7 +1471,7 @@ void luaV_execute (lua55_State *L, CallInfo *ci) {
         TValue *rb = KB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rb);  /* key must be a short string */
-        luaV_fastset(upval, key, rc, hres, luaH_psetshortstr);
+        luaV_fastset_ic(upval, key, rc, icache(cl, pc), hres);
         if (hres == HOK)
           luaV_finishfastset(L, upval, rc);
         else
@@ -1397,7 +1516,7 @@ void luaV_execute (lua55_State *L, CallInfo *ci) {
         TValue *rb = KB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rb);  /* key must be a short string */
-        luaV_fastset(s2v(ra), key, rc, hres, luaH_psetshortstr);
+        luaV_fastset_ic(s2v(ra), key, rc, icache(cl, pc), hres);
         if (hres == HOK)
           luaV_finishfastset(L, s2v(ra), rc);
         else
@@ -1432,7 +1551,7 @@ void luaV_execute (lua55_State *L, CallInfo *ci) {
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
         setobj2s(L, ra + 1, rb);
-        luaV_fastget(rb, key, s2v(ra), luaH_getshortstr, tag);
+        tag = getmethod_ic(L, rb, key, s2v(ra), icache(cl, pc));
         if (tagisempty(tag))
           Protect(luaV_finishget(L, rb, rc, ra, tag));
         vmbreak;
@@ -1644,6 +1763,8 @@ void luaV_execute (lua55_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_JMP) {
+        if (GETARG_sJ(i) < 0)  /* backward jump? */
+          luaR_poll(L);
         dojump(ci, i, 0);
         vmbreak;
       }
@@ -1709,9 +1830,12 @@ void luaV_execute (lua55_State *L, CallInfo *ci) {
       vmcase(OP_TESTSET) {
         StkId ra = RA(i);
         TValue *rb = vRB(i);
-        if (l_isfalse(rb) == GETARG_k(i))
+        if (l_isfalse(rb) == GETARG_k(i)) {
+          opstatjump(L, i, 0);
           pc++;
+        }
         else {
+          opstatjump(L, i, 1);
           setobj2s(L, ra, rb);
           donextjump(ci);
         }
@@ -1726,6 +1850,7 @@ void luaV_execute (lua55_State *L, CallInfo *ci) {
           L->top.p = ra + b;  /* top signals number of arguments */
         /* else previous instruction set top */
         savepc(ci);  /* in case of errors */
+        luaR_poll(L);
         if ((newci = luaD_precall(L, ra, nresults)) == NULL)
           updatetrap(ci);  /* C call; nothing else to be done */
         else {  /* Lua call: run function in this same C frame */
@@ -1746,6 +1871,7 @@ void luaV_execute (lua55_State *L, CallInfo *ci) {
         else  /* previous instruction set top */
           b = cast_int(L->top.p - ra);
         savepc(ci);  /* several calls here can raise errors */
+        luaR_poll(L);
         if (TESTARG_k(i)) {
           luaF_closeupval(L, base);  /* close upvalues from current call */
           lua_assert(L->tbclist.p < base);  /* no pending tbc variables */
@@ -1767,6 +1893,7 @@ void luaV_execute (lua55_State *L, CallInfo *ci) {
         if (n < 0)  /* not fixed? */
           n = cast_int(L->top.p - ra);  /* get what is available */
         savepc(ci);
+        luaR_poll(L);
         if (TESTARG_k(i)) {  /* may there be open upvalues? */
           ci->u2.nres = n;  /* save number of returns */
           if (L->top.p < ci->top.p)
@@ -1783,6 +1910,7 @@ void luaV_execute (lua55_State *L, CallInfo *ci) {
         goto ret;
       }
       vmcase(OP_RETURN0) {
+        luaR_poll(L);  /* sample leaf functions too */
         if (l_unlikely(L->hookmask)) {
           StkId ra = RA(i);
           L->top.p = ra;
@@ -1800,6 +1928,7 @@ void luaV_execute (lua55_State *L, CallInfo *ci) {
         goto ret;
       }
       vmcase(OP_RETURN1) {
+        luaR_poll(L);  /* sample leaf functions too */
         if (l_unlikely(L->hookmask)) {
           StkId ra = RA(i);
           L->top.p = ra + 1;
@@ -1843,6 +1972,7 @@ void luaV_execute (lua55_State *L, CallInfo *ci) {
         }
         else if (floatforloop(ra))  /* float loop */
           pc -= GETARG_Bx(i);  /* jump back */
+        luaR_poll(L);
         updatetrap(ci);  /* allows a signal to break the loop */
         vmbreak;
       }
@@ -1896,6 +2026,7 @@ void luaV_execute (lua55_State *L, CallInfo *ci) {
         StkId ra = RA(i);
         if (!ttisnil(s2v(ra + 3)))  /* continue loop? */
           pc -= GETARG_Bx(i);  /* jump back */
+        luaR_poll(L);
         vmbreak;
       }}
       vmcase(OP_SETLIST) {
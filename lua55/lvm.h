@@ -111,6 +111,14 @@ typedef enum {
 #define luaV_shiftr(x,y)	luaV_shiftl(x,intop(-, 0, y))
 
 
+/* count a call to a Lua function (see 'lua55_opstats') */
+#if defined(LUA_OPSTATS)
+#define luaV_opstatcall(p)	((p)->ncalls++)
+#else
+#define luaV_opstatcall(p)	((void)0)
+#endif
+
+
 
 LUAI_FUNC int luaV_equalobj (lua55_State *L, const TValue *t1, const TValue *t2);
 LUAI_FUNC int luaV_lessthan (lua55_State *L, const TValue *l, const TValue *r);